@@ -0,0 +1,75 @@
+//===-- Cheerp/Devirtualize.h - Cheerp whole program devirtualization -----===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_DEVIRTUALIZE_H
+#define _CHEERP_DEVIRTUALIZE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+
+namespace cheerp
+{
+
+/**
+ * Devirtualize - Replace indirect calls through constant tables of functions with direct calls.
+ *
+ * Virtual calls load the callee from a slot of a vtable, i.e. through a GEP with constant indexes into a struct.
+ * Since Cheerp compiles the whole program, when tables of a type only exist in constant globals the possible
+ * callees are the functions found at the same slot in every constant table of that type, including the ones
+ * embedded in the tables of derived classes. Tables of a type which may live in mutable memory, or which may
+ * be reached by casting another pointer, are not considered.
+ *
+ * Calls with a single possible callee become direct calls. Calls with up to maxGuardedTargets callees are
+ * expanded into a chain of comparisons guarding direct calls, the indirect call is kept as the fallback.
+ */
+class Devirtualize: public llvm::ModulePass
+{
+public:
+	static char ID;
+	explicit Devirtualize() : ModulePass(ID) { }
+	bool runOnModule(llvm::Module& M) override;
+	const char* getPassName() const override;
+
+	static const uint32_t maxGuardedTargets = 3;
+private:
+	typedef llvm::SmallSetVector<llvm::Function*, 4> TargetSet;
+	// Every constant table of each type, found in the initializers of constant globals
+	llvm::DenseMap<llvm::StructType*, llvm::SmallVector<llvm::Constant*, 4>> tables;
+	// Types of the objects in mutable memory and of the pointers created by casts
+	llvm::SmallPtrSet<llvm::Type*, 32> unsafeTypes;
+	llvm::SmallPtrSet<const llvm::Constant*, 32> visitedConstants;
+	llvm::DenseMap<llvm::StructType*, bool> safeTables;
+
+	void collectTables(llvm::Constant* C);
+	void collectConstantCasts(const llvm::Constant* C);
+	void collectUnsafeTypes(llvm::Module& M);
+	static bool typeContains(llvm::Type* t, llvm::Type* contained);
+	bool isSafeTable(llvm::StructType* tableType);
+	/**
+	 * Find the possible callees of an indirect call, returns false if they can't be determined
+	 */
+	bool findTargets(llvm::CallInst* CI, TargetSet& targets);
+	static llvm::Constant* getCallee(llvm::Function* target, llvm::Type* calleeType);
+	void expandGuardedCall(llvm::CallInst* CI, const TargetSet& targets);
+};
+
+//===----------------------------------------------------------------------===//
+//
+// Devirtualize - Replace indirect calls through constant tables with direct calls
+//
+llvm::ModulePass *createDevirtualizePass();
+}
+
+#endif //_CHEERP_DEVIRTUALIZE_H
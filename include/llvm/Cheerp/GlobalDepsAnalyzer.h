@@ -12,10 +12,11 @@
 #ifndef _CHEERP_GLOBAL_DEPS_ANALYZER_H
 #define _CHEERP_GLOBAL_DEPS_ANALYZER_H
 
-#include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Cheerp/Utility.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetLibraryInfo.h"
 #include <string>
 #include <unordered_map>
@@ -27,7 +28,8 @@ namespace cheerp
 /**
  * Determine which globals (variables and functions) need to be compiled.
  * 
- * It also computes a proper ordering between variables and functions to satisfy dependencies
+ * It also computes a proper ordering between variables and functions to satisfy dependencies,
+ * and keeps the graph of the dependencies between the reachable globals.
  */
 class GlobalDepsAnalyzer : public llvm::ModulePass
 {
@@ -38,8 +40,10 @@ public:
 
 	/**
 	 * Run the filter. Notice that it does not modify the module.
+	 *
+	 * If dumpDepsFile is not empty the dependency graph is written to it in DOT format
 	 */
-	GlobalDepsAnalyzer();
+	GlobalDepsAnalyzer(const std::string& dumpDepsFile = std::string());
 	
 	/**
 	 * Determine if a given global value is reachable
@@ -48,8 +52,30 @@ public:
 	 */
 	bool isReachable(const llvm::GlobalValue * val) const
 	{
-		return reachableGlobals.count(val);
+		return globalIds.count(val);
 	}
+
+	/**
+	 * Get the reachable globals directly used by the initializer or the body of a reachable global
+	 */
+	std::vector<const llvm::GlobalValue*> getDependencies(const llvm::GlobalValue * val) const;
+
+	/**
+	 * Get the reachable globals which directly use a reachable global
+	 */
+	std::vector<const llvm::GlobalValue*> getUsers(const llvm::GlobalValue * val) const;
+
+	/**
+	 * Get the globals which are reachable from outside the module: the exported functions,
+	 * the entry point and the list of constructors
+	 */
+	std::vector<const llvm::GlobalValue*> getRoots() const;
+
+	/**
+	 * Write the dependency graph in DOT format, every node is labeled with the number of
+	 * instructions of the function or the size in bytes of the initializer of the variable
+	 */
+	void dumpDependencyGraph(llvm::raw_ostream& out) const;
 	
 	/**
 	 * Get the map of global variables whose definitions triggers the completion of the definition of other global vars
@@ -104,35 +130,88 @@ public:
 
 	llvm::StructType* needsDowncastArray(llvm::StructType* t) const;
 private:
-	typedef llvm::SmallSet<const llvm::GlobalValue*, 8> VisitedSet;
-	
+	// User of the globals which are reachable from outside the module
+	static const uint32_t ROOT_USER = 0xffffffff;
+
+	// Node of the dependency graph, there is one for each reachable global
+	struct GlobalNode
+	{
+		const llvm::GlobalValue* G;
+		// Identifiers of the globals used by this one, sorted once the analysis is done
+		llvm::SmallVector<uint32_t, 4> deps;
+		// Set while the initializer of the global is being visited, used to detect circular dependencies
+		bool onStack;
+		GlobalNode(const llvm::GlobalValue* G):G(G),onStack(false)
+		{
+		}
+	};
+
+	// A constant being visited and the next operand to visit
+	struct ConstantFrame
+	{
+		const llvm::Constant* C;
+		uint32_t nextOperand;
+		ConstantFrame(const llvm::Constant* C):C(C),nextOperand(0)
+		{
+		}
+	};
+
+	// A global whose initializer is being visited
+	struct GlobalFrame
+	{
+		uint32_t id;
+		// The constants between the global and the one being currently visited
+		llvm::SmallVector<ConstantFrame, 8> constants;
+		// The list of uses followed from the global to the constant being currently visited,
+		// it is used only in the circular dependency case, to fill up the fixup map
+		SubExprVec subexpr;
+		GlobalFrame(uint32_t id):id(id)
+		{
+		}
+	};
+	typedef llvm::SmallVector<GlobalFrame, 8> VisitStack;
+
 	const char* getPassName() const override;
 
 	/**
 	 * Propagate the search across globalvalues (i.e. Functions, GlobalVariables and GlobalAliases)
 	 * 
-	 * visited contains the nodes which are being currently visited.
-	 * the subexpr argument is required whenever we are calling this from a visitConstant. 
-	 * It is used only in the circular dependency case, to fill up the fixup map
+	 * userId is the identifier of the global which uses G, or ROOT_USER if G is reachable from outside the module
 	 */
-	void visitGlobal( const llvm::GlobalValue *, 
-			  VisitedSet & visited, 
-			  const SubExprVec & subexpr );
-	
-	/** 
-	 * Propagate the search across constant expressions.
-	 * 
-	 * visited is just forwarded to visitGlobal
-	 * subexpr is filled with the list of uses followed to get to the current constant being processed
+	void visitGlobal( const llvm::GlobalValue * G, uint32_t userId );
+
+	/**
+	 * Propagate the search across a constant used by the body of the function with identifier userId
 	 */
-	void visitConstant( const llvm::Constant *, 
-			    VisitedSet & visited, 
-			    SubExprVec & subexpr );
-	
+	void visitConstant( const llvm::Constant * C, uint32_t userId );
+
 	/**
 	 * Visit every instruction inside a function.
 	 */
-	void visitFunction( const llvm::Function * F, VisitedSet & visited );
+	void visitFunction( const llvm::Function * F );
+
+	/**
+	 * Start visiting G from the global with identifier userId, which is either the global on top of the stack or
+	 * the user passed to visitGlobal, or ROOT_USER.
+	 *
+	 * Variables and aliases which were not reachable yet are pushed on the stack, functions on the functions queue.
+	 */
+	void enterGlobal( VisitStack & stack, const llvm::GlobalValue * G, uint32_t userId );
+
+	/**
+	 * Start visiting a constant used by the global on top of the stack.
+	 *
+	 * Return true if the constant has operands to visit and has been pushed on the stack
+	 */
+	bool enterConstant( VisitStack & stack, const llvm::Constant * C );
+
+	/**
+	 * Visit the constants and the globals on the stack until it is empty
+	 */
+	void runVisitStack( VisitStack & stack );
+
+	uint32_t addGlobalNode( const llvm::GlobalValue * G );
+	void addDependency( uint32_t userId, uint32_t id );
 	
 
 	/**
@@ -151,7 +230,10 @@ private:
 	 */
 	int filterModule( llvm::Module & );
 
-	std::unordered_set< const llvm::GlobalValue * > reachableGlobals; // Set of all the reachable globals
+	// Dense index of all the reachable globals, in order of discovery
+	llvm::DenseMap< const llvm::GlobalValue *, uint32_t > globalIds;
+	std::vector< GlobalNode > globalNodes;
+	llvm::SmallVector< uint32_t, 4 > rootIds;
 	
 	FixupMap varsFixups;
 	std::unordered_set<llvm::StructType* > classesWithBaseInfoNeeded;
@@ -167,15 +249,17 @@ private:
 	const llvm::TargetLibraryInfo* TLI;
 
 	const llvm::Function* entryPoint;
+
+	std::string dumpDepsFile;
 	
 	bool hasCreateClosureUsers;
 	bool hasVAArgs;
 	bool hasPointerArrays;
 };
 
-inline llvm::Pass * createGlobalDepsAnalyzerPass()
+inline llvm::Pass * createGlobalDepsAnalyzerPass(const std::string& dumpDepsFile = std::string())
 {
-	return new GlobalDepsAnalyzer;
+	return new GlobalDepsAnalyzer(dumpDepsFile);
 }
 
 }
@@ -0,0 +1,111 @@
+//===-- Cheerp/I64Lowering.h - Cheerp utility code ------------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_I64_LOWERING_H
+#define _CHEERP_I64_LOWERING_H
+
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cheerp
+{
+
+/**
+ * I64Lowering - Split 64-bit integers in pairs of 32-bit integers, since JS numbers can't represent them.
+ *
+ * Arguments and return values of functions with a body are split as well, the high part of returned values
+ * is passed in a global. When an i64 needs to be materialized as a single JS value, for memory accesses or
+ * calls to functions without a body, it is packed in a [low,high] array by the cheerpI64Pack builtin and
+ * unpacked by the cheerpI64Low/cheerpI64High builtins. The writer compiles these builtins natively.
+ * Packing allocates a new JS array, so every store of an i64 to memory costs an allocation.
+ *
+ * Bitcasts between double and i64 go through the cheerpI64BitsLow/cheerpI64BitsHigh and cheerpI64ToDouble
+ * builtins, which the writer compiles using a shared Float64Array and an Int32Array view of its buffer.
+ */
+class I64Lowering: public llvm::ModulePass
+{
+public:
+	static char ID;
+	explicit I64Lowering() : ModulePass(ID), module(NULL), highBits(NULL), packFunc(NULL), lowFunc(NULL), highFunc(NULL),
+		bitsLowFunc(NULL), bitsHighFunc(NULL), toDoubleFunc(NULL) { }
+	bool runOnModule(llvm::Module &M) override;
+	const char *getPassName() const override;
+
+	static const char* packName;
+	static const char* lowName;
+	static const char* highName;
+	static const char* bitsLowName;
+	static const char* bitsHighName;
+	static const char* toDoubleName;
+private:
+	// Low and high parts of a lowered i64
+	typedef std::pair<llvm::Value*, llvm::Value*> ValuePair;
+
+	llvm::Module* module;
+	llvm::GlobalVariable* highBits;
+	llvm::Function* packFunc;
+	llvm::Function* lowFunc;
+	llvm::Function* highFunc;
+	llvm::Function* bitsLowFunc;
+	llvm::Function* bitsHighFunc;
+	llvm::Function* toDoubleFunc;
+	std::unordered_map<unsigned, llvm::Function*> divRemHelpers;
+
+	// Per function state
+	std::unordered_map<llvm::Value*, ValuePair> loweredValues;
+	std::unordered_map<llvm::Value*, ValuePair> unpackedValues;
+	std::vector<llvm::Instruction*> loweredInstructions;
+	std::vector<llvm::PHINode*> loweredPHIs;
+
+	static bool isI64(llvm::Type* t)
+	{
+		return t->isIntegerTy(64);
+	}
+	static bool hasI64InSignature(llvm::FunctionType* FT);
+	llvm::FunctionType* getLoweredFunctionType(llvm::FunctionType* FT);
+	bool isBuiltinCall(const llvm::Value* V, const llvm::Function* builtin) const;
+
+	/**
+	 * Replace divisions and remainders with calls to helpers written in i64 IR, they will be lowered as well
+	 */
+	void replaceDivRem(llvm::Function& F);
+	llvm::Function* getDivRemHelper(unsigned opcode);
+	/**
+	 * Split the i64 arguments and return value of a function, the old body is moved into the new function
+	 */
+	llvm::Function* rewriteSignature(llvm::Function* F);
+	void rewriteCall(llvm::CallSite CS, llvm::Value* newCallee, llvm::FunctionType* newFT);
+	llvm::Value* createPack(const ValuePair& p, llvm::IRBuilder<>& Builder);
+
+	void lowerFunction(llvm::Function& F);
+	void lowerInstruction(llvm::Instruction& I);
+	ValuePair getPair(llvm::Value* V, llvm::Instruction* insertPoint);
+	bool isLowered(llvm::Value* V) const;
+	ValuePair lowerAdd(const ValuePair& a, const ValuePair& b, llvm::IRBuilder<>& Builder);
+	ValuePair lowerSub(const ValuePair& a, const ValuePair& b, llvm::IRBuilder<>& Builder);
+	ValuePair lowerMul(const ValuePair& a, const ValuePair& b, llvm::IRBuilder<>& Builder);
+	ValuePair lowerShift(unsigned opcode, const ValuePair& a, llvm::Value* amount, llvm::IRBuilder<>& Builder);
+	llvm::Value* lowerICmp(llvm::CmpInst::Predicate p, const ValuePair& a, const ValuePair& b, llvm::IRBuilder<>& Builder);
+	void lowerSwitch(llvm::SwitchInst& SI);
+};
+
+//===----------------------------------------------------------------------===//
+//
+// I64Lowering - Split 64-bit integers in pairs of 32-bit integers
+//
+llvm::ModulePass *createI64LoweringPass();
+}
+
+#endif //_CHEERP_I64_LOWERING_H
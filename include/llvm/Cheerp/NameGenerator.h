@@ -43,8 +43,6 @@ public:
 	{
 		assert(namemap.count(v) );
 		assert(! namemap.at(v).empty() );
-		if(!edgeContext.isNull())
-			return getNameForEdge(v);
 		return namemap.at(v);
 	}
 
@@ -55,8 +53,6 @@ public:
 	{
 		assert(secondaryNamemap.count(v) );
 		assert(!secondaryNamemap.at(v).empty());
-		if(!edgeContext.isNull())
-			return getSecondaryNameForEdge(v);
 		return secondaryNamemap.at(v);
 	}
 
@@ -71,23 +67,33 @@ public:
 	}
 
 	/**
-	 * Same as getName, but supports the required temporary variables in edges between blocks
-	 * It uses the current edge context.
-	*/
-	llvm::StringRef getNameForEdge(const llvm::Value* v) const;
-	llvm::StringRef getSecondaryNameForEdge(const llvm::Value* v) const;
-
-	void setEdgeContext(const llvm::BasicBlock* fromBB, const llvm::BasicBlock* toBB)
+	 * The edge between blocks which is currently being compiled.
+	 * It is owned by the users, so that many of them can share a single NameGenerator
+	 */
+	struct EdgeContext
 	{
-		assert(edgeContext.isNull());
-		edgeContext.fromBB=fromBB;
-		edgeContext.toBB=toBB;
-	}
+		const llvm::BasicBlock* fromBB;
+		const llvm::BasicBlock* toBB;
+		EdgeContext():fromBB(NULL), toBB(NULL)
+		{
+		}
+		bool isNull() const
+		{
+			return fromBB==NULL;
+		}
+		void clear()
+		{
+			fromBB=NULL;
+			toBB=NULL;
+		}
+	};
 
-	void clearEdgeContext()
-	{
-		edgeContext.clear();
-	}
+	/**
+	 * Same as getName, but supports the required temporary variables in edges between blocks
+	 * It uses the passed edge context.
+	*/
+	llvm::StringRef getNameForEdge(const llvm::Value* v, const EdgeContext& edgeContext) const;
+	llvm::StringRef getSecondaryNameForEdge(const llvm::Value* v, const EdgeContext& edgeContext) const;
 
 	enum NAME_FILTER_MODE { GLOBAL = 0, GLOBAL_SECONDARY, LOCAL, LOCAL_SECONDARY };
 	// Filter the original string so that it no longer contains invalid JS characters.
@@ -132,24 +138,6 @@ private:
 	typedef std::unordered_map<InstOnEdge, llvm::SmallString<8>, InstOnEdge::Hash > EdgeNameMapTy;
 	EdgeNameMapTy edgeNamemap;
 	EdgeNameMapTy edgeSecondaryNamemap;
-	struct EdgeContext
-	{
-		const llvm::BasicBlock* fromBB;
-		const llvm::BasicBlock* toBB;
-		EdgeContext():fromBB(NULL), toBB(NULL)
-		{
-		}
-		bool isNull() const
-		{
-			return fromBB==NULL;
-		}
-		void clear()
-		{
-			fromBB=NULL;
-			toBB=NULL;
-		}
-	};
-	EdgeContext edgeContext;
 	const std::vector<std::string>& reservedNames;
 };
 
@@ -18,6 +18,7 @@
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/Support/RWMutex.h"
 #include "llvm/Support/Timer.h"
 #include <unordered_map>
 #include <unordered_set>
@@ -288,8 +289,11 @@ public:
 class PointerAnalyzer : public llvm::ModulePass
 {
 public:
-	PointerAnalyzer() : 
-		ModulePass(ID)
+	/**
+	 * jobs is the number of threads used to visit the functions in runOnModule
+	 */
+	PointerAnalyzer(unsigned jobs = 1) :
+		ModulePass(ID), jobs(jobs), concurrentAccess(false)
 #ifndef NDEBUG
 		,fullyResolved(false),
 		timerGroup("Pointer Analyzer"),
@@ -330,6 +334,16 @@ public:
 	// Compute all the offsets for REGULAR pointer which may be assumed constant
 	void computeConstantOffsets(const llvm::Module& M );
 
+	/**
+	 * Allow queries from multiple threads, only valid after computeConstantOffsets.
+	 * Queries for already resolved values run in parallel, the other ones are serialized.
+	 * getFinalPointerKindWrapper returns a reference to the cached data and must not be used while enabled.
+	 */
+	void setConcurrentAccess(bool c) const
+	{
+		concurrentAccess = c;
+	}
+
 #ifndef NDEBUG
 	mutable bool fullyResolved;
 	// Dump a pointer value info
@@ -376,11 +390,21 @@ public:
 	static REGULAR_POINTER_PREFERENCE getRegularPreference(const IndirectPointerKindConstraint& c, PointerKindData& pointerKindData, AddressTakenMap& addressTakenCache);
 	static POINTER_KIND getPointerKindForMemberImpl(const TypeAndIndex& baseAndIndex, PointerKindData& pointerKindData, AddressTakenMap& addressTakenCache);
 private:
+	/**
+	 * Visit the functions of the module on multiple threads. Each batch of functions is visited into its own
+	 * PointerKindData, then the batches are merged in order into pointerKindData.
+	 */
+	void prefetchFuncsInParallel(const llvm::Module& M);
 	const PointerConstantOffsetWrapper& getFinalPointerConstantOffsetWrapper(const llvm::Value*) const;
+	POINTER_KIND getPointerKindImpl(const llvm::Value* p) const;
 	mutable PointerKindData pointerKindData;
 	mutable PointerOffsetData pointerOffsetData;
 	mutable AddressTakenMap addressTakenCache;
 
+	unsigned jobs;
+	mutable bool concurrentAccess;
+	mutable llvm::sys::RWMutex concurrentAccessLock;
+
 #ifndef NDEBUG
 	mutable llvm::TimerGroup timerGroup;
 	mutable llvm::Timer gpkTimer, gpkfrTimer;
@@ -394,9 +418,9 @@ void writePointerDumpHeader();
 
 #endif //NDEBUG
 
-inline llvm::Pass * createPointerAnalyzerPass()
+inline llvm::Pass * createPointerAnalyzerPass(unsigned jobs = 1)
 {
-	return new PointerAnalyzer;
+	return new PointerAnalyzer(jobs);
 }
 
 }
@@ -123,15 +123,17 @@ public:
 FunctionPass *createPointerToImmutablePHIRemovalPass();
 
 /**
- * This pass removes all free/delete/delete[] calls as their are no-op in Cheerp
+ * This pass removes all free/delete/delete[] calls as their are no-op in Cheerp.
+ * Frees of objects of pooled types are kept, the backend recycles them.
  */
 class FreeAndDeleteRemoval: public FunctionPass
 {
 private:
 	void deleteInstructionAndUnusedOperands(Instruction* I);
+	std::vector<std::string> poolTypes;
 public:
 	static char ID;
-	explicit FreeAndDeleteRemoval() : FunctionPass(ID) { }
+	explicit FreeAndDeleteRemoval(const std::vector<std::string>& poolTypes = std::vector<std::string>()) : FunctionPass(ID), poolTypes(poolTypes) { }
 	bool runOnFunction(Function &F) override;
 	const char *getPassName() const override;
 
@@ -142,7 +144,7 @@ public:
 //
 // FreeAndDeleteRemoval
 //
-FunctionPass *createFreeAndDeleteRemovalPass();
+FunctionPass *createFreeAndDeleteRemovalPass(const std::vector<std::string>& poolTypes = std::vector<std::string>());
 
 /**
  * This pass moves allocas as close as possible to the actual users
@@ -18,7 +18,8 @@
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 
-#include <map>
+#include <algorithm>
+#include <vector>
 
 namespace cheerp
 {
@@ -29,8 +30,105 @@ public:
     llvm::GlobalVariable *globalValue;
     llvm::Type *allocType;
     size_t size;
+    // Transaction which created the allocation or saved its memory
+    uint32_t transaction;
 
-    AllocData() : globalValue(nullptr), allocType(nullptr), size(0) { }
+    AllocData() : globalValue(nullptr), allocType(nullptr), size(0), transaction(0) { }
+};
+
+/**
+ * Index of non overlapping address ranges, sorted by start address.
+ *
+ * Allocations mostly come in increasing address order, so insertions are usually appends.
+ * Consecutive lookups usually hit the same range, so the last range found is checked first.
+ */
+template<class T>
+class AddressRangeIndex
+{
+public:
+    struct Range
+    {
+        char* start;
+        char* end;
+        T data;
+        Range(char* start, char* end, const T& data) : start(start), end(end), data(data) { }
+    };
+    typedef typename std::vector<Range>::iterator iterator;
+
+    AddressRangeIndex() : lastHit(0) { }
+
+    void insert(char* start, char* end, const T& data)
+    {
+        if (ranges.empty() || ranges.back().start < start)
+        {
+            ranges.push_back(Range(start, end, data));
+            return;
+        }
+        ranges.insert(upperBound(start), Range(start, end, data));
+        lastHit = 0;
+    }
+    /**
+     * Find the range containing p, the end of a range is considered part of it if includeEnd is true
+     */
+    Range* find(char* p, bool includeEnd)
+    {
+        if (lastHit < ranges.size() && contains(ranges[lastHit], p, includeEnd))
+            return &ranges[lastHit];
+        iterator it = upperBound(p);
+        if (it == ranges.begin())
+            return nullptr;
+        --it;
+        if (!contains(*it, p, includeEnd))
+            return nullptr;
+        lastHit = it - ranges.begin();
+        return &(*it);
+    }
+    /**
+     * Find the range which starts exactly at p
+     */
+    Range* findStart(char* p)
+    {
+        Range* r = find(p, /*includeEnd*/true);
+        return (r && r->start == p) ? r : nullptr;
+    }
+    /**
+     * Remove the range which starts exactly at start
+     */
+    void erase(char* start)
+    {
+        iterator it = upperBound(start);
+        assert(it != ranges.begin() && (it-1)->start == start);
+        ranges.erase(it-1);
+        lastHit = 0;
+    }
+    iterator begin() { return ranges.begin(); }
+    iterator end() { return ranges.end(); }
+    void clear() { ranges.clear(); lastHit = 0; }
+private:
+    std::vector<Range> ranges;
+    size_t lastHit;
+
+    static bool contains(const Range& r, char* p, bool includeEnd)
+    {
+        return p >= r.start && (p < r.end || (includeEnd && p == r.end));
+    }
+    iterator upperBound(char* p)
+    {
+        return std::upper_bound(ranges.begin(), ranges.end(), p,
+                [](char* p, const Range& r) { return p < r.start; });
+    }
+};
+
+class GlobalData
+{
+public:
+    llvm::GlobalVariable *globalValue;
+    // Set when the pre-executed code stores to the global
+    bool modified;
+    // Transaction which saved the memory of the global
+    uint32_t transaction;
+
+    GlobalData(llvm::GlobalVariable *GV) : globalValue(GV), modified(false), transaction(0) { }
 };
 
 class PreExecute : public llvm::ModulePass
@@ -42,10 +140,10 @@ public:
     llvm::ExecutionEngine *currentEE;
     llvm::Module *currentModule;
 
-    std::map<llvm::GlobalVariable *, llvm::Constant *>  modifiedGlobals;
-    std::map<char *, AllocData> typedAllocations;
+    AddressRangeIndex<GlobalData> globalRanges;
+    AddressRangeIndex<AllocData> typedAllocations;
 
-    explicit PreExecute() : llvm::ModulePass(ID) {
+    explicit PreExecute() : llvm::ModulePass(ID), currentTransaction(0) {
     }
 
     const char* getPassName() const override;
@@ -57,9 +155,68 @@ public:
         AllocData data;
         data.allocType = type;
         data.size = size;
-        typedAllocations.insert(std::make_pair(buf, data));
+        data.transaction = currentTransaction;
+        typedAllocations.insert(buf, buf + size, data);
+        transactionAllocations.push_back(buf);
     };
+    /**
+     * Abort the current execution, the reason is reported if the constructor is not folded
+     */
+    void recordFailure(const std::string& reason);
 private:
+    /**
+     * Memory saved before the first store of the current transaction to a
+     * global or to a typed allocation which existed before the transaction
+     */
+    struct MemorySnapshot
+    {
+        char* start;
+        std::vector<char> data;
+        // The global owning the memory, NULL for typed allocations
+        GlobalData* global;
+        bool wasModified;
+    };
+    std::vector<MemorySnapshot> snapshots;
+    // Typed allocations promoted to globals, whose initializer has not been computed yet
+    std::vector<std::pair<llvm::GlobalVariable*, char*>> pendingAllocations;
+    // Typed allocations done during the current transaction
+    std::vector<char*> transactionAllocations;
+    uint32_t currentTransaction;
+    std::string failureReason;
+
+    /**
+     * Every constructor is executed in a transaction, if its execution fails
+     * the memory is restored to the state it had before the transaction began
+     */
+    void beginTransaction();
+    void commitTransaction();
+    void rollbackTransaction();
+    void saveSnapshot(char* start, char* end, GlobalData* global);
+    /**
+     * Execute func in a transaction, returns false and rolls back if the execution failed
+     */
+    bool runInTransaction(llvm::Function* func);
+    /**
+     * Check that the memory written by the current transaction can be
+     * serialized, i.e. that every pointer stored into it points to a function,
+     * to a global or to a typed allocation with a type safe offset
+     */
+    bool isTransactionSerializable(const llvm::DataLayout* DL);
+    bool isSerializable(const llvm::DataLayout* DL, llvm::Type* memType, char* Addr);
+    /**
+     * Find the global containing p, a pointer to the end of a global is
+     * accepted if it does not point into another one
+     */
+    AddressRangeIndex<GlobalData>::Range* findGlobalRange(char* p)
+    {
+        auto range = globalRanges.find(p, /*includeEnd*/false);
+        return range ? range : globalRanges.find(p, /*includeEnd*/true);
+    }
+    /**
+     * Type of the global which will replace a typed allocation
+     */
+    static llvm::Type* getAllocationGlobalType(const llvm::DataLayout* DL, const AllocData& data);
+
     llvm::Constant* findPointerFromGlobal(const llvm::DataLayout* DL,
             llvm::Type* memType, llvm::GlobalValue* GV, char* GlobalStartAddr,
             char* StoredAddr, llvm::Type* Int32Ty);
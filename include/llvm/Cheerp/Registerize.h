@@ -12,11 +12,13 @@
 #ifndef _CHEERP_REGISTERIZE_H
 #define _CHEERP_REGISTERIZE_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 namespace cheerp
 {
@@ -89,7 +91,8 @@ public:
 	static REGISTER_KIND getRegKindFromType(llvm::Type*);
 private:
 	// Final data structures
-	std::unordered_map<const llvm::Instruction*, uint32_t> registersMap;
+	// Instruction has no spare field to store the register in, so getRegisterId is a hash lookup
+	llvm::DenseMap<const llvm::Instruction*, uint32_t> registersMap;
 	std::unordered_map<const llvm::AllocaInst*, LiveRange> allocaLiveRanges;
 	bool NoRegisterize;
 #ifndef NDEBUG
@@ -99,37 +102,65 @@ private:
 	struct InstructionLiveRange
 	{
 		// codePathId is used to efficently coalesce uses in a sequential range when possible
+		// codePathId is 0 if the instruction does not need a live range
 		uint32_t codePathId;
 		LiveRange range;
+		InstructionLiveRange(): codePathId(0)
+		{
+		}
 		InstructionLiveRange(uint32_t c): codePathId(c)
 		{
 		}
+		bool isValid() const
+		{
+			return codePathId != 0;
+		}
 		void addUse(uint32_t codePathId, uint32_t thisIndex);
 	};
-	// Map from instructions to their unique identifier
-	typedef std::unordered_map<const llvm::Instruction*, uint32_t> InstIdMapTy;
-	struct CompareInstructionByID
+	// Dense numbering of the reachable instructions of a function, identifiers start from 1
+	struct InstIdMapTy: public llvm::DenseMap<const llvm::Instruction*, uint32_t>
 	{
-	private:
-		const InstIdMapTy* instIdMap;
-	public:
-		CompareInstructionByID(const InstIdMapTy& i):instIdMap(&i)
+		// Instructions indexed by their identifier
+		std::vector<llvm::Instruction*> instructions;
+		uint32_t getId(const llvm::Instruction* I) const
 		{
+			assert(count(I));
+			return find(I)->second;
 		}
-		bool operator()(llvm::Instruction* l, llvm::Instruction*r) const
+	};
+	// Live ranges of the instructions, indexed by their identifier
+	typedef std::vector<InstructionLiveRange> LiveRangesTy;
+	// Sorted and coalesced intervals used by a register. Unlike the chunks of a LiveRange intervals are never empty,
+	// an empty chunk [s,s) still occupies the index s since the instruction writes the register there.
+	struct RegisterIntervals: public std::vector<LiveRangeChunk>
+	{
+		bool doesInterfere(const LiveRange& range) const;
+		void add(const LiveRange& range);
+		uint32_t getEnd() const
 		{
-			assert(instIdMap->count(l) && instIdMap->count(r));
-			return instIdMap->find(l)->second < instIdMap->find(r)->second;
+			return empty() ? 0 : back().end;
 		}
 	};
-	// Map from instructions to their live ranges
-	typedef std::map<llvm::Instruction*, InstructionLiveRange, CompareInstructionByID> LiveRangesTy;
 	struct RegisterRange
 	{
-		LiveRange range;
+		RegisterIntervals range;
 		REGISTER_KIND regKind;
-		RegisterRange(const LiveRange& range, REGISTER_KIND k):range(range),regKind(k)
+		RegisterRange(const LiveRange& r, REGISTER_KIND k):regKind(k)
 		{
+			range.add(r);
+		}
+	};
+	// The registers allocated to a function
+	struct RegistersState
+	{
+		std::vector<RegisterRange> registers;
+		// The ids of the registers of each kind, in increasing order
+		std::vector<uint32_t> registersOfKind[DOUBLE+1];
+		uint32_t createRegister(const LiveRange& range, REGISTER_KIND kind)
+		{
+			registers.push_back(RegisterRange(range, kind));
+			registersOfKind[kind].push_back(registers.size()-1);
+			return registers.size()-1;
 		}
 	};
 	// Temporary data structures used while exploring the CFG
@@ -159,7 +190,23 @@ private:
 		{
 		}
 	};
-	typedef std::unordered_map<llvm::BasicBlock*, BlockState> BlocksState;
+	// State of all the blocks of a function, indexed by their position in the function
+	struct BlocksState
+	{
+		std::vector<BlockState> states;
+		llvm::DenseMap<const llvm::BasicBlock*, uint32_t> blockIds;
+		BlocksState(const llvm::Function& F)
+		{
+			for(const llvm::BasicBlock& BB: F)
+				blockIds.insert(std::make_pair(&BB, blockIds.size()));
+			states.resize(blockIds.size());
+		}
+		BlockState& operator[](const llvm::BasicBlock* BB)
+		{
+			assert(blockIds.count(BB));
+			return states[blockIds.find(BB)->second];
+		}
+	};
 	// Temporary data used to registerize allocas
 	typedef std::vector<const llvm::AllocaInst*> AllocaSetTy;
 	typedef std::map<uint32_t, uint32_t> RangeChunksTy;
@@ -181,6 +228,7 @@ private:
 		{
 		}
 	};
+	// Only the blocks reached by the exploration of a single alloca are stored, not every block of the function
 	struct AllocaBlocksState: public std::unordered_map<llvm::BasicBlock*, AllocaBlockState>
 	{
 		std::vector<llvm::BasicBlock*> pendingBlocks;
@@ -212,19 +260,23 @@ private:
 
 	LiveRangesTy computeLiveRanges(llvm::Function& F, const InstIdMapTy& instIdMap, cheerp::PointerAnalyzer& PA);
 	void doUpAndMark(BlocksState& blocksState, llvm::BasicBlock* BB, llvm::Instruction* I);
-	static void assignInstructionsIds(InstIdMapTy& instIdMap, const llvm::Function& F, AllocaSetTy& allocaSet);
+	static void assignInstructionsIds(InstIdMapTy& instIdMap, llvm::Function& F, AllocaSetTy& allocaSet);
 	uint32_t dfsLiveRangeInBlock(BlocksState& blockState, LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap,
 					llvm::BasicBlock& BB, cheerp::PointerAnalyzer& PA, uint32_t nextIndex, uint32_t codePathId);
-	void extendRangeForUsedOperands(llvm::Instruction& I, LiveRangesTy& liveRanges, cheerp::PointerAnalyzer& PA,
-					uint32_t thisIndex, uint32_t codePathId);
-	uint32_t assignToRegisters(const LiveRangesTy& F, const PointerAnalyzer& PA);
-	void handlePHI(llvm::Instruction& I, const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers, const PointerAnalyzer& PA);
-	uint32_t findOrCreateRegister(llvm::SmallVector<RegisterRange, 4>& registers, const InstructionLiveRange& range,
+	void extendRangeForUsedOperands(llvm::Instruction& I, LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap,
+					cheerp::PointerAnalyzer& PA, uint32_t thisIndex, uint32_t codePathId);
+	uint32_t assignToRegisters(const LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap, const PointerAnalyzer& PA);
+	// Registers assigned to the instructions of a function, indexed by their identifier
+	typedef std::vector<uint32_t> InstRegistersTy;
+	void handlePHI(llvm::Instruction& I, const LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap, InstRegistersTy& instRegisters,
+					RegistersState& registers, const PointerAnalyzer& PA);
+	uint32_t findOrCreateRegister(RegistersState& registers, const InstructionLiveRange& range,
 					REGISTER_KIND kind);
 	bool addRangeToRegisterIfPossible(RegisterRange& regRange, const InstructionLiveRange& liveRange, REGISTER_KIND kind);
 	void computeAllocaLiveRanges(AllocaSetTy& allocaSet, const InstIdMapTy& instIdMap);
-	typedef std::set<llvm::Instruction*, CompareInstructionByID> InstructionSetOrderedByID;
-	InstructionSetOrderedByID gatherDerivedMemoryAccesses(const llvm::AllocaInst* rootI, const InstIdMapTy& instIdMap);
+	// Instructions and their identifiers, sorted by identifier
+	typedef std::vector<std::pair<uint32_t, llvm::Instruction*>> InstructionsOrderedByID;
+	InstructionsOrderedByID gatherDerivedMemoryAccesses(const llvm::AllocaInst* rootI, const InstIdMapTy& instIdMap);
 	enum UP_AND_MARK_ALLOCA_STATE { USE_FOUND = 0, USE_NOT_FOUND, USE_UNKNOWN };
 	struct UpAndMarkAllocaState
 	{
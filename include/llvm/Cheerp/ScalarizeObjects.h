@@ -0,0 +1,75 @@
+//===-- Cheerp/ScalarizeObjects.h - Cheerp scalar replacement of objects --===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_SCALARIZE_OBJECTS_H
+#define _CHEERP_SCALARIZE_OBJECTS_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+
+namespace cheerp
+{
+
+/**
+ * ScalarizeObjects - Replace objects which do not escape the function with one SSA value for each member.
+ *
+ * Both struct allocas and single object allocations (new, malloc and cheerp_allocate) are handled,
+ * otherwise each of them is compiled to a JS object literal. An object does not escape if it is only
+ * accessed by loads and stores of its scalar members through GEPs with constant indexes. Lifetime markers
+ * and deallocations of the object are dropped.
+ *
+ * Every member gets its own alloca, which are then promoted to registers. Members of heap allocations
+ * are set to zero at the allocation point, like the members of the JS object would be.
+ */
+class ScalarizeObjects: public llvm::FunctionPass
+{
+public:
+	static char ID;
+	explicit ScalarizeObjects() : FunctionPass(ID) { }
+	bool runOnFunction(llvm::Function& F) override;
+	const char* getPassName() const override;
+	void getAnalysisUsage(llvm::AnalysisUsage& AU) const override;
+
+	// Objects with more scalar members than this are left alone
+	static const uint32_t maxMembers = 32;
+private:
+	struct ObjectUses
+	{
+		// Loads and stores of the object, with the index of the accessed scalar member
+		llvm::SmallVector<std::pair<llvm::Instruction*, uint32_t>, 8> accesses;
+		// GEPs, casts, lifetime markers and deallocations to erase, users come after their operand
+		llvm::SmallVector<llvm::Instruction*, 8> deadInstructions;
+	};
+
+	static uint32_t countMembers(llvm::Type* t);
+	static void collectMemberTypes(llvm::Type* t, llvm::SmallVectorImpl<llvm::Type*>& memberTypes);
+	static bool isDroppableCall(const llvm::Instruction* I);
+	static bool collectUses(llvm::Value* ptr, llvm::Type* pointedType, uint32_t firstMember, ObjectUses& uses);
+	/**
+	 * Returns the type of the object allocated by a call, or NULL if the allocation can't be scalarized
+	 */
+	static llvm::StructType* getAllocatedObjectType(llvm::CallInst* CI);
+	static bool collectAllocationUses(llvm::CallInst* CI, llvm::StructType* objectType, ObjectUses& uses);
+	void scalarize(llvm::Instruction* object, llvm::StructType* objectType, ObjectUses& uses,
+			bool zeroInitialize, llvm::SmallVectorImpl<llvm::AllocaInst*>& newAllocas);
+};
+
+//===----------------------------------------------------------------------===//
+//
+// ScalarizeObjects - Replace non escaping objects with SSA values for their members
+//
+llvm::FunctionPass *createScalarizeObjectsPass();
+}
+
+#endif //_CHEERP_SCALARIZE_OBJECTS_H
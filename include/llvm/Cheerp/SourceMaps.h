@@ -17,6 +17,8 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace cheerp
 {
@@ -24,7 +26,20 @@ namespace cheerp
 class SourceMapGenerator
 {
 private:
-	llvm::tool_output_file sourceMap;
+	// A mapping event which has been recorded to be replayed later on
+	struct MappingEvent
+	{
+		enum KIND { FUNCTION_NAME = 0, DEBUG_LOC, FINISH_LINE };
+		KIND kind;
+		uint32_t lineOffset;
+		llvm::DISubprogram method;
+		llvm::DebugLoc debugLoc;
+		MappingEvent(KIND k, uint32_t o):kind(k),lineOffset(o)
+		{
+		}
+	};
+	// NULL when only recording mapping events
+	std::unique_ptr<llvm::tool_output_file> sourceMap;
 	const std::string& sourceMapName;
 	const std::string& sourceMapPrefix;
 	llvm::LLVMContext& Ctx;
@@ -37,10 +52,16 @@ private:
 	uint32_t lineOffset;
 	uint32_t lastName;
 	bool lineBegin;
+	std::vector<MappingEvent> recordedEvents;
 	void writeBase64VLQInt(int32_t i);
+	bool isRecording() const { return !sourceMap; }
 public:
 	// sourceMapName and sourceMapPrefix life spans should be longer than the one of the SourceMapGenerator
 	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C, std::error_code& ErrorCode);
+	// Build a generator which does not write any file, but only records the mapping events.
+	// They are relative to the position where the recording started, so they can be generated
+	// independently (i.e. on another thread) and later replayed on the generator of the actual file.
+	explicit SourceMapGenerator(llvm::LLVMContext& C);
 	void setFunctionName(const llvm::DISubprogram &method);
 	void setDebugLoc(const llvm::DebugLoc& debugLoc);
 	void beginFile();
@@ -48,6 +69,8 @@ public:
 	// TODO: It's not clear if the line offset in encoded in bytes or charathers
 	void addLineOffset(uint32_t o) { lineOffset+=o; }
 	void endFile();
+	// Emit the events recorded by the passed generator, as if they happened here
+	void replay(const SourceMapGenerator& recorder);
 	std::string getSourceMapName() const;
 };
 
@@ -0,0 +1,73 @@
+//===-- Cheerp/StackArena.h - Cheerp stack arena for typed allocas --------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_STACK_ARENA_H
+#define _CHEERP_STACK_ARENA_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Cheerp/PointerAnalyzer.h"
+#include "llvm/Cheerp/Registerize.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+
+namespace cheerp
+{
+
+/**
+ * StackArena - Allocate the typed array allocas of a function in a module level arena.
+ *
+ * Every alloca of an array of typed array elements becomes a new typed array on each call.
+ * There is an arena for each element type, which is a typed array with a stack pointer.
+ * A function reserves the space for all its allocas of a type at entry and releases it
+ * before returning. The arena is grown, by reallocating it, when it is full.
+ *
+ * Only allocas which do not escape are moved to the arena, i.e. allocas only accessed by
+ * loads and stores through GEPs. Each access loads the arena again, since a call may have
+ * grown it in the meantime.
+ */
+class StackArena: public llvm::ModulePass
+{
+public:
+	static char ID;
+	explicit StackArena() : ModulePass(ID), module(NULL) { }
+	bool runOnModule(llvm::Module& M) override;
+	const char* getPassName() const override;
+	void getAnalysisUsage(llvm::AnalysisUsage& AU) const override;
+
+	// Number of elements of a newly created arena
+	static const uint32_t initialArenaSize = 1024;
+private:
+	struct Arena
+	{
+		// Global pointer to the current arena
+		llvm::GlobalVariable* base;
+		// Global index of the first free element
+		llvm::GlobalVariable* top;
+		// Reserves N elements and returns the index of the first one
+		llvm::Function* allocFunc;
+	};
+	llvm::Module* module;
+	llvm::DenseMap<llvm::Type*, Arena> arenas;
+
+	static bool canUseArena(const llvm::AllocaInst* AI);
+	Arena& getArena(llvm::Type* elementType);
+	bool rewriteFunction(llvm::Function& F, PointerAnalyzer& PA, Registerize& registerize);
+};
+
+//===----------------------------------------------------------------------===//
+//
+// StackArena - Allocate non escaping typed array allocas in a module level arena
+//
+llvm::ModulePass *createStackArenaPass();
+}
+
+#endif //_CHEERP_STACK_ARENA_H
@@ -25,8 +25,8 @@ class TypeOptimizer: public llvm::ModulePass
 private:
 	struct TypeMappingInfo
 	{
-		enum MAPPING_KIND { IDENTICAL, COLLAPSED, COLLAPSING, COLLAPSING_BUT_USED, BYTE_LAYOUT_TO_ARRAY, POINTER_FROM_ARRAY, FLATTENED_ARRAY,
-						MERGED_MEMBER_ARRAYS, MERGED_MEMBER_ARRAYS_AND_COLLAPSED };
+		enum MAPPING_KIND { IDENTICAL, COLLAPSED, COLLAPSING, COLLAPSING_BUT_USED, BYTE_LAYOUT_TO_ARRAY, STRUCT_TO_TYPED_ARRAY, POINTER_FROM_ARRAY,
+						FLATTENED_ARRAY, MERGED_MEMBER_ARRAYS, MERGED_MEMBER_ARRAYS_AND_COLLAPSED };
 		llvm::Type* mappedType;
 		MAPPING_KIND elementMappingKind;
 		TypeMappingInfo():mappedType(NULL),elementMappingKind(IDENTICAL)
@@ -50,6 +50,7 @@ private:
 	std::unordered_map<llvm::StructType*, std::vector<std::pair<uint32_t, uint32_t>>> membersMappingData;
 	std::unordered_map<llvm::GlobalVariable*, llvm::Constant*> globalsMapping;
 	std::unordered_map<llvm::GlobalValue*, llvm::Type*> globalTypeMapping;
+	// Also used for the base type of STRUCT_TO_TYPED_ARRAY structs
 	std::unordered_map<llvm::StructType*, llvm::Type*> baseTypesForByteLayout;
 	std::unordered_map<llvm::Type*, TypeMappingInfo> typesMapping;
 	std::unordered_set<llvm::Function*> pendingFunctions;
@@ -63,6 +64,12 @@ private:
 	};
 	// In this context a field "escapes" if it has any use which is not just a load/store
 	std::unordered_set<std::pair<llvm::StructType*, uint32_t>, EscapingFieldsHash> escapingFields;
+	// Structs which are used as elements of arrays, either statically or with pointer arithmetic
+	std::unordered_set<llvm::StructType*> arrayElementStructs;
+	// Structs which are used as first class values, their layout can't change
+	std::unordered_set<llvm::StructType*> valueStructs;
+	// Structs which are direct bases of other structs
+	std::unordered_set<llvm::StructType*> baseStructs;
 #ifndef NDEBUG
 	std::unordered_set<llvm::Type*> newStructTypes;
 #endif
@@ -77,6 +84,12 @@ private:
 	uint8_t rewriteGEPIndexes(llvm::SmallVector<llvm::Value*, 4>& newIndexes, llvm::Type* ptrType, llvm::ArrayRef<llvm::Use> idxs,
 				llvm::Type* targetType, llvm::Instruction* insertionPoint);
 	bool isUnsafeDowncastSource(llvm::StructType* st);
+	/**
+	 * Returns the type of all the members of st if it can be flattened in a typed array, NULL otherwise
+	 */
+	llvm::Type* getTypedArrayBaseType(llvm::StructType* st);
+	void addArrayElementStruct(llvm::Type* t, bool isArrayElement);
+	void addValueStruct(llvm::Type* t);
 	void addAllBaseTypesForByteLayout(llvm::StructType* st, llvm::Type* base);
 	static void pushAllBaseConstantElements(llvm::SmallVector<llvm::Constant*, 4>& newElements, llvm::Constant* C, llvm::Type* baseType);
 	// Helper function to handle the various kind of arrays in constants
@@ -155,6 +155,17 @@ public:
 	// Returns true if the type is not considered a literal object or array in JS
 	static bool isSimpleType(llvm::Type* t);
 
+	/**
+	 * Returns true if objects of the given type are recycled through a free list instead of being left to the GC.
+	 * Types are selected by their LLVM name (i.e. struct.Node) or by their C++ name (i.e. Node)
+	 */
+	static bool isPooledType(const llvm::StructType* st, const std::vector<std::string>& poolTypes);
+
+	/**
+	 * Returns the object passed to free/delete, looking through bitcasts
+	 */
+	static const llvm::Value* getFreedObject(const llvm::Value* obj);
+
 	static llvm::NamedMDNode* getBasesMetadata(const llvm::StructType * t, const llvm::Module & m)
 	{
 		if(!t->hasName())
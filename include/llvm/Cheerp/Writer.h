@@ -12,6 +12,8 @@
 #ifndef _CHEERP_WRITER_H
 #define _CHEERP_WRITER_H
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/NameGenerator.h"
@@ -25,8 +27,11 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/Support/FormattedStream.h"
+#include <cstring>
 #include <set>
 #include <map>
+#include <memory>
+#include <unordered_map>
 
 namespace cheerp
 {
@@ -37,6 +42,10 @@ class NewLineHandler
 
 /**
  * Black magic to conditionally enable indented output
+ *
+ * The output is accumulated in chunks which are written to the underlying stream when full.
+ * The position in the output is tracked incrementally, it is only reported to the source
+ * map generator when a mapping is added or a line is finished.
  */
 class ostream_proxy
 {
@@ -46,26 +55,34 @@ public:
 		sourceMapGenerator(g),
 		readableOutput(readableOutput),
 		newLine(true),
-		indentLevel(0)
+		indentLevel(0),
+		buffer(new char[ChunkSize]),
+		bufferCur(buffer.get()),
+		bufferEnd(buffer.get() + ChunkSize),
+		flushedBytes(0),
+		sourceMapPosition(0)
 	{}
 
+	~ostream_proxy()
+	{
+		flush();
+	}
+
 	friend ostream_proxy& operator<<( ostream_proxy & os, char c )
 	{
-		uint64_t begin = os.stream.tell();
-		os.write_indent(c);
-		uint64_t end = os.stream.tell();
-		if(os.sourceMapGenerator)
-			os.sourceMapGenerator->addLineOffset(end-begin);
+		if(os.readableOutput)
+			os.write_indent(c);
+		else
+			os.append(c);
 		return os;
 	}
 
 	friend ostream_proxy& operator<<( ostream_proxy & os, llvm::StringRef s )
 	{
-		uint64_t begin = os.stream.tell();
-		os.write_indent(s);
-		uint64_t end = os.stream.tell();
-		if(os.sourceMapGenerator)
-			os.sourceMapGenerator->addLineOffset(end-begin);
+		if(os.readableOutput)
+			os.write_indent(s);
+		else
+			os.append(s);
 		return os;
 	}
 
@@ -74,31 +91,150 @@ public:
 		if(!os.readableOutput)
 			return os;
 		if(os.sourceMapGenerator)
+		{
+			os.syncSourceMap();
 			os.sourceMapGenerator->finishLine();
-		os.stream << '\n';
+		}
+		os.append('\n');
+		// The new line is not part of any line
+		os.sourceMapPosition = os.position();
 		os.newLine = true;
 		return os;
 	}
 
+	// Integers are formatted directly in the buffer, as raw_ostream would do
 	template<class T>
 	friend typename std::enable_if<
-		!std::is_convertible<T&&, llvm::StringRef>::value, // Use this only if T is not convertible to StringRef
+		std::is_integral<T>::value && !std::is_same<T, bool>::value && sizeof(T) != 1,
+		ostream_proxy&>::type operator<<( ostream_proxy & os, T t )
+	{
+		if(os.readableOutput)
+			os.write_line_indent();
+		// Enough for the longest 64-bit value and the sign
+		char digits[21];
+		char* end = digits + sizeof(digits);
+		char* cur = end;
+		bool negative = t < 0;
+		// Avoid overflowing on the most negative value by using the unsigned type
+		typename std::make_unsigned<T>::type u = t;
+		if(negative)
+			u = -u;
+		do
+		{
+			*--cur = '0' + u % 10;
+			u /= 10;
+		}
+		while(u);
+		if(negative)
+			*--cur = '-';
+		os.append(llvm::StringRef(cur, end - cur));
+		return os;
+	}
+
+	template<class T>
+	friend typename std::enable_if<
+		!std::is_convertible<T&&, llvm::StringRef>::value && // Use this only if T is not convertible to StringRef
+		!(std::is_integral<typename std::decay<T>::type>::value && !std::is_same<typename std::decay<T>::type, bool>::value
+		  && sizeof(T) != 1), // and not an integer handled above
 		ostream_proxy&>::type operator<<( ostream_proxy & os, T && t )
 	{
-		uint64_t begin = os.stream.tell();
-		if ( os.newLine && os.readableOutput )
-			for ( int i = 0; i < os.indentLevel; i++ )
-				os.stream << '\t';
-
-		os.stream << std::forward<T>(t);
-		os.newLine = false;
-		uint64_t end = os.stream.tell();
-		if(os.sourceMapGenerator)
-			os.sourceMapGenerator->addLineOffset(end-begin);
+		if(os.readableOutput)
+			os.write_line_indent();
+		llvm::SmallString<32> str;
+		llvm::raw_svector_ostream s(str);
+		s << std::forward<T>(t);
+		os.append(s.str());
 		return os;
 	}
 
+	bool isReadableOutput() const
+	{
+		return readableOutput;
+	}
+
+	struct IndentState
+	{
+		bool newLine;
+		int indentLevel;
+	};
+
+	IndentState getIndentState() const
+	{
+		return IndentState{newLine, indentLevel};
+	}
+
+	/**
+	 * Append code generated by another proxy at the top level, and continue from its final state.
+	 * The source map data, if any, must be forwarded separately.
+	 */
+	void appendCode(llvm::StringRef code, const IndentState& finalState)
+	{
+		append(code);
+		sourceMapPosition = position();
+		newLine = finalState.newLine;
+		indentLevel = finalState.indentLevel;
+	}
+
+	/**
+	 * Report to the source map generator the code written since the last mapping
+	 */
+	void syncSourceMap()
+	{
+		assert(sourceMapGenerator);
+		uint64_t curPosition = position();
+		sourceMapGenerator->addLineOffset(curPosition - sourceMapPosition);
+		sourceMapPosition = curPosition;
+	}
+
+	/**
+	 * Write all the buffered code to the underlying stream
+	 */
+	void flush()
+	{
+		if(sourceMapGenerator)
+			syncSourceMap();
+		flushBuffer();
+	}
+
 private:
+	static const size_t ChunkSize = 1 << 16;
+
+	uint64_t position() const
+	{
+		return flushedBytes + (bufferCur - buffer.get());
+	}
+
+	void flushBuffer()
+	{
+		size_t size = bufferCur - buffer.get();
+		stream.write(buffer.get(), size);
+		flushedBytes += size;
+		bufferCur = buffer.get();
+	}
+
+	void append(char c)
+	{
+		if(bufferCur == bufferEnd)
+			flushBuffer();
+		*bufferCur++ = c;
+	}
+
+	void append(llvm::StringRef s)
+	{
+		if(s.size() > size_t(bufferEnd - bufferCur))
+		{
+			flushBuffer();
+			// Bypass the buffer if the data would not fit anyway
+			if(s.size() > ChunkSize)
+			{
+				stream.write(s.data(), s.size());
+				flushedBytes += s.size();
+				return;
+			}
+		}
+		memcpy(bufferCur, s.data(), s.size());
+		bufferCur += s.size();
+	}
 
 	// Return true if we are closing a curly bracket, need to unindent by 1.
 	bool updateIndent( char c ) {
@@ -124,11 +260,19 @@ private:
 		if (updateIndent( std::forward<T>(t) ) )
 			oldIndent--;
 
-		if ( newLine && readableOutput )
+		if ( newLine )
 			for ( int i = 0; i < oldIndent; i++ )
-				stream << '\t';
+				append('\t');
+
+		append(std::forward<T>(t));
+		newLine = false;
+	}
 
-		stream << std::forward<T>(t);
+	void write_line_indent()
+	{
+		if ( newLine )
+			for ( int i = 0; i < indentLevel; i++ )
+				append('\t');
 		newLine = false;
 	}
 
@@ -137,10 +281,21 @@ private:
 	bool readableOutput;
 	bool newLine;
 	int indentLevel;
+	std::unique_ptr<char[]> buffer;
+	char* bufferCur;
+	char* bufferEnd;
+	// Bytes already written to the underlying stream
+	uint64_t flushedBytes;
+	// Position of the last code reported to the source map generator
+	uint64_t sourceMapPosition;
 };
 
 const static int V8MaxLiteralDepth = 3;
 const static int V8MaxLiteralProperties = 8;
+// Switches with fewer cases are rendered as a chain of ifs
+const static unsigned MinCasesForNativeSwitch = 4;
+// Copies of constant size up to this number of elements are compiled as element by element assignments
+const static unsigned MaxUnrolledMemFuncElements = 4;
 
 class CheerpWriter
 {
@@ -155,7 +310,10 @@ private:
 	const Registerize & registerize;
 
 	GlobalDepsAnalyzer & globalDeps;
-	NameGenerator namegen;
+	// The name generator is shared between the main writer and the ones used to compile functions in parallel
+	std::unique_ptr<NameGenerator> ownedNamegen;
+	const NameGenerator& namegen;
+	NameGenerator::EdgeContext edgeContext;
 	TypeSupport types;
 	std::set<const llvm::GlobalVariable*> compiledGVars;
 
@@ -174,6 +332,77 @@ private:
 	bool addCredits;
 	// Flag to signal if we should add code that measures time until main is reached
 	bool measureTimeToMain;
+	// Flag to signal if every struct type should be allocated with its constructor function
+	bool useStructConstructors;
+	// Flag to signal if we should report the struct types which are created with more than one shape
+	bool reportStructShapes;
+	// Minimum size in bytes of the constant arrays compiled as base64 blobs, 0 disables blobs
+	uint32_t blobThreshold;
+	// Flag to signal if the compiled code decodes any blob
+	bool blobsUsed;
+	// Flag to signal if the compiled code needs the scratch views for bitcasts between double and i64
+	bool i64BitcastsUsed;
+	// Number of threads used to compile the functions
+	unsigned jobs;
+
+	/**
+	 * Typed array views used to access byte layout objects at provably aligned offsets.
+	 * Views are created lazily and cached on the DataView object.
+	 */
+	enum BYTE_LAYOUT_VIEW { BYTE_LAYOUT_VIEW_INT8 = 0, BYTE_LAYOUT_VIEW_INT16, BYTE_LAYOUT_VIEW_INT32, BYTE_LAYOUT_VIEW_FLOAT32, BYTE_LAYOUT_VIEW_FLOAT64 };
+	// Bitmask of the BYTE_LAYOUT_VIEW kinds used by the compiled code
+	uint32_t byteLayoutViewsUsed;
+
+	// Struct types whose objects are recycled through free lists, see TypeSupport::isPooledType
+	std::vector<std::string> poolTypes;
+	// Pooled types whose free list is used by the compiled code
+	std::unordered_set<const llvm::StructType*> poolsUsed;
+
+	/**
+	 * Ways in which JS objects for a struct type are created. Objects built in different ways
+	 * may end up with different hidden classes in the JS engine, making accesses polymorphic.
+	 */
+	enum STRUCT_SHAPE { STRUCT_SHAPE_LITERAL = 1, STRUCT_SHAPE_CONSTRUCTOR = 2, STRUCT_SHAPE_CONSTANT = 4 };
+	// Bitmask of the STRUCT_SHAPE kinds used for each struct type by the compiled code
+	std::unordered_map<const llvm::StructType*, uint32_t> structShapes;
+	void reportStructTypeShapes() const;
+
+	/**
+	 * \addtogroup CodeSplitting methods to move the code which is not needed at startup to a secondary file
+	 *
+	 * Functions which are only reachable through split points (the requested entry points and the functions
+	 * marked as cold) are compiled in the secondary file. The primary file contains a stub for each of the
+	 * secondary functions it uses, the first call to a stub loads and evaluates the secondary file in the
+	 * scope of the primary one.
+	 *
+	 * @{
+	 */
+	// Stream of the secondary file, code splitting is disabled if NULL
+	llvm::raw_ostream* secondaryStream;
+	// URL used at runtime to load the secondary file
+	std::string secondaryURL;
+	// Names of the functions which should be compiled in the secondary file along with the code only they use
+	std::vector<std::string> splitEntryPoints;
+	// Functions compiled in the secondary file, in module order
+	std::vector<const llvm::Function*> secondaryFunctions;
+	// Slot in the table of the loaded functions for each secondary function used by the primary file,
+	// or NO_SECONDARY_SLOT if the function is only used by the secondary file
+	llvm::DenseMap<const llvm::Function*, uint32_t> secondarySlots;
+	uint32_t secondarySlotsCount;
+	static const uint32_t NO_SECONDARY_SLOT = 0xffffffff;
+	/**
+	 * Partition the functions between the primary and the secondary file using the dependency graph
+	 */
+	void computeSecondaryFunctions();
+	/**
+	 * Compile the secondary file, the used helpers are compiled in the primary file
+	 */
+	void compileSecondaryFile();
+	/**
+	 * Compile the loader of the secondary file and the stubs of the secondary functions used by the primary file
+	 */
+	void compileSecondaryStubs();
+	/** @} */
 
 	/**
 	 * \addtogroup MemFunction methods to handle memcpy, memmove, mallocs and free (and alike)
@@ -185,8 +414,19 @@ private:
 	 * Compile memcpy and memmove
 	 */
 	void compileMemFunc(const llvm::Value* dest,
-	                    const llvm::Value* srcOrResetVal,
-	                    const llvm::Value* size);
+	                    const llvm::Value* src,
+	                    const llvm::Value* size,
+	                    bool isMemmove);
+	/**
+	 * Compile memset using TypedArray.fill
+	 */
+	void compileMemset(const llvm::Value* dest,
+	                   const llvm::Value* resetVal,
+	                   const llvm::Value* size);
+	/**
+	 * Compile the array which holds the elements pointed by p, for byte layout pointers a cached Int8Array view is used
+	 */
+	void compileMemFuncBase(const llvm::Value* p);
 
 	/**
 	 * Copy baseSrc into baseDest
@@ -204,7 +444,40 @@ private:
 	// COMPILE_EMPTY is returned if there is no need to add a ;\n to end the line
 	enum COMPILE_INSTRUCTION_FEEDBACK { COMPILE_OK = 0, COMPILE_UNSUPPORTED, COMPILE_EMPTY };
 
-	void handleBuiltinNamespace(const char* identifier, llvm::ImmutableCallSite callV);
+	/**
+	 * How calls to a function are compiled, the classification only depends on the function
+	 */
+	enum BUILTIN_HANDLER { BUILTIN_NONE = 0, BUILTIN_FREE, BUILTIN_I64_PACK, BUILTIN_I64_LOW, BUILTIN_I64_HIGH,
+				BUILTIN_I64_BITS_LOW, BUILTIN_I64_BITS_HIGH, BUILTIN_I64_TO_DOUBLE, BUILTIN_FMOD, BUILTIN_MATH,
+				BUILTIN_ALLOCATION, BUILTIN_CLIENT_STRING, BUILTIN_CLIENT_CONSTRUCTOR, BUILTIN_CLIENT_GETTER,
+				BUILTIN_CLIENT_SETTER, BUILTIN_CLIENT_INDEX, BUILTIN_CLIENT_METHOD, BUILTIN_CLIENT_MALFORMED };
+	struct BuiltinInfo
+	{
+		BUILTIN_HANDLER handler;
+		// Name of the JS function, method or property
+		llvm::StringRef name;
+		// Name of the client class, empty for free functions
+		llvm::StringRef className;
+		// Static client methods are called on the class
+		bool isStatic;
+		BuiltinInfo():handler(BUILTIN_NONE),isStatic(false)
+		{
+		}
+	};
+	typedef llvm::DenseMap<const llvm::Function*, BuiltinInfo> BuiltinTable;
+	// Only the writer which owns the table computes it, writers for parallel compilation share it
+	std::unique_ptr<BuiltinTable> ownedBuiltinTable;
+	const BuiltinTable& builtinTable;
+	/**
+	 * Classify all the functions of the module, so that names don't need to be parsed for each call
+	 */
+	void computeBuiltinTable();
+	BuiltinInfo classifyBuiltin(const llvm::Function& F) const;
+	/**
+	 * Parse the mangled name of a function in the client namespace, without the namespace prefix
+	 */
+	static void classifyClientBuiltin(llvm::StringRef identifier, BuiltinInfo& info);
+	void compileClientBuiltin(const BuiltinInfo& info, llvm::ImmutableCallSite callV);
 	COMPILE_INSTRUCTION_FEEDBACK handleBuiltinCall(llvm::ImmutableCallSite callV, const llvm::Function* f);
 
 	void compilePredicate(llvm::CmpInst::Predicate p);
@@ -258,6 +531,19 @@ private:
 	 * starting from the array itself instead of from the value. This will make it possible to loop backward over the array.
 	 */
 	const llvm::Value* compileByteLayoutOffset(const llvm::Value* p, BYTE_LAYOUT_OFFSET_MODE offsetMode);
+	/**
+	 * Returns true if the offset compiled by compileByteLayoutOffset in BYTE_LAYOUT_OFFSET_FULL mode is provably a multiple of alignment
+	 */
+	bool isByteLayoutOffsetAligned(const llvm::Value* p, uint32_t alignment) const;
+	/**
+	 * Compile an access to the value pointed by a byte layout pointer using a typed array view.
+	 * Returns false without printing anything if the access is not provably aligned, a DataView must be used in such case.
+	 */
+	bool compileByteLayoutViewAccess(const llvm::Value* p);
+	/**
+	 * Compile the cached typed array view of the given kind on the buffer of a byte layout pointer
+	 */
+	void compileByteLayoutView(const llvm::Value* p, BYTE_LAYOUT_VIEW viewKind);
 
 	/**
 	 * Compile a pointer from a GEP expression, with the given pointer kind
@@ -317,7 +603,10 @@ private:
 
 	void compileMethodLocal(llvm::StringRef name, Registerize::REGISTER_KIND kind);
 	void compileMethodLocals(const llvm::Function& F, bool needsLabel);
-	void compileMethod(const llvm::Function& F);
+	/**
+	 * Compile a function declaration, or a function expression if anonymous is true
+	 */
+	void compileMethod(const llvm::Function& F, bool anonymous = false);
 	/**
 	 * Helper structure for compiling globals
 	 */
@@ -337,10 +626,36 @@ private:
 	void compileNullPtrs();
 	void compileCreateClosure();
 	void compileHandleVAArg();
+	void compileByteLayoutViews();
+	/**
+	 * Compile the helper which decodes a base64 blob to an ArrayBuffer
+	 */
+	void compileBlobDecoder();
+	/**
+	 * Compile the free lists of the pooled types used by the code
+	 */
+	void compilePools();
+	/**
+	 * Returns true if objects of the given type can be recycled through a free list
+	 */
+	bool isPooledType(llvm::Type* t) const;
+	/**
+	 * Compile the name of the free list for the given pooled type
+	 */
+	void compilePoolName(const llvm::StructType* st);
 	/**
 	 * This method supports both ConstantArray and ConstantDataSequential
 	 */
 	void compileConstantArrayMembers(const llvm::Constant* C);
+	/**
+	 * Append the little endian representation of a constant to bytes, returns false if it is not plain data
+	 */
+	static bool collectConstantBytes(const llvm::Constant* c, llvm::SmallVectorImpl<uint8_t>& bytes);
+	/**
+	 * Compile a large constant of plain data as an ArrayBuffer decoded from a base64 string.
+	 * Returns false, without writing anything, if the constant should be compiled as a literal instead.
+	 */
+	bool compileConstantAsBlob(const llvm::Constant* c);
 
 	/**
 	 * Methods implemented in Types.cpp
@@ -377,16 +692,89 @@ private:
 	//JS interoperability support
 	std::vector<llvm::StringRef> compileClassesExportedToJs();
 	void addExportedFreeFunctions(std::vector<llvm::StringRef>& namesList, const llvm::NamedMDNode* namedNode);
+
+	/**
+	 * \addtogroup Names methods to get the names of values, taking into account the edge being compiled
+	 *
+	 * @{
+	 */
+	void setEdgeContext(const llvm::BasicBlock* fromBB, const llvm::BasicBlock* toBB)
+	{
+		assert(edgeContext.isNull());
+		edgeContext.fromBB=fromBB;
+		edgeContext.toBB=toBB;
+	}
+
+	void clearEdgeContext()
+	{
+		edgeContext.clear();
+	}
+
+	llvm::StringRef getName(const llvm::Value* v) const
+	{
+		if(!edgeContext.isNull())
+			return namegen.getNameForEdge(v, edgeContext);
+		return namegen.getName(v);
+	}
+
+	llvm::StringRef getSecondaryName(const llvm::Value* v) const
+	{
+		if(!edgeContext.isNull())
+			return namegen.getSecondaryNameForEdge(v, edgeContext);
+		return namegen.getSecondaryName(v);
+	}
+	/** @} */
+
+	/**
+	 * \addtogroup ParallelFunctions methods to compile functions on multiple threads
+	 *
+	 * @{
+	 */
+
+	/**
+	 * Build a writer which compiles functions to a separate stream.
+	 * All the module level state (analyses, names, flags) is shared with the parent.
+	 */
+	CheerpWriter(const CheerpWriter& parent, llvm::raw_ostream& s, SourceMapGenerator* sourceMapGenerator);
+
+	/**
+	 * Compile the given functions using multiple threads and append them to the stream in order
+	 */
+	void compileMethodsInParallel(const std::vector<const llvm::Function*>& functions);
+	/**
+	 * Collect what the code compiled by a child writer needs from the module level output
+	 */
+	void mergeWriterState(const CheerpWriter& writer);
+
+	/**
+	 * Make sure that compiling the function will not create any new type or constant in the context.
+	 * The LLVMContext is not thread safe.
+	 */
+	void prepareMethodForParallelCompilation(const llvm::Function& F);
+
+	/**
+	 * Notify the source map generator that the function is about to be compiled
+	 */
+	void compileMethodSourceMapInfo(const llvm::Function& F);
+	/** @} */
 public:
 	ostream_proxy stream;
 	CheerpWriter(llvm::Module& m, llvm::raw_ostream& s, cheerp::PointerAnalyzer & PA, cheerp::Registerize & registerize,
 	             cheerp::GlobalDepsAnalyzer & gda, SourceMapGenerator* sourceMapGenerator, const std::vector<std::string>& reservedNames, bool ReadableOutput,
-	             bool MakeModule, bool NoRegisterize, bool UseNativeJavaScriptMath, bool useMathImul, bool addCredits, bool measureTimeToMain):
+	             bool MakeModule, bool NoRegisterize, bool UseNativeJavaScriptMath, bool useMathImul, bool addCredits, bool measureTimeToMain,
+	             bool useStructConstructors, bool reportStructShapes, uint32_t blobThreshold, unsigned jobs, const std::vector<std::string>& poolTypes, llvm::raw_ostream* secondaryStream,
+	             const std::string& secondaryURL, const std::vector<std::string>& splitEntryPoints):
 		module(m),targetData(&m),currentFun(NULL),PA(PA),registerize(registerize),globalDeps(gda),
-		namegen(m, globalDeps, registerize, PA, reservedNames, ReadableOutput),types(m),
+		ownedNamegen(new NameGenerator(m, globalDeps, registerize, PA, reservedNames, ReadableOutput)),namegen(*ownedNamegen),types(m),
 		sourceMapGenerator(sourceMapGenerator),NewLine(),useNativeJavaScriptMath(UseNativeJavaScriptMath),
-		useMathImul(useMathImul),makeModule(MakeModule),addCredits(addCredits),measureTimeToMain(measureTimeToMain),stream(s, sourceMapGenerator, ReadableOutput)
+		useMathImul(useMathImul),makeModule(MakeModule),addCredits(addCredits),measureTimeToMain(measureTimeToMain),
+		useStructConstructors(useStructConstructors),reportStructShapes(reportStructShapes),
+		blobThreshold(blobThreshold),blobsUsed(false),i64BitcastsUsed(false),jobs(jobs),byteLayoutViewsUsed(0),
+		poolTypes(poolTypes),secondaryStream(secondaryStream),secondaryURL(secondaryURL),splitEntryPoints(splitEntryPoints),
+		secondarySlotsCount(0),ownedBuiltinTable(new BuiltinTable()),builtinTable(*ownedBuiltinTable),
+		stream(s, sourceMapGenerator, ReadableOutput)
 	{
+		computeBuiltinTable();
 	}
 	void makeJS();
 	void compileBB(const llvm::BasicBlock& BB);
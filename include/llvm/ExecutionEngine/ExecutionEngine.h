@@ -429,6 +429,15 @@ public:
   /// Returns if the execution is known to have failed
   virtual bool hasFailed() const { return false; }
 
+  /// Mark the execution as failed, it will stop as soon as possible
+  virtual void markFailed() {}
+
+  /// Forget about a failed execution, so that a new one can be started
+  virtual void clearFailure() {}
+
+  /// Returns why the execution has been aborted by the engine itself, if known
+  virtual StringRef getFailureReason() const { return StringRef(); }
+
   /// DisableLazyCompilation - When lazy compilation is off (the default), the
   /// JIT will eagerly compile every function reachable from the argument to
   /// getPointerToFunction.  If lazy compilation is turned on, the JIT will only
@@ -487,7 +496,7 @@ public:
     LazyFunctionCreator = P;
   }
 
-  /// InstallStoreListener - Listener to invoke on each store
+  /// InstallStoreListener - Listener to invoke before each store
   void InstallStoreListener(void (*P)(void* Addr)) {
     StoreListener = P;
   }
@@ -301,6 +301,10 @@ void initializeReplaceNopCastsAndByteSwapsPass(PassRegistry&);
 void initializeTypeOptimizerPass(PassRegistry&);
 void initializeDelayAllocasPass(PassRegistry&);
 void initializePreExecutePass(PassRegistry&);
+void initializeI64LoweringPass(PassRegistry&);
+void initializeStackArenaPass(PassRegistry&);
+void initializeScalarizeObjectsPass(PassRegistry&);
+void initializeDevirtualizePass(PassRegistry&);
 }
 
 #endif
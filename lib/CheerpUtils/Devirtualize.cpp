@@ -0,0 +1,277 @@
+//===-- Devirtualize.cpp - Cheerp whole program devirtualization ----------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/Devirtualize.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#define DEBUG_TYPE "CheerpDevirtualize"
+
+STATISTIC(NumDevirtualizedCalls, "Number of indirect calls replaced by direct calls");
+STATISTIC(NumGuardedCalls, "Number of indirect calls replaced by guarded direct calls");
+
+namespace cheerp {
+
+using namespace llvm;
+
+const uint32_t Devirtualize::maxGuardedTargets;
+
+void Devirtualize::collectTables(Constant* C)
+{
+	// Zero initializers, undefs and data arrays do not contain any function
+	if(ConstantStruct* CS = dyn_cast<ConstantStruct>(C))
+	{
+		tables[CS->getType()].push_back(CS);
+		for(Value* op: CS->operands())
+			collectTables(cast<Constant>(op));
+	}
+	else if(ConstantArray* CA = dyn_cast<ConstantArray>(C))
+	{
+		if(!CA->getType()->getElementType()->isAggregateType())
+			return;
+		for(Value* op: CA->operands())
+			collectTables(cast<Constant>(op));
+	}
+}
+
+void Devirtualize::collectConstantCasts(const Constant* C)
+{
+	// Casts may be nested in other expressions and in the initializers of globals
+	if(isa<GlobalValue>(C) || !visitedConstants.insert(C).second)
+		return;
+	const ConstantExpr* CE = dyn_cast<ConstantExpr>(C);
+	if(CE && CE->getOpcode() == Instruction::BitCast && CE->getType()->isPointerTy())
+		unsafeTypes.insert(CE->getType()->getPointerElementType());
+	for(const Value* op: C->operands())
+		collectConstantCasts(cast<Constant>(op));
+}
+
+void Devirtualize::collectUnsafeTypes(Module& M)
+{
+	for(GlobalVariable& GV: M.globals())
+	{
+		if(!GV.isConstant() || !GV.hasDefinitiveInitializer())
+			unsafeTypes.insert(GV.getType()->getElementType());
+		if(GV.hasInitializer())
+			collectConstantCasts(GV.getInitializer());
+	}
+	const DataLayout* DL = M.getDataLayout();
+	for(Function& F: M)
+	{
+		for(BasicBlock& BB: F)
+		{
+			for(Instruction& I: BB)
+			{
+				if(AllocaInst* AI = dyn_cast<AllocaInst>(&I))
+					unsafeTypes.insert(AI->getAllocatedType());
+				else if(isa<BitCastInst>(I) && I.getType()->isPointerTy())
+					unsafeTypes.insert(I.getType()->getPointerElementType());
+				else if(ImmutableCallSite CS = ImmutableCallSite(&I))
+				{
+					if(DynamicAllocInfo::getAllocType(CS) != DynamicAllocInfo::not_an_alloc)
+					{
+						DynamicAllocInfo info(CS, DL);
+						unsafeTypes.insert(info.getCastedType()->getElementType());
+					}
+				}
+				for(Value* op: I.operands())
+				{
+					if(Constant* C = dyn_cast<Constant>(op))
+						collectConstantCasts(C);
+				}
+			}
+		}
+	}
+}
+
+bool Devirtualize::typeContains(Type* t, Type* contained)
+{
+	if(t == contained)
+		return true;
+	if(StructType* st = dyn_cast<StructType>(t))
+	{
+		for(Type* elementType: st->elements())
+		{
+			if(typeContains(elementType, contained))
+				return true;
+		}
+	}
+	else if(ArrayType* at = dyn_cast<ArrayType>(t))
+		return typeContains(at->getElementType(), contained);
+	return false;
+}
+
+bool Devirtualize::isSafeTable(StructType* tableType)
+{
+	auto it = safeTables.find(tableType);
+	if(it != safeTables.end())
+		return it->second;
+	bool safe = std::none_of(unsafeTypes.begin(), unsafeTypes.end(),
+			[tableType](Type* t) { return typeContains(t, tableType); });
+	safeTables.insert(std::make_pair(tableType, safe));
+	return safe;
+}
+
+bool Devirtualize::findTargets(CallInst* CI, TargetSet& targets)
+{
+	LoadInst* LI = dyn_cast<LoadInst>(CI->getCalledValue()->stripPointerCastsSafe());
+	if(!LI)
+		return false;
+	GEPOperator* GEP = dyn_cast<GEPOperator>(LI->getPointerOperand());
+	if(!GEP || GEP->getNumIndices() < 2 || !GEP->hasAllConstantIndices() || !cast<ConstantInt>(GEP->getOperand(1))->isZero())
+		return false;
+	StructType* tableType = dyn_cast<StructType>(GEP->getPointerOperandType()->getPointerElementType());
+	if(!tableType || !isSafeTable(tableType))
+		return false;
+	auto it = tables.find(tableType);
+	if(it == tables.end())
+		return false;
+	for(Constant* table: it->second)
+	{
+		Constant* slot = table;
+		for(uint32_t i = 2; i < GEP->getNumOperands() && slot; i++)
+			slot = slot->getAggregateElement(cast<ConstantInt>(GEP->getOperand(i)));
+		if(!slot)
+			return false;
+		if(Function* F = dyn_cast<Function>(slot->stripPointerCastsSafe()))
+		{
+			// Calling a pure virtual method is undefined behaviour, it is not a possible callee
+			if(F->getName() == "__cxa_pure_virtual")
+				continue;
+			if(F->empty())
+				return false;
+			targets.insert(F);
+			if(targets.size() > maxGuardedTargets)
+				return false;
+		}
+		else if(!slot->isNullValue() && !isa<UndefValue>(slot))
+			return false;
+	}
+	return !targets.empty();
+}
+
+Constant* Devirtualize::getCallee(Function* target, Type* calleeType)
+{
+	// Overriders may take a derived class as this, the slot holds a casted function in that case
+	if(target->getType() == calleeType)
+		return target;
+	return ConstantExpr::getBitCast(target, calleeType);
+}
+
+void Devirtualize::expandGuardedCall(CallInst* CI, const TargetSet& targets)
+{
+	LLVMContext& C = CI->getContext();
+	Value* callee = CI->getCalledValue();
+	BasicBlock* checkBlock = CI->getParent();
+	Function* F = checkBlock->getParent();
+	BasicBlock* mergeBlock = checkBlock->splitBasicBlock(CI, "devirt.merge");
+	// The indirect call is kept as the fallback
+	BasicBlock* indirectBlock = BasicBlock::Create(C, "devirt.indirect", F, mergeBlock);
+	CI->removeFromParent();
+	indirectBlock->getInstList().push_back(CI);
+	BranchInst::Create(mergeBlock, indirectBlock);
+	PHINode* result = NULL;
+	if(!CI->getType()->isVoidTy())
+	{
+		result = PHINode::Create(CI->getType(), targets.size() + 1, CI->getName(), &mergeBlock->front());
+		CI->replaceAllUsesWith(result);
+	}
+	checkBlock->getTerminator()->eraseFromParent();
+	for(uint32_t i = 0; i < targets.size(); i++)
+	{
+		Constant* target = getCallee(targets[i], callee->getType());
+		BasicBlock* callBlock = BasicBlock::Create(C, "devirt.call", F, indirectBlock);
+		CallInst* directCall = cast<CallInst>(CI->clone());
+		directCall->setCalledFunction(target);
+		callBlock->getInstList().push_back(directCall);
+		BranchInst::Create(mergeBlock, callBlock);
+		if(result)
+			result->addIncoming(directCall, callBlock);
+		BasicBlock* nextBlock = (i + 1 < targets.size()) ? BasicBlock::Create(C, "devirt.check", F, indirectBlock) : indirectBlock;
+		Value* isTarget = new ICmpInst(*checkBlock, ICmpInst::ICMP_EQ, callee, target, "devirt.is");
+		BranchInst::Create(callBlock, nextBlock, isTarget, checkBlock);
+		checkBlock = nextBlock;
+	}
+	if(result)
+		result->addIncoming(CI, indirectBlock);
+}
+
+bool Devirtualize::runOnModule(Module& M)
+{
+	for(GlobalVariable& GV: M.globals())
+	{
+		if(GV.isConstant() && GV.hasDefinitiveInitializer())
+			collectTables(GV.getInitializer());
+	}
+	collectUnsafeTypes(M);
+
+	// Find all the calls first, guarded calls split the blocks
+	SmallVector<std::pair<CallInst*, TargetSet>, 16> calls;
+	for(Function& F: M)
+	{
+		for(BasicBlock& BB: F)
+		{
+			for(Instruction& I: BB)
+			{
+				CallInst* CI = dyn_cast<CallInst>(&I);
+				if(!CI || CI->getCalledFunction() || CI->isInlineAsm())
+					continue;
+				TargetSet targets;
+				if(findTargets(CI, targets))
+					calls.push_back(std::make_pair(CI, targets));
+			}
+		}
+	}
+
+	for(auto& it: calls)
+	{
+		CallInst* CI = it.first;
+		if(it.second.size() == 1)
+		{
+			Value* oldCallee = CI->getCalledValue();
+			CI->setCalledFunction(getCallee(it.second[0], oldCallee->getType()));
+			RecursivelyDeleteTriviallyDeadInstructions(oldCallee);
+			NumDevirtualizedCalls++;
+		}
+		else
+		{
+			expandGuardedCall(CI, it.second);
+			NumGuardedCalls++;
+		}
+	}
+
+	tables.clear();
+	unsafeTypes.clear();
+	visitedConstants.clear();
+	safeTables.clear();
+	return !calls.empty();
+}
+
+const char* Devirtualize::getPassName() const
+{
+	return "CheerpDevirtualize";
+}
+
+char Devirtualize::ID = 0;
+
+ModulePass* createDevirtualizePass() { return new Devirtualize(); }
+
+}
+
+using namespace cheerp;
+
+INITIALIZE_PASS_BEGIN(Devirtualize, "Devirtualize", "Devirtualize calls through constant tables of functions",
+			false, false)
+INITIALIZE_PASS_END(Devirtualize, "Devirtualize", "Devirtualize calls through constant tables of functions",
+			false, false)
@@ -17,7 +17,9 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/ValueSymbolTable.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/GraphWriter.h"
 
 using namespace llvm;
 
@@ -28,14 +30,15 @@ namespace cheerp {
 using namespace std;
 
 char GlobalDepsAnalyzer::ID = 0;
+const uint32_t GlobalDepsAnalyzer::ROOT_USER;
 
 const char* GlobalDepsAnalyzer::getPassName() const
 {
 	return "GlobalDepsAnalyzer";
 }
 
-GlobalDepsAnalyzer::GlobalDepsAnalyzer() : ModulePass(ID), DL(NULL), TLI(NULL), entryPoint(NULL),
-	hasCreateClosureUsers(false), hasVAArgs(false), hasPointerArrays(false)
+GlobalDepsAnalyzer::GlobalDepsAnalyzer(const std::string& dumpDepsFile) : ModulePass(ID), DL(NULL), TLI(NULL), entryPoint(NULL),
+	dumpDepsFile(dumpDepsFile), hasCreateClosureUsers(false), hasVAArgs(false), hasPointerArrays(false)
 {
 }
 
@@ -55,7 +58,6 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	assert(DL);
 	TLI = getAnalysisIfAvailable<TargetLibraryInfo>();
 	assert(TLI);
-	VisitedSet visited;
 	
 	//Compile the list of JS methods
 	//Look for metadata which ends in _methods. They are the have the list
@@ -76,9 +78,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 			assert( isa<Function>(cast<ConstantAsMetadata>(node->getOperand(0))->getValue()) );
 			Function* f = cast<Function>(cast<ConstantAsMetadata>(node->getOperand(0))->getValue());
 			
-			SubExprVec vec;
-			visitGlobal( f, visited, vec );
-			assert( visited.empty() );
+			visitGlobal( f, ROOT_USER );
 			externals.push_back(f);
 		}
 	}
@@ -87,9 +87,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	if (webMainOrMain || (webMainOrMain = module.getFunction("main")))
 	{
 		// Webmain entry point
-		SubExprVec vec;
-		visitGlobal( webMainOrMain, visited, vec );
-		assert( visited.empty() );
+		visitGlobal( webMainOrMain, ROOT_USER );
 		externals.push_back(webMainOrMain);
 	}
 	else
@@ -128,6 +126,10 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 		};
 		
 		std::set< const Constant *, decltype(constComparator) > requiredConstructors( constComparator );
+
+		// The constructors are used by the list of constructors, which is used from the outside
+		uint32_t constructorVarId = addGlobalNode(constructorVar);
+		addDependency(ROOT_USER, constructorVarId);
 	
 		for (ConstantArray::const_op_iterator it = constructors->op_begin();
 		     it != constructors->op_end(); ++it)
@@ -136,9 +138,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 			const Constant * p = cast<Constant>(it);
 
 			requiredConstructors.insert(p);
-			SubExprVec vec;
-			visitGlobal( getConstructorFunction(p), visited, vec );
-			assert( visited.empty() );
+			visitGlobal( getConstructorFunction(p), constructorVarId );
 		}
 		
 		constructorsNeeded.reserve( requiredConstructors.size() );
@@ -147,105 +147,176 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 				std::back_inserter(constructorsNeeded),
 				getConstructorFunction );
 
-		reachableGlobals.insert(constructorVar);
 		varsOrder.push_back(constructorVar);
 	}
 	while (!functionsQueue.empty())
 	{
 		const Function* F = functionsQueue.back();
 		functionsQueue.pop_back();
-		visitFunction( F, visited);
-		assert( visited.empty() );
+		visitFunction( F );
 	}
+	auto sortAndUnique = []( SmallVectorImpl<uint32_t>& ids )
+	{
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	};
+	sortAndUnique(rootIds);
+	for (GlobalNode& node: globalNodes)
+		sortAndUnique(node.deps);
 	NumRemovedGlobals = filterModule(module);
+	if (!dumpDepsFile.empty())
+	{
+		std::error_code ErrorCode;
+		llvm::raw_fd_ostream depsFile(dumpDepsFile, ErrorCode, sys::fs::F_Text);
+		if (ErrorCode)
+			llvm::report_fatal_error(ErrorCode.message(), false);
+		dumpDependencyGraph(depsFile);
+	}
 	return true;
 }
 
-void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * C, VisitedSet & visited, const SubExprVec & subexpr )
+uint32_t GlobalDepsAnalyzer::addGlobalNode( const GlobalValue * G )
 {
-	// Cycle detector
-	if ( !visited.insert(C).second )
-	{
-		assert( reachableGlobals.count(C) );
-		if ( const GlobalVariable * GV = dyn_cast< GlobalVariable >(C) )
-		{
-			assert( !subexpr.empty() );
+	assert( !globalIds.count(G) );
+	uint32_t id = globalNodes.size();
+	globalIds.insert(std::make_pair(G, id));
+	globalNodes.push_back(GlobalNode(G));
+	return id;
+}
 
-			varsFixups.emplace( GV, subexpr );
-		}
-		return;
-	}
-	
-	if ( reachableGlobals.insert(C).second )
-	{
+void GlobalDepsAnalyzer::addDependency( uint32_t userId, uint32_t id )
+{
+	SmallVectorImpl<uint32_t>& deps = userId == ROOT_USER ? rootIds : globalNodes[userId].deps;
+	// Filter out the common case of consecutive uses of the same global, duplicates are removed at the end
+	if ( deps.empty() || deps.back() != id )
+		deps.push_back(id);
+}
 
-		if(const GlobalAlias * GA = dyn_cast<GlobalAlias>(C) )
-		{
-			SubExprVec vec;
-			visitGlobal(cast<GlobalValue>(GA->getAliasee()), visited, vec );
-		}
-		else if (const Function * F = dyn_cast<Function>(C) )
-			functionsQueue.push_back(F);
-		else if (const GlobalVariable * GV = dyn_cast<GlobalVariable>(C) )
+void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * G, uint32_t userId )
+{
+	// The user does not get a frame, it must not be completed when the stack is emptied
+	VisitStack stack;
+	enterGlobal(stack, G, userId);
+	runVisitStack(stack);
+}
+
+void GlobalDepsAnalyzer::visitConstant( const Constant * C, uint32_t userId )
+{
+	VisitStack stack;
+	stack.push_back(GlobalFrame(userId));
+	enterConstant(stack, C);
+	runVisitStack(stack);
+}
+
+void GlobalDepsAnalyzer::enterGlobal( VisitStack & stack, const GlobalValue * G, uint32_t userId )
+{
+	auto it = globalIds.find(G);
+	if ( it != globalIds.end() )
+	{
+		addDependency(userId, it->second);
+		// Cycle detector
+		if ( globalNodes[it->second].onStack )
 		{
-			if (GV->hasInitializer() )
+			assert( !stack.empty() );
+			if ( const GlobalVariable * GV = dyn_cast< GlobalVariable >(G) )
 			{
-				// Add the "GlobalVariable - initializer" use to the subexpr,
-				// in order to being able to get the global variable from the fixup map
-				SubExprVec Newsubexpr (1, &GV->getOperandUse(0));
-				visitConstant( GV->getInitializer(), visited, Newsubexpr);
-				Type* globalType = GV->getInitializer()->getType();
-				visitType(globalType, /*forceTypedArray*/ true);
+				const SubExprVec & subexpr = stack.back().subexpr;
+				assert( !subexpr.empty() );
+
+				varsFixups.emplace( GV, subexpr );
 			}
-			
-			varsOrder.push_back(GV);
 		}
+		return;
 	}
 
-	visited.erase(C);
+	uint32_t id = addGlobalNode(G);
+	addDependency(userId, id);
+	if (const Function * F = dyn_cast<Function>(G) )
+	{
+		functionsQueue.push_back(F);
+		return;
+	}
+	assert( isa<GlobalVariable>(G) || isa<GlobalAlias>(G) );
+	// The only operand of variables is the initializer, and the only operand of aliases is the aliasee
+	globalNodes[id].onStack = true;
+	stack.push_back(GlobalFrame(id));
+	GlobalFrame & frame = stack.back();
+	frame.constants.push_back(ConstantFrame(G));
+	if ( const GlobalVariable * GV = dyn_cast<GlobalVariable>(G) )
+	{
+		// Add the "GlobalVariable - initializer" use to the subexpr,
+		// in order to being able to get the global variable from the fixup map
+		if ( GV->hasInitializer() )
+			frame.subexpr.push_back(&GV->getOperandUse(0));
+	}
 }
 
-void GlobalDepsAnalyzer::visitConstant( const Constant * C, VisitedSet & visited, SubExprVec & subexpr )
+bool GlobalDepsAnalyzer::enterConstant( VisitStack & stack, const Constant * C )
 {
 	if ( const GlobalValue * GV = dyn_cast<GlobalValue>(C) )
-		visitGlobal(GV, visited, subexpr);
-	else if(const ConstantExpr * CE = dyn_cast<const ConstantExpr>(C))
 	{
-		for(const Value* V: CE->operands())
-		{
-			const Constant* C=cast<Constant>(V);
-			visitConstant(C, visited, subexpr);
-		}
+		enterGlobal(stack, GV, stack.back().id);
+		return false;
 	}
-	else if(const ConstantArray* d = dyn_cast<const ConstantArray>(C) )
+	else if ( isa<ConstantExpr>(C) || isa<ConstantArray>(C) || isa<ConstantStruct>(C) )
 	{
-		assert(d->getType()->getNumElements() == d->getNumOperands());
-		
-		for (ConstantArray::const_op_iterator it = d->op_begin();it != d->op_end(); ++it)
-		{
-			assert( isa<Constant>(it) );
-			subexpr.push_back( it );
-			visitConstant( cast<Constant>(it), visited, subexpr);
-			subexpr.pop_back();
-		}
+		stack.back().constants.push_back(ConstantFrame(C));
+		return true;
 	}
-	else if(const ConstantStruct* d = dyn_cast<const ConstantStruct>(C) )
+	return false;
+}
+
+void GlobalDepsAnalyzer::runVisitStack( VisitStack & stack )
+{
+	// Arrays and structs record the uses of their elements in subexpr, constant expressions are transparent
+	auto followsUses = []( const Constant * C ) -> bool
 	{
-		assert(d->getType()->getNumElements() == d->getNumOperands());
-		
-		for (ConstantArray::const_op_iterator it = d->op_begin();it != d->op_end(); ++it)
+		return isa<ConstantArray>(C) || isa<ConstantStruct>(C);
+	};
+	while ( !stack.empty() )
+	{
+		GlobalFrame & frame = stack.back();
+		if ( frame.constants.empty() )
 		{
-			assert( isa<Constant>(it) );
-			subexpr.push_back( it );
-			visitConstant(cast<Constant>(it), visited, subexpr);
-			subexpr.pop_back();
+			const GlobalValue * G = globalNodes[frame.id].G;
+			globalNodes[frame.id].onStack = false;
+			if ( const GlobalVariable * GV = dyn_cast<GlobalVariable>(G) )
+			{
+				if ( GV->hasInitializer() )
+				{
+					Type* globalType = GV->getInitializer()->getType();
+					visitType(globalType, /*forceTypedArray*/ true);
+				}
+				varsOrder.push_back(GV);
+			}
+			stack.pop_back();
+			continue;
 		}
+		ConstantFrame & constantFrame = frame.constants.back();
+		const Constant * C = constantFrame.C;
+		if ( constantFrame.nextOperand == C->getNumOperands() )
+		{
+			frame.constants.pop_back();
+			if ( !frame.constants.empty() && followsUses(frame.constants.back().C) )
+				frame.subexpr.pop_back();
+			continue;
+		}
+		uint32_t opNo = constantFrame.nextOperand++;
+		bool followUse = followsUses(C);
+		if ( followUse )
+			frame.subexpr.push_back(&C->getOperandUse(opNo));
+		// The frame may be moved if a new global is pushed on the stack
+		uint32_t frameIndex = stack.size() - 1;
+		// The use of a constant with operands is removed from subexpr when the constant is popped
+		if ( !enterConstant(stack, cast<Constant>(C->getOperand(opNo))) && followUse )
+			stack[frameIndex].subexpr.pop_back();
 	}
 }
 
-void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
+void GlobalDepsAnalyzer::visitFunction(const Function* F)
 {
-	VisitedSet NewvisitPath;
+	assert( globalIds.count(F) );
+	uint32_t id = globalIds.find(F)->second;
 
 	for ( const BasicBlock & bb : *F )
 		for (const Instruction & I : bb)
@@ -253,11 +324,7 @@ void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 			for (const Value * v : I.operands() )
 			{
 				if (const Constant * c = dyn_cast<Constant>(v) )
-				{
-					SubExprVec Newsubexpr;
-					visitConstant(c, NewvisitPath, Newsubexpr);
-					assert( NewvisitPath.empty() );
-				}
+					visitConstant(c, id);
 			}
 
 			if ( const AllocaInst* AI = dyn_cast<AllocaInst>(&I) )
@@ -345,6 +412,69 @@ llvm::StructType* GlobalDepsAnalyzer::needsDowncastArray(llvm::StructType* t) co
 	return NULL;
 }
 
+std::vector<const GlobalValue*> GlobalDepsAnalyzer::getDependencies( const GlobalValue * val ) const
+{
+	assert( isReachable(val) );
+	std::vector<const GlobalValue*> ret;
+	for ( uint32_t id: globalNodes[globalIds.find(val)->second].deps )
+		ret.push_back(globalNodes[id].G);
+	return ret;
+}
+
+std::vector<const GlobalValue*> GlobalDepsAnalyzer::getUsers( const GlobalValue * val ) const
+{
+	assert( isReachable(val) );
+	uint32_t valId = globalIds.find(val)->second;
+	std::vector<const GlobalValue*> ret;
+	for ( const GlobalNode & node: globalNodes )
+	{
+		if ( std::binary_search(node.deps.begin(), node.deps.end(), valId) )
+			ret.push_back(node.G);
+	}
+	return ret;
+}
+
+std::vector<const GlobalValue*> GlobalDepsAnalyzer::getRoots() const
+{
+	std::vector<const GlobalValue*> ret;
+	for ( uint32_t id: rootIds )
+		ret.push_back(globalNodes[id].G);
+	return ret;
+}
+
+void GlobalDepsAnalyzer::dumpDependencyGraph( raw_ostream & out ) const
+{
+	out << "digraph \"Global dependencies\" {\n";
+	for ( uint32_t i = 0; i < globalNodes.size(); i++ )
+	{
+		const GlobalValue * G = globalNodes[i].G;
+		out << "\tg" << i << " [label=\"" << DOT::EscapeString(G->getName()) << "\\n";
+		if ( const Function * F = dyn_cast<Function>(G) )
+		{
+			uint32_t instructions = 0;
+			for ( const BasicBlock & BB: *F )
+				instructions += BB.size();
+			out << instructions << " instructions\",shape=box";
+		}
+		else if ( const GlobalVariable * GV = dyn_cast<GlobalVariable>(G) )
+		{
+			uint64_t size = GV->hasInitializer() ? DL->getTypeAllocSize(GV->getInitializer()->getType()) : 0;
+			out << size << " bytes\",shape=ellipse";
+		}
+		else
+			out << "alias\",shape=diamond";
+		if ( std::binary_search(rootIds.begin(), rootIds.end(), i) )
+			out << ",style=bold";
+		out << "];\n";
+	}
+	for ( uint32_t i = 0; i < globalNodes.size(); i++ )
+	{
+		for ( uint32_t dep: globalNodes[i].deps )
+			out << "\tg" << i << " -> g" << dep << ";\n";
+	}
+	out << "}\n";
+}
+
 int GlobalDepsAnalyzer::filterModule( llvm::Module & module )
 {
 	std::vector< llvm::GlobalValue * > eraseQueue;
@@ -0,0 +1,979 @@
+//===-- I64Lowering.cpp - Cheerp helper -----------------------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/I64Lowering.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#define DEBUG_TYPE "I64Lowering"
+
+STATISTIC(NumLoweredFunctions, "Number of functions with i64 arguments or return values split");
+STATISTIC(NumLoweredInstructions, "Number of i64 instructions lowered to i32 instructions");
+
+namespace cheerp {
+
+using namespace llvm;
+
+const char* I64Lowering::packName = "cheerpI64Pack";
+const char* I64Lowering::lowName = "cheerpI64Low";
+const char* I64Lowering::highName = "cheerpI64High";
+const char* I64Lowering::bitsLowName = "cheerpI64BitsLow";
+const char* I64Lowering::bitsHighName = "cheerpI64BitsHigh";
+const char* I64Lowering::toDoubleName = "cheerpI64ToDouble";
+
+bool I64Lowering::hasI64InSignature(FunctionType* FT)
+{
+	if(isI64(FT->getReturnType()))
+		return true;
+	for(Type* t: FT->params())
+	{
+		if(isI64(t))
+			return true;
+	}
+	return false;
+}
+
+FunctionType* I64Lowering::getLoweredFunctionType(FunctionType* FT)
+{
+	Type* Int32Ty = Type::getInt32Ty(module->getContext());
+	SmallVector<Type*, 8> params;
+	for(Type* t: FT->params())
+	{
+		if(isI64(t))
+		{
+			params.push_back(Int32Ty);
+			params.push_back(Int32Ty);
+		}
+		else
+			params.push_back(t);
+	}
+	Type* retType = isI64(FT->getReturnType()) ? Int32Ty : FT->getReturnType();
+	return FunctionType::get(retType, params, FT->isVarArg());
+}
+
+bool I64Lowering::isBuiltinCall(const Value* V, const Function* builtin) const
+{
+	const CallInst* CI = dyn_cast<CallInst>(V);
+	return CI && CI->getCalledFunction() == builtin;
+}
+
+Function* I64Lowering::getDivRemHelper(unsigned opcode)
+{
+	auto it = divRemHelpers.find(opcode);
+	if(it != divRemHelpers.end())
+		return it->second;
+
+	LLVMContext& C = module->getContext();
+	Type* Int32Ty = Type::getInt32Ty(C);
+	Type* Int64Ty = Type::getInt64Ty(C);
+	Type* params[] = { Int64Ty, Int64Ty };
+	FunctionType* FT = FunctionType::get(Int64Ty, params, false);
+	const char* name = NULL;
+	switch(opcode)
+	{
+		case Instruction::UDiv: name = "cheerpI64UDiv"; break;
+		case Instruction::URem: name = "cheerpI64URem"; break;
+		case Instruction::SDiv: name = "cheerpI64SDiv"; break;
+		case Instruction::SRem: name = "cheerpI64SRem"; break;
+		default: llvm_unreachable("Unexpected division opcode");
+	}
+	Function* helper = Function::Create(FT, GlobalValue::InternalLinkage, name, module);
+	divRemHelpers[opcode] = helper;
+	Function::arg_iterator args = helper->arg_begin();
+	Value* n = args++;
+	Value* d = args++;
+
+	BasicBlock* entry = BasicBlock::Create(C, "entry", helper);
+	IRBuilder<> Builder(entry);
+	if(opcode == Instruction::SDiv || opcode == Instruction::SRem)
+	{
+		// Compute the unsigned result on the absolute values, then fix the sign
+		Value* zero = ConstantInt::get(Int64Ty, 0);
+		Value* negN = Builder.CreateICmpSLT(n, zero);
+		Value* negD = Builder.CreateICmpSLT(d, zero);
+		Value* absN = Builder.CreateSelect(negN, Builder.CreateSub(zero, n), n);
+		Value* absD = Builder.CreateSelect(negD, Builder.CreateSub(zero, d), d);
+		Function* unsignedHelper = getDivRemHelper(opcode == Instruction::SDiv ? Instruction::UDiv : Instruction::URem);
+		Value* res = Builder.CreateCall2(unsignedHelper, absN, absD);
+		Value* negRes = opcode == Instruction::SDiv ? Builder.CreateXor(negN, negD) : negN;
+		Builder.CreateRet(Builder.CreateSelect(negRes, Builder.CreateSub(zero, res), res));
+		return helper;
+	}
+
+	// Use a native 32-bit operation if both operands fit
+	BasicBlock* fastBlock = BasicBlock::Create(C, "fast", helper);
+	BasicBlock* loopBlock = BasicBlock::Create(C, "loop", helper);
+	BasicBlock* exitBlock = BasicBlock::Create(C, "exit", helper);
+	Value* limit = ConstantInt::get(Int64Ty, 0x100000000ULL);
+	Builder.CreateCondBr(Builder.CreateAnd(Builder.CreateICmpULT(n, limit), Builder.CreateICmpULT(d, limit)), fastBlock, loopBlock);
+
+	Builder.SetInsertPoint(fastBlock);
+	Value* n32 = Builder.CreateTrunc(n, Int32Ty);
+	Value* d32 = Builder.CreateTrunc(d, Int32Ty);
+	Value* res32 = opcode == Instruction::UDiv ? Builder.CreateUDiv(n32, d32) : Builder.CreateURem(n32, d32);
+	Builder.CreateRet(Builder.CreateZExt(res32, Int64Ty));
+
+	// Restoring shift and subtract division, one bit per iteration
+	Builder.SetInsertPoint(loopBlock);
+	PHINode* bitIndex = Builder.CreatePHI(Int32Ty, 2);
+	PHINode* quotient = Builder.CreatePHI(Int64Ty, 2);
+	PHINode* remainder = Builder.CreatePHI(Int64Ty, 2);
+	Value* bitIndex64 = Builder.CreateZExt(bitIndex, Int64Ty);
+	Value* bit = Builder.CreateAnd(Builder.CreateLShr(n, bitIndex64), 1);
+	Value* shiftedRemainder = Builder.CreateOr(Builder.CreateShl(remainder, 1), bit);
+	// If the top bit of the remainder is set the shift overflowed and the divisor surely fits
+	Value* fits = Builder.CreateOr(Builder.CreateICmpSLT(remainder, ConstantInt::get(Int64Ty, 0)),
+					Builder.CreateICmpUGE(shiftedRemainder, d));
+	Value* nextRemainder = Builder.CreateSelect(fits, Builder.CreateSub(shiftedRemainder, d), shiftedRemainder);
+	Value* nextQuotient = Builder.CreateSelect(fits, Builder.CreateOr(quotient, Builder.CreateShl(ConstantInt::get(Int64Ty, 1), bitIndex64)), quotient);
+	Value* nextBitIndex = Builder.CreateSub(bitIndex, ConstantInt::get(Int32Ty, 1));
+	Builder.CreateCondBr(Builder.CreateICmpSLT(nextBitIndex, ConstantInt::get(Int32Ty, 0)), exitBlock, loopBlock);
+	bitIndex->addIncoming(ConstantInt::get(Int32Ty, 63), entry);
+	bitIndex->addIncoming(nextBitIndex, loopBlock);
+	quotient->addIncoming(ConstantInt::get(Int64Ty, 0), entry);
+	quotient->addIncoming(nextQuotient, loopBlock);
+	remainder->addIncoming(ConstantInt::get(Int64Ty, 0), entry);
+	remainder->addIncoming(nextRemainder, loopBlock);
+
+	Builder.SetInsertPoint(exitBlock);
+	Builder.CreateRet(opcode == Instruction::UDiv ? nextQuotient : nextRemainder);
+	return helper;
+}
+
+void I64Lowering::replaceDivRem(Function& F)
+{
+	SmallVector<BinaryOperator*, 4> divRems;
+	for(BasicBlock& BB: F)
+	{
+		for(Instruction& I: BB)
+		{
+			if(!isI64(I.getType()))
+				continue;
+			switch(I.getOpcode())
+			{
+				case Instruction::UDiv:
+				case Instruction::SDiv:
+				case Instruction::URem:
+				case Instruction::SRem:
+					divRems.push_back(cast<BinaryOperator>(&I));
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	for(BinaryOperator* I: divRems)
+	{
+		Value* args[] = { I->getOperand(0), I->getOperand(1) };
+		CallInst* CI = CallInst::Create(getDivRemHelper(I->getOpcode()), args, "", I);
+		I->replaceAllUsesWith(CI);
+		I->eraseFromParent();
+	}
+}
+
+void I64Lowering::rewriteCall(CallSite CS, Value* newCallee, FunctionType* newFT)
+{
+	Instruction* I = CS.getInstruction();
+	FunctionType* FT = cast<FunctionType>(cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+	IRBuilder<> Builder(I);
+	SmallVector<Value*, 8> args;
+	for(unsigned i=0;i<CS.arg_size();i++)
+	{
+		Value* arg = CS.getArgument(i);
+		// Variadic arguments are passed as a single value
+		if(i < FT->getNumParams() && isI64(arg->getType()))
+		{
+			args.push_back(Builder.CreateCall(lowFunc, arg));
+			args.push_back(Builder.CreateCall(highFunc, arg));
+		}
+		else
+			args.push_back(arg);
+	}
+	Instruction* newCall;
+	Instruction* insertPoint;
+	if(InvokeInst* II = dyn_cast<InvokeInst>(I))
+	{
+		InvokeInst* newInvoke = Builder.CreateInvoke(newCallee, II->getNormalDest(), II->getUnwindDest(), args);
+		newInvoke->setCallingConv(II->getCallingConv());
+		newInvoke->setAttributes(II->getAttributes().getFnAttributes());
+		newCall = newInvoke;
+		if(isI64(I->getType()))
+		{
+			// Read the high part on the normal edge only
+			BasicBlock* normalDest = II->getNormalDest();
+			BasicBlock* cont = BasicBlock::Create(I->getContext(), "", normalDest->getParent(), normalDest);
+			BranchInst::Create(normalDest, cont);
+			newInvoke->setNormalDest(cont);
+			for(BasicBlock::iterator it = normalDest->begin(); PHINode* phi = dyn_cast<PHINode>(it); ++it)
+			{
+				int index = phi->getBasicBlockIndex(I->getParent());
+				if(index >= 0)
+					phi->setIncomingBlock(index, cont);
+			}
+		}
+		insertPoint = newInvoke->getNormalDest()->getFirstInsertionPt();
+	}
+	else
+	{
+		CallInst* CI = cast<CallInst>(I);
+		CallInst* newCI = Builder.CreateCall(newCallee, args);
+		newCI->setCallingConv(CI->getCallingConv());
+		newCI->setAttributes(CI->getAttributes().getFnAttributes());
+		newCI->setTailCallKind(CI->getTailCallKind());
+		newCall = newCI;
+		insertPoint = newCI->getNextNode();
+	}
+	Value* result = newCall;
+	if(isI64(I->getType()))
+	{
+		// The high part is returned in a global, read it immediately
+		Builder.SetInsertPoint(insertPoint);
+		Value* high = Builder.CreateLoad(highBits);
+		result = Builder.CreateCall2(packFunc, newCall, high);
+	}
+	newCall->takeName(I);
+	if(!I->use_empty())
+		I->replaceAllUsesWith(result);
+	I->eraseFromParent();
+}
+
+Function* I64Lowering::rewriteSignature(Function* F)
+{
+	FunctionType* FT = F->getFunctionType();
+	FunctionType* newFT = getLoweredFunctionType(FT);
+	Function* newF = Function::Create(newFT, F->getLinkage(), "");
+	module->getFunctionList().insert(F, newF);
+	newF->copyAttributesFrom(F);
+	// Parameter attributes don't apply anymore
+	newF->setAttributes(F->getAttributes().getFnAttributes());
+	newF->takeName(F);
+	newF->getBasicBlockList().splice(newF->begin(), F->getBasicBlockList());
+
+	// Arguments are packed again at the beginning of the body, I64Lowering::lowerFunction will remove the packing
+	IRBuilder<> Builder(newF->getEntryBlock().getFirstInsertionPt());
+	Function::arg_iterator newArg = newF->arg_begin();
+	for(Argument& oldArg: F->args())
+	{
+		if(isI64(oldArg.getType()))
+		{
+			Value* low = newArg++;
+			Value* high = newArg++;
+			oldArg.replaceAllUsesWith(Builder.CreateCall2(packFunc, low, high));
+		}
+		else
+		{
+			newArg->takeName(&oldArg);
+			oldArg.replaceAllUsesWith(newArg++);
+		}
+	}
+	if(isI64(FT->getReturnType()))
+	{
+		for(BasicBlock& BB: *newF)
+		{
+			ReturnInst* RI = dyn_cast<ReturnInst>(BB.getTerminator());
+			if(!RI)
+				continue;
+			Builder.SetInsertPoint(RI);
+			Value* retVal = RI->getReturnValue();
+			Builder.CreateStore(Builder.CreateCall(highFunc, retVal), highBits);
+			Builder.CreateRet(Builder.CreateCall(lowFunc, retVal));
+			RI->eraseFromParent();
+		}
+	}
+
+	// Rewrite direct calls, every other use sees the new function with the old type
+	SmallVector<CallSite, 8> calls;
+	for(Use& U: F->uses())
+	{
+		CallSite CS(U.getUser());
+		if(CS && CS.isCallee(&U))
+			calls.push_back(CS);
+	}
+	for(CallSite CS: calls)
+		rewriteCall(CS, newF, newFT);
+	if(!F->use_empty())
+		F->replaceAllUsesWith(ConstantExpr::getBitCast(newF, F->getType()));
+	F->eraseFromParent();
+	NumLoweredFunctions++;
+	return newF;
+}
+
+Value* I64Lowering::createPack(const ValuePair& p, IRBuilder<>& Builder)
+{
+	return Builder.CreateCall2(packFunc, p.first, p.second);
+}
+
+bool I64Lowering::isLowered(Value* V) const
+{
+	return loweredValues.count(V) || isa<ConstantExpr>(V);
+}
+
+I64Lowering::ValuePair I64Lowering::getPair(Value* V, Instruction* insertPoint)
+{
+	assert(isI64(V->getType()));
+	auto it = loweredValues.find(V);
+	if(it != loweredValues.end())
+		return it->second;
+	Type* Int32Ty = Type::getInt32Ty(module->getContext());
+	if(ConstantInt* CI = dyn_cast<ConstantInt>(V))
+	{
+		uint64_t val = CI->getZExtValue();
+		return ValuePair(ConstantInt::get(Int32Ty, val & 0xffffffff), ConstantInt::get(Int32Ty, val >> 32));
+	}
+	if(isa<UndefValue>(V))
+		return ValuePair(UndefValue::get(Int32Ty), UndefValue::get(Int32Ty));
+	if(ConstantExpr* CE = dyn_cast<ConstantExpr>(V))
+	{
+		// Materialize the expression so that it can be lowered like any other instruction
+		Instruction* I = CE->getAsInstruction();
+		I->insertBefore(insertPoint);
+		lowerInstruction(*I);
+		return getPair(I, insertPoint);
+	}
+	if(isBuiltinCall(V, packFunc))
+	{
+		CallInst* CI = cast<CallInst>(V);
+		return ValuePair(CI->getArgOperand(0), CI->getArgOperand(1));
+	}
+	// The value comes from memory or from a function without a body, unpack it after the definition
+	it = unpackedValues.find(V);
+	if(it != unpackedValues.end())
+		return it->second;
+	Instruction* unpackPoint;
+	if(isa<Argument>(V))
+		unpackPoint = insertPoint->getParent()->getParent()->getEntryBlock().getFirstInsertionPt();
+	else if(InvokeInst* II = dyn_cast<InvokeInst>(V))
+		unpackPoint = II->getNormalDest()->getFirstInsertionPt();
+	else if(isa<PHINode>(V))
+		unpackPoint = cast<Instruction>(V)->getParent()->getFirstInsertionPt();
+	else
+		unpackPoint = std::next(BasicBlock::iterator(cast<Instruction>(V)));
+	IRBuilder<> Builder(unpackPoint);
+	ValuePair ret(Builder.CreateCall(lowFunc, V), Builder.CreateCall(highFunc, V));
+	unpackedValues[V] = ret;
+	return ret;
+}
+
+I64Lowering::ValuePair I64Lowering::lowerAdd(const ValuePair& a, const ValuePair& b, IRBuilder<>& Builder)
+{
+	Value* low = Builder.CreateAdd(a.first, b.first);
+	Value* carry = Builder.CreateZExt(Builder.CreateICmpULT(low, a.first), low->getType());
+	Value* high = Builder.CreateAdd(Builder.CreateAdd(a.second, b.second), carry);
+	return ValuePair(low, high);
+}
+
+I64Lowering::ValuePair I64Lowering::lowerSub(const ValuePair& a, const ValuePair& b, IRBuilder<>& Builder)
+{
+	Value* low = Builder.CreateSub(a.first, b.first);
+	Value* borrow = Builder.CreateZExt(Builder.CreateICmpULT(a.first, b.first), low->getType());
+	Value* high = Builder.CreateSub(Builder.CreateSub(a.second, b.second), borrow);
+	return ValuePair(low, high);
+}
+
+I64Lowering::ValuePair I64Lowering::lowerMul(const ValuePair& a, const ValuePair& b, IRBuilder<>& Builder)
+{
+	// The full 64-bit product of the low parts is computed using 16-bit halves, all the partial products fit in 32 bits
+	Value* a0 = Builder.CreateAnd(a.first, 0xffff);
+	Value* a1 = Builder.CreateLShr(a.first, 16);
+	Value* b0 = Builder.CreateAnd(b.first, 0xffff);
+	Value* b1 = Builder.CreateLShr(b.first, 16);
+	Value* p00 = Builder.CreateMul(a0, b0);
+	Value* p01 = Builder.CreateMul(a0, b1);
+	Value* p10 = Builder.CreateMul(a1, b0);
+	Value* p11 = Builder.CreateMul(a1, b1);
+	Value* mid = Builder.CreateAdd(Builder.CreateAdd(Builder.CreateLShr(p00, 16), Builder.CreateAnd(p01, 0xffff)), Builder.CreateAnd(p10, 0xffff));
+	Value* low = Builder.CreateOr(Builder.CreateAnd(p00, 0xffff), Builder.CreateShl(mid, 16));
+	Value* high = Builder.CreateAdd(Builder.CreateAdd(p11, Builder.CreateLShr(p01, 16)), Builder.CreateAdd(Builder.CreateLShr(p10, 16), Builder.CreateLShr(mid, 16)));
+	// The cross products only contribute to the high part
+	Value* cross = Builder.CreateAdd(Builder.CreateMul(a.first, b.second), Builder.CreateMul(a.second, b.first));
+	return ValuePair(low, Builder.CreateAdd(high, cross));
+}
+
+I64Lowering::ValuePair I64Lowering::lowerShift(unsigned opcode, const ValuePair& a, Value* amount, IRBuilder<>& Builder)
+{
+	Type* Int32Ty = amount->getType();
+	Value* zero = ConstantInt::get(Int32Ty, 0);
+	if(ConstantInt* C = dyn_cast<ConstantInt>(amount))
+	{
+		uint32_t k = C->getZExtValue() & 63;
+		if(k == 0)
+			return a;
+		if(k < 32)
+		{
+			switch(opcode)
+			{
+				case Instruction::Shl:
+					return ValuePair(Builder.CreateShl(a.first, k), Builder.CreateOr(Builder.CreateShl(a.second, k), Builder.CreateLShr(a.first, 32 - k)));
+				case Instruction::LShr:
+					return ValuePair(Builder.CreateOr(Builder.CreateLShr(a.first, k), Builder.CreateShl(a.second, 32 - k)), Builder.CreateLShr(a.second, k));
+				default:
+					return ValuePair(Builder.CreateOr(Builder.CreateLShr(a.first, k), Builder.CreateShl(a.second, 32 - k)), Builder.CreateAShr(a.second, k));
+			}
+		}
+		k -= 32;
+		switch(opcode)
+		{
+			case Instruction::Shl:
+				return ValuePair(zero, k ? Builder.CreateShl(a.first, k) : a.first);
+			case Instruction::LShr:
+				return ValuePair(k ? Builder.CreateLShr(a.second, k) : a.second, zero);
+			default:
+				return ValuePair(k ? Builder.CreateAShr(a.second, k) : a.second, Builder.CreateAShr(a.second, 31));
+		}
+	}
+	// Shifts of 32 or more bits move one part into the other. The bits crossing parts for smaller shifts are computed
+	// with two shifts, since shifting by 32 is a no-op in JS
+	Value* smallAmount = Builder.CreateAnd(amount, 31);
+	Value* big = Builder.CreateICmpNE(Builder.CreateAnd(amount, 32), zero);
+	Value* crossAmount = Builder.CreateSub(ConstantInt::get(Int32Ty, 31), smallAmount);
+	if(opcode == Instruction::Shl)
+	{
+		Value* lowSmall = Builder.CreateShl(a.first, smallAmount);
+		Value* highSmall = Builder.CreateOr(Builder.CreateShl(a.second, smallAmount), Builder.CreateLShr(Builder.CreateLShr(a.first, 1), crossAmount));
+		return ValuePair(Builder.CreateSelect(big, zero, lowSmall), Builder.CreateSelect(big, lowSmall, highSmall));
+	}
+	Value* highSmall = opcode == Instruction::LShr ? Builder.CreateLShr(a.second, smallAmount) : Builder.CreateAShr(a.second, smallAmount);
+	Value* lowSmall = Builder.CreateOr(Builder.CreateLShr(a.first, smallAmount), Builder.CreateShl(Builder.CreateShl(a.second, 1), crossAmount));
+	Value* highBig = opcode == Instruction::LShr ? zero : Builder.CreateAShr(a.second, 31);
+	return ValuePair(Builder.CreateSelect(big, highSmall, lowSmall), Builder.CreateSelect(big, highBig, highSmall));
+}
+
+Value* I64Lowering::lowerICmp(CmpInst::Predicate p, const ValuePair& a, const ValuePair& b, IRBuilder<>& Builder)
+{
+	if(p == CmpInst::ICMP_EQ)
+		return Builder.CreateAnd(Builder.CreateICmpEQ(a.first, b.first), Builder.CreateICmpEQ(a.second, b.second));
+	if(p == CmpInst::ICMP_NE)
+		return Builder.CreateOr(Builder.CreateICmpNE(a.first, b.first), Builder.CreateICmpNE(a.second, b.second));
+	// The high parts decide, unless they are equal. Low parts are always compared as unsigned.
+	CmpInst::Predicate highPredicate = p;
+	switch(p)
+	{
+		case CmpInst::ICMP_SLE: highPredicate = CmpInst::ICMP_SLT; break;
+		case CmpInst::ICMP_SGE: highPredicate = CmpInst::ICMP_SGT; break;
+		case CmpInst::ICMP_ULE: highPredicate = CmpInst::ICMP_ULT; break;
+		case CmpInst::ICMP_UGE: highPredicate = CmpInst::ICMP_UGT; break;
+		default: break;
+	}
+	CmpInst::Predicate lowPredicate = ICmpInst::getUnsignedPredicate(p);
+	return Builder.CreateSelect(Builder.CreateICmpEQ(a.second, b.second),
+				Builder.CreateICmp(lowPredicate, a.first, b.first),
+				Builder.CreateICmp(highPredicate, a.second, b.second));
+}
+
+void I64Lowering::lowerSwitch(SwitchInst& SI)
+{
+	ValuePair cond = getPair(SI.getCondition(), &SI);
+	BasicBlock* BB = SI.getParent();
+	BasicBlock* defaultDest = SI.getDefaultDest();
+	Type* Int32Ty = cond.first->getType();
+	IRBuilder<> Builder(&SI);
+	// Detach the successors from the original block, new edges are added below
+	std::vector<std::pair<PHINode*, Value*>> incomingValues;
+	SmallPtrSet<BasicBlock*, 8> visited;
+	for(unsigned i=0;i<SI.getNumSuccessors();i++)
+	{
+		BasicBlock* succ = SI.getSuccessor(i);
+		if(!visited.insert(succ).second)
+			continue;
+		for(BasicBlock::iterator it = succ->begin(); PHINode* phi = dyn_cast<PHINode>(it); ++it)
+		{
+			incomingValues.push_back(std::make_pair(phi, phi->getIncomingValueForBlock(BB)));
+			int index;
+			while((index = phi->getBasicBlockIndex(BB)) >= 0)
+				phi->removeIncomingValue(index, /*DeletePHIIfEmpty*/ false);
+		}
+	}
+	auto addEdge = [&](BasicBlock* from, BasicBlock* to)
+	{
+		for(auto& incoming: incomingValues)
+		{
+			if(incoming.first->getParent() == to)
+				incoming.first->addIncoming(incoming.second, from);
+		}
+	};
+	bool sameHighPart = true;
+	uint64_t highPart = SI.getNumCases() ? SI.case_begin().getCaseValue()->getZExtValue() >> 32 : 0;
+	for(SwitchInst::CaseIt it = SI.case_begin(); it != SI.case_end(); ++it)
+		sameHighPart &= (it.getCaseValue()->getZExtValue() >> 32) == highPart;
+	if(sameHighPart)
+	{
+		// Compare the high part once, then switch on the low part
+		BasicBlock* lowBlock = BasicBlock::Create(BB->getContext(), "", BB->getParent(), BB->getNextNode());
+		Builder.CreateCondBr(Builder.CreateICmpEQ(cond.second, ConstantInt::get(Int32Ty, highPart)), lowBlock, defaultDest);
+		addEdge(BB, defaultDest);
+		Builder.SetInsertPoint(lowBlock);
+		SwitchInst* newSI = Builder.CreateSwitch(cond.first, defaultDest, SI.getNumCases());
+		addEdge(lowBlock, defaultDest);
+		for(SwitchInst::CaseIt it = SI.case_begin(); it != SI.case_end(); ++it)
+		{
+			newSI->addCase(cast<ConstantInt>(ConstantInt::get(Int32Ty, it.getCaseValue()->getZExtValue() & 0xffffffff)), it.getCaseSuccessor());
+			addEdge(lowBlock, it.getCaseSuccessor());
+		}
+	}
+	else
+	{
+		// Otherwise use a chain of comparisons
+		BasicBlock* cur = BB;
+		BasicBlock* insertBefore = BB->getNextNode();
+		for(SwitchInst::CaseIt it = SI.case_begin(); it != SI.case_end(); ++it)
+		{
+			BasicBlock* next = BasicBlock::Create(BB->getContext(), "", BB->getParent(), insertBefore);
+			ValuePair caseValue = getPair(it.getCaseValue(), &SI);
+			Builder.CreateCondBr(lowerICmp(CmpInst::ICMP_EQ, cond, caseValue, Builder), it.getCaseSuccessor(), next);
+			addEdge(cur, it.getCaseSuccessor());
+			cur = next;
+			Builder.SetInsertPoint(cur);
+		}
+		Builder.CreateBr(defaultDest);
+		addEdge(cur, defaultDest);
+	}
+	SI.eraseFromParent();
+}
+
+void I64Lowering::lowerInstruction(Instruction& I)
+{
+	LLVMContext& C = module->getContext();
+	Type* Int32Ty = Type::getInt32Ty(C);
+	IRBuilder<> Builder(&I);
+	ValuePair result;
+	switch(I.getOpcode())
+	{
+		case Instruction::Add:
+		case Instruction::Sub:
+		case Instruction::Mul:
+		case Instruction::And:
+		case Instruction::Or:
+		case Instruction::Xor:
+		{
+			if(!isI64(I.getType()))
+				break;
+			ValuePair a = getPair(I.getOperand(0), &I);
+			ValuePair b = getPair(I.getOperand(1), &I);
+			if(I.getOpcode() == Instruction::Add)
+				result = lowerAdd(a, b, Builder);
+			else if(I.getOpcode() == Instruction::Sub)
+				result = lowerSub(a, b, Builder);
+			else if(I.getOpcode() == Instruction::Mul)
+				result = lowerMul(a, b, Builder);
+			else
+			{
+				Instruction::BinaryOps op = cast<BinaryOperator>(I).getOpcode();
+				result = ValuePair(Builder.CreateBinOp(op, a.first, b.first), Builder.CreateBinOp(op, a.second, b.second));
+			}
+			loweredValues[&I] = result;
+			loweredInstructions.push_back(&I);
+			NumLoweredInstructions++;
+			return;
+		}
+		case Instruction::Shl:
+		case Instruction::LShr:
+		case Instruction::AShr:
+		{
+			if(!isI64(I.getType()))
+				break;
+			// Only the low part of the amount is relevant
+			ValuePair a = getPair(I.getOperand(0), &I);
+			Value* amount = getPair(I.getOperand(1), &I).first;
+			loweredValues[&I] = lowerShift(I.getOpcode(), a, amount, Builder);
+			loweredInstructions.push_back(&I);
+			NumLoweredInstructions++;
+			return;
+		}
+		case Instruction::ICmp:
+		{
+			if(!isI64(I.getOperand(0)->getType()))
+				break;
+			ValuePair a = getPair(I.getOperand(0), &I);
+			ValuePair b = getPair(I.getOperand(1), &I);
+			I.replaceAllUsesWith(lowerICmp(cast<ICmpInst>(I).getPredicate(), a, b, Builder));
+			loweredInstructions.push_back(&I);
+			NumLoweredInstructions++;
+			return;
+		}
+		case Instruction::Select:
+		{
+			if(!isI64(I.getType()))
+				break;
+			Value* cond = I.getOperand(0);
+			ValuePair a = getPair(I.getOperand(1), &I);
+			ValuePair b = getPair(I.getOperand(2), &I);
+			loweredValues[&I] = ValuePair(Builder.CreateSelect(cond, a.first, b.first), Builder.CreateSelect(cond, a.second, b.second));
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::PHI:
+		{
+			if(!isI64(I.getType()))
+				break;
+			// Incoming values are filled after the whole function is lowered
+			PHINode* phi = cast<PHINode>(&I);
+			result.first = Builder.CreatePHI(Int32Ty, phi->getNumIncomingValues());
+			result.second = Builder.CreatePHI(Int32Ty, phi->getNumIncomingValues());
+			loweredValues[&I] = result;
+			loweredInstructions.push_back(&I);
+			loweredPHIs.push_back(phi);
+			return;
+		}
+		case Instruction::Trunc:
+		{
+			if(!isI64(I.getOperand(0)->getType()))
+				break;
+			Value* low = getPair(I.getOperand(0), &I).first;
+			if(!I.getType()->isIntegerTy(32))
+				low = Builder.CreateTrunc(low, I.getType());
+			I.replaceAllUsesWith(low);
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::ZExt:
+		case Instruction::SExt:
+		{
+			if(!isI64(I.getType()))
+				break;
+			Value* low = I.getOperand(0);
+			bool isSigned = I.getOpcode() == Instruction::SExt;
+			if(!low->getType()->isIntegerTy(32))
+				low = isSigned ? Builder.CreateSExt(low, Int32Ty) : Builder.CreateZExt(low, Int32Ty);
+			Value* high = isSigned ? Builder.CreateAShr(low, 31) : ConstantInt::get(Int32Ty, 0);
+			loweredValues[&I] = ValuePair(low, high);
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::SIToFP:
+		case Instruction::UIToFP:
+		{
+			if(!isI64(I.getOperand(0)->getType()))
+				break;
+			ValuePair a = getPair(I.getOperand(0), &I);
+			Type* DoubleTy = Type::getDoubleTy(C);
+			Value* high = I.getOpcode() == Instruction::SIToFP ? Builder.CreateSIToFP(a.second, DoubleTy) : Builder.CreateUIToFP(a.second, DoubleTy);
+			Value* ret = Builder.CreateFAdd(Builder.CreateFMul(high, ConstantFP::get(DoubleTy, 4294967296.0)), Builder.CreateUIToFP(a.first, DoubleTy));
+			if(!I.getType()->isDoubleTy())
+				ret = Builder.CreateFPTrunc(ret, I.getType());
+			I.replaceAllUsesWith(ret);
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::FPToSI:
+		case Instruction::FPToUI:
+		{
+			if(!isI64(I.getType()))
+				break;
+			Type* DoubleTy = Type::getDoubleTy(C);
+			Value* val = I.getOperand(0);
+			if(!val->getType()->isDoubleTy())
+				val = Builder.CreateFPExt(val, DoubleTy);
+			// Convert the magnitude, conversions to i32 truncate towards zero
+			Value* negative = NULL;
+			if(I.getOpcode() == Instruction::FPToSI)
+			{
+				negative = Builder.CreateFCmpOLT(val, ConstantFP::get(DoubleTy, 0.0));
+				val = Builder.CreateSelect(negative, Builder.CreateFNeg(val), val);
+			}
+			Value* high = Builder.CreateFPToUI(Builder.CreateFMul(val, ConstantFP::get(DoubleTy, 1.0/4294967296.0)), Int32Ty);
+			Value* lowPart = Builder.CreateFSub(val, Builder.CreateFMul(Builder.CreateUIToFP(high, DoubleTy), ConstantFP::get(DoubleTy, 4294967296.0)));
+			result = ValuePair(Builder.CreateFPToUI(lowPart, Int32Ty), high);
+			if(negative)
+			{
+				ValuePair negated = lowerSub(ValuePair(ConstantInt::get(Int32Ty, 0), ConstantInt::get(Int32Ty, 0)), result, Builder);
+				result = ValuePair(Builder.CreateSelect(negative, negated.first, result.first), Builder.CreateSelect(negative, negated.second, result.second));
+			}
+			loweredValues[&I] = result;
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::PtrToInt:
+		{
+			if(!isI64(I.getType()))
+				break;
+			loweredValues[&I] = ValuePair(Builder.CreatePtrToInt(I.getOperand(0), Int32Ty), ConstantInt::get(Int32Ty, 0));
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::IntToPtr:
+		{
+			if(!isI64(I.getOperand(0)->getType()))
+				break;
+			I.replaceAllUsesWith(Builder.CreateIntToPtr(getPair(I.getOperand(0), &I).first, I.getType()));
+			loweredInstructions.push_back(&I);
+			return;
+		}
+		case Instruction::BitCast:
+		{
+			if(!isI64(I.getType()) && !isI64(I.getOperand(0)->getType()))
+				break;
+			// Type punning of doubles, e.g. for hashing, reads and writes the two halves of the same memory
+			if(isI64(I.getType()) && I.getOperand(0)->getType()->isDoubleTy())
+			{
+				Value* val = I.getOperand(0);
+				loweredValues[&I] = ValuePair(Builder.CreateCall(bitsLowFunc, val), Builder.CreateCall(bitsHighFunc, val));
+			}
+			else if(isI64(I.getOperand(0)->getType()) && I.getType()->isDoubleTy())
+			{
+				ValuePair a = getPair(I.getOperand(0), &I);
+				I.replaceAllUsesWith(Builder.CreateCall2(toDoubleFunc, a.first, a.second));
+			}
+			else
+				llvm::report_fatal_error("Bitcasts between i64 and types other than double are not supported", false);
+			loweredInstructions.push_back(&I);
+			NumLoweredInstructions++;
+			return;
+		}
+		case Instruction::Switch:
+		{
+			if(!isI64(I.getOperand(0)->getType()))
+				break;
+			lowerSwitch(cast<SwitchInst>(I));
+			return;
+		}
+		case Instruction::GetElementPtr:
+		{
+			// Indexes are 32-bit anyway
+			for(unsigned i=1;i<I.getNumOperands();i++)
+			{
+				if(isI64(I.getOperand(i)->getType()))
+					I.setOperand(i, getPair(I.getOperand(i), &I).first);
+			}
+			return;
+		}
+		case Instruction::Call:
+		{
+			CallInst& CI = cast<CallInst>(I);
+			if(CI.getCalledFunction() == lowFunc || CI.getCalledFunction() == highFunc)
+			{
+				// Leave alone the unpacking of values which are not lowered
+				auto it = unpackedValues.find(CI.getArgOperand(0));
+				if(it != unpackedValues.end() && (it->second.first == &I || it->second.second == &I))
+					return;
+				ValuePair a = getPair(CI.getArgOperand(0), &I);
+				I.replaceAllUsesWith(CI.getCalledFunction() == lowFunc ? a.first : a.second);
+				loweredInstructions.push_back(&I);
+				return;
+			}
+			if(CI.getCalledFunction() == packFunc)
+				return;
+			IntrinsicInst* II = dyn_cast<IntrinsicInst>(&I);
+			if(II && isI64(II->getType()) && II->getIntrinsicID() == Intrinsic::expect)
+			{
+				loweredValues[&I] = getPair(II->getArgOperand(0), &I);
+				loweredInstructions.push_back(&I);
+				return;
+			}
+			if(II && isI64(II->getType()) && II->getIntrinsicID() == Intrinsic::ctlz)
+			{
+				ValuePair a = getPair(II->getArgOperand(0), &I);
+				Function* ctlz = Intrinsic::getDeclaration(module, Intrinsic::ctlz, Int32Ty);
+				Value* zeroUndef = ConstantInt::getFalse(C);
+				Value* lowCount = Builder.CreateAdd(Builder.CreateCall2(ctlz, a.first, zeroUndef), ConstantInt::get(Int32Ty, 32));
+				Value* highCount = Builder.CreateCall2(ctlz, a.second, zeroUndef);
+				Value* count = Builder.CreateSelect(Builder.CreateICmpEQ(a.second, ConstantInt::get(Int32Ty, 0)), lowCount, highCount);
+				loweredValues[&I] = ValuePair(count, ConstantInt::get(Int32Ty, 0));
+				loweredInstructions.push_back(&I);
+				return;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+	// Any other use of a lowered value needs a single JS value
+	for(unsigned i=0;i<I.getNumOperands();i++)
+	{
+		Value* op = I.getOperand(i);
+		if(isI64(op->getType()) && isLowered(op))
+			I.setOperand(i, createPack(getPair(op, &I), Builder));
+	}
+}
+
+void I64Lowering::lowerFunction(Function& F)
+{
+	loweredValues.clear();
+	unpackedValues.clear();
+	loweredInstructions.clear();
+	loweredPHIs.clear();
+
+	// Definitions must be visited before their uses
+	removeUnreachableBlocks(F);
+	ReversePostOrderTraversal<Function*> RPOT(&F);
+	std::vector<BasicBlock*> blocks(RPOT.begin(), RPOT.end());
+	for(BasicBlock* BB: blocks)
+	{
+		for(BasicBlock::iterator it = BB->begin(); it != BB->end(); )
+		{
+			Instruction& I = *it++;
+			lowerInstruction(I);
+		}
+	}
+	for(PHINode* phi: loweredPHIs)
+	{
+		const ValuePair& newPHIs = loweredValues[phi];
+		for(unsigned i=0;i<phi->getNumIncomingValues();i++)
+		{
+			BasicBlock* incomingBlock = phi->getIncomingBlock(i);
+			ValuePair incoming = getPair(phi->getIncomingValue(i), incomingBlock->getTerminator());
+			cast<PHINode>(newPHIs.first)->addIncoming(incoming.first, incomingBlock);
+			cast<PHINode>(newPHIs.second)->addIncoming(incoming.second, incomingBlock);
+		}
+	}
+	for(Instruction* I: loweredInstructions)
+		I->replaceAllUsesWith(UndefValue::get(I->getType()));
+	for(Instruction* I: loweredInstructions)
+		I->eraseFromParent();
+
+	// Packing and unpacking may not be needed anymore
+	bool Changed = true;
+	while(Changed)
+	{
+		Changed = false;
+		for(BasicBlock& BB: F)
+		{
+			for(BasicBlock::iterator it = BB.begin(); it != BB.end(); )
+			{
+				Instruction& I = *it++;
+				if(I.use_empty() && (isBuiltinCall(&I, packFunc) || isBuiltinCall(&I, lowFunc) || isBuiltinCall(&I, highFunc)))
+				{
+					I.eraseFromParent();
+					Changed = true;
+				}
+			}
+		}
+	}
+}
+
+bool I64Lowering::runOnModule(Module& M)
+{
+	module = &M;
+	bool hasI64 = false;
+	for(Function& F: M)
+	{
+		hasI64 |= hasI64InSignature(F.getFunctionType());
+		for(BasicBlock& BB: F)
+		{
+			for(Instruction& I: BB)
+			{
+				hasI64 |= isI64(I.getType());
+				for(Value* op: I.operands())
+					hasI64 |= isI64(op->getType());
+			}
+		}
+		if(hasI64)
+			break;
+	}
+	if(!hasI64)
+		return false;
+
+	LLVMContext& C = M.getContext();
+	Type* Int32Ty = Type::getInt32Ty(C);
+	Type* Int64Ty = Type::getInt64Ty(C);
+	packFunc = cast<Function>(M.getOrInsertFunction(packName, Int64Ty, Int32Ty, Int32Ty, NULL));
+	lowFunc = cast<Function>(M.getOrInsertFunction(lowName, Int32Ty, Int64Ty, NULL));
+	highFunc = cast<Function>(M.getOrInsertFunction(highName, Int32Ty, Int64Ty, NULL));
+	Type* DoubleTy = Type::getDoubleTy(C);
+	bitsLowFunc = cast<Function>(M.getOrInsertFunction(bitsLowName, Int32Ty, DoubleTy, NULL));
+	bitsHighFunc = cast<Function>(M.getOrInsertFunction(bitsHighName, Int32Ty, DoubleTy, NULL));
+	toDoubleFunc = cast<Function>(M.getOrInsertFunction(toDoubleName, DoubleTy, Int32Ty, Int32Ty, NULL));
+	packFunc->setDoesNotAccessMemory();
+	lowFunc->setDoesNotAccessMemory();
+	highFunc->setDoesNotAccessMemory();
+	bitsLowFunc->setDoesNotAccessMemory();
+	bitsHighFunc->setDoesNotAccessMemory();
+	toDoubleFunc->setDoesNotAccessMemory();
+	highBits = new GlobalVariable(M, Int32Ty, false, GlobalValue::InternalLinkage, ConstantInt::get(Int32Ty, 0), "cheerpI64RetHigh");
+
+	// Methods exported to JS keep their signature
+	std::unordered_set<Function*> exportedFunctions;
+	for(NamedMDNode& namedNode: M.named_metadata())
+	{
+		StringRef name = namedNode.getName();
+		if(name != "jsexported_methods" && !(name.endswith("_methods") && name.startswith("class.")))
+			continue;
+		for(const MDNode* node: namedNode.operands())
+		{
+			if(Function* F = dyn_cast<Function>(cast<ConstantAsMetadata>(node->getOperand(0))->getValue()))
+				exportedFunctions.insert(F);
+		}
+	}
+
+	std::vector<Function*> functions;
+	for(Function& F: M)
+	{
+		if(!F.empty())
+			functions.push_back(&F);
+	}
+	for(Function* F: functions)
+		replaceDivRem(*F);
+	for(auto& helper: divRemHelpers)
+		functions.push_back(helper.second);
+
+	for(Function*& F: functions)
+	{
+		if(hasI64InSignature(F->getFunctionType()) && !exportedFunctions.count(F))
+			F = rewriteSignature(F);
+	}
+
+	// Indirect calls see the lowered signature as well
+	for(Function* F: functions)
+	{
+		SmallVector<CallSite, 4> indirectCalls;
+		for(BasicBlock& BB: *F)
+		{
+			for(Instruction& I: BB)
+			{
+				CallSite CS(&I);
+				if(!CS || isa<Function>(CS.getCalledValue()))
+					continue;
+				Function* callee = dyn_cast<Function>(CS.getCalledValue()->stripPointerCastsNoFollowAliases());
+				// Casts of functions without a body or exported ones keep the original signature
+				if(callee && (callee->empty() || exportedFunctions.count(callee)))
+					continue;
+				FunctionType* FT = cast<FunctionType>(cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+				if(hasI64InSignature(FT))
+					indirectCalls.push_back(CS);
+			}
+		}
+		for(CallSite CS: indirectCalls)
+		{
+			FunctionType* FT = cast<FunctionType>(cast<PointerType>(CS.getCalledValue()->getType())->getElementType());
+			FunctionType* newFT = getLoweredFunctionType(FT);
+			IRBuilder<> Builder(CS.getInstruction());
+			Value* newCallee = Builder.CreateBitCast(CS.getCalledValue(), newFT->getPointerTo());
+			rewriteCall(CS, newCallee, newFT);
+		}
+	}
+
+	for(Function* F: functions)
+		lowerFunction(*F);
+	return true;
+}
+
+const char* I64Lowering::getPassName() const
+{
+	return "I64Lowering";
+}
+
+char I64Lowering::ID = 0;
+
+ModulePass* createI64LoweringPass() { return new I64Lowering(); }
+
+}
+
+using namespace cheerp;
+
+INITIALIZE_PASS_BEGIN(I64Lowering, "I64Lowering", "Split 64-bit integers in pairs of 32-bit integers",
+                      false, false)
+INITIALIZE_PASS_END(I64Lowering, "I64Lowering", "Split 64-bit integers in pairs of 32-bit integers",
+                    false, false)
@@ -14,12 +14,16 @@
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Debug.h"
+#include <atomic>
+#include <memory>
 #include <numeric>
+#include <thread>
 
 using namespace llvm;
 
@@ -288,8 +292,13 @@ void PointerAnalyzer::getAnalysisUsage(AnalysisUsage& AU) const
 
 bool PointerAnalyzer::runOnModule(Module& M)
 {
-	for(const Function & F : M)
-		prefetchFunc(F);
+	if(jobs > 1)
+		prefetchFuncsInParallel(M);
+	else
+	{
+		for(const Function & F : M)
+			prefetchFunc(F);
+	}
 
 	llvm::SmallVector<const User*, 4> globalsUsersQueue;
 	for(const GlobalVariable & GV : M.getGlobalList())
@@ -714,6 +723,7 @@ PointerKindWrapper& PointerUsageVisitor::visitUse(PointerKindWrapper& ret, const
 		{
 		case Intrinsic::memmove:
 		case Intrinsic::memcpy:
+		case Intrinsic::memset:
 		{
 			if (TypeSupport::hasByteLayout(intrinsic->getOperand(0)->getType()->getPointerElementType()))
 				return ret |= COMPLETE_OBJECT;
@@ -756,7 +766,6 @@ PointerKindWrapper& PointerUsageVisitor::visitUse(PointerKindWrapper& ret, const
 				llvm::report_fatal_error("Unreachable code in cheerp::PointerAnalyzer::visitUse, cheerp_create_closure");
 		case Intrinsic::flt_rounds:
 		case Intrinsic::cheerp_allocate:
-		case Intrinsic::memset:
 		default:
 			SmallString<128> str("Unreachable code in cheerp::PointerAnalyzer::visitUse, unhandled intrinsic: ");
 			str+=intrinsic->getCalledFunction()->getName();
@@ -778,6 +787,10 @@ PointerKindWrapper& PointerUsageVisitor::visitUse(PointerKindWrapper& ret, const
 			return ret |= pointerKindData.getConstraintPtr(IndirectPointerKindConstraint(INDIRECT_ARG_CONSTRAINT, typeAndIndex));
 		}
 
+		// Frees are kept only for pooled types, the freed object is recycled as is
+		if ( calledFunction->empty() && calledFunction->getName() == "free" )
+			return ret |= COMPLETE_OBJECT;
+
 		unsigned argNo = cs.getArgumentNo(U);
 
 		if ( argNo >= calledFunction->arg_size() )
@@ -1199,6 +1212,249 @@ PointerConstantOffsetWrapper PointerResolverForOffsetVisitor::resolvePointerOffs
 		return offset;
 }
 
+/**
+ * Explicit graph of the dependencies between the pointer data of arguments and constraints, used to fully resolve
+ * all of them at once. Nodes are solved one strongly connected component at a time, after all the components they
+ * depend on, so every dependency is resolved exactly once. Inside a component the values are iterated to a fixed point.
+ */
+template<class T>
+struct PointerConstraintGraph
+{
+	static const uint32_t NO_NODE = 0xffffffff;
+	struct Node
+	{
+		Node(T& data, const IndirectPointerKindConstraint* constraint):data(data),constraint(constraint),orderDep(NO_NODE),
+					hasDefaultDep(false)
+		{
+		}
+		T& data;
+		// NULL for arguments and members
+		const IndirectPointerKindConstraint* constraint;
+		// Nodes whose value flows into this one
+		llvm::SmallVector<uint32_t, 4> deps;
+		// Node which must be solved before this one, but whose value does not flow into it
+		uint32_t orderDep;
+		// At least one of the constraints resolves to T::staticDefaultValue
+		bool hasDefaultDep;
+	};
+
+	PointerConstraintGraph(PointerAnalyzer::PointerData<T>& pointerData, PointerAnalyzer::AddressTakenMap& addressTakenCache) :
+				pointerData(pointerData), addressTakenCache(addressTakenCache) {}
+
+	uint32_t addNode(T& data, const IndirectPointerKindConstraint* constraint)
+	{
+		nodeForData.insert(std::make_pair(&data, nodes.size()));
+		nodes.emplace_back(data, constraint);
+		return nodes.size() - 1;
+	}
+	uint32_t getNodeForData(const T& data) const
+	{
+		auto it = nodeForData.find(&data);
+		return it == nodeForData.end() ? NO_NODE : it->second;
+	}
+	// Find the node a constraint resolves to, this mirrors PointerResolverBaseVisitor::resolveConstraint.
+	// Returns NO_NODE if the constraint resolves to T::staticDefaultValue
+	uint32_t getNodeForConstraint(const IndirectPointerKindConstraint& c)
+	{
+		switch(c.kind)
+		{
+			case DIRECT_ARG_CONSTRAINT:
+			{
+				if (addressTakenCache.checkAddressTaken(c.argPtr->getParent()))
+				{
+					Type* argPointedType = c.argPtr->getType()->getPointerElementType();
+					TypeAndIndex typeAndIndex(argPointedType, c.argPtr->getArgNo(), TypeAndIndex::ARGUMENT);
+					return getNodeForConstraint(IndirectPointerKindConstraint( INDIRECT_ARG_CONSTRAINT, typeAndIndex));
+				}
+				assert(pointerData.argsMap.count(c.argPtr));
+				return getNodeForData(pointerData.argsMap.find(c.argPtr)->second);
+			}
+			case RETURN_CONSTRAINT:
+			case STORED_TYPE_CONSTRAINT:
+			case RETURN_TYPE_CONSTRAINT:
+			case BASE_AND_INDEX_CONSTRAINT:
+			case INDIRECT_ARG_CONSTRAINT:
+			{
+				const auto& it=pointerData.constraintsMap.find(c);
+				if(it==pointerData.constraintsMap.end())
+					return NO_NODE;
+				return getNodeForData(it->second);
+			}
+			case DIRECT_ARG_CONSTRAINT_IF_ADDRESS_TAKEN:
+			{
+				if (!addressTakenCache.checkAddressTaken(c.argPtr->getParent()))
+					return NO_NODE;
+				assert(pointerData.argsMap.count(c.argPtr));
+				return getNodeForData(pointerData.argsMap.find(c.argPtr)->second);
+			}
+		}
+		assert(false);
+		return NO_NODE;
+	}
+	// Must be called after all the nodes have been added, and before any of them is modified
+	void addEdges()
+	{
+		for(Node& n: nodes)
+		{
+			for(const IndirectPointerKindConstraint* c: n.data.constraints)
+			{
+				uint32_t d = getNodeForConstraint(*c);
+				if(d == NO_NODE)
+					n.hasDefaultDep = true;
+				else
+					n.deps.push_back(d);
+			}
+		}
+	}
+
+	/**
+	 * Call eval on every node, after all the nodes it depends on have reached their final value.
+	 * eval must return true if the value of the node has changed since the last call
+	 */
+	template<class F>
+	void solve(F eval)
+	{
+		const uint32_t N = nodes.size();
+		std::vector<llvm::SmallVector<uint32_t, 2>> users(N);
+		for(uint32_t i=0;i<N;i++)
+		{
+			for(uint32_t d: nodes[i].deps)
+				users[d].push_back(i);
+			if(nodes[i].orderDep != NO_NODE)
+				users[nodes[i].orderDep].push_back(i);
+		}
+		auto getNumEdges = [&](uint32_t n) -> uint32_t
+		{
+			return nodes[n].deps.size() + (nodes[n].orderDep != NO_NODE);
+		};
+		auto getEdge = [&](uint32_t n, uint32_t e) -> uint32_t
+		{
+			return e < nodes[n].deps.size() ? nodes[n].deps[e] : nodes[n].orderDep;
+		};
+
+		// Iterative Tarjan's algorithm, components are completed in reverse topological order
+		std::vector<uint32_t> index(N, NO_NODE);
+		std::vector<uint32_t> lowLink(N);
+		std::vector<uint32_t> sccId(N, NO_NODE);
+		std::vector<bool> onStack(N, false);
+		std::vector<bool> inWorkList(N, false);
+		std::vector<uint32_t> sccStack;
+		std::vector<uint32_t> workList;
+		std::vector<std::pair<uint32_t, uint32_t>> callStack;
+		uint32_t nextIndex = 0;
+		uint32_t nextSccId = 0;
+		auto visit = [&](uint32_t n)
+		{
+			index[n] = lowLink[n] = nextIndex++;
+			sccStack.push_back(n);
+			onStack[n] = true;
+			callStack.emplace_back(n, 0);
+		};
+		for(uint32_t root=0;root<N;root++)
+		{
+			if(index[root] != NO_NODE)
+				continue;
+			visit(root);
+			while(!callStack.empty())
+			{
+				uint32_t n = callStack.back().first;
+				if(callStack.back().second < getNumEdges(n))
+				{
+					uint32_t d = getEdge(n, callStack.back().second++);
+					if(index[d] == NO_NODE)
+						visit(d);
+					else if(onStack[d])
+						lowLink[n] = std::min(lowLink[n], index[d]);
+					continue;
+				}
+				callStack.pop_back();
+				if(!callStack.empty())
+				{
+					uint32_t parent = callStack.back().first;
+					lowLink[parent] = std::min(lowLink[parent], lowLink[n]);
+				}
+				if(lowLink[n] != index[n])
+					continue;
+				// n is the root of a component, solve it
+				uint32_t curSccId = nextSccId++;
+				uint32_t member;
+				do
+				{
+					member = sccStack.back();
+					sccStack.pop_back();
+					onStack[member] = false;
+					sccId[member] = curSccId;
+					workList.push_back(member);
+					inWorkList[member] = true;
+				}
+				while(member != n);
+				while(!workList.empty())
+				{
+					uint32_t w = workList.back();
+					workList.pop_back();
+					inWorkList[w] = false;
+					if(!eval(w))
+						continue;
+					for(uint32_t u: users[w])
+					{
+						if(sccId[u] == curSccId && !inWorkList[u])
+						{
+							workList.push_back(u);
+							inWorkList[u] = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	PointerAnalyzer::PointerData<T>& pointerData;
+	PointerAnalyzer::AddressTakenMap& addressTakenCache;
+	std::vector<Node> nodes;
+	llvm::DenseMap<const T*, uint32_t> nodeForData;
+};
+
+template<class T>
+const uint32_t PointerConstraintGraph<T>::NO_NODE;
+
+/**
+ * Join two fully resolved kinds, BYTE_LAYOUT and REGULAR are absorbing like in resolvePointerKind
+ */
+static void joinResolvedKind(PointerKindWrapper& lhs, const PointerKindWrapper& rhs)
+{
+	if(lhs==BYTE_LAYOUT || rhs==COMPLETE_OBJECT)
+		return;
+	if(rhs==BYTE_LAYOUT || lhs==COMPLETE_OBJECT)
+		lhs = rhs;
+	else
+		lhs |= rhs;
+}
+
+/**
+ * Join two fully resolved offsets, UNINITALIZED is the identity and INVALID is absorbing
+ */
+static void joinResolvedOffset(PointerConstantOffsetWrapper& lhs, const PointerConstantOffsetWrapper& rhs)
+{
+	if(lhs.isInvalid() || rhs.isUninitialized())
+		return;
+	if(rhs.isInvalid() || lhs.isUninitialized())
+		lhs = rhs;
+	else if(lhs.getPointerOffset() != rhs.getPointerOffset())
+		lhs = PointerConstantOffsetWrapper(PointerConstantOffsetWrapper::INVALID);
+}
+
+/**
+ * The resolved offset of a node without taking into account its constraints
+ */
+static PointerConstantOffsetWrapper getOwnOffset(const PointerConstantOffsetWrapper& o)
+{
+	if(o.isInvalid())
+		return PointerConstantOffsetWrapper::INVALID;
+	if(o.isValid())
+		return o.getPointerOffset();
+	return PointerConstantOffsetWrapper::UNINITALIZED;
+}
+
 struct TimerGuard
 {
 	TimerGuard(Timer & timer) : timer(timer)
@@ -1213,11 +1469,56 @@ struct TimerGuard
 	Timer & timer;
 };
 
-void PointerAnalyzer::prefetchFunc(const Function& F) const
+/**
+ * Take exclusive access to the cached data, if the analyzer is used by multiple threads
+ */
+struct ConcurrentWriteGuard
+{
+	ConcurrentWriteGuard(sys::RWMutex& lock, bool concurrentAccess) : lock(concurrentAccess ? &lock : NULL)
+	{
+		if(this->lock)
+			this->lock->lock();
+	}
+	~ConcurrentWriteGuard()
+	{
+		if(lock)
+			lock->unlock();
+	}
+
+	sys::RWMutex* lock;
+};
+
+static const PointerKindWrapper& getFinalPointerKindWrapperImpl(const Value* p, PointerAnalyzer::PointerKindData& pointerKindData,
+								PointerAnalyzer::AddressTakenMap& addressTakenCache)
+{
+	// If the values is already cached just return it
+	auto it = pointerKindData.valueMap.find(p);
+	if(it!=pointerKindData.valueMap.end())
+	{
+		assert(it->second.isKnown());
+		return it->second;
+	}
+
+	PointerKindWrapper ret;
+	PointerKindWrapper& k = PointerUsageVisitor(pointerKindData, addressTakenCache).visitValue(ret, p, /*first*/ true);
+#ifndef NDEBUG
+	it = pointerKindData.valueMap.find(p);
+	assert(it!=pointerKindData.valueMap.end());
+	assert(&it->second == &k);
+	assert(k.isKnown());
+#endif
+	return k;
+}
+
+/**
+ * Visit all the pointers of a function. The visit only caches data for the values of the function itself,
+ * the other data it produces is keyed by arguments of F or accumulated into constraints and members.
+ */
+static void prefetchFuncImpl(const Function& F, PointerAnalyzer::PointerKindData& pointerKindData, PointerAnalyzer::AddressTakenMap& addressTakenCache)
 {
 	for(const Argument & arg : F.getArgumentList())
 		if(arg.getType()->isPointerTy())
-			getFinalPointerKindWrapper(&arg);
+			getFinalPointerKindWrapperImpl(&arg, pointerKindData, addressTakenCache);
 	for(const BasicBlock & BB : F)
 	{
 		for(auto it=BB.rbegin();it != BB.rend();++it)
@@ -1225,7 +1526,7 @@ void PointerAnalyzer::prefetchFunc(const Function& F) const
 			if(it->getType()->isPointerTy() ||
 				(isa<StoreInst>(*it) && it->getOperand(0)->getType()->isPointerTy()))
 			{
-				getFinalPointerKindWrapper(&(*it));
+				getFinalPointerKindWrapperImpl(&(*it), pointerKindData, addressTakenCache);
 			}
 		}
 	}
@@ -1237,29 +1538,106 @@ void PointerAnalyzer::prefetchFunc(const Function& F) const
 	}
 }
 
-const PointerKindWrapper& PointerAnalyzer::getFinalPointerKindWrapper(const Value* p) const
+/**
+ * Move the data of a partial visit into the main data. The constraints referenced by the partial data point
+ * into its own constraintsMap, so they are replaced by the unique constraints of the main data.
+ */
+static void mergePointerKindData(PointerAnalyzer::PointerKindData& to, PointerAnalyzer::PointerKindData& from)
+{
+	auto remapConstraints = [&](PointerKindWrapper& k) -> PointerKindWrapper&
+	{
+		if(k.constraints.empty())
+			return k;
+		llvm::DenseSet<const IndirectPointerKindConstraint*> remapped;
+		for(const IndirectPointerKindConstraint* c: k.constraints)
+			remapped.insert(to.getConstraintPtr(*c));
+		k.constraints.swap(remapped);
+		return k;
+	};
+	for(auto& it: from.constraintsMap)
+	{
+		PointerKindWrapper& k = to.constraintsMap[it.first];
+		k |= remapConstraints(it.second);
+	}
+	for(auto& it: from.baseStructAndIndexMapForMembers)
+		to.baseStructAndIndexMapForMembers[it.first] |= remapConstraints(it.second);
+	// Values and arguments belong to a single function, so they are never shared between batches
+	for(auto& it: from.argsMap)
+	{
+		assert(!to.argsMap.count(it.first));
+		to.argsMap.insert(std::make_pair(it.first, remapConstraints(it.second)));
+	}
+	for(auto& it: from.valueMap)
+	{
+		assert(!to.valueMap.count(it.first));
+		to.valueMap.insert(std::make_pair(it.first, remapConstraints(it.second)));
+	}
+}
+
+void PointerAnalyzer::prefetchFunc(const Function& F) const
 {
 #ifndef NDEBUG
 	TimerGuard guard(gpkTimer);
 #endif //NDEBUG
+	prefetchFuncImpl(F, pointerKindData, addressTakenCache);
+}
 
-	// If the values is already cached just return it
-	auto it = pointerKindData.valueMap.find(p);
-	if(it!=pointerKindData.valueMap.end())
+void PointerAnalyzer::prefetchFuncsInParallel(const Module& M)
+{
+	// Functions are split in batches of fixed size, independently of the number of threads,
+	// and the batches are merged in module order. This keeps the result deterministic.
+	const uint32_t batchSize = 64;
+	std::vector<const Function*> functions;
+	for(const Function & F : M)
+		functions.push_back(&F);
+	uint32_t numBatches = (functions.size() + batchSize - 1) / batchSize;
+
+	struct PartialData
 	{
-		assert(it->second.isKnown());
-		return it->second;
+		PointerKindData pointerKindData;
+		AddressTakenMap addressTakenCache;
+	};
+	std::vector<std::unique_ptr<PartialData>> partialData(numBatches);
+	std::atomic<uint32_t> nextBatch(0);
+	auto prefetchBatches = [&]()
+	{
+		for(uint32_t i = nextBatch++; i < numBatches; i = nextBatch++)
+		{
+			PartialData* partial = new PartialData;
+			partialData[i].reset(partial);
+			uint32_t end = std::min<uint32_t>((i + 1) * batchSize, functions.size());
+			for(uint32_t f = i * batchSize; f < end; f++)
+				prefetchFuncImpl(*functions[f], partial->pointerKindData, partial->addressTakenCache);
+		}
+	};
+
+#if LLVM_ENABLE_THREADS
+	std::vector<std::thread> workers;
+	for(uint32_t i=1;i<jobs && i<numBatches;i++)
+		workers.emplace_back(prefetchBatches);
+#endif
+	// This thread does its share of the work as well
+	prefetchBatches();
+#if LLVM_ENABLE_THREADS
+	for(std::thread& t: workers)
+		t.join();
+#endif
+
+	for(std::unique_ptr<PartialData>& partial: partialData)
+	{
+		mergePointerKindData(pointerKindData, partial->pointerKindData);
+		addressTakenCache.insert(partial->addressTakenCache.begin(), partial->addressTakenCache.end());
+		// Free the memory as soon as possible, the partial data may be large
+		partial.reset();
 	}
+}
 
-	PointerKindWrapper ret;
-	PointerKindWrapper& k = PointerUsageVisitor(pointerKindData, addressTakenCache).visitValue(ret, p, /*first*/ true);
+const PointerKindWrapper& PointerAnalyzer::getFinalPointerKindWrapper(const Value* p) const
+{
 #ifndef NDEBUG
-	it = pointerKindData.valueMap.find(p);
-	assert(it!=pointerKindData.valueMap.end());
-	assert(&it->second == &k);
-	assert(k.isKnown());
-#endif
-	return k;
+	TimerGuard guard(gpkTimer);
+#endif //NDEBUG
+	return getFinalPointerKindWrapperImpl(p, pointerKindData, addressTakenCache);
 }
 
 const PointerConstantOffsetWrapper& PointerAnalyzer::getFinalPointerConstantOffsetWrapper(const Value* p) const
@@ -1284,6 +1662,22 @@ const PointerConstantOffsetWrapper& PointerAnalyzer::getFinalPointerConstantOffs
 }
 
 POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
+{
+	if(!concurrentAccess)
+		return getPointerKindImpl(p);
+
+	// Most values have been already cached and resolved, look them up in parallel
+	{
+		sys::ScopedReader guard(concurrentAccessLock);
+		auto it = pointerKindData.valueMap.find(p);
+		if(it!=pointerKindData.valueMap.end() && it->second!=INDIRECT)
+			return it->second.getPointerKind(PREF_NONE);
+	}
+	ConcurrentWriteGuard guard(concurrentAccessLock, concurrentAccess);
+	return getPointerKindImpl(p);
+}
+
+POINTER_KIND PointerAnalyzer::getPointerKindImpl(const Value* p) const
 {
 #ifndef NDEBUG
 	TimerGuard guard(gpkTimer);
@@ -1300,6 +1694,7 @@ POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
 
 POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 {
+	ConcurrentWriteGuard guard(concurrentAccessLock, concurrentAccess);
 	if(TypeSupport::hasByteLayout(F->getReturnType()->getPointerElementType()))
 		return BYTE_LAYOUT;
 
@@ -1318,6 +1713,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 
 POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) const
 {
+	ConcurrentWriteGuard guard(concurrentAccessLock, concurrentAccess);
 	IndirectPointerKindConstraint c(STORED_TYPE_CONSTRAINT, pointerType->getPointerElementType());
 	auto it=pointerKindData.constraintsMap.find(c);
 	if(it==pointerKindData.constraintsMap.end())
@@ -1335,6 +1731,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) con
 
 POINTER_KIND PointerAnalyzer::getPointerKindForArgumentTypeAndIndex( const TypeAndIndex& argTypeAndIndex ) const
 {
+	ConcurrentWriteGuard guard(concurrentAccessLock, concurrentAccess);
 	if(TypeSupport::hasByteLayout(argTypeAndIndex.type))
 		return BYTE_LAYOUT;
 
@@ -1352,6 +1749,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForArgumentTypeAndIndex( const TypeA
 
 POINTER_KIND PointerAnalyzer::getPointerKindForMemberPointer(const TypeAndIndex& baseAndIndex) const
 {
+	ConcurrentWriteGuard guard(concurrentAccessLock, concurrentAccess);
 	IndirectPointerKindConstraint c(BASE_AND_INDEX_CONSTRAINT, baseAndIndex);
 	auto it=pointerKindData.constraintsMap.find(c);
 	if(it==pointerKindData.constraintsMap.end())
@@ -1386,6 +1784,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForMemberImpl(const TypeAndIndex& ba
 
 POINTER_KIND PointerAnalyzer::getPointerKindForMember(const TypeAndIndex& baseAndIndex) const
 {
+	ConcurrentWriteGuard guard(concurrentAccessLock, concurrentAccess);
 	return getPointerKindForMemberImpl(baseAndIndex, pointerKindData, addressTakenCache);
 }
 
@@ -1527,56 +1926,78 @@ void PointerAnalyzer::invalidate(const Value * v)
 
 void PointerAnalyzer::fullResolve()
 {
+	PointerConstraintGraph<PointerKindWrapper> graph(pointerKindData, addressTakenCache);
+	// The preference of each node, PREF_NONE for pointers stored in members. Their preference depends on the kind of
+	// the pointers to the same member, so they are solved after them.
+	std::vector<REGULAR_POINTER_PREFERENCE> preferences;
 	for(auto& it: pointerKindData.argsMap)
 	{
-		if(it.second!=INDIRECT)
-		{
-			it.second.applyRegularPreference(PREF_SPLIT_REGULAR);
-			continue;
-		}
-		bool mayCache = true;
-		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
-		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==SPLIT_REGULAR || k==REGULAR);
-		it.second = k;
-		it.second.applyRegularPreference(PREF_SPLIT_REGULAR);
+		graph.addNode(it.second, NULL);
+		preferences.push_back(PREF_SPLIT_REGULAR);
 	}
 	for(auto& it: pointerKindData.baseStructAndIndexMapForMembers)
 	{
-		if(it.second!=INDIRECT)
-		{
-			it.second.applyRegularPreference(PREF_REGULAR);
-			continue;
-		}
-		bool mayCache = true;
-		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
-		// BYTE_LAYOUT is not expected for the kind of pointers to member
-		assert(k==COMPLETE_OBJECT || k==SPLIT_REGULAR || k==REGULAR);
-		it.second = k;
-		it.second.applyRegularPreference(PREF_REGULAR);
+		graph.addNode(it.second, NULL);
+		preferences.push_back(PREF_REGULAR);
 	}
 	for(auto& it: pointerKindData.constraintsMap)
 	{
-		REGULAR_POINTER_PREFERENCE pref = getRegularPreference(it.first, pointerKindData, addressTakenCache);
-		assert(pref != PREF_NONE);
-		if(it.second!=INDIRECT)
+		uint32_t n = graph.addNode(it.second, &it.first);
+		if(it.first.kind == BASE_AND_INDEX_CONSTRAINT)
 		{
-			it.second.applyRegularPreference(pref);
-			continue;
+			TypeAndIndex tai(it.first.typePtr, it.first.i, TypeAndIndex::STRUCT_MEMBER);
+			auto member = pointerKindData.baseStructAndIndexMapForMembers.find(tai);
+			if(member != pointerKindData.baseStructAndIndexMapForMembers.end())
+			{
+				graph.nodes[n].orderDep = graph.getNodeForData(member->second);
+				preferences.push_back(PREF_NONE);
+				continue;
+			}
 		}
-		bool mayCache = true;
-		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
-		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==REGULAR || k==SPLIT_REGULAR);
-		it.second = k;
-		it.second.applyRegularPreference(pref);
-	}
+		preferences.push_back(getRegularPreference(it.first, pointerKindData, addressTakenCache));
+	}
+	graph.addEdges();
+
+	std::vector<PointerKindWrapper> resolved(graph.nodes.size());
+	graph.solve([&](uint32_t n) -> bool
+	{
+		const PointerConstraintGraph<PointerKindWrapper>::Node& node = graph.nodes[n];
+		assert(node.data.isKnown());
+		PointerKindWrapper k;
+		if(node.data!=INDIRECT)
+			k = node.data;
+		for(uint32_t d: node.deps)
+			joinResolvedKind(k, resolved[d]);
+		REGULAR_POINTER_PREFERENCE pref = preferences[n];
+		if(pref == PREF_NONE)
+		{
+			// A pointer which requires a wrapping array can't be SPLIT_REGULAR
+			pref = resolved[node.orderDep] == REGULAR ? PREF_REGULAR : PREF_SPLIT_REGULAR;
+		}
+		k.applyRegularPreference(pref);
+		bool changed = k.getPointerKind(PREF_NONE) != resolved[n].getPointerKind(PREF_NONE);
+		resolved[n].swap(k);
+		return changed;
+	});
+
 	for(auto& it: pointerKindData.valueMap)
 	{
 		if(it.second!=INDIRECT)
 			continue;
-		bool mayCache = true;
-		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
+		PointerKindWrapper k;
+		for(const IndirectPointerKindConstraint* c: it.second.constraints)
+		{
+			uint32_t d = graph.getNodeForConstraint(*c);
+			if(d != graph.NO_NODE)
+				joinResolvedKind(k, resolved[d]);
+		}
 		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==REGULAR || k==SPLIT_REGULAR);
-		it.second = k;
+		it.second.swap(k);
+	}
+	for(uint32_t i=0;i<graph.nodes.size();i++)
+	{
+		assert(resolved[i]==COMPLETE_OBJECT || resolved[i]==BYTE_LAYOUT || resolved[i]==REGULAR || resolved[i]==SPLIT_REGULAR);
+		graph.nodes[i].data.swap(resolved[i]);
 	}
 #ifndef NDEBUG
 	fullyResolved = true;
@@ -1637,6 +2058,64 @@ void PointerAnalyzer::computeConstantOffsets(const Module& M)
 			globalsUsersQueue.push_back(v);
 		}
 	}
+
+	// Resolve the offsets which depend on constraints now, so that the getConstantOffsetFor* queries
+	// never need to modify the data. All the resolutions see the unresolved state, then they are stored.
+	PointerConstraintGraph<PointerConstantOffsetWrapper> graph(pointerOffsetData, addressTakenCache);
+	for(auto& it: pointerOffsetData.argsMap)
+		graph.addNode(it.second, NULL);
+	for(auto& it: pointerOffsetData.constraintsMap)
+		graph.addNode(it.second, &it.first);
+	graph.addEdges();
+
+	std::vector<PointerConstantOffsetWrapper> resolved(graph.nodes.size());
+	graph.solve([&](uint32_t n) -> bool
+	{
+		const PointerConstraintGraph<PointerConstantOffsetWrapper>::Node& node = graph.nodes[n];
+		assert(!node.data.isUnknown());
+		PointerConstantOffsetWrapper o = getOwnOffset(node.data);
+		if(node.hasDefaultDep)
+			joinResolvedOffset(o, PointerConstantOffsetWrapper::staticDefaultValue);
+		for(uint32_t d: node.deps)
+			joinResolvedOffset(o, resolved[d]);
+		PointerConstantOffsetWrapper& old = resolved[n];
+		bool changed = o.isInvalid() != old.isInvalid() || o.isValid() != old.isValid() ||
+				(o.isValid() && o.getPointerOffset() != old.getPointerOffset());
+		old = o;
+		return changed;
+	});
+
+	Type* Int32Ty=IntegerType::get(M.getContext(), 32);
+	const ConstantInt* zeroOffset=cast<ConstantInt>(ConstantInt::get(Int32Ty, 0));
+	std::vector<std::pair<PointerConstantOffsetWrapper*, PointerConstantOffsetWrapper>> resolvedOffsets;
+	auto storeOffset = [&](PointerConstantOffsetWrapper& o, PointerConstantOffsetWrapper ret)
+	{
+		// Offsets which are only constrained by uninitialized values are 0
+		if(ret.isUninitialized())
+			ret=PointerConstantOffsetWrapper(zeroOffset);
+		resolvedOffsets.emplace_back(&o, ret);
+	};
+	for(auto& it: pointerOffsetData.valueMap)
+	{
+		if(!it.second.hasConstraints())
+			continue;
+		assert(!it.second.isInvalid() && !it.second.isUnknown());
+		PointerConstantOffsetWrapper ret = getOwnOffset(it.second);
+		for(const IndirectPointerKindConstraint* c: it.second.constraints)
+		{
+			uint32_t d = graph.getNodeForConstraint(*c);
+			joinResolvedOffset(ret, d == graph.NO_NODE ? PointerConstantOffsetWrapper::staticDefaultValue : resolved[d]);
+		}
+		storeOffset(it.second, ret);
+	}
+	for(uint32_t i=0;i<graph.nodes.size();i++)
+	{
+		const PointerConstraintGraph<PointerConstantOffsetWrapper>::Node& node = graph.nodes[i];
+		if(node.constraint && node.constraint->kind == BASE_AND_INDEX_CONSTRAINT && node.data.hasConstraints())
+			storeOffset(node.data, resolved[i]);
+	}
+	for(auto& it: resolvedOffsets)
+		it.first->swap(it.second);
 }
 
 #ifndef NDEBUG
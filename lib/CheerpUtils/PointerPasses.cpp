@@ -555,6 +555,9 @@ bool FreeAndDeleteRemoval::runOnFunction(Function& F)
 			if(F->getIntrinsicID()==Intrinsic::cheerp_deallocate ||
 				F->getName()=="free")
 			{
+				StructType* freedType = dyn_cast<StructType>(cheerp::TypeSupport::getFreedObject(call->getArgOperand(0))->getType()->getPointerElementType());
+				if(freedType && cheerp::TypeSupport::isPooledType(freedType, poolTypes))
+					continue;
 				deleteInstructionAndUnusedOperands(call);
 				Changed = true;
 			}
@@ -575,7 +578,7 @@ void FreeAndDeleteRemoval::getAnalysisUsage(AnalysisUsage & AU) const
 	llvm::Pass::getAnalysisUsage(AU);
 }
 
-FunctionPass *createFreeAndDeleteRemovalPass() { return new FreeAndDeleteRemoval(); }
+FunctionPass *createFreeAndDeleteRemovalPass(const std::vector<std::string>& poolTypes) { return new FreeAndDeleteRemoval(poolTypes); }
 
 Instruction* DelayAllocas::findCommonInsertionPoint(AllocaInst* AI, DominatorTree* DT, Instruction* currentInsertionPoint, Instruction* user)
 {
@@ -10,6 +10,8 @@
 //===---------------------------------------------------------------------===//
 
 #define DEBUG_TYPE "pre-execute"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Cheerp/PreExecute.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
@@ -29,6 +31,12 @@
 using namespace llvm;
 
 static cl::opt<bool> PreExecuteMain("cheerp-preexecute-main", cl::desc("Run main/webMain in the PreExecuter step") );
+static cl::opt<bool> PreExecuteReport("cheerp-preexecute-report", cl::desc("Report which constructors have been folded by the PreExecuter step") );
+
+STATISTIC(NumStores, "Number of stores processed during pre-execution");
+STATISTIC(NumFolded, "Number of constructors folded by pre-execution");
+STATISTIC(NumPromotedAllocations, "Number of heap allocations serialized into globals");
+STATISTIC(NumRolledBack, "Number of failed pre-executions which have been rolled back");
 
 namespace cheerp {
 
@@ -72,31 +80,30 @@ static GenericValue pre_execute_pointer_base(FunctionType *FT,
                                          const std::vector<GenericValue> &Args) {
   char *p = (char *)(GVTOP(Args[0]));
   // TODO: We currently only support malloc memory
-  auto it = PreExecute::currentPreExecutePass->typedAllocations.upper_bound(p);
-  assert (it != PreExecute::currentPreExecutePass->typedAllocations.begin());
-  --it;
-  // Verify that the address is in the memory block
-  assert (p >= it->first);
-  AllocData& allocData = it->second;
   // The edge of the allocation is a valid pointer
-  assert(p <= (it->first + allocData.size));
-  return GenericValue(it->first);
+  auto range = PreExecute::currentPreExecutePass->typedAllocations.find(p, /*includeEnd*/true);
+  if (!range)
+  {
+    PreExecute::currentPreExecutePass->recordFailure("pointer base of untyped memory");
+    return GenericValue((void*)nullptr);
+  }
+  return GenericValue(range->start);
 }
 
 static GenericValue pre_execute_pointer_offset(FunctionType *FT,
                                          const std::vector<GenericValue> &Args) {
   char *p = (char *)(GVTOP(Args[0]));
   // TODO: We currently only support malloc memory
-  auto it = PreExecute::currentPreExecutePass->typedAllocations.upper_bound(p);
-  assert (it != PreExecute::currentPreExecutePass->typedAllocations.begin());
-  --it;
-  // Verify that the address is in the memory block
-  assert (p >= it->first);
-  AllocData& allocData = it->second;
   // The edge of the allocation is a valid pointer
-  assert(p <= (it->first + allocData.size));
+  auto range = PreExecute::currentPreExecutePass->typedAllocations.find(p, /*includeEnd*/true);
   GenericValue GV;
-  GV.IntVal = APInt(32, p - it->first);
+  if (!range)
+  {
+    PreExecute::currentPreExecutePass->recordFailure("pointer offset of untyped memory");
+    GV.IntVal = APInt(32, 0);
+    return GV;
+  }
+  GV.IntVal = APInt(32, p - range->start);
   return GV;
 }
 
@@ -122,12 +129,16 @@ static GenericValue pre_execute_reallocate(FunctionType *FT,
   void *p = (void *)(GVTOP(Args[0]));
   size_t size=(size_t)(Args[1].IntVal.getLimitedValue());
   ExecutionEngine *currentEE = PreExecute::currentPreExecutePass->currentEE;
+  // Find out the old size
+  auto range = PreExecute::currentPreExecutePass->typedAllocations.findStart((char*)p);
+  if (!range)
+  {
+    PreExecute::currentPreExecutePass->recordFailure("reallocation of untyped memory");
+    return GenericValue((void*)nullptr);
+  }
   void* ret = currentEE->MemoryAllocator.Allocate(size+4, 8);
   memset(ret, 0, size);
-  // Find out the old size
-  auto it = PreExecute::currentPreExecutePass->typedAllocations.find((char*)p);
-  assert(it != PreExecute::currentPreExecutePass->typedAllocations.end());
-  uint32_t oldSize = it->second.size;
+  uint32_t oldSize = range->data.size;
   // Copy the old contents in the new buffer
   memcpy(ret, p, oldSize);
 
@@ -164,8 +175,38 @@ static GenericValue pre_execute_cast(FunctionType *FT,
 static GenericValue pre_execute_memcpy(FunctionType *FT,
                                        const std::vector<GenericValue> &Args) {
   // Support fully typed memcpy
-  memcpy(GVTOP(Args[0]), GVTOP(Args[1]),
-         (size_t)(Args[2].IntVal.getLimitedValue()));
+  size_t size = (size_t)(Args[2].IntVal.getLimitedValue());
+  // The copy does not go through the interpreter, track it as a store
+  if (size)
+    PreExecute::currentPreExecutePass->recordStore(GVTOP(Args[0]));
+  memcpy(GVTOP(Args[0]), GVTOP(Args[1]), size);
+
+  GenericValue GV;
+  GV.IntVal = 0;
+  return GV;
+}
+
+static GenericValue pre_execute_memmove(FunctionType *FT,
+                                        const std::vector<GenericValue> &Args) {
+  size_t size = (size_t)(Args[2].IntVal.getLimitedValue());
+  // The copy does not go through the interpreter, track it as a store
+  if (size)
+    PreExecute::currentPreExecutePass->recordStore(GVTOP(Args[0]));
+  memmove(GVTOP(Args[0]), GVTOP(Args[1]), size);
+
+  GenericValue GV;
+  GV.IntVal = 0;
+  return GV;
+}
+
+static GenericValue pre_execute_memset(FunctionType *FT,
+                                       const std::vector<GenericValue> &Args) {
+  int val = (int)(Args[1].IntVal.getZExtValue());
+  size_t size = (size_t)(Args[2].IntVal.getLimitedValue());
+  // Like memcpy, the memory is written without going through the interpreter
+  if (size)
+    PreExecute::currentPreExecutePass->recordStore(GVTOP(Args[0]));
+  memset(GVTOP(Args[0]), val, size);
 
   GenericValue GV;
   GV.IntVal = 0;
@@ -305,6 +346,10 @@ static void* LazyFunctionCreator(const std::string& funcName)
         return (void*)(void(*)())pre_execute_pointer_offset;
     if (strncmp(funcName.c_str(), "llvm.memcpy.", strlen("llvm.memcpy."))==0)
         return (void*)(void(*)())pre_execute_memcpy;
+    if (strncmp(funcName.c_str(), "llvm.memmove.", strlen("llvm.memmove."))==0)
+        return (void*)(void(*)())pre_execute_memmove;
+    if (strncmp(funcName.c_str(), "llvm.memset.", strlen("llvm.memset."))==0)
+        return (void*)(void(*)())pre_execute_memset;
     if (strcmp(funcName.c_str(), "_Z11assertEqualIcEvRKT_S2_PKc") == 0)
         return (void*)(void(*)())assertEqual<char>;
     if (strcmp(funcName.c_str(), "_Z11assertEqualIsEvRKT_S2_PKc") == 0)
@@ -334,20 +379,241 @@ static void* LazyFunctionCreator(const std::string& funcName)
     if (strcmp(funcName.c_str(), "llvm.dbg.value") == 0)
         return (void*)(void(*)())emptyFunction;
 
+    // Intrinsics are probed before being lowered, and other functions may
+    // still be found by the interpreter, the failure is reported by it
     return NULL;
 }
 
 void PreExecute::recordStore(void* Addr)
 {
+    NumStores++;
+    // The store has not happened yet, save the memory the first time it is
+    // touched in this transaction
     // Look for the address in the globals, if found keep note of this
-    const GlobalValue* GV=currentEE->getGlobalValueAtAddress(Addr);
-    if(!GV)
-        return;
-    if(const GlobalVariable* GVar = dyn_cast<GlobalVariable>(GV))
+    auto range = globalRanges.find((char*)Addr, /*includeEnd*/false);
+    if (range)
     {
-        modifiedGlobals.insert(std::make_pair(const_cast<GlobalVariable*>(GVar),nullptr));
+        if (range->data.transaction != currentTransaction)
+        {
+            saveSnapshot(range->start, range->end, &range->data);
+            range->data.transaction = currentTransaction;
+        }
+        range->data.modified = true;
         return;
     }
+    // Allocations done in this transaction are dropped on rollback
+    auto alloc = typedAllocations.find((char*)Addr, /*includeEnd*/false);
+    if (alloc && alloc->data.transaction != currentTransaction)
+    {
+        saveSnapshot(alloc->start, alloc->end, nullptr);
+        alloc->data.transaction = currentTransaction;
+    }
+}
+
+void PreExecute::recordFailure(const std::string& reason)
+{
+    if (failureReason.empty())
+        failureReason = reason;
+    currentEE->markFailed();
+}
+
+void PreExecute::saveSnapshot(char* start, char* end, GlobalData* global)
+{
+    snapshots.push_back(MemorySnapshot());
+    MemorySnapshot& snapshot = snapshots.back();
+    snapshot.start = start;
+    snapshot.data.assign(start, end);
+    snapshot.global = global;
+    snapshot.wasModified = global && global->modified;
+}
+
+void PreExecute::beginTransaction()
+{
+    currentTransaction++;
+    snapshots.clear();
+    transactionAllocations.clear();
+    failureReason.clear();
+}
+
+void PreExecute::commitTransaction()
+{
+    snapshots.clear();
+    transactionAllocations.clear();
+}
+
+void PreExecute::rollbackTransaction()
+{
+    for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it)
+    {
+        memcpy(it->start, it->data.data(), it->data.size());
+        if (it->global)
+            it->global->modified = it->wasModified;
+    }
+    // The memory of the dropped allocations is not reused, but nothing can point to it anymore
+    for (char* buf : transactionAllocations)
+        typedAllocations.erase(buf);
+    commitTransaction();
+    NumRolledBack++;
+}
+
+bool PreExecute::runInTransaction(Function* func)
+{
+    beginTransaction();
+    currentEE->runFunction(func, std::vector<GenericValue>());
+    if (!currentEE->hasFailed() && isTransactionSerializable(currentModule->getDataLayout()))
+    {
+        commitTransaction();
+        return true;
+    }
+    rollbackTransaction();
+    if (failureReason.empty())
+        failureReason = currentEE->getFailureReason().str();
+    if (failureReason.empty())
+        failureReason = "execution failed";
+    currentEE->clearFailure();
+    return false;
+}
+
+llvm::Type* getTypeSafeGepForAddress(SmallVector<Constant*, 4>& Indices, Type* Int32Ty, const DataLayout* DL,
+                    Type* startType, Type* endType, uint32_t Offset);
+
+static bool isSupportedType(Type* t)
+{
+    if (t->isIntegerTy() || t->isFloatTy() || t->isDoubleTy() || t->isPointerTy())
+        return true;
+    if (StructType* ST = dyn_cast<StructType>(t))
+        return std::all_of(ST->element_begin(), ST->element_end(), isSupportedType);
+    if (ArrayType* AT = dyn_cast<ArrayType>(t))
+        return isSupportedType(AT->getElementType());
+    return false;
+}
+
+static bool containsPointers(Type* t)
+{
+    if (t->isPointerTy())
+        return true;
+    if (StructType* ST = dyn_cast<StructType>(t))
+        return std::any_of(ST->element_begin(), ST->element_end(), containsPointers);
+    if (ArrayType* AT = dyn_cast<ArrayType>(t))
+        return containsPointers(AT->getElementType());
+    return false;
+}
+
+Type* PreExecute::getAllocationGlobalType(const DataLayout* DL, const AllocData& data)
+{
+    // Make it an array, if it's more than 1 element long
+    uint32_t elementSize = DL->getTypeAllocSize(data.allocType);
+    uint32_t size = data.size / elementSize;
+    return size > 1 ? ArrayType::get(data.allocType, size) : data.allocType;
+}
+
+bool PreExecute::isSerializable(const DataLayout* DL, Type* memType, char* Addr)
+{
+    if (!containsPointers(memType))
+        return isSupportedType(memType);
+    if (StructType* ST = dyn_cast<StructType>(memType))
+    {
+        const StructLayout* SL = DL->getStructLayout(ST);
+        for (uint32_t i = 0; i < ST->getNumElements(); i++)
+        {
+            if (!isSerializable(DL, ST->getElementType(i), Addr + SL->getElementOffset(i)))
+                return false;
+        }
+        return true;
+    }
+    if (ArrayType* AT = dyn_cast<ArrayType>(memType))
+    {
+        uint32_t elementSize = DL->getTypeAllocSize(AT->getElementType());
+        for (uint32_t i = 0; i < AT->getNumElements(); i++)
+        {
+            if (!isSerializable(DL, AT->getElementType(), Addr + i*elementSize))
+                return false;
+        }
+        return true;
+    }
+    PointerType* PT = cast<PointerType>(memType);
+    char* StoredAddr = nullptr;
+    memcpy(&StoredAddr, Addr, DL->getTypeStoreSize(PT));
+    if (StoredAddr == nullptr || PT->getElementType()->isFunctionTy())
+        return true;
+    Type* Int32Ty = IntegerType::get(currentModule->getContext(), 32);
+    SmallVector<Constant*, 4> Indices;
+    if (auto range = findGlobalRange(StoredAddr))
+    {
+        return getTypeSafeGepForAddress(Indices, Int32Ty, DL, range->data.globalValue->getType(),
+                PT->getElementType(), StoredAddr - range->start);
+    }
+    // The edge of the allocation is a valid pointer
+    if (auto range = typedAllocations.find(StoredAddr, /*includeEnd*/true))
+    {
+        Type* globalType = getAllocationGlobalType(DL, range->data);
+        return getTypeSafeGepForAddress(Indices, Int32Ty, DL, globalType->getPointerTo(),
+                PT->getElementType(), StoredAddr - range->start);
+    }
+    return false;
+}
+
+bool PreExecute::isTransactionSerializable(const DataLayout* DL)
+{
+    bool serializable = true;
+    // Memory which existed before the transaction and has been written
+    for (const MemorySnapshot& snapshot : snapshots)
+    {
+        Type* memType;
+        if (snapshot.global)
+            memType = snapshot.global->globalValue->getType()->getPointerElementType();
+        else
+            memType = getAllocationGlobalType(DL, typedAllocations.findStart(snapshot.start)->data);
+        serializable &= isSerializable(DL, memType, snapshot.start);
+    }
+    // Memory allocated by the transaction
+    for (char* buf : transactionAllocations)
+    {
+        Type* memType = getAllocationGlobalType(DL, typedAllocations.findStart(buf)->data);
+        serializable &= isSerializable(DL, memType, buf);
+    }
+    if (!serializable)
+        failureReason = "stores a pointer to memory which can not be serialized";
+    return serializable;
+}
+
+/**
+ * Collect the globals which may be accessed by F, following direct and indirect
+ * uses of functions and the initializers of the globals
+ */
+static void collectReachableGlobals(const Function* F, SmallSetVector<const GlobalVariable*, 32>& globals)
+{
+    SmallPtrSet<const Constant*, 32> visited;
+    SmallVector<const Constant*, 32> worklist;
+    worklist.push_back(F);
+    while (!worklist.empty())
+    {
+        const Constant* C = worklist.pop_back_val();
+        if (!visited.insert(C).second)
+            continue;
+        if (const GlobalVariable* GV = dyn_cast<GlobalVariable>(C))
+        {
+            globals.insert(GV);
+            if (GV->hasInitializer())
+                worklist.push_back(GV->getInitializer());
+        }
+        else if (const Function* func = dyn_cast<Function>(C))
+        {
+            for (const BasicBlock& BB : *func)
+                for (const Instruction& I : BB)
+                    for (const Value* op : I.operands())
+                        if (isa<Constant>(op))
+                            worklist.push_back(cast<Constant>(op));
+        }
+        else if (const GlobalAlias* GA = dyn_cast<GlobalAlias>(C))
+            worklist.push_back(GA->getAliasee());
+        else
+        {
+            for (const Value* op : C->operands())
+                if (isa<Constant>(op))
+                    worklist.push_back(cast<Constant>(op));
+        }
+    }
 }
 
 static bool isTypeCompatible(Type* curType, Type* endType)
@@ -378,8 +644,13 @@ llvm::Type* getTypeSafeGepForAddress(SmallVector<Constant*, 4>& Indices, Type* I
         Type* ET = PT->getElementType();
         uint32_t elementSize = DL->getTypeAllocSize(ET);
         uint32_t elementOffset = Offset/elementSize;
+        // The end of a global array, e.g. the capacity of a vector buffer, is reached
+        // by indexing the array past its last element, not the global past itself
+        if (Offset == elementSize && isa<ArrayType>(ET) && !isTypeCompatible(ET, endType))
+            elementOffset = 0;
+        else
+            Offset %= elementSize;
         Indices.push_back(ConstantInt::get(Int32Ty, elementOffset));
-        Offset %= elementSize;
         curType = ET;
     }
     Type* typeAtLastNotZero = curType;
@@ -450,31 +721,22 @@ Constant* PreExecute::findPointerFromGlobal(const DataLayout* DL,
 
 GlobalValue* PreExecute::getGlobalForMalloc(const DataLayout* DL, char* StoredAddr, char*& MallocStartAddress)
 {
-    auto it = typedAllocations.upper_bound(StoredAddr);
-    if (it == typedAllocations.begin())
-        return NULL;
-    --it;
-    // Verify that the address is in the memory block
-    if (StoredAddr < it->first)
-        return NULL;
-    AllocData& allocData = it->second;
     // The edge of the allocation is a valid pointer
-    if (StoredAddr > (it->first + allocData.size))
+    auto range = typedAllocations.find(StoredAddr, /*includeEnd*/true);
+    if (!range)
         return NULL;
-    MallocStartAddress = it->first;
+    AllocData& allocData = range->data;
+    MallocStartAddress = range->start;
     if (allocData.globalValue)
         return allocData.globalValue;
     // We need to promote this memory to a globalvalue
-    // Make it an array, if it's more than 1 element long
-    uint32_t elementSize = DL->getTypeAllocSize(allocData.allocType);
-    uint32_t size = allocData.size / elementSize;
-    Type* newGlobalType = size > 1 ? ArrayType::get(allocData.allocType, size) : allocData.allocType;
+    Type* newGlobalType = getAllocationGlobalType(DL, allocData);
 
     allocData.globalValue = new GlobalVariable(*currentModule, newGlobalType,
             false, GlobalValue::InternalLinkage, nullptr, "promotedMalloc");
 
-    // Build an initializer
-    allocData.globalValue->setInitializer(computeInitializerFromMemory(DL, newGlobalType, it->first));
+    // The initializer is built later, object graphs may be too deep to do it recursively
+    pendingAllocations.push_back(std::make_pair(allocData.globalValue, MallocStartAddress));
 
     return allocData.globalValue;
 }
@@ -484,12 +746,10 @@ Constant* PreExecute::computeInitializerFromMemory(const DataLayout* DL,
 {
     if (IntegerType* IT=dyn_cast<IntegerType>(memType))
     {
-        if (IT->getBitWidth() > 32)
-            return NULL;
         // Assume little endian
-        uint32_t integerVal = 0;
-        memcpy(&integerVal, Addr, std::max(IT->getBitWidth()/8, 1u));
-        return ConstantInt::get(IT, integerVal);
+        SmallVector<uint64_t, 2> words((IT->getBitWidth() + 63) / 64, 0);
+        memcpy(words.data(), Addr, DL->getTypeStoreSize(IT));
+        return ConstantInt::get(IT->getContext(), APInt(IT->getBitWidth(), words));
     }
     else if (memType->isFloatTy())
     {
@@ -552,19 +812,18 @@ Constant* PreExecute::computeInitializerFromMemory(const DataLayout* DL,
 	}
 
         Type* Int32Ty = IntegerType::get(currentModule->getContext(), 32);
-        const GlobalValue* GV = currentEE->getGlobalValueAtAddress(StoredAddr);
-        if (GV)
+        auto range = findGlobalRange(StoredAddr);
+        if (range)
         {
-            char* GlobalStartAddr = (char*)currentEE->getPointerToGlobal(GV);
             Constant* ret = findPointerFromGlobal(DL, memType,
-                    const_cast<GlobalValue*>(GV), GlobalStartAddr,
+                    range->data.globalValue, range->start,
                     StoredAddr, Int32Ty);
             return ret;
         }
 
         // Look inside type safe allocated memory
         char* MallocStartAddress;
-        GV = getGlobalForMalloc(DL, StoredAddr, MallocStartAddress);
+        const GlobalValue* GV = getGlobalForMalloc(DL, StoredAddr, MallocStartAddress);
         if (GV)
         {
 #ifdef DEBUG_PRE_EXECUTE
@@ -591,8 +850,10 @@ bool PreExecute::runOnModule(Module& m)
     std::string error;
     std::string triple = sys::getDefaultTargetTriple();
     const Target *target = TargetRegistry::lookupTarget(triple, error);
-    TargetMachine* machine;
-    machine = target->createTargetMachine(triple, "", "", TargetOptions());
+    // The interpreter does not need a target machine, and the host target may not be built
+    TargetMachine* machine = nullptr;
+    if (target)
+        machine = target->createTargetMachine(triple, "", "", TargetOptions());
 
     std::unique_ptr<Module> uniqM(&m);
 
@@ -610,7 +871,63 @@ bool PreExecute::runOnModule(Module& m)
     currentEE->InstallStoreListener(StoreListener);
     currentEE->InstallLazyFunctionCreator(LazyFunctionCreator);
 
+    // Index the memory of the globals, they have all been allocated by the execution engine
+    const DataLayout *DL = m.getDataLayout();
+    for (GlobalVariable& GV : m.globals())
+    {
+        char* Addr = (char*)currentEE->getPointerToGlobalIfAvailable(&GV);
+        if (!Addr)
+            continue;
+        uint64_t size = DL->getTypeAllocSize(GV.getType()->getPointerElementType());
+        globalRanges.insert(Addr, Addr + size, GlobalData(&GV));
+    }
+
+    // Globals which may be accessed by the code kept at run-time, mapped to the first function using them.
+    // Code sharing any of them is not folded, since it may observe the missing side effects
+    DenseMap<const GlobalVariable*, const Function*> runtimeGlobals;
+    // Returns true if func has been folded
+    auto preExecute = [&](Function* func) -> bool
+    {
+        SmallSetVector<const GlobalVariable*, 32> reachable;
+        const Function* dependency = nullptr;
+        const GlobalVariable* sharedGlobal = nullptr;
+        if (!runtimeGlobals.empty())
+        {
+            collectReachableGlobals(func, reachable);
+            for (const GlobalVariable* GV : reachable)
+            {
+                auto it = runtimeGlobals.find(GV);
+                if (it == runtimeGlobals.end())
+                    continue;
+                dependency = it->second;
+                sharedGlobal = GV;
+                break;
+            }
+        }
+        bool folded = !dependency && runInTransaction(func);
+        if (PreExecuteReport)
+        {
+            llvm::errs() << "PreExecute: ";
+            if (folded)
+                llvm::errs() << "folded " << func->getName() << "\n";
+            else if (dependency)
+                llvm::errs() << "kept " << func->getName() << ": depends on " << dependency->getName()
+                             << " through " << sharedGlobal->getName() << "\n";
+            else
+                llvm::errs() << "kept " << func->getName() << ": " << failureReason << "\n";
+        }
+        if (folded)
+            return true;
+        if (reachable.empty())
+            collectReachableGlobals(func, reachable);
+        for (const GlobalVariable* GV : reachable)
+            runtimeGlobals.insert(std::make_pair(GV, func));
+        return false;
+    };
+
     GlobalVariable * constructorVar = m.getGlobalVariable("llvm.global_ctors");
+    // Constructors which could not be folded, they stay in llvm.global_ctors
+    SmallVector<Constant*, 4> runtimeConstructors;
 
     if (constructorVar)
     {
@@ -627,7 +944,13 @@ bool PreExecute::runOnModule(Module& m)
         {
             Constant *elem = cast<Constant>(*it);
             Function* func = cast<Function>(elem->getAggregateElement(1));
-            currentEE->runFunction(func, std::vector< GenericValue >());
+            if (preExecute(func))
+            {
+                NumFolded++;
+                Changed = true;
+            }
+            else
+                runtimeConstructors.push_back(elem);
         }
     }
 
@@ -637,8 +960,20 @@ bool PreExecute::runOnModule(Module& m)
         if (!mainFunc)
             mainFunc = m.getFunction("main");
         assert(mainFunc && "unable to find main/webMain in module!");
-        currentEE->runFunction(mainFunc, std::vector<GenericValue>());
-        mainFunc->eraseFromParent();
+        if (preExecute(mainFunc))
+        {
+            mainFunc->eraseFromParent();
+            Changed = true;
+        }
+    }
+
+    // Collect the modified globals in module order, so that the output is deterministic
+    std::vector<std::pair<GlobalVariable*, Constant*>> modifiedGlobals;
+    for (GlobalVariable& GV : m.globals())
+    {
+        auto range = globalRanges.findStart((char*)currentEE->getPointerToGlobalIfAvailable(&GV));
+        if (range && range->data.modified)
+            modifiedGlobals.push_back(std::make_pair(&GV, nullptr));
     }
 
     // Compute new initializer for the modified globals
@@ -647,7 +982,6 @@ bool PreExecute::runOnModule(Module& m)
         GlobalVariable* GV = it.first;
         void* Addr = currentEE->getPointerToGlobal(GV);
         Constant* newInit;
-        const DataLayout *DL = m.getDataLayout();
         Type *ptrType = GV->getType()->getPointerElementType();
         newInit = computeInitializerFromMemory(DL, ptrType, (char*)Addr);
         assert(newInit);
@@ -655,6 +989,19 @@ bool PreExecute::runOnModule(Module& m)
         Changed = true;
     }
 
+    // Serialize the typed allocations reachable from the modified globals, computing
+    // the initializers may discover more of them
+    while (!pendingAllocations.empty())
+    {
+        GlobalVariable* GV = pendingAllocations.back().first;
+        char* Addr = pendingAllocations.back().second;
+        pendingAllocations.pop_back();
+        Constant* newInit = computeInitializerFromMemory(DL, GV->getType()->getPointerElementType(), Addr);
+        assert(newInit);
+        GV->setInitializer(newInit);
+        NumPromotedAllocations++;
+    }
+
     // Set new initializers for the modified globals
     for(auto& it: modifiedGlobals)
     {
@@ -666,15 +1013,25 @@ bool PreExecute::runOnModule(Module& m)
     currentEE->printMemoryStats();
 #endif
 
-    // Delete global constructors and remove the main body
-    if (constructorVar)
+    // Delete the folded global constructors
+    if (constructorVar && runtimeConstructors.empty())
+        constructorVar->eraseFromParent();
+    else if (constructorVar && runtimeConstructors.size() != constructorVar->getInitializer()->getNumOperands())
+    {
+        ArrayType* AT = ArrayType::get(runtimeConstructors[0]->getType(), runtimeConstructors.size());
+        GlobalVariable* newVar = new GlobalVariable(m, AT, false, GlobalValue::AppendingLinkage,
+                ConstantArray::get(AT, runtimeConstructors), "");
+        newVar->takeName(constructorVar);
         constructorVar->eraseFromParent();
+    }
 
     bool removed = currentEE->removeModule(&m);
     assert(removed && "failed to free the module from ExecutionEngine");
 
     delete currentEE;
 
+    globalRanges.clear();
+    typedAllocations.clear();
     currentPreExecutePass = NULL;
     currentModule = NULL;
     currentEE = NULL;
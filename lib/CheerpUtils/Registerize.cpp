@@ -10,6 +10,7 @@
 //===----------------------------------------------------------------------===//
 
 #define DEBUG_TYPE "CheerpRegisterize"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/Registerize.h"
@@ -19,6 +20,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Debug.h"
+#include <queue>
 
 using namespace llvm;
 
@@ -107,22 +109,23 @@ void Registerize::assignRegistersToInstructions(Function& F, cheerp::PointerAnal
 		// First, build live ranges for all instructions
 		LiveRangesTy liveRanges=computeLiveRanges(F, instIdMap, PA);
 		// Assign each instruction to a virtual register
-		uint32_t registersCount = assignToRegisters(liveRanges, PA);
+		uint32_t registersCount = assignToRegisters(liveRanges, instIdMap, PA);
 		// Now compute live ranges for alloca memory which is not in SSA form
 		NumRegisters += registersCount;
 		// To debug we need to know the ranges for each instructions and the assigned register
 		DEBUG(if (registersCount) dbgs() << "Function " << F.getName() << " needs " << registersCount << " registers\n");
 		// Very verbose debugging below, activate if needed
 #ifdef VERBOSEDEBUG
-		for(auto it: liveRanges)
+		for(uint32_t i=1;i<liveRanges.size();i++)
 		{
-			if(it.first->getParent()->getParent() != &F)
+			if(!liveRanges[i].isValid())
 				continue;
-			dbgs() << "Instruction " << *it.first << " alive in ranges ";
-			for(const Registerize::LiveRangeChunk& chunk: it.second.range)
+			Instruction* I=instIdMap.instructions[i];
+			dbgs() << "Instruction " << *I << " alive in ranges ";
+			for(const Registerize::LiveRangeChunk& chunk: liveRanges[i].range)
 				dbgs() << '[' << chunk.start << ',' << chunk.end << ')';
 			dbgs() << "\n";
-			dbgs() << "\tMapped to register " << registersMap[it.first] << "\n";
+			dbgs() << "\tMapped to register " << registersMap[I] << "\n";
 		}
 #endif
 	}
@@ -170,7 +173,7 @@ void Registerize::computeLiveRangeForAllocas(Function& F)
 
 Registerize::LiveRangesTy Registerize::computeLiveRanges(Function& F, const InstIdMapTy& instIdMap, cheerp::PointerAnalyzer & PA)
 {
-	BlocksState blocksState;
+	BlocksState blocksState(F);
 	for(BasicBlock& BB: F)
 	{
 		for(Instruction& I: BB)
@@ -194,66 +197,76 @@ Registerize::LiveRangesTy Registerize::computeLiveRanges(Function& F, const Inst
 	}
 	// Remove verbose debugging output
 #ifdef VERBOSEDEBUG
-	for(auto it: blocksState)
+	for(BasicBlock& BB: F)
 	{
-		llvm::errs() << "Block:\n" << *it.first << "\n";
+		llvm::errs() << "Block:\n" << BB << "\n";
 		llvm::errs() << "Inst out:\n";
-		for(Instruction* I: it.second.outSet)
+		for(Instruction* I: blocksState[&BB].outSet)
 			llvm::errs() << *I << "\n";
 	}
 #endif
 	// Depth first analysis of blocks, starting from the entry block
-	LiveRangesTy liveRanges(instIdMap);
+	LiveRangesTy liveRanges(instIdMap.instructions.size());
 	dfsLiveRangeInBlock(blocksState, liveRanges, instIdMap, F.getEntryBlock(), PA, 1, 1);
 	return liveRanges;
 }
 
 void Registerize::doUpAndMark(BlocksState& blocksState, BasicBlock* BB, Instruction* I)
 {
-	// Defined here, no propagation needed
-	if(I->getParent()==BB && !isa<PHINode>(I))
-		return;
-	BlockState& blockState=blocksState[BB];
-	// Already propagated
-	if(blockState.isLiveIn(I))
-		return;
-	blockState.setLiveIn(I);
-	if(I->getParent()==BB && isa<PHINode>(I))
-		return;
-	// Run on predecessor blocks
-	for(::pred_iterator it=pred_begin(BB);it!=pred_end(BB);++it)
+	// Use an explicit worklist, the chain of predecessors may be as long as the function
+	SmallVector<BasicBlock*, 8> worklist;
+	worklist.push_back(BB);
+	while(!worklist.empty())
 	{
-		BasicBlock* pred=*it;
-		BlockState& predBlockState=blocksState[pred];
-		if(!predBlockState.isLiveOut(I))
-			predBlockState.addLiveOut(I);
-		doUpAndMark(blocksState, pred, I);
+		BB = worklist.pop_back_val();
+		// Defined here, no propagation needed
+		if(I->getParent()==BB && !isa<PHINode>(I))
+			continue;
+		BlockState& blockState=blocksState[BB];
+		// Already propagated
+		if(blockState.isLiveIn(I))
+			continue;
+		blockState.setLiveIn(I);
+		if(I->getParent()==BB && isa<PHINode>(I))
+			continue;
+		// Run on predecessor blocks
+		for(::pred_iterator it=pred_begin(BB);it!=pred_end(BB);++it)
+		{
+			BasicBlock* pred=*it;
+			BlockState& predBlockState=blocksState[pred];
+			if(!predBlockState.isLiveOut(I))
+				predBlockState.addLiveOut(I);
+			worklist.push_back(pred);
+		}
 	}
 }
 
-void Registerize::assignInstructionsIds(InstIdMapTy& instIdMap, const Function& F, AllocaSetTy& allocaSet)
+void Registerize::assignInstructionsIds(InstIdMapTy& instIdMap, Function& F, AllocaSetTy& allocaSet)
 {
-	SmallVector<const BasicBlock*, 4> bbQueue;
-	std::set<const BasicBlock*> doneBlocks;
+	SmallVector<BasicBlock*, 4> bbQueue;
+	SmallPtrSet<const BasicBlock*, 16> doneBlocks;
 	uint32_t nextIndex = 1;
+	// Identifier 0 is never used
+	instIdMap.instructions.push_back(NULL);
 
 	bbQueue.push_back(&F.getEntryBlock());
 	while(!bbQueue.empty())
 	{
-		const BasicBlock* BB = bbQueue.pop_back_val();
+		BasicBlock* BB = bbQueue.pop_back_val();
 		if(!doneBlocks.insert(BB).second)
 			continue;
 
-		for (const Instruction& I: *BB)
+		for (Instruction& I: *BB)
 		{
 			// Take our chance to store away all alloca, they are registerized using non-SSA logic
 			if (isa<AllocaInst>(I))
 				allocaSet.push_back(cast<AllocaInst>(&I));
 			uint32_t thisIndex = nextIndex++;
 			instIdMap[&I]=thisIndex;
+			instIdMap.instructions.push_back(&I);
 		}
 
-		const TerminatorInst* term=BB->getTerminator();
+		TerminatorInst* term=BB->getTerminator();
 		uint32_t numSuccessors = term->getNumSuccessors();
 		for(uint32_t i=0;i<numSuccessors;i++)
 		{
@@ -277,10 +290,9 @@ uint32_t Registerize::dfsLiveRangeInBlock(BlocksState& blocksState, LiveRangesTy
 	// For each use used operands extend their live ranges to here
 	for (Instruction& I: BB)
 	{
-		assert(liveRanges.count(&I)==0);
 		uint32_t thisIndex = nextIndex++;
-		assert(instIdMap.count(&I));
-		assert(instIdMap.find(&I)->second==thisIndex);
+		assert(instIdMap.getId(&I)==thisIndex);
+		assert(!liveRanges[thisIndex].isValid());
 		// Inlineable instructions extends the life of the not-inlineable instructions they use.
 		// This happens inside extendRangeForUsedOperands.
 		if (isInlineable(I, PA))
@@ -288,15 +300,15 @@ uint32_t Registerize::dfsLiveRangeInBlock(BlocksState& blocksState, LiveRangesTy
 		// Void instruction and instructions without uses do not need any lifetime computation
 		if (!I.getType()->isVoidTy() && !I.use_empty())
 		{
-			InstructionLiveRange& range=liveRanges.emplace(&I,
-				InstructionLiveRange(codePathId)).first->second;
+			InstructionLiveRange& range=liveRanges[thisIndex];
+			range.codePathId=codePathId;
 			range.range.push_back(LiveRangeChunk(thisIndex, thisIndex));
 		}
 		// Operands of PHIs are declared as live out from the source block.
 		// This is handled below.
 		if (isa<PHINode>(I))
 			continue;
-		extendRangeForUsedOperands(I, liveRanges, PA, thisIndex, codePathId);
+		extendRangeForUsedOperands(I, liveRanges, instIdMap, PA, thisIndex, codePathId);
 	}
 	// Extend the live range of live-out instrution to the end of the block
 	uint32_t endOfBlockIndex=nextIndex;
@@ -305,10 +317,10 @@ uint32_t Registerize::dfsLiveRangeInBlock(BlocksState& blocksState, LiveRangesTy
 	{
 		// If inlineable we need to extend the life of the not-inlineable operands
 		if (isInlineable(*outLiveInst, PA))
-			extendRangeForUsedOperands(*outLiveInst, liveRanges, PA, endOfBlockIndex, codePathId);
+			extendRangeForUsedOperands(*outLiveInst, liveRanges, instIdMap, PA, endOfBlockIndex, codePathId);
 		else
 		{
-			InstructionLiveRange& range=liveRanges.find(outLiveInst)->second;
+			InstructionLiveRange& range=liveRanges[instIdMap.getId(outLiveInst)];
 			range.addUse(codePathId, endOfBlockIndex);
 		}
 	}
@@ -326,8 +338,8 @@ uint32_t Registerize::dfsLiveRangeInBlock(BlocksState& blocksState, LiveRangesTy
 	return nextIndex;
 }
 
-void Registerize::extendRangeForUsedOperands(Instruction& I, LiveRangesTy& liveRanges, cheerp::PointerAnalyzer& PA,
-						uint32_t thisIndex, uint32_t codePathId)
+void Registerize::extendRangeForUsedOperands(Instruction& I, LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap,
+						cheerp::PointerAnalyzer& PA, uint32_t thisIndex, uint32_t codePathId)
 {
 	// SPLIT_REGULAR pointers keep alive the register until after the instruction. Calls are an exception as the offset is stored in a global.
 	if(I.getType()->isPointerTy() && PA.getPointerKind(&I) == SPLIT_REGULAR)
@@ -345,52 +357,115 @@ void Registerize::extendRangeForUsedOperands(Instruction& I, LiveRangesTy& liveR
 			continue;
 		// Recursively traverse inlineable operands
 		if(isInlineable(*usedI, PA))
-			extendRangeForUsedOperands(*usedI, liveRanges, PA, thisIndex, codePathId);
+			extendRangeForUsedOperands(*usedI, liveRanges, instIdMap, PA, thisIndex, codePathId);
 		else
 		{
-			assert(liveRanges.count(usedI));
-			InstructionLiveRange& range=liveRanges.find(usedI)->second;
+			InstructionLiveRange& range=liveRanges[instIdMap.getId(usedI)];
+			assert(range.isValid());
 			if(codePathId!=thisIndex)
 				range.addUse(codePathId, thisIndex);
 		}
 	}
 }
 
-uint32_t Registerize::assignToRegisters(const LiveRangesTy& liveRanges, const PointerAnalyzer& PA)
+uint32_t Registerize::assignToRegisters(const LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap, const PointerAnalyzer& PA)
 {
-	llvm::SmallVector<RegisterRange, 4> registers;
+	RegistersState registers;
+	InstRegistersTy instRegisters(liveRanges.size(), 0xffffffff);
 	// First try to assign all PHI operands to the same register as the PHI itself
-	for(auto it: liveRanges)
+	for(uint32_t i=1;i<liveRanges.size();i++)
 	{
-		Instruction* I=it.first;
-		if(!isa<PHINode>(I))
+		Instruction* I=instIdMap.instructions[i];
+		if(!liveRanges[i].isValid() || !isa<PHINode>(I))
 			continue;
-		handlePHI(*I, liveRanges, registers, PA);
+		handlePHI(*I, liveRanges, instIdMap, instRegisters, registers, PA);
+	}
+	// Assign a register to the remaining instructions with a linear scan. The instructions are visited in order
+	// of definition, and the definition is the start of their range. A register whose intervals all end before
+	// the definition is expired, it does not interfere with this or any later range.
+	// The lowest compatible register is chosen, like findOrCreateRegister does, so only the active registers
+	// with a lower id than the first expired one need to be checked.
+	typedef std::pair<uint32_t, uint32_t> EndAndRegister;
+	struct KindState
+	{
+		std::set<uint32_t> active;
+		std::set<uint32_t> expired;
+		// Min-heap of the ends of the active registers, entries are stale if the register has been extended since
+		std::priority_queue<EndAndRegister, std::vector<EndAndRegister>, std::greater<EndAndRegister>> ends;
+	};
+	KindState kindStates[DOUBLE+1];
+	for(uint32_t i=0;i<registers.registers.size();i++)
+	{
+		KindState& kindState = kindStates[registers.registers[i].regKind];
+		kindState.active.insert(i);
+		kindState.ends.push(EndAndRegister(registers.registers[i].range.getEnd(), i));
 	}
-	// Assign a register to the remaining instructions
-	for(auto it: liveRanges)
+	for(uint32_t i=1;i<liveRanges.size();i++)
 	{
-		Instruction* I=it.first;
-		if(isa<PHINode>(I))
+		Instruction* I=instIdMap.instructions[i];
+		const InstructionLiveRange& range=liveRanges[i];
+		if(!range.isValid() || isa<PHINode>(I))
 			continue;
-		InstructionLiveRange& range=it.second;
 		// Move on if a register is already assigned
-		if(registersMap.count(I))
+		if(instRegisters[i]!=0xffffffff)
 			continue;
-		uint32_t chosenRegister=findOrCreateRegister(registers, range, getRegKindFromType(I->getType()));
-		registersMap[I] = chosenRegister;
+		REGISTER_KIND kind = getRegKindFromType(I->getType());
+		KindState& kindState = kindStates[kind];
+		uint32_t start = range.range.front().start;
+		while(!kindState.ends.empty() && kindState.ends.top().first <= start)
+		{
+			EndAndRegister e = kindState.ends.top();
+			kindState.ends.pop();
+			if(registers.registers[e.second].range.getEnd() != e.first || !kindState.active.erase(e.second))
+				continue;
+			kindState.expired.insert(e.second);
+		}
+		uint32_t firstExpired = kindState.expired.empty() ? 0xffffffff : *kindState.expired.begin();
+		uint32_t chosenRegister = 0xffffffff;
+		for(uint32_t r: kindState.active)
+		{
+			if(r > firstExpired)
+				break;
+			if(addRangeToRegisterIfPossible(registers.registers[r], range, kind))
+			{
+				chosenRegister = r;
+				break;
+			}
+		}
+		if(chosenRegister == 0xffffffff && firstExpired != 0xffffffff)
+		{
+			chosenRegister = firstExpired;
+			bool added = addRangeToRegisterIfPossible(registers.registers[chosenRegister], range, kind);
+			assert(added);
+			(void)added;
+			kindState.expired.erase(chosenRegister);
+			kindState.active.insert(chosenRegister);
+		}
+		if(chosenRegister == 0xffffffff)
+		{
+			chosenRegister = registers.createRegister(range.range, kind);
+			kindState.active.insert(chosenRegister);
+		}
+		kindState.ends.push(EndAndRegister(registers.registers[chosenRegister].range.getEnd(), chosenRegister));
+		instRegisters[i] = chosenRegister;
 	}
-	return registers.size();
+	// Publish the assignment, only instructions with a live range have a register
+	for(uint32_t i=1;i<instRegisters.size();i++)
+	{
+		if(instRegisters[i]!=0xffffffff)
+			registersMap[instIdMap.instructions[i]] = instRegisters[i];
+	}
+	return registers.registers.size();
 }
 
-void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers, const PointerAnalyzer& PA)
+void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, const InstIdMapTy& instIdMap, InstRegistersTy& instRegisters,
+				RegistersState& registers, const PointerAnalyzer& PA)
 {
-	uint32_t chosenRegister=0xffffffff;
-	const InstructionLiveRange& PHIrange=liveRanges.find(&I)->second;
+	uint32_t PHIid=instIdMap.getId(&I);
+	const InstructionLiveRange& PHIrange=liveRanges[PHIid];
 	// A PHI may already have an assigned register if it's an operand to another PHI
-	if(registersMap.count(&I))
-		chosenRegister = registersMap[&I];
-	else
+	uint32_t chosenRegister=instRegisters[PHIid];
+	if(chosenRegister==0xffffffff)
 	{
 		// If one of the operands already has a register allocated try to use that register again
 		for(Value* op: I.operands())
@@ -398,11 +473,10 @@ void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm
 			Instruction* usedI=dyn_cast<Instruction>(op);
 			if(!usedI || isInlineable(*usedI, PA))
 				continue;
-			assert(liveRanges.count(usedI));
-			if(registersMap.count(usedI)==0)
+			uint32_t operandRegister=instRegisters[instIdMap.getId(usedI)];
+			if(operandRegister==0xffffffff)
 				continue;
-			uint32_t operandRegister=registersMap[usedI];
-			if(addRangeToRegisterIfPossible(registers[operandRegister], PHIrange,
+			if(addRangeToRegisterIfPossible(registers.registers[operandRegister], PHIrange,
 							getRegKindFromType(usedI->getType())))
 			{
 				chosenRegister=operandRegister;
@@ -413,39 +487,40 @@ void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm
 	// If a register has not been chosen yet, find or create a new one
 	if(chosenRegister==0xffffffff)
 		chosenRegister=findOrCreateRegister(registers, PHIrange, getRegKindFromType(I.getType()));
-	registersMap[&I]=chosenRegister;
+	instRegisters[PHIid]=chosenRegister;
 	// Iterate again on the operands and try to map as many as possible into the same register
 	for(Value* op: I.operands())
 	{
 		Instruction* usedI=dyn_cast<Instruction>(op);
 		if(!usedI || isInlineable(*usedI, PA))
 			continue;
-		assert(liveRanges.count(usedI));
+		uint32_t usedId=instIdMap.getId(usedI);
+		assert(liveRanges[usedId].isValid());
 		// Skip already assigned operands
-		if(registersMap.count(usedI))
+		if(instRegisters[usedId]!=0xffffffff)
 			continue;
-		const InstructionLiveRange& opRange=liveRanges.find(usedI)->second;
-		bool spaceFound=addRangeToRegisterIfPossible(registers[chosenRegister], opRange,
+		const InstructionLiveRange& opRange=liveRanges[usedId];
+		bool spaceFound=addRangeToRegisterIfPossible(registers.registers[chosenRegister], opRange,
 								getRegKindFromType(usedI->getType()));
 		if (spaceFound)
 		{
 			// Update the mapping
-			registersMap[usedI]=chosenRegister;
+			instRegisters[usedId]=chosenRegister;
 		}
 	}
 }
 
-uint32_t Registerize::findOrCreateRegister(llvm::SmallVector<RegisterRange, 4>& registers, const InstructionLiveRange& range,
+uint32_t Registerize::findOrCreateRegister(RegistersState& registers, const InstructionLiveRange& range,
 						REGISTER_KIND kind)
 {
-	for(uint32_t i=0;i<registers.size();i++)
+	// Registers of other kinds are never compatible
+	for(uint32_t i: registers.registersOfKind[kind])
 	{
-		if(addRangeToRegisterIfPossible(registers[i], range, kind))
+		if(addRangeToRegisterIfPossible(registers.registers[i], range, kind))
 			return i;
 	}
 	// Create a new register with the range of the current instruction already used
-	registers.push_back(RegisterRange(range.range, kind));
-	return registers.size()-1;
+	return registers.createRegister(range.range, kind);
 }
 
 Registerize::REGISTER_KIND Registerize::getRegKindFromType(llvm::Type* t)
@@ -501,6 +576,53 @@ void Registerize::LiveRange::dump() const
 		dbgs() << '[' << chunk.start << ',' << chunk.end << ')';
 }
 
+/**
+ * The interval of indexes occupied by a chunk, an empty chunk still occupies its start
+ */
+static Registerize::LiveRangeChunk getOccupiedInterval(const Registerize::LiveRangeChunk& chunk)
+{
+	return Registerize::LiveRangeChunk(chunk.start, std::max(chunk.end, chunk.start+1));
+}
+
+bool Registerize::RegisterIntervals::doesInterfere(const LiveRange& range) const
+{
+	for(const LiveRangeChunk& chunk: range)
+	{
+		LiveRangeChunk occupied = getOccupiedInterval(chunk);
+		// Find the first interval which ends after the start of the chunk, intervals are disjoint so the ends are sorted too
+		auto it = std::upper_bound(begin(), end(), occupied.start,
+			[](uint32_t start, const LiveRangeChunk& interval) { return start < interval.end; });
+		if(it != end() && it->start < occupied.end)
+			return true;
+	}
+	return false;
+}
+
+void Registerize::RegisterIntervals::add(const LiveRange& range)
+{
+	for(const LiveRangeChunk& chunk: range)
+	{
+		LiveRangeChunk occupied = getOccupiedInterval(chunk);
+		auto it = std::lower_bound(begin(), end(), occupied);
+		assert(it == end() || it->start >= occupied.end);
+		assert(it == begin() || std::prev(it)->end <= occupied.start);
+		// Coalesce with the adjacent intervals if possible
+		bool mergePrev = it != begin() && std::prev(it)->end == occupied.start;
+		bool mergeNext = it != end() && it->start == occupied.end;
+		if(mergePrev && mergeNext)
+		{
+			std::prev(it)->end = it->end;
+			erase(it);
+		}
+		else if(mergePrev)
+			std::prev(it)->end = occupied.end;
+		else if(mergeNext)
+			it->start = occupied.start;
+		else
+			insert(it, occupied);
+	}
+}
+
 bool Registerize::addRangeToRegisterIfPossible(RegisterRange& regRange, const InstructionLiveRange& liveRange,
 						REGISTER_KIND kind)
 {
@@ -508,7 +630,7 @@ bool Registerize::addRangeToRegisterIfPossible(RegisterRange& regRange, const In
 		return false;
 	if(regRange.range.doesInterfere(liveRange.range))
 		return false;
-	regRange.range.merge(liveRange.range);
+	regRange.range.add(liveRange.range);
 	return true;
 }
 
@@ -519,7 +641,7 @@ void Registerize::computeAllocaLiveRanges(AllocaSetTy& allocaSet, const InstIdMa
 		AllocaBlocksState blocksState;
 		RangeChunksTy ranges;
 		// For each alloca gather all uses and derived uses
-		InstructionSetOrderedByID allUses=gatherDerivedMemoryAccesses(alloca, instIdMap);
+		InstructionsOrderedByID allUses=gatherDerivedMemoryAccesses(alloca, instIdMap);
 		if(allUses.empty())
 		{
 			// Initialize an empty live range to signal that no analysis is possible
@@ -531,10 +653,10 @@ void Registerize::computeAllocaLiveRanges(AllocaSetTy& allocaSet, const InstIdMa
 		// Build the range containing the uses directly inside the block.
 		BasicBlock* currentBlock = NULL;
 		LiveRangeChunk localRange(0, 0);
-		for(Instruction* I: allUses)
+		for(auto& use: allUses)
 		{
-			assert(instIdMap.count(I));
-			uint32_t instId=instIdMap.find(I)->second;
+			uint32_t instId=use.first;
+			Instruction* I=use.second;
 			// If the current use is the first of a new block
 			if(I->getParent() != currentBlock)
 			{
@@ -663,7 +785,7 @@ void Registerize::computeAllocaLiveRanges(AllocaSetTy& allocaSet, const InstIdMa
 /*
 	Returns the set of instruction which access memory derived from the passed Alloca
 */
-Registerize::InstructionSetOrderedByID Registerize::gatherDerivedMemoryAccesses(const AllocaInst* rootI, const InstIdMapTy& instIdMap)
+Registerize::InstructionsOrderedByID Registerize::gatherDerivedMemoryAccesses(const AllocaInst* rootI, const InstIdMapTy& instIdMap)
 {
 	SmallVector<const Use*, 10> allUses;
 	for(const Use& U: rootI->uses())
@@ -726,15 +848,18 @@ Registerize::InstructionSetOrderedByID Registerize::gatherDerivedMemoryAccesses(
 			break;
 		}
 	}
-	InstructionSetOrderedByID ret(instIdMap);
+	InstructionsOrderedByID ret;
 	for(const Use* U: allUses)
 	{
 		Instruction* userI=cast<Instruction>(U->getUser());
 		// Skip instruction which only touch the pointer and not the actual memory
 		if(isa<BitCastInst>(userI) || isa<GetElementPtrInst>(userI))
 			continue;
-		ret.insert(userI);
+		ret.push_back(std::make_pair(instIdMap.getId(userI), userI));
 	}
+	// An instruction may use the alloca more than once
+	std::sort(ret.begin(), ret.end());
+	ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
 	return ret;
 }
 
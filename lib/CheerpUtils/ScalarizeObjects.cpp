@@ -0,0 +1,310 @@
+//===-- ScalarizeObjects.cpp - Cheerp scalar replacement of objects -------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/ScalarizeObjects.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+#define DEBUG_TYPE "ScalarizeObjects"
+
+STATISTIC(NumScalarizedAllocas, "Number of struct allocas replaced by their members");
+STATISTIC(NumScalarizedAllocations, "Number of heap allocations replaced by their members");
+
+namespace cheerp {
+
+using namespace llvm;
+
+const uint32_t ScalarizeObjects::maxMembers;
+
+uint32_t ScalarizeObjects::countMembers(Type* t)
+{
+	// The count saturates at maxMembers+1, it is only compared against the limit
+	if(StructType* st = dyn_cast<StructType>(t))
+	{
+		uint32_t count = 0;
+		for(Type* elementType: st->elements())
+		{
+			count += countMembers(elementType);
+			if(count > maxMembers)
+				return maxMembers + 1;
+		}
+		return count;
+	}
+	else if(ArrayType* at = dyn_cast<ArrayType>(t))
+	{
+		uint32_t elementCount = countMembers(at->getElementType());
+		if(elementCount && at->getNumElements() > maxMembers)
+			return maxMembers + 1;
+		return std::min<uint32_t>(elementCount * at->getNumElements(), maxMembers + 1);
+	}
+	return 1;
+}
+
+void ScalarizeObjects::collectMemberTypes(Type* t, SmallVectorImpl<Type*>& memberTypes)
+{
+	if(StructType* st = dyn_cast<StructType>(t))
+	{
+		for(Type* elementType: st->elements())
+			collectMemberTypes(elementType, memberTypes);
+	}
+	else if(ArrayType* at = dyn_cast<ArrayType>(t))
+	{
+		for(uint64_t i = 0; i < at->getNumElements(); i++)
+			collectMemberTypes(at->getElementType(), memberTypes);
+	}
+	else
+		memberTypes.push_back(t);
+}
+
+bool ScalarizeObjects::isDroppableCall(const Instruction* I)
+{
+	const CallInst* CI = dyn_cast<CallInst>(I);
+	if(!CI)
+		return false;
+	const Function* F = CI->getCalledFunction();
+	if(!F)
+		return false;
+	switch(F->getIntrinsicID())
+	{
+		case Intrinsic::lifetime_start:
+		case Intrinsic::lifetime_end:
+		case Intrinsic::cheerp_deallocate:
+			return true;
+		default:
+			break;
+	}
+	return F->getName() == "free" || F->getName() == "_ZdlPv";
+}
+
+bool ScalarizeObjects::collectUses(Value* ptr, Type* pointedType, uint32_t firstMember, ObjectUses& uses)
+{
+	for(User* U: ptr->users())
+	{
+		Instruction* I = cast<Instruction>(U);
+		if(LoadInst* LI = dyn_cast<LoadInst>(I))
+		{
+			if(LI->isVolatile() || pointedType->isAggregateType())
+				return false;
+			uses.accesses.push_back(std::make_pair(LI, firstMember));
+		}
+		else if(StoreInst* SI = dyn_cast<StoreInst>(I))
+		{
+			// Storing the pointer itself makes the object escape
+			if(SI->isVolatile() || SI->getValueOperand() == ptr || pointedType->isAggregateType())
+				return false;
+			uses.accesses.push_back(std::make_pair(SI, firstMember));
+		}
+		else if(GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(I))
+		{
+			if(!GEP->hasAllConstantIndices() || !cast<ConstantInt>(GEP->getOperand(1))->isZero())
+				return false;
+			// Find out which member is the first one of the pointed sub-object
+			Type* curType = pointedType;
+			uint32_t member = firstMember;
+			for(uint32_t i = 2; i < GEP->getNumOperands(); i++)
+			{
+				uint64_t index = cast<ConstantInt>(GEP->getOperand(i))->getZExtValue();
+				if(StructType* st = dyn_cast<StructType>(curType))
+				{
+					for(uint32_t j = 0; j < index; j++)
+						member += countMembers(st->getElementType(j));
+					curType = st->getElementType(index);
+				}
+				else if(ArrayType* at = dyn_cast<ArrayType>(curType))
+				{
+					if(index >= at->getNumElements())
+						return false;
+					member += index * countMembers(at->getElementType());
+					curType = at->getElementType();
+				}
+				else
+					return false;
+			}
+			uses.deadInstructions.push_back(GEP);
+			if(!collectUses(GEP, curType, member, uses))
+				return false;
+		}
+		else if(isa<BitCastInst>(I))
+		{
+			// Casts are only allowed for lifetime markers and deallocations
+			uses.deadInstructions.push_back(I);
+			for(User* BU: I->users())
+			{
+				if(!isDroppableCall(cast<Instruction>(BU)))
+					return false;
+				uses.deadInstructions.push_back(cast<Instruction>(BU));
+			}
+		}
+		else if(isDroppableCall(I))
+			uses.deadInstructions.push_back(I);
+		else
+			return false;
+	}
+	return true;
+}
+
+StructType* ScalarizeObjects::getAllocatedObjectType(CallInst* CI)
+{
+	DynamicAllocInfo::AllocType allocType = DynamicAllocInfo::getAllocType(CI);
+	if(allocType != DynamicAllocInfo::malloc && allocType != DynamicAllocInfo::calloc &&
+		allocType != DynamicAllocInfo::opnew && allocType != DynamicAllocInfo::cheerp_allocate)
+	{
+		return NULL;
+	}
+	const DataLayout* DL = CI->getParent()->getParent()->getParent()->getDataLayout();
+	DynamicAllocInfo info(CI, DL);
+	StructType* st = dyn_cast<StructType>(info.getCastedType()->getElementType());
+	if(!st || !st->isSized() || TypeSupport::hasByteLayout(st) || countMembers(st) > maxMembers)
+		return NULL;
+	// Only allocations of exactly one object are supported
+	if(info.sizeIsRuntime())
+		return NULL;
+	if(allocType == DynamicAllocInfo::calloc && !cast<ConstantInt>(info.getNumberOfElementsArg())->isOne())
+		return NULL;
+	if(cast<ConstantInt>(info.getByteSizeArg())->getZExtValue() != DL->getTypeAllocSize(st))
+		return NULL;
+	return st;
+}
+
+bool ScalarizeObjects::collectAllocationUses(CallInst* CI, StructType* objectType, ObjectUses& uses)
+{
+	if(CI->getType() == objectType->getPointerTo())
+		return collectUses(CI, objectType, 0, uses);
+	// malloc and new return an i8*, which is then casted to the object type
+	for(User* U: CI->users())
+	{
+		Instruction* I = cast<Instruction>(U);
+		if(isa<BitCastInst>(I) && I->getType() == objectType->getPointerTo())
+		{
+			uses.deadInstructions.push_back(I);
+			if(!collectUses(I, objectType, 0, uses))
+				return false;
+		}
+		else if(isDroppableCall(I))
+			uses.deadInstructions.push_back(I);
+		else
+			return false;
+	}
+	return true;
+}
+
+void ScalarizeObjects::scalarize(Instruction* object, StructType* objectType, ObjectUses& uses,
+		bool zeroInitialize, SmallVectorImpl<AllocaInst*>& newAllocas)
+{
+	SmallVector<Type*, 8> memberTypes;
+	collectMemberTypes(objectType, memberTypes);
+	Function* F = object->getParent()->getParent();
+	Instruction* insertPoint = F->getEntryBlock().getFirstInsertionPt();
+	SmallVector<AllocaInst*, 8> members;
+	for(uint32_t i = 0; i < memberTypes.size(); i++)
+	{
+		AllocaInst* member = new AllocaInst(memberTypes[i], object->getName() + "." + Twine(i), insertPoint);
+		members.push_back(member);
+		newAllocas.push_back(member);
+	}
+	// Every execution of the allocation creates a new zeroed object
+	if(zeroInitialize)
+	{
+		for(uint32_t i = 0; i < memberTypes.size(); i++)
+			new StoreInst(Constant::getNullValue(memberTypes[i]), members[i], object);
+	}
+	for(auto& access: uses.accesses)
+	{
+		Instruction* I = access.first;
+		unsigned ptrIndex = isa<LoadInst>(I) ? LoadInst::getPointerOperandIndex() : StoreInst::getPointerOperandIndex();
+		I->setOperand(ptrIndex, members[access.second]);
+	}
+	// Users have been collected after their operands, erase them in reverse order
+	for(auto it = uses.deadInstructions.rbegin(); it != uses.deadInstructions.rend(); ++it)
+		(*it)->eraseFromParent();
+	assert(object->use_empty());
+	object->eraseFromParent();
+}
+
+bool ScalarizeObjects::runOnFunction(Function& F)
+{
+	// Lifetime markers and deallocations of scalarized objects are erased, candidates may be erased in the meantime
+	SmallVector<WeakVH, 8> candidates;
+	for(BasicBlock& BB: F)
+	{
+		for(Instruction& I: BB)
+		{
+			if(isa<AllocaInst>(I) || isa<CallInst>(I))
+				candidates.push_back(&I);
+		}
+	}
+
+	bool Changed = false;
+	SmallVector<AllocaInst*, 16> newAllocas;
+	for(WeakVH& candidate: candidates)
+	{
+		Instruction* I = cast_or_null<Instruction>(candidate);
+		if(!I)
+			continue;
+		ObjectUses uses;
+		if(AllocaInst* AI = dyn_cast<AllocaInst>(I))
+		{
+			StructType* st = dyn_cast<StructType>(AI->getAllocatedType());
+			if(!st || AI->isArrayAllocation() || TypeSupport::hasByteLayout(st) || countMembers(st) > maxMembers)
+				continue;
+			if(!collectUses(AI, st, 0, uses))
+				continue;
+			scalarize(AI, st, uses, /*zeroInitialize*/ false, newAllocas);
+			NumScalarizedAllocas++;
+		}
+		else
+		{
+			CallInst* CI = cast<CallInst>(I);
+			StructType* st = getAllocatedObjectType(CI);
+			if(!st || !collectAllocationUses(CI, st, uses))
+				continue;
+			scalarize(CI, st, uses, /*zeroInitialize*/ true, newAllocas);
+			NumScalarizedAllocations++;
+		}
+		Changed = true;
+	}
+	if(!newAllocas.empty())
+	{
+		DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+		PromoteMemToReg(newAllocas, DT);
+	}
+	return Changed;
+}
+
+const char* ScalarizeObjects::getPassName() const
+{
+	return "ScalarizeObjects";
+}
+
+char ScalarizeObjects::ID = 0;
+
+void ScalarizeObjects::getAnalysisUsage(AnalysisUsage& AU) const
+{
+	AU.addRequired<DominatorTreeWrapperPass>();
+	AU.setPreservesCFG();
+	llvm::FunctionPass::getAnalysisUsage(AU);
+}
+
+FunctionPass* createScalarizeObjectsPass() { return new ScalarizeObjects(); }
+
+}
+
+using namespace cheerp;
+
+INITIALIZE_PASS_BEGIN(ScalarizeObjects, "ScalarizeObjects", "Replace non escaping objects with SSA values for their members",
+			false, false)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_END(ScalarizeObjects, "ScalarizeObjects", "Replace non escaping objects with SSA values for their members",
+			false, false)
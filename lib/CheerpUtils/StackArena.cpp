@@ -0,0 +1,287 @@
+//===-- StackArena.cpp - Cheerp stack arena for typed allocas -------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/StackArena.h"
+#include "llvm/Cheerp/GlobalDepsAnalyzer.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+#define DEBUG_TYPE "StackArena"
+
+STATISTIC(NumArenaAllocas, "Number of typed array allocas moved to the stack arena");
+STATISTIC(NumArenaFunctions, "Number of functions using the stack arena");
+
+namespace cheerp {
+
+using namespace llvm;
+
+const uint32_t StackArena::initialArenaSize;
+
+static const char* getArenaSuffix(Type* t)
+{
+	if(t->isFloatTy())
+		return "f32";
+	switch(cast<IntegerType>(t)->getBitWidth())
+	{
+		case 8:
+			return "i8";
+		case 16:
+			return "i16";
+		default:
+			assert(t->isIntegerTy(32));
+			return "i32";
+	}
+}
+
+bool StackArena::canUseArena(const AllocaInst* AI)
+{
+	if(!AI->isStaticAlloca() || AI->isArrayAllocation())
+		return false;
+	ArrayType* AT = dyn_cast<ArrayType>(AI->getAllocatedType());
+	if(!AT || !TypeSupport::isTypedArrayType(AT->getElementType(), /*forceTypedArray*/ false))
+		return false;
+	for(const User* U: AI->users())
+	{
+		if(const BitCastInst* BC = dyn_cast<BitCastInst>(U))
+		{
+			// Lifetime markers are dropped, the arena space lives until the function returns
+			for(const User* BCU: BC->users())
+			{
+				const IntrinsicInst* II = dyn_cast<IntrinsicInst>(BCU);
+				if(!II || (II->getIntrinsicID() != Intrinsic::lifetime_start && II->getIntrinsicID() != Intrinsic::lifetime_end))
+					return false;
+			}
+			continue;
+		}
+		const GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(U);
+		if(!GEP || GEP->getNumIndices() != 2 || GEP->getPointerOperand() != AI)
+			return false;
+		const ConstantInt* firstIndex = dyn_cast<ConstantInt>(GEP->getOperand(1));
+		if(!firstIndex || !firstIndex->isZero() || !GEP->getOperand(2)->getType()->isIntegerTy(32))
+			return false;
+		// The element pointer must not escape
+		for(const User* GU: GEP->users())
+		{
+			if(isa<LoadInst>(GU))
+				continue;
+			const StoreInst* SI = dyn_cast<StoreInst>(GU);
+			if(!SI || SI->getValueOperand() == GEP)
+				return false;
+		}
+	}
+	return true;
+}
+
+StackArena::Arena& StackArena::getArena(Type* elementType)
+{
+	auto it = arenas.find(elementType);
+	if(it != arenas.end())
+		return it->second;
+
+	LLVMContext& C = module->getContext();
+	Type* Int32Ty = IntegerType::get(C, 32);
+	PointerType* elementPtrType = elementType->getPointerTo();
+	std::string suffix = getArenaSuffix(elementType);
+	Arena& arena = arenas[elementType];
+
+	ArrayType* storageType = ArrayType::get(elementType, initialArenaSize);
+	GlobalVariable* storage = new GlobalVariable(*module, storageType, false, GlobalValue::InternalLinkage,
+			ConstantAggregateZero::get(storageType), "__cheerpStackStorage_" + suffix);
+	Constant* Zero = ConstantInt::get(Int32Ty, 0);
+	Constant* Indexes[] = { Zero, Zero };
+	arena.base = new GlobalVariable(*module, elementPtrType, false, GlobalValue::InternalLinkage,
+			ConstantExpr::getGetElementPtr(storage, Indexes), "__cheerpStack_" + suffix);
+	arena.top = new GlobalVariable(*module, Int32Ty, false, GlobalValue::InternalLinkage,
+			Zero, "__cheerpStackTop_" + suffix);
+	GlobalVariable* capacity = new GlobalVariable(*module, Int32Ty, false, GlobalValue::InternalLinkage,
+			ConstantInt::get(Int32Ty, initialArenaSize), "__cheerpStackSize_" + suffix);
+
+	// Build the allocation function, it reserves the space and grows the arena if needed
+	Type* argTypes[] = { Int32Ty };
+	FunctionType* allocType = FunctionType::get(Int32Ty, argTypes, false);
+	arena.allocFunc = Function::Create(allocType, GlobalValue::InternalLinkage, "__cheerpStackAlloc_" + suffix, module);
+	Argument* size = arena.allocFunc->arg_begin();
+	size->setName("size");
+	BasicBlock* entryBlock = BasicBlock::Create(C, "entry", arena.allocFunc);
+	BasicBlock* growBlock = BasicBlock::Create(C, "grow", arena.allocFunc);
+	BasicBlock* doneBlock = BasicBlock::Create(C, "done", arena.allocFunc);
+
+	IRBuilder<> Builder(entryBlock);
+	Value* oldTop = Builder.CreateLoad(arena.top, "oldtop");
+	Value* newTop = Builder.CreateAdd(oldTop, size, "newtop");
+	Builder.CreateStore(newTop, arena.top);
+	Value* isFull = Builder.CreateICmpUGT(newTop, Builder.CreateLoad(capacity, "size"), "isfull");
+	Builder.CreateCondBr(isFull, growBlock, doneBlock);
+
+	// Double the needed size, the old contents are copied by the reallocation
+	Builder.SetInsertPoint(growBlock);
+	Value* newCapacity = Builder.CreateShl(newTop, 1, "newsize");
+	uint32_t elementSize = module->getDataLayout()->getTypeAllocSize(elementType);
+	Value* newBytes = Builder.CreateMul(newCapacity, ConstantInt::get(Int32Ty, elementSize), "newbytes");
+	Type* reallocTys[] = { elementPtrType, elementPtrType };
+	Function* reallocFunc = Intrinsic::getDeclaration(module, Intrinsic::cheerp_reallocate, reallocTys);
+	Value* newArena = Builder.CreateCall2(reallocFunc, Builder.CreateLoad(arena.base, "arena"), newBytes, "newarena");
+	Builder.CreateStore(newArena, arena.base);
+	Builder.CreateStore(newCapacity, capacity);
+	Builder.CreateBr(doneBlock);
+
+	Builder.SetInsertPoint(doneBlock);
+	Builder.CreateRet(oldTop);
+	return arena;
+}
+
+bool StackArena::rewriteFunction(Function& F, PointerAnalyzer& PA, Registerize& registerize)
+{
+	// Group the allocas by element type, keeping the order of the function
+	SmallVector<std::pair<Type*, SmallVector<AllocaInst*, 4>>, 2> allocasByType;
+	for(Instruction& I: F.getEntryBlock())
+	{
+		AllocaInst* AI = dyn_cast<AllocaInst>(&I);
+		if(!AI || !canUseArena(AI))
+			continue;
+		Type* elementType = AI->getAllocatedType()->getArrayElementType();
+		auto it = std::find_if(allocasByType.begin(), allocasByType.end(),
+				[elementType](const std::pair<Type*, SmallVector<AllocaInst*, 4>>& p) { return p.first == elementType; });
+		if(it == allocasByType.end())
+		{
+			allocasByType.push_back(std::make_pair(elementType, SmallVector<AllocaInst*, 4>()));
+			it = allocasByType.end() - 1;
+		}
+		it->second.push_back(AI);
+	}
+	if(allocasByType.empty())
+		return false;
+
+	// Careful, registerize must be invalidated before changing the function
+	registerize.invalidateLiveRangeForAllocas(F);
+	Type* Int32Ty = IntegerType::get(F.getContext(), 32);
+	IRBuilder<> Builder(F.getEntryBlock().getFirstInsertionPt());
+	// The arenas used by this function and the index of the frame in each of them
+	SmallVector<std::pair<GlobalVariable*, Value*>, 2> frames;
+	for(auto& it: allocasByType)
+	{
+		Arena& arena = getArena(it.first);
+		uint32_t frameSize = 0;
+		for(AllocaInst* AI: it.second)
+			frameSize += AI->getAllocatedType()->getArrayNumElements();
+		Value* frame = Builder.CreateCall(arena.allocFunc, ConstantInt::get(Int32Ty, frameSize), "stackframe");
+		frames.push_back(std::make_pair(arena.top, frame));
+
+		uint32_t allocaOffset = 0;
+		for(AllocaInst* AI: it.second)
+		{
+			SmallVector<User*, 8> users(AI->user_begin(), AI->user_end());
+			for(User* U: users)
+			{
+				Instruction* UI = cast<Instruction>(U);
+				if(isa<BitCastInst>(UI))
+				{
+					while(!UI->use_empty())
+						cast<Instruction>(UI->user_back())->eraseFromParent();
+					PA.invalidate(UI);
+					UI->eraseFromParent();
+					continue;
+				}
+				Value* index = UI->getOperand(2);
+				SmallVector<User*, 8> accesses(UI->user_begin(), UI->user_end());
+				for(User* A: accesses)
+				{
+					// Load the arena right before the access, a call may have grown it
+					IRBuilder<> AccessBuilder(cast<Instruction>(A));
+					Value* base = AccessBuilder.CreateLoad(arena.base, "stackarena");
+					Value* arenaIndex = frame;
+					if(const ConstantInt* CI = dyn_cast<ConstantInt>(index))
+					{
+						if(allocaOffset + CI->getZExtValue())
+							arenaIndex = AccessBuilder.CreateAdd(frame, ConstantInt::get(Int32Ty, allocaOffset + CI->getZExtValue()));
+					}
+					else
+					{
+						if(allocaOffset)
+							arenaIndex = AccessBuilder.CreateAdd(frame, ConstantInt::get(Int32Ty, allocaOffset));
+						arenaIndex = AccessBuilder.CreateAdd(arenaIndex, index);
+					}
+					Value* elementPtr = AccessBuilder.CreateGEP(base, arenaIndex, UI->getName());
+					A->replaceUsesOfWith(UI, elementPtr);
+				}
+				PA.invalidate(UI);
+				UI->eraseFromParent();
+			}
+			allocaOffset += AI->getAllocatedType()->getArrayNumElements();
+			PA.invalidate(AI);
+			AI->eraseFromParent();
+			NumArenaAllocas++;
+		}
+	}
+
+	// Release the frames before returning
+	for(BasicBlock& BB: F)
+	{
+		ReturnInst* RI = dyn_cast<ReturnInst>(BB.getTerminator());
+		if(!RI)
+			continue;
+		for(auto& frame: frames)
+			new StoreInst(frame.second, frame.first, RI);
+	}
+	registerize.computeLiveRangeForAllocas(F);
+	NumArenaFunctions++;
+	return true;
+}
+
+bool StackArena::runOnModule(Module& M)
+{
+	module = &M;
+	PointerAnalyzer& PA = getAnalysis<PointerAnalyzer>();
+	Registerize& registerize = getAnalysis<Registerize>();
+	// The allocation functions are added while iterating, collect the functions first
+	std::vector<Function*> functions;
+	for(Function& F: M)
+	{
+		if(!F.empty())
+			functions.push_back(&F);
+	}
+	bool Changed = false;
+	for(Function* F: functions)
+		Changed |= rewriteFunction(*F, PA, registerize);
+	arenas.clear();
+	module = NULL;
+	return Changed;
+}
+
+const char* StackArena::getPassName() const
+{
+	return "StackArena";
+}
+
+void StackArena::getAnalysisUsage(AnalysisUsage& AU) const
+{
+	AU.addRequired<PointerAnalyzer>();
+	AU.addPreserved<PointerAnalyzer>();
+	AU.addRequired<Registerize>();
+	AU.addPreserved<Registerize>();
+	AU.addPreserved<GlobalDepsAnalyzer>();
+	llvm::ModulePass::getAnalysisUsage(AU);
+}
+
+char StackArena::ID = 0;
+
+ModulePass* createStackArenaPass() { return new StackArena(); }
+
+}
+
+using namespace cheerp;
+
+INITIALIZE_PASS_BEGIN(StackArena, "StackArena", "Allocate non escaping typed array allocas in a module level arena",
+			false, false)
+INITIALIZE_PASS_END(StackArena, "StackArena", "Allocate non escaping typed array allocas in a module level arena",
+			false, false)
@@ -240,12 +240,15 @@ bool StructMemFuncLowering::runOnBlock(BasicBlock& BB)
 		if(mode==NONE)
 			continue;
 		Type* pointedType = F->getFunctionType()->getParamType(0)->getPointerElementType();
-		//We want to decompose everything which is not a byte layout structure. memset is always decomposed.
-		if(mode != MEMSET)
+		//We want to decompose everything which is not a byte layout structure.
+		bool isByteLayout = isa<StructType>(pointedType) && cast<StructType>(pointedType)->hasByteLayout();
+		if(isByteLayout)
+			continue;
+		//memset of values stored in typed arrays is compiled to TypedArray.fill by the backend
+		if(mode == MEMSET && (pointedType->isIntegerTy(8) || pointedType->isIntegerTy(16) || pointedType->isIntegerTy(32) ||
+			((pointedType->isFloatTy() || pointedType->isDoubleTy()) && isa<ConstantInt>(CI->getOperand(1)))))
 		{
-			bool isByteLayout = isa<StructType>(pointedType) && cast<StructType>(pointedType)->hasByteLayout();
-			if(isByteLayout)
-				continue;
+			continue;
 		}
 		//We have a typed mem func on a struct
 		//Decompose it in a loop
@@ -107,16 +107,70 @@ llvm::StructType* TypeOptimizer::isEscapingStructGEP(const User* GEP)
 	return containerStructType;
 }
 
+void TypeOptimizer::addArrayElementStruct(Type* t, bool isArrayElement)
+{
+	if(ArrayType* AT=dyn_cast<ArrayType>(t))
+		addArrayElementStruct(AT->getElementType(), true);
+	else if(StructType* ST=dyn_cast<StructType>(t))
+	{
+		if(ST->isOpaque())
+			return;
+		// The members of array elements are also considered array elements, so that nested structs can be flattened
+		if(isArrayElement && !arrayElementStructs.insert(ST).second)
+			return;
+		for(uint32_t i=0;i<ST->getNumElements();i++)
+			addArrayElementStruct(ST->getElementType(i), isArrayElement);
+	}
+}
+
+void TypeOptimizer::addValueStruct(Type* t)
+{
+	if(ArrayType* AT=dyn_cast<ArrayType>(t))
+		addValueStruct(AT->getElementType());
+	else if(StructType* ST=dyn_cast<StructType>(t))
+	{
+		if(ST->isOpaque() || !valueStructs.insert(ST).second)
+			return;
+		for(uint32_t i=0;i<ST->getNumElements();i++)
+			addValueStruct(ST->getElementType(i));
+	}
+}
+
 void TypeOptimizer::gatherAllTypesInfo(const Module& M)
 {
+	for(StructType* st: M.getIdentifiedStructTypes())
+	{
+		if(st->getDirectBase())
+			baseStructs.insert(st->getDirectBase());
+	}
+	for(const GlobalVariable& GV: M.globals())
+		addArrayElementStruct(GV.getType()->getPointerElementType(), false);
 	for(const Function& F: M)
 	{
+		FunctionType* FT = F.getFunctionType();
+		addValueStruct(FT->getReturnType());
+		for(uint32_t i=0;i<FT->getNumParams();i++)
+			addValueStruct(FT->getParamType(i));
 		for(const BasicBlock& BB: F)
 		{
 			for(const Instruction& I: BB)
 			{
-				if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(&I))
+				addValueStruct(I.getType());
+				for(const Value* op: I.operands())
+					addValueStruct(op->getType());
+				if(const AllocaInst* AI=dyn_cast<AllocaInst>(&I))
+					addArrayElementStruct(AI->getAllocatedType(), AI->isArrayAllocation());
+				else if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(&I))
 				{
+					if(II->getIntrinsicID()==Intrinsic::cheerp_allocate || II->getIntrinsicID()==Intrinsic::cheerp_reallocate)
+					{
+						// Allocations of more than one element are arrays
+						Type* allocType = II->getType()->getPointerElementType();
+						const ConstantInt* size = dyn_cast<ConstantInt>(II->getArgOperand(II->getNumArgOperands()-1));
+						if(!size || size->getZExtValue() > DL->getTypeAllocSize(allocType))
+							addArrayElementStruct(allocType, true);
+						continue;
+					}
 					if(II->getIntrinsicID()!=Intrinsic::cheerp_downcast)
 						continue;
 					// If a source type is downcasted with an offset != 0 we can't collapse the type
@@ -146,6 +200,10 @@ void TypeOptimizer::gatherAllTypesInfo(const Module& M)
 				}
 				else if(const GetElementPtrInst* GEP=dyn_cast<GetElementPtrInst>(&I))
 				{
+					// Pointer arithmetic means that the pointed type is used in an array
+					const ConstantInt* firstIndex = dyn_cast<ConstantInt>(GEP->getOperand(1));
+					if(!firstIndex || !firstIndex->isZero())
+						addArrayElementStruct(GEP->getPointerOperandType()->getPointerElementType(), true);
 					StructType* containerStructType = isEscapingStructGEP(GEP);
 					if(!containerStructType)
 						continue;
@@ -202,6 +260,62 @@ bool TypeOptimizer::isUnsafeDowncastSource(StructType* st)
 	return false;
 }
 
+static bool isTypedArrayElementType(Type* t)
+{
+	return t->isFloatTy() || t->isDoubleTy() || t->isIntegerTy(8) || t->isIntegerTy(16) || t->isIntegerTy(32);
+}
+
+static bool containsOnlyTypedArrayElements(Type* t)
+{
+	if(ArrayType* AT=dyn_cast<ArrayType>(t))
+		return containsOnlyTypedArrayElements(AT->getElementType());
+	if(StructType* ST=dyn_cast<StructType>(t))
+	{
+		if(ST->isOpaque())
+			return false;
+		for(uint32_t i=0;i<ST->getNumElements();i++)
+		{
+			if(!containsOnlyTypedArrayElements(ST->getElementType(i)))
+				return false;
+		}
+		return true;
+	}
+	return isTypedArrayElementType(t);
+}
+
+/**
+	Structs used in arrays are mapped to an array of their members when they all have the same type.
+	This way the array of structs is flattened to a single typed array, instead of an array of objects.
+	Pointers to the struct become pointers to the first member, so the members can escape freely.
+	Only structs with a plain layout are considered: no bases, no downcasts and no first class uses.
+	Structs with members of different types, e.g. a float and an int, are kept as arrays of objects.
+	Splitting them into one typed array per member would need a pointer kind addressing all the arrays.
+*/
+Type* TypeOptimizer::getTypedArrayBaseType(StructType* st)
+{
+	if(st->isLiteral() || st->isOpaque() || st->getNumElements() < 2 || st->hasByteLayout() || st->getDirectBase())
+		return NULL;
+	if(!arrayElementStructs.count(st) || valueStructs.count(st) || baseStructs.count(st) || downcastSourceToDestinationsMapping.count(st))
+		return NULL;
+	if(TypeSupport::isJSExportedType(st, *module) || TypeSupport::hasBasesInfoMetadata(st, *module))
+		return NULL;
+	// Check the layout first, there are no pointers so rewriting the members below can't recurse into st
+	if(!containsOnlyTypedArrayElements(st))
+		return NULL;
+	Type* baseType = NULL;
+	for(uint32_t i=0;i<st->getNumElements();i++)
+	{
+		// Nested structs and arrays may have been flattened already
+		Type* rewrittenType = rewriteType(st->getElementType(i));
+		if(ArrayType* AT=dyn_cast<ArrayType>(rewrittenType))
+			rewrittenType = AT->getElementType();
+		if(!isTypedArrayElementType(rewrittenType) || (baseType && rewrittenType != baseType))
+			return NULL;
+		baseType = rewrittenType;
+	}
+	return baseType;
+}
+
 TypeOptimizer::TypeMappingInfo TypeOptimizer::rewriteType(Type* t)
 {
 	assert(!newStructTypes.count(t));
@@ -280,6 +394,14 @@ TypeOptimizer::TypeMappingInfo TypeOptimizer::rewriteType(Type* t)
 			return CacheAndReturn(newType, TypeMappingInfo::BYTE_LAYOUT_TO_ARRAY);
 		}
 
+		// Arrays of small structs with members of a single type are flattened into a single typed array
+		if(Type* baseType = getTypedArrayBaseType(st))
+		{
+			baseTypesForByteLayout.insert(std::make_pair(st, baseType));
+			uint32_t numElements = DL->getTypeAllocSize(st) / DL->getTypeAllocSize(baseType);
+			return CacheAndReturn(ArrayType::get(baseType, numElements), TypeMappingInfo::STRUCT_TO_TYPED_ARRAY);
+		}
+
 		// Generate a new type inconditionally, it may end up being the same as the old one
 		StructType* newStruct=StructType::create(st->getContext());
 #ifndef NDEBUG
@@ -598,7 +720,8 @@ std::pair<Constant*, uint8_t> TypeOptimizer::rewriteConstant(Constant* C)
 		return std::make_pair(UndefValue::get(newTypeInfo.mappedType), 0);
 	else if(ConstantStruct* CS=dyn_cast<ConstantStruct>(C))
 	{
-		if(newTypeInfo.elementMappingKind == TypeMappingInfo::BYTE_LAYOUT_TO_ARRAY)
+		if(newTypeInfo.elementMappingKind == TypeMappingInfo::BYTE_LAYOUT_TO_ARRAY ||
+			newTypeInfo.elementMappingKind == TypeMappingInfo::STRUCT_TO_TYPED_ARRAY)
 		{
 			auto baseTypeIt = baseTypesForByteLayout.find(cast<StructType>(CS->getType()));
 			assert(baseTypeIt != baseTypesForByteLayout.end() && baseTypeIt->second);
@@ -825,6 +948,7 @@ uint8_t TypeOptimizer::rewriteGEPIndexes(SmallVector<Value*, 4>& newIndexes, Typ
 			case TypeMappingInfo::COLLAPSED:
 				break;
 			case TypeMappingInfo::BYTE_LAYOUT_TO_ARRAY:
+			case TypeMappingInfo::STRUCT_TO_TYPED_ARRAY:
 			{
 				assert(integerOffset==0);
 				assert(isa<StructType>(curType));
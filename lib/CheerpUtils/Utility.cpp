@@ -409,6 +409,31 @@ std::pair<StructType*, StringRef> TypeSupport::getJSExportedTypeFromMetadata(Str
 	return std::make_pair(t, jsClassName);
 }
 
+bool TypeSupport::isPooledType(const StructType* st, const std::vector<std::string>& poolTypes)
+{
+	if(!st->hasName() || st->hasByteLayout())
+		return false;
+	StringRef name = st->getName();
+	for(const std::string& poolType: poolTypes)
+	{
+		if(name == poolType || name == "struct." + poolType || name == "class." + poolType)
+			return true;
+	}
+	return false;
+}
+
+const Value* TypeSupport::getFreedObject(const Value* obj)
+{
+	while(const BitCastInst* BI = dyn_cast<BitCastInst>(obj))
+		obj = BI->getOperand(0);
+	if(const ConstantExpr* CE = dyn_cast<ConstantExpr>(obj))
+	{
+		if(CE->getOpcode() == Instruction::BitCast)
+			obj = CE->getOperand(0);
+	}
+	return obj;
+}
+
 bool TypeSupport::isSimpleType(Type* t)
 {
 	switch(t->getTypeID())
@@ -719,6 +744,10 @@ void initializeCheerpOpts(PassRegistry &Registry)
 	initializeTypeOptimizerPass(Registry);
 	initializeDelayAllocasPass(Registry);
 	initializePreExecutePass(Registry);
+	initializeI64LoweringPass(Registry);
+	initializeStackArenaPass(Registry);
+	initializeScalarizeObjectsPass(Registry);
+	initializeDevirtualizePass(Registry);
 }
 
 }
@@ -10,20 +10,76 @@
 //===----------------------------------------------------------------------===//
 
 #include "Relooper.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Cheerp/I64Lowering.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/Cheerp/Writer.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/Support/ErrorHandling.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 using namespace llvm;
 using namespace std;
 using namespace cheerp;
 
+#define DEBUG_TYPE "CheerpWriter"
+
+STATISTIC(NumLabelVariables, "Number of functions that need a label variable for control flow");
+STATISTIC(NumRegularObjects, "Number of {d,o} pointer objects created in the output");
+
+namespace {
+// Typed array views used for aligned byte layout accesses, in BYTE_LAYOUT_VIEW order
+struct ByteLayoutView
+{
+	const char* helperName;
+	const char* cacheName;
+	const char* typedArray;
+	uint32_t shift;
+};
+const ByteLayoutView byteLayoutViews[] = {
+	{ "cheerpViewInt8", "i8", "Int8Array", 0 },
+	{ "cheerpViewInt16", "i16", "Int16Array", 1 },
+	{ "cheerpViewInt32", "i32", "Int32Array", 2 },
+	{ "cheerpViewFloat32", "f32", "Float32Array", 2 },
+	{ "cheerpViewFloat64", "f64", "Float64Array", 3 }
+};
+
+// Find the value which holds the same JS array as p. Byte layout pointers always share the DataView of the object,
+// otherwise only pointer arithmetic and indexing of the first array keep the same array.
+const Value* getMemFuncArrayBase(const Value* p, bool byteLayout)
+{
+	while(true)
+	{
+		if(const GEPOperator* gep = dyn_cast<GEPOperator>(p))
+		{
+			bool sameArray = gep->getNumIndices() == 1;
+			if(gep->getNumIndices() == 2 && isa<ArrayType>(gep->getPointerOperandType()->getPointerElementType()))
+			{
+				const ConstantInt* firstIndex = dyn_cast<ConstantInt>(gep->getOperand(1));
+				sameArray = firstIndex && firstIndex->isZero();
+			}
+			if(!sameArray && !byteLayout)
+				return p;
+			p = gep->getPointerOperand();
+		}
+		else if(byteLayout && Operator::getOpcode(p) == Instruction::BitCast)
+			p = cast<Operator>(p)->getOperand(0);
+		else
+			return p;
+	}
+}
+}
+
 //De-comment this to debug the pointer kind of every function
 //#define CHEERP_DEBUG_POINTERS
 
@@ -44,6 +100,9 @@ public:
 	void renderIfBlockBegin(const void* privateBlock, int branchId, bool first);
 	void renderIfBlockBegin(const void* privateBlock, const vector<int>& branchId, bool first);
 	void renderElseBlockBegin();
+	void renderSwitchBlockBegin(const void* privateBlock);
+	void renderCaseBlockBegin(const void* privateBlock, int branchId);
+	void renderDefaultBlockBegin();
 	void renderBlockEnd();
 	void renderBlockPrologue(const void* privateBlockTo, const void* privateBlockFrom);
 	bool hasBlockPrologue(const void* privateBlockTo, const void* privateBlockFrom) const;
@@ -60,16 +119,16 @@ public:
 	void renderIfOnLabel(int labelId, bool first);
 };
 
-void CheerpWriter::handleBuiltinNamespace(const char* identifier, llvm::ImmutableCallSite callV)
+void CheerpWriter::classifyClientBuiltin(StringRef identifier, BuiltinInfo& info)
 {
-	assert(callV.getCalledFunction());
-	const char* ident = identifier;
+	// Names are null terminated, as required by strtol
+	const char* ident = identifier.data();
 	//Read the class name
 	char* className;
 	int classLen = strtol(ident,&className,10);
 	if(classLen == 0)
 	{
-		llvm::report_fatal_error(Twine("Unexpected C++ mangled name: ", StringRef(identifier)), false);
+		info.handler = BUILTIN_CLIENT_MALFORMED;
 		return;
 	}
 	ident = className + classLen;
@@ -89,36 +148,55 @@ void CheerpWriter::handleBuiltinNamespace(const char* identifier, llvm::Immutabl
 	//This condition is necessarily true
 	assert(funcNameLen!=0);
 
-	bool isClientStatic = callV.getCalledFunction()->hasFnAttribute(Attribute::Static);
+	if(className)
+		info.className = StringRef(className, classLen);
+	info.name = StringRef(funcName, funcNameLen);
+	if(info.name.startswith("get_"))
+	{
+		//Getter
+		info.handler = className ? BUILTIN_CLIENT_GETTER : BUILTIN_CLIENT_MALFORMED;
+		info.name = info.name.substr(4);
+	}
+	else if(info.name.startswith("set_"))
+	{
+		//Setter, the name is empty for the generic setter
+		info.handler = className ? BUILTIN_CLIENT_SETTER : BUILTIN_CLIENT_MALFORMED;
+		info.name = info.name.substr(4);
+	}
+	else if(className == NULL && info.name.startswith("Objectix"))
+	{
+		// operator[]
+		info.handler = BUILTIN_CLIENT_INDEX;
+	}
+	else
+		info.handler = BUILTIN_CLIENT_METHOD;
+}
+
+void CheerpWriter::compileClientBuiltin(const BuiltinInfo& info, llvm::ImmutableCallSite callV)
+{
+	assert(callV.getCalledFunction());
+	if(info.handler == BUILTIN_CLIENT_MALFORMED)
+	{
+		llvm::report_fatal_error(Twine("Unexpected C++ mangled name: ", callV.getCalledFunction()->getName()), false);
+		return;
+	}
 
 	if(callV->getType()->isDoubleTy() || callV->getType()->isFloatTy())
 		stream << '+';
 
 	//The first arg should be the object
-	if(strncmp(funcName,"get_",4)==0)
+	if(info.handler == BUILTIN_CLIENT_GETTER)
 	{
 		//Getter
 		assert(callV.arg_size()==1);
-		if(className == NULL)
-		{
-			llvm::report_fatal_error(Twine("Unexpected getter without class: ", StringRef(identifier)), false);
-			return;
-		}
-
 		compileOperand(callV.getArgument(0));
-		stream << '.' << StringRef( funcName + 4, funcNameLen - 4 );
+		stream << '.' << info.name;
 	}
-	else if(strncmp(funcName,"set_",4)==0)
+	else if(info.handler == BUILTIN_CLIENT_SETTER)
 	{
 		//Setter
-		if(className == NULL)
-		{
-			llvm::report_fatal_error(Twine("Unexpected setter without class: ", StringRef(identifier)), false);
-			return;
-		}
-
 		compileOperand(callV.getArgument(0));
-		if(funcNameLen == 4)
+		if(info.name.empty())
 		{
 			// Generic setter
 			assert(callV.arg_size()==3);
@@ -130,11 +208,11 @@ void CheerpWriter::handleBuiltinNamespace(const char* identifier, llvm::Immutabl
 		else
 		{
 			assert(callV.arg_size()==2);
-			stream << '.' << StringRef( funcName + 4, funcNameLen - 4 ) <<  '=';
+			stream << '.' << info.name <<  '=';
 			compileOperand(callV.getArgument(1));
 		}
 	}
-	else if(className == NULL && strncmp(funcName,"Objectix",8)==0)
+	else if(info.handler == BUILTIN_CLIENT_INDEX)
 	{
 		// operator[]
 		assert(callV.arg_size()==2);
@@ -148,14 +226,14 @@ void CheerpWriter::handleBuiltinNamespace(const char* identifier, llvm::Immutabl
 		User::const_op_iterator it = callV.arg_begin();
 
 		//Regular call
-		if(className)
+		if(!info.className.empty())
 		{
-			if(isClientStatic)
-				stream << StringRef(className,classLen);
+			if(info.isStatic)
+				stream << info.className;
 			else if(callV.arg_empty())
 			{
 				llvm::report_fatal_error(Twine("At least 'this' parameter was expected: ",
-					StringRef(identifier)), false);
+					callV.getCalledFunction()->getName()), false);
 				return;
 			}
 			else
@@ -165,7 +243,7 @@ void CheerpWriter::handleBuiltinNamespace(const char* identifier, llvm::Immutabl
 			}
 			stream << '.';
 		}
-		stream << StringRef(funcName,funcNameLen);
+		stream << info.name;
 		compileMethodArgs(it,callV.arg_end(), callV, /*forceBoolean*/ true);
 	}
 }
@@ -193,17 +271,16 @@ void CheerpWriter::compileCopyElement(const Value* baseDest,
 			if(TypeSupport::hasByteLayout(currentType))
 			{
 				uint64_t typeSize = targetData.getTypeAllocSize(currentType);
-				stream << "var __tmp__=new Int8Array(";
-				compilePointerBase(baseDest);
-				stream << ".buffer,";
-				compilePointerOffset(baseDest, LOWEST);
-				stream << ',' << typeSize << ");" << NewLine;
-				stream << "__tmp__.set(";
-				stream << "new Int8Array(";
-				compilePointerBase(baseSrc);
-				stream << ".buffer,";
+				compileMemFuncBase(baseDest);
+				stream << ".set(";
+				compileMemFuncBase(baseSrc);
+				stream << ".subarray(";
 				compilePointerOffset(baseSrc, LOWEST);
-				stream << ',' << typeSize << "));" << NewLine;
+				stream << ',';
+				compilePointerOffset(baseSrc, ADD_SUB);
+				stream << '+' << typeSize << "),";
+				compilePointerOffset(baseDest, LOWEST);
+				stream << ");" << NewLine;
 				break;
 			}
 			// Fallthrough if not byte layout
@@ -232,7 +309,7 @@ void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 		{
 			compilePointerBase(src);
 			stream << ';' << NewLine;
-			stream << namegen.getSecondaryName(callV.getInstruction()) << '=';
+			stream << getSecondaryName(callV.getInstruction()) << '=';
 			compilePointerOffset(src, LOWEST);
 		}
 		else
@@ -245,7 +322,7 @@ void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 		{
 			compileCompleteObject(src);
 			stream << ".a;" << NewLine;
-			stream << namegen.getSecondaryName(callV.getInstruction()) << '=';
+			stream << getSecondaryName(callV.getInstruction()) << '=';
 			compileCompleteObject(src);
 			stream << ".o-(";
 			compileOperand(offset, LOWEST);
@@ -254,6 +331,7 @@ void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 		else if(result_kind == REGULAR)
 		{
 			stream << "{d:";
+			NumRegularObjects++;
 			compileCompleteObject(src);
 			stream << ".a,o:";
 			compileCompleteObject(src);
@@ -274,11 +352,19 @@ void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 	}
 }
 
+void CheerpWriter::compileMemFuncBase(const Value* p)
+{
+	if(PA.getPointerKind(p) == BYTE_LAYOUT)
+		compileByteLayoutView(p, BYTE_LAYOUT_VIEW_INT8);
+	else
+		compilePointerBase(p);
+}
+
 /* Method that handles memcpy and memmove.
- * Since only immutable types are handled in the backend and we use TypedArray.set to make the copy
- * there is not need to handle memmove in a special way
+ * Since only immutable types are handled in the backend and we use TypedArray.set or copyWithin to make the copy
+ * there is not need to handle memmove in a special way, except when unrolling small copies
 */
-void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Value* size)
+void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Value* size, bool isMemmove)
 {
 	Type* destType=dest->getType();
 	Type* pointedType = cast<PointerType>(destType)->getElementType();
@@ -286,6 +372,7 @@ void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Val
 		llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
 
 	uint64_t typeSize = TypeSupport::hasByteLayout(pointedType) ? 1 : targetData.getTypeAllocSize(pointedType);
+	bool byteLayout = PA.getPointerKind(dest) == BYTE_LAYOUT;
 
 	bool constantNumElements = false;
 	uint32_t numElem = 0;
@@ -295,8 +382,50 @@ void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Val
 		uint32_t allocatedSize = getIntFromValue(size);
 		numElem = (allocatedSize+typeSize-1)/typeSize;
 		constantNumElements = true;
+		if(numElem == 0)
+			return;
 	}
-	else
+
+	// Copies inside the same object can be done in place, copyWithin is memmove-like and also works for normal arrays
+	if(getMemFuncArrayBase(dest, byteLayout) == getMemFuncArrayBase(src, byteLayout) && (!constantNumElements || numElem > 1))
+	{
+		compileMemFuncBase(dest);
+		stream << ".copyWithin(";
+		compilePointerOffset(dest, LOWEST);
+		stream << ',';
+		compilePointerOffset(src, LOWEST);
+		stream << ',';
+		compilePointerOffset(src, ADD_SUB);
+		stream << '+';
+		if(constantNumElements)
+			stream << numElem;
+		else
+		{
+			compileOperand(size, MUL_DIV);
+			stream << '/' << typeSize << ">>0";
+		}
+		stream << ");" << NewLine;
+		return;
+	}
+
+	// Unroll small copies, they don't need temporary views. Overlapping memmoves would need a direction, so skip them.
+	if(constantNumElements && numElem > 1 && numElem <= MaxUnrolledMemFuncElements && !byteLayout && !isMemmove)
+	{
+		for(uint32_t i=0;i<numElem;i++)
+		{
+			compilePointerBase(dest);
+			stream << '[';
+			compilePointerOffset(dest, ADD_SUB);
+			stream << '+' << i << "]=";
+			compilePointerBase(src);
+			stream << '[';
+			compilePointerOffset(src, ADD_SUB);
+			stream << '+' << i << "];" << NewLine;
+		}
+		return;
+	}
+
+	if(!constantNumElements)
 	{
 		//Compute number of elements at runtime
 		stream << "var __numElem__=";
@@ -306,25 +435,15 @@ void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Val
 		stream << ';' << NewLine;
 	}
 
-
 	// Handle the case for multiple elements, it assumes that we can use TypedArray.set
 	if(!constantNumElements)
 		stream << "if(__numElem__>1)" << NewLine << '{';
 	if(!constantNumElements || numElem>1)
 	{
-		bool byteLayout = PA.getPointerKind(dest) == BYTE_LAYOUT;
 		// The semantics of TypedArray.set is memmove-like, no need to care about direction
-		if(byteLayout)
-			stream << "(new Int8Array(";
-		compilePointerBase(dest);
-		if(byteLayout)
-			stream << ".buffer))";
+		compileMemFuncBase(dest);
 		stream << ".set(";
-		if(byteLayout)
-			stream << "(new Int8Array(";
-		compilePointerBase(src);
-		if(byteLayout)
-			stream << ".buffer))";
+		compileMemFuncBase(src);
 
 		//We need to get a subview of the source
 		stream << ".subarray(";
@@ -354,6 +473,92 @@ void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Val
 		stream << NewLine << '}';
 }
 
+void CheerpWriter::compileMemset(const Value* dest, const Value* resetVal, const Value* size)
+{
+	Type* pointedType = dest->getType()->getPointerElementType();
+	bool byteLayout = PA.getPointerKind(dest) == BYTE_LAYOUT;
+	const ConstantInt* constantResetVal = dyn_cast<ConstantInt>(resetVal);
+	if(!byteLayout && !pointedType->isIntegerTy(8) && !pointedType->isIntegerTy(16) && !pointedType->isIntegerTy(32) &&
+		!((pointedType->isFloatTy() || pointedType->isDoubleTy()) && constantResetVal))
+	{
+		llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
+	}
+	uint64_t typeSize = byteLayout ? 1 : targetData.getTypeAllocSize(pointedType);
+	uint32_t numElem = 0;
+	if(isa<ConstantInt>(size))
+	{
+		numElem = getIntFromValue(size)/typeSize;
+		if(numElem == 0)
+			return;
+	}
+
+	// Compile the byte replicated over the whole element
+	auto compileResetVal = [&]()
+	{
+		if(byteLayout || pointedType->isIntegerTy(8))
+			compileOperand(resetVal, LOWEST);
+		else if(constantResetVal)
+		{
+			uint64_t byte = constantResetVal->getZExtValue() & 0xff;
+			uint64_t bits = 0;
+			for(uint32_t i=0;i<typeSize;i++)
+				bits = (bits << 8) | byte;
+			if(pointedType->isIntegerTy())
+				stream << bits;
+			else if(bits == 0)
+				stream << '0';
+			else
+			{
+				APFloat f(pointedType->isFloatTy() ? APFloat::IEEEsingle : APFloat::IEEEdouble, APInt(typeSize*8, bits));
+				if(f.isNaN())
+					stream << "NaN";
+				else if(f.isInfinity())
+					stream << (f.isNegative() ? "-Infinity" : "Infinity");
+				else
+				{
+					SmallString<32> buf;
+					f.toString(buf, std::numeric_limits<double>::max_digits10);
+					stream << buf;
+				}
+			}
+		}
+		else
+		{
+			// The product is exact, fill takes care of wrapping it
+			stream << '(';
+			compileOperand(resetVal, BIT_AND);
+			stream << "&255)*" << (pointedType->isIntegerTy(16) ? 257 : 16843009);
+		}
+	};
+
+	if(PA.getPointerKind(dest) == COMPLETE_OBJECT)
+	{
+		// A single element, not stored in an array
+		assert(numElem == 1);
+		compileCompleteObject(dest);
+		stream << '=';
+		compileResetVal();
+		stream << ';' << NewLine;
+		return;
+	}
+	compileMemFuncBase(dest);
+	stream << ".fill(";
+	compileResetVal();
+	stream << ',';
+	compilePointerOffset(dest, LOWEST);
+	stream << ',';
+	compilePointerOffset(dest, ADD_SUB);
+	stream << '+';
+	if(numElem)
+		stream << numElem;
+	else
+	{
+		compileOperand(size, MUL_DIV);
+		stream << '/' << typeSize << ">>0";
+	}
+	stream << ");" << NewLine;
+}
+
 uint32_t CheerpWriter::compileArraySize(const DynamicAllocInfo & info, bool shouldPrint, bool inBytes)
 {
 	// We assume parenthesis around this code
@@ -429,6 +634,7 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 	if(needsRegular)
 	{
 		stream << "{d:";
+		NumRegularObjects++;
 	}
 
 	// To implement cheerp_reallocate we need to strategies:
@@ -520,12 +726,25 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 		if((REGULAR == result || SPLIT_REGULAR == result) && !needsDowncastArray)
 			stream << '[';
 
+		// Reuse a freed object if possible. Fresh memory is not guaranteed to be zeroed, except for calloc.
+		bool usePool = numElem == 1 && isPooledType(t) && info.getAllocType() != DynamicAllocInfo::calloc;
+		if(usePool)
+		{
+			poolsUsed.insert(cast<StructType>(t));
+			stream << '(';
+			compilePoolName(cast<StructType>(t));
+			stream << ".length?";
+			compilePoolName(cast<StructType>(t));
+			stream << ".pop():";
+		}
 		for(uint32_t i = 0; i < numElem;i++)
 		{
-			compileType(t, LITERAL_OBJ, !isInlineable(*info.getInstruction(), PA) ? namegen.getName(info.getInstruction()) : StringRef());
+			compileType(t, LITERAL_OBJ, !isInlineable(*info.getInstruction(), PA) ? getName(info.getInstruction()) : StringRef());
 			if((i+1) < numElem)
 				stream << ',';
 		}
+		if(usePool)
+			stream << ')';
 
 		if(REGULAR == result || SPLIT_REGULAR == result)
 		{
@@ -567,6 +786,62 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 void CheerpWriter::compileFree(const Value* obj)
 {
 	//TODO: Clean up class related data structures
+	// Objects of pooled types are recycled by later allocations
+	obj = TypeSupport::getFreedObject(obj);
+	if(!isPooledType(obj->getType()->getPointerElementType()) || isa<ConstantPointerNull>(obj))
+		return;
+	StructType* st = cast<StructType>(obj->getType()->getPointerElementType());
+	poolsUsed.insert(st);
+	// Freeing null is allowed
+	compileCompleteObject(obj);
+	stream << "&&";
+	compilePoolName(st);
+	stream << ".push(";
+	compileCompleteObject(obj);
+	stream << ')';
+}
+
+bool CheerpWriter::isPooledType(Type* t) const
+{
+	StructType* st = dyn_cast<StructType>(t);
+	return st && TypeSupport::isPooledType(st, poolTypes) && !globalDeps.needsDowncastArray(st);
+}
+
+void CheerpWriter::compilePoolName(const StructType* st)
+{
+	stream << "cheerpPool" << NameGenerator::filterLLVMName(st->getName(), NameGenerator::GLOBAL);
+}
+
+void CheerpWriter::compilePools()
+{
+	// Use the module order, so that the output is deterministic
+	for(StructType* st: module.getIdentifiedStructTypes())
+	{
+		if(!poolsUsed.count(st))
+			continue;
+		stream << "var ";
+		compilePoolName(st);
+		stream << "=[];" << NewLine;
+	}
+}
+
+void CheerpWriter::reportStructTypeShapes() const
+{
+	// Use the module order, so that the output is deterministic
+	for(StructType* st: module.getIdentifiedStructTypes())
+	{
+		auto it = structShapes.find(st);
+		if(it == structShapes.end() || (it->second & (it->second - 1)) == 0)
+			continue;
+		llvm::errs() << "Struct type " << st->getName() << " is created with multiple shapes:";
+		if(it->second & STRUCT_SHAPE_LITERAL)
+			llvm::errs() << " literal";
+		if(it->second & STRUCT_SHAPE_CONSTRUCTOR)
+			llvm::errs() << " constructor";
+		if(it->second & STRUCT_SHAPE_CONSTANT)
+			llvm::errs() << " constant";
+		llvm::errs() << "\n";
+	}
 }
 
 CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(ImmutableCallSite callV, const Function * func)
@@ -579,19 +854,18 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 	
 	ImmutableCallSite::arg_iterator it = callV.arg_begin(), itE = callV.arg_end();
 	
-	StringRef ident = func->getName();
 	unsigned intrinsicId = func->getIntrinsicID();
 	//First handle high priority builtins, they will be used even
 	//if an implementation is available from the user
 	if(intrinsicId==Intrinsic::memmove ||
 		intrinsicId==Intrinsic::memcpy)
 	{
-		compileMemFunc(*(it), *(it+1), *(it+2));
+		compileMemFunc(*(it), *(it+1), *(it+2), intrinsicId==Intrinsic::memmove);
 		return COMPILE_EMPTY;
 	}
 	else if(intrinsicId==Intrinsic::memset)
 	{
-		llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
+		compileMemset(*(it), *(it+1), *(it+2));
 		return COMPILE_EMPTY;
 	}
 	else if(intrinsicId==Intrinsic::invariant_start)
@@ -610,7 +884,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 	else if(intrinsicId==Intrinsic::vastart)
 	{
 		compileCompleteObject(*it);
-		stream << "={d:arguments,o:" << namegen.getName(currentFun) << ".length}";
+		stream << "={d:arguments,o:" << getName(currentFun) << ".length}";
 		return COMPILE_OK;
 	}
 	else if(intrinsicId==Intrinsic::vaend)
@@ -677,6 +951,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 	else if(intrinsicId==Intrinsic::cheerp_make_regular)
 	{
 		stream << "{d:";
+		NumRegularObjects++;
 		compileCompleteObject(*it);
 		stream << ",o:";
 		compileOperand(*(it+1));
@@ -701,210 +976,247 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 		compileOperand(*it);
 		return COMPILE_OK;
 	}
-	else if(ident=="free" || ident=="_ZdlPv" || ident=="_ZdaPv" || intrinsicId==Intrinsic::cheerp_deallocate)
-	{
-		compileFree(*it);
-		return COMPILE_OK;
-	}
-	else if(ident=="fmod" || ident=="fmodf")
-	{
-		// Handle this internally, C++ does not have float mod operation
-		stream << '(';
-		compileOperand(*(it), MUL_DIV);
-		stream << '%';
-		compileOperand(*(it+1), MUL_DIV);
-		stream << ')';
-		return COMPILE_OK;
-	}
-	else if(useNativeJavaScriptMath)
+
+	auto builtinIt = builtinTable.find(func);
+	const BuiltinInfo& builtin = builtinIt != builtinTable.end() ? builtinIt->second : classifyBuiltin(*func);
+	switch(builtin.handler)
 	{
-		if(ident=="fabs" || ident=="fabsf")
-		{
-			stream << "Math.abs(";
-			compileOperand(*(it));
-			stream << ')';
-			return COMPILE_OK;
-		}
-		else if(ident=="acos" || ident=="acosf")
-		{
-			stream << "Math.acos(";
-			compileOperand(*(it));
-			stream << ')';
-			return COMPILE_OK;
-		}
-		else if(ident=="asin" || ident=="asinf")
-		{
-			stream << "Math.asin(";
-			compileOperand(*(it));
-			stream << ')';
-			return COMPILE_OK;
-		}
-		else if(ident=="atan" || ident=="atanf")
+		case BUILTIN_FREE:
 		{
-			stream << "Math.atan(";
-			compileOperand(*(it));
-			stream << ')';
+			compileFree(*it);
 			return COMPILE_OK;
 		}
-		else if(ident=="atan2" || ident=="atan2f")
+		case BUILTIN_I64_PACK:
 		{
-			stream << "Math.atan2(";
-			compileOperand(*(it));
+			// 64-bit integers are kept as [low,high] when they need to be a single value
+			stream << '[';
+			compileOperand(*(it), LOWEST);
 			stream << ',';
-			compileOperand(*(it+1));
-			stream << ')';
+			compileOperand(*(it+1), LOWEST);
+			stream << ']';
 			return COMPILE_OK;
 		}
-		else if(ident=="ceil" || ident=="ceilf")
+		case BUILTIN_I64_LOW:
+		case BUILTIN_I64_HIGH:
 		{
-			stream << "Math.ceil(";
-			compileOperand(*(it));
-			stream << ')';
+			// Zero initialized memory contains 0 instead of an array, both parts are 0 in that case
+			stream << '(';
+			compileOperand(*(it), HIGHEST);
+			stream << (builtin.handler == BUILTIN_I64_LOW ? "[0]" : "[1]") << "|0)";
 			return COMPILE_OK;
 		}
-		else if(ident=="cos" || ident=="cosf")
+		case BUILTIN_I64_BITS_LOW:
+		case BUILTIN_I64_BITS_HIGH:
 		{
-			stream << "Math.cos(";
-			compileOperand(*(it));
-			stream << ')';
+			// Typed arrays use the platform byte order, which is little endian everywhere in practice
+			stream << "(__cheerpF64Scratch[0]=";
+			compileOperand(*(it), LOWEST);
+			stream << ",__cheerpI32Scratch[" << (builtin.handler == BUILTIN_I64_BITS_LOW ? '0' : '1') << "]|0)";
+			i64BitcastsUsed = true;
 			return COMPILE_OK;
 		}
-		else if(ident=="exp" || ident=="expf")
+		case BUILTIN_I64_TO_DOUBLE:
 		{
-			stream << "Math.exp(";
-			compileOperand(*(it));
-			stream << ')';
+			stream << "(__cheerpI32Scratch[0]=";
+			compileOperand(*(it), LOWEST);
+			stream << ",__cheerpI32Scratch[1]=";
+			compileOperand(*(it+1), LOWEST);
+			stream << ",__cheerpF64Scratch[0])";
+			i64BitcastsUsed = true;
 			return COMPILE_OK;
 		}
-		else if(ident=="floor" || ident=="floorf")
+		case BUILTIN_FMOD:
 		{
-			stream << "Math.floor(";
-			compileOperand(*(it));
+			// Handle this internally, C++ does not have float mod operation
+			stream << '(';
+			compileOperand(*(it), MUL_DIV);
+			stream << '%';
+			compileOperand(*(it+1), MUL_DIV);
 			stream << ')';
 			return COMPILE_OK;
 		}
-		else if(ident=="log" || ident=="logf")
+		case BUILTIN_MATH:
 		{
-			stream << "Math.log(";
-			compileOperand(*(it));
+			stream << "Math." << builtin.name << '(';
+			for(ImmutableCallSite::arg_iterator arg = it; arg != itE; ++arg)
+			{
+				if(arg != it)
+					stream << ',';
+				compileOperand(*arg);
+			}
 			stream << ')';
 			return COMPILE_OK;
 		}
-		else if(ident=="pow" || ident=="powf")
+		case BUILTIN_ALLOCATION:
 		{
-			stream << "Math.pow(";
-			compileOperand(*(it));
-			stream << ',';
-			compileOperand(*(it+1));
-			stream << ')';
+			DynamicAllocInfo da(callV, &targetData);
+			assert(da.isValidAlloc());
+			compileAllocation(da);
 			return COMPILE_OK;
 		}
-		else if(ident=="round" || ident=="roundf")
+		case BUILTIN_CLIENT_STRING:
 		{
-			stream << "Math.round(";
-			compileOperand(*(it));
-			stream << ')';
-			return COMPILE_OK;
-		}
-		else if(ident=="sin" || ident=="sinf")
-		{
-			stream << "Math.sin(";
-			compileOperand(*(it));
-			stream << ')';
+			StringRef str;
+			if(llvm::getConstantStringInfo(*it, str))
+			{
+				stream << '"';
+				for(uint8_t c: str)
+				{
+					if(c=='\b')
+						stream << "\\b";
+					else if(c=='\f')
+						stream << "\\f";
+					else if(c=='\n')
+						stream << "\\n";
+					else if(c=='\r')
+						stream << "\\r";
+					else if(c=='\t')
+						stream << "\\t";
+					else if(c=='\v')
+						stream << "\\v";
+					else if(c=='\'')
+						stream << "\\'";
+					else if(c=='"')
+						stream << "\\\"";
+					else if(c=='\\')
+						stream << "\\\\";
+					else if(c>=' ' && c<='~')
+					{
+						// Printable ASCII after we exscluded the previous one
+						stream << c;
+					}
+					else
+					{
+						char buf[5];
+						snprintf(buf, 5, "\\x%02x", c);
+						stream << buf;
+					}
+				}
+				stream << '"';
+				return COMPILE_OK;
+			}
+			//If the method is implemented by the user, stop here
+			if(userImplemented)
+				return COMPILE_UNSUPPORTED;
+			//For builtin String, do not use new
+			stream << builtin.className;
+			compileMethodArgs(it, itE, callV, /*forceBoolean*/ true);
 			return COMPILE_OK;
 		}
-		else if(ident=="sqrt" || ident=="sqrtf")
+		case BUILTIN_CLIENT_CONSTRUCTOR:
 		{
-			stream << "Math.sqrt(";
-			compileOperand(*(it));
-			stream << ')';
+			//Default handling of builtin constructors
+			//For builtin String, do not use new
+			if(!builtin.className.startswith("String"))
+				stream << "new ";
+			stream << builtin.className;
+			compileMethodArgs(it, itE, callV, /*forceBoolean*/ true);
 			return COMPILE_OK;
 		}
-		else if(ident=="tan" || ident=="tanf")
+		case BUILTIN_CLIENT_GETTER:
+		case BUILTIN_CLIENT_SETTER:
+		case BUILTIN_CLIENT_INDEX:
+		case BUILTIN_CLIENT_METHOD:
+		case BUILTIN_CLIENT_MALFORMED:
 		{
-			stream << "Math.tan(";
-			compileOperand(*(it));
-			stream << ')';
+			compileClientBuiltin(builtin, callV);
 			return COMPILE_OK;
 		}
+		case BUILTIN_NONE:
+			break;
 	}
+	return COMPILE_UNSUPPORTED;
+}
 
-	DynamicAllocInfo da(callV, &targetData);
-	if (da.isValidAlloc())
+void CheerpWriter::computeBuiltinTable()
+{
+	for(const Function& F: module)
 	{
-		compileAllocation(da);
-		return COMPILE_OK;
+		BuiltinInfo info = classifyBuiltin(F);
+		if(info.handler != BUILTIN_NONE)
+			ownedBuiltinTable->insert(std::make_pair(&F, info));
 	}
-	else if(ident=="cheerpCreate_ZN6client6StringC2EPKc")
-	{
-		StringRef str;
-		if(llvm::getConstantStringInfo(*it, str))
-		{
-			stream << '"';
-			for(uint8_t c: str)
-			{
-				if(c=='\b')
-					stream << "\\b";
-				else if(c=='\f')
-					stream << "\\f";
-				else if(c=='\n')
-					stream << "\\n";
-				else if(c=='\r')
-					stream << "\\r";
-				else if(c=='\t')
-					stream << "\\t";
-				else if(c=='\v')
-					stream << "\\v";
-				else if(c=='\'')
-					stream << "\\'";
-				else if(c=='"')
-					stream << "\\\"";
-				else if(c=='\\')
-					stream << "\\\\";
-				else if(c>=' ' && c<='~')
-				{
-					// Printable ASCII after we exscluded the previous one
-					stream << c;
-				}
-				else
-				{
-					char buf[5];
-					snprintf(buf, 5, "\\x%02x", c);
-					stream << buf;
-				}
+}
+
+CheerpWriter::BuiltinInfo CheerpWriter::classifyBuiltin(const Function& F) const
+{
+	// Math functions which have a native JS equivalent, both the double and float versions are mapped
+	static const char* mathBuiltins[][2] = {
+		{ "fabs", "abs" }, { "acos", "acos" }, { "asin", "asin" }, { "atan", "atan" }, { "atan2", "atan2" },
+		{ "ceil", "ceil" }, { "cos", "cos" }, { "exp", "exp" }, { "floor", "floor" }, { "log", "log" },
+		{ "pow", "pow" }, { "round", "round" }, { "sin", "sin" }, { "sqrt", "sqrt" }, { "tan", "tan" }
+	};
+	BuiltinInfo info;
+	StringRef ident = F.getName();
+	//These builtins will be used even if an implementation is available from the user
+	if(ident=="free" || ident=="_ZdlPv" || ident=="_ZdaPv" || F.getIntrinsicID()==Intrinsic::cheerp_deallocate)
+		info.handler = BUILTIN_FREE;
+	else if(ident==cheerp::I64Lowering::packName)
+		info.handler = BUILTIN_I64_PACK;
+	else if(ident==cheerp::I64Lowering::lowName)
+		info.handler = BUILTIN_I64_LOW;
+	else if(ident==cheerp::I64Lowering::highName)
+		info.handler = BUILTIN_I64_HIGH;
+	else if(ident==cheerp::I64Lowering::bitsLowName)
+		info.handler = BUILTIN_I64_BITS_LOW;
+	else if(ident==cheerp::I64Lowering::bitsHighName)
+		info.handler = BUILTIN_I64_BITS_HIGH;
+	else if(ident==cheerp::I64Lowering::toDoubleName)
+		info.handler = BUILTIN_I64_TO_DOUBLE;
+	else if(ident=="fmod" || ident=="fmodf")
+		info.handler = BUILTIN_FMOD;
+	if(info.handler != BUILTIN_NONE)
+		return info;
+	if(useNativeJavaScriptMath)
+	{
+		StringRef baseName = ident.endswith("f") ? ident.drop_back() : ident;
+		for(const auto& mathBuiltin: mathBuiltins)
+		{
+			if(ident == mathBuiltin[0] || baseName == mathBuiltin[0])
+			{
+				info.handler = BUILTIN_MATH;
+				info.name = mathBuiltin[1];
+				return info;
 			}
-			stream << '"';
-			return COMPILE_OK;
 		}
 	}
-
-	//If the method is implemented by the user, stop here
-	if(userImplemented)
-		return COMPILE_UNSUPPORTED;
-
-	if(ident.startswith("_ZN6client"))
+	switch(F.getIntrinsicID())
 	{
-		handleBuiltinNamespace(ident.data()+10,callV);
-		return COMPILE_OK;
+		case Intrinsic::cheerp_allocate:
+		case Intrinsic::cheerp_reallocate:
+			info.handler = BUILTIN_ALLOCATION;
+			return info;
+		default:
+			break;
 	}
-	else if(ident.startswith("_ZNK6client"))
+	if(ident=="malloc" || ident=="calloc" || ident=="_Znwj" || ident=="_Znaj")
 	{
-		handleBuiltinNamespace(ident.data()+11,callV);
-		return COMPILE_OK;
+		info.handler = BUILTIN_ALLOCATION;
+		return info;
 	}
+	if(ident=="cheerpCreate_ZN6client6StringC2EPKc")
+	{
+		info.handler = BUILTIN_CLIENT_STRING;
+		info.className = "String";
+		return info;
+	}
+	//Methods implemented by the user are not builtins
+	if(!F.empty())
+		return info;
+	if(ident.startswith("_ZN6client"))
+		classifyClientBuiltin(ident.substr(10), info);
+	else if(ident.startswith("_ZNK6client"))
+		classifyClientBuiltin(ident.substr(11), info);
 	else if(ident.startswith("cheerpCreate_ZN6client"))
 	{
 		//Default handling of builtin constructors
 		char* typeName;
 		int typeLen=strtol(ident.data()+22,&typeName,10);
-		//For builtin String, do not use new
-		if(strncmp(typeName, "String", 6)!=0)
-			stream << "new ";
-		stream << StringRef(typeName, typeLen);
-		compileMethodArgs(it, itE, callV, /*forceBoolean*/ true);
-		return COMPILE_OK;
+		info.className = StringRef(typeName, typeLen);
+		info.handler = BUILTIN_CLIENT_CONSTRUCTOR;
 	}
-	return COMPILE_UNSUPPORTED;
+	info.isStatic = F.hasFnAttribute(Attribute::Static);
+	return info;
 }
 
 void CheerpWriter::compilePredicate(CmpInst::Predicate p)
@@ -1216,7 +1528,7 @@ void CheerpWriter::compilePointerBase(const Value* p, bool forEscapingPointer)
 
 	if((!isa<Instruction>(p) || !isInlineable(*cast<Instruction>(p), PA)) && PA.getPointerKind(p) == SPLIT_REGULAR)
 	{
-		stream << namegen.getName(p);
+		stream << getName(p);
 		return;
 	}
 
@@ -1311,6 +1623,87 @@ const Value* CheerpWriter::compileByteLayoutOffset(const Value* p, BYTE_LAYOUT_O
 	return lastOffset;
 }
 
+bool CheerpWriter::isByteLayoutOffsetAligned(const Value* p, uint32_t alignment) const
+{
+	// Mirror the traversal done by compileByteLayoutOffset in BYTE_LAYOUT_OFFSET_FULL mode, every term of the sum must be aligned
+	while ( isBitCast(p) || isGEP(p) )
+	{
+		const User * u = cast<User>(p);
+		bool byteLayoutFromHere = PA.getPointerKind(u->getOperand(0)) != BYTE_LAYOUT;
+		Type* curType = u->getOperand(0)->getType();
+		if (isGEP(p))
+		{
+			bool skipUntilBytelayout = byteLayoutFromHere;
+			for (uint32_t i=1;i<u->getNumOperands();i++)
+			{
+				const Value* index = u->getOperand(i);
+				if (StructType* ST = dyn_cast<StructType>(curType))
+				{
+					uint32_t elementIndex = cast<ConstantInt>(index)->getZExtValue();
+					if (!skipUntilBytelayout && targetData.getStructLayout(ST)->getElementOffset(elementIndex) % alignment)
+						return false;
+					curType = ST->getElementType(elementIndex);
+				}
+				else
+				{
+					uint64_t elementSize = targetData.getTypeAllocSize(curType->getSequentialElementType());
+					// A constant index may still produce an aligned offset when the element size is not aligned
+					if (const ConstantInt* CI = dyn_cast<ConstantInt>(index))
+						elementSize *= CI->getSExtValue();
+					if (!skipUntilBytelayout && elementSize % alignment)
+						return false;
+					curType = curType->getSequentialElementType();
+				}
+				if (skipUntilBytelayout && TypeSupport::hasByteLayout(curType))
+					skipUntilBytelayout = false;
+			}
+		}
+		// The base of the byte layout object is always at offset 0
+		if(byteLayoutFromHere)
+			return true;
+		p = u->getOperand(0);
+	}
+	// The offset of a generic byte layout pointer is only known at run time
+	if(const ConstantInt* CI=PA.getConstantOffsetForPointer(p))
+		return (CI->getSExtValue() * targetData.getTypeAllocSize(p->getType()->getPointerElementType())) % alignment == 0;
+	return false;
+}
+
+bool CheerpWriter::compileByteLayoutViewAccess(const Value* p)
+{
+	Type* pointedType=p->getType()->getPointerElementType();
+	BYTE_LAYOUT_VIEW viewKind;
+	if(pointedType->isIntegerTy(8))
+		viewKind = BYTE_LAYOUT_VIEW_INT8;
+	else if(pointedType->isIntegerTy(16))
+		viewKind = BYTE_LAYOUT_VIEW_INT16;
+	else if(pointedType->isIntegerTy(32))
+		viewKind = BYTE_LAYOUT_VIEW_INT32;
+	else if(pointedType->isFloatTy())
+		viewKind = BYTE_LAYOUT_VIEW_FLOAT32;
+	else if(pointedType->isDoubleTy())
+		viewKind = BYTE_LAYOUT_VIEW_FLOAT64;
+	else
+		return false;
+	const ByteLayoutView& view = byteLayoutViews[viewKind];
+	if(isa<ConstantPointerNull>(p) || isa<UndefValue>(p) || !isByteLayoutOffsetAligned(p, 1 << view.shift))
+		return false;
+	compileByteLayoutView(p, viewKind);
+	// Views are indexed in units of the element size, the shift also coerces the offset to an integer
+	stream << '[';
+	compileByteLayoutOffset(p, BYTE_LAYOUT_OFFSET_FULL);
+	stream << ">>" << view.shift << ']';
+	return true;
+}
+
+void CheerpWriter::compileByteLayoutView(const Value* p, BYTE_LAYOUT_VIEW viewKind)
+{
+	byteLayoutViewsUsed |= 1 << viewKind;
+	stream << byteLayoutViews[viewKind].helperName << '(';
+	compilePointerBase(p);
+	stream << ')';
+}
+
 void CheerpWriter::compilePointerOffset(const Value* p, PARENT_PRIORITY parentPrio, bool forEscapingPointer)
 {
 	if(parentPrio >= SHIFT) stream << '(';
@@ -1347,7 +1740,7 @@ void CheerpWriter::compilePointerOffset(const Value* p, PARENT_PRIORITY parentPr
 	}
 	else if(isa<Argument>(p))
 	{
-		stream << namegen.getSecondaryName(p);
+		stream << getSecondaryName(p);
 	}
 	else if((isa<SelectInst> (p) && isInlineable(*cast<Instruction>(p), PA)) || (isa<ConstantExpr>(p) && cast<ConstantExpr>(p)->getOpcode() == Instruction::Select))
 	{
@@ -1362,7 +1755,7 @@ void CheerpWriter::compilePointerOffset(const Value* p, PARENT_PRIORITY parentPr
 	}
 	else if((!isa<Instruction>(p) || !isInlineable(*cast<Instruction>(p), PA)) && PA.getPointerKind(p) == SPLIT_REGULAR)
 	{
-		stream << namegen.getSecondaryName(p);
+		stream << getSecondaryName(p);
 	}
 	else if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(p))
 	{
@@ -1525,6 +1918,81 @@ void CheerpWriter::compileConstantAsBytes(const Constant* c, bool first)
 	}
 }
 
+bool CheerpWriter::collectConstantBytes(const Constant* c, SmallVectorImpl<uint8_t>& bytes)
+{
+	// Same layout as compileConstantAsBytes, elements of data arrays are read directly to not create new constants
+	if(const ConstantDataSequential* CD = dyn_cast<ConstantDataSequential>(c))
+	{
+		Type* elementType = CD->getElementType();
+		uint32_t bitWidth = elementType->getPrimitiveSizeInBits();
+		for(uint32_t i=0;i<CD->getNumElements();i++)
+		{
+			uint64_t val;
+			if(elementType->isIntegerTy())
+				val = CD->getElementAsInteger(i);
+			else if(elementType->isFloatTy())
+				val = FloatToBits(CD->getElementAsFloat(i));
+			else if(elementType->isDoubleTy())
+				val = DoubleToBits(CD->getElementAsDouble(i));
+			else
+				return false;
+			for(uint32_t j=0;j<bitWidth;j+=8)
+				bytes.push_back((val>>j)&255);
+		}
+	}
+	else if(isa<ConstantArray>(c) || isa<ConstantStruct>(c))
+	{
+		for(uint32_t i=0;i<c->getNumOperands();i++)
+		{
+			if(!collectConstantBytes(cast<Constant>(c->getOperand(i)), bytes))
+				return false;
+		}
+	}
+	else if(const ConstantFP* f=dyn_cast<ConstantFP>(c))
+	{
+		const APInt& integerRepresentation = f->getValueAPF().bitcastToAPInt();
+		uint64_t val = integerRepresentation.getLimitedValue();
+		for(uint32_t i=0;i<integerRepresentation.getBitWidth();i+=8)
+			bytes.push_back((val>>i)&255);
+	}
+	else if(const ConstantInt* ci=dyn_cast<ConstantInt>(c))
+	{
+		const APInt& integerRepresentation = ci->getValue();
+		uint64_t val = integerRepresentation.getLimitedValue();
+		for(uint32_t i=0;i<integerRepresentation.getBitWidth();i+=8)
+			bytes.push_back((val>>i)&255);
+	}
+	else
+		return false;
+	return true;
+}
+
+bool CheerpWriter::compileConstantAsBlob(const Constant* c)
+{
+	if(blobThreshold == 0 || targetData.getTypeAllocSize(c->getType()) < blobThreshold)
+		return false;
+	SmallVector<uint8_t, 256> bytes;
+	if(!collectConstantBytes(c, bytes))
+		return false;
+	// Typed arrays created over the buffer use the byte order of the platform, which is little endian in practice
+	static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	stream << "__cheerpBlob(\"";
+	for(uint32_t i=0;i<bytes.size();i+=3)
+	{
+		uint32_t v = bytes[i] << 16;
+		if(i+1 < bytes.size())
+			v |= bytes[i+1] << 8;
+		if(i+2 < bytes.size())
+			v |= bytes[i+2];
+		stream << base64Chars[(v>>18)&63] << base64Chars[(v>>12)&63];
+		stream << (i+1 < bytes.size() ? base64Chars[(v>>6)&63] : '=');
+		stream << (i+2 < bytes.size() ? base64Chars[v&63] : '=');
+	}
+	stream << "\")";
+	blobsUsed = true;
+	return true;
+}
+
 void CheerpWriter::compileConstant(const Constant* c)
 {
 	if(!currentFun && doesConstantDependOnUndefined(c))
@@ -1537,15 +2005,27 @@ void CheerpWriter::compileConstant(const Constant* c)
 	{
 		compileConstantExpr(cast<ConstantExpr>(c));
 	}
+	else if(isa<ConstantDataSequential>(c) && !TypeSupport::isTypedArrayType(cast<ConstantDataSequential>(c)->getElementType(), /* forceTypedArray*/ true))
+	{
+		// i64 elements are [low,high] pairs, see I64Lowering, so they are stored in a regular array
+		stream << '[';
+		compileConstantArrayMembers(c);
+		stream << ']';
+	}
 	else if(isa<ConstantDataSequential>(c))
 	{
 		const ConstantDataSequential* d=cast<ConstantDataSequential>(c);
 		Type* t=d->getElementType();
 		stream << "new ";
 		compileTypedArrayType(t);
-		stream << "([";
-		compileConstantArrayMembers(d);
-		stream << "])";
+		stream << '(';
+		if(!compileConstantAsBlob(d))
+		{
+			stream << '[';
+			compileConstantArrayMembers(d);
+			stream << ']';
+		}
+		stream << ')';
 	}
 	else if(isa<ConstantArray>(c))
 	{
@@ -1561,11 +2041,17 @@ void CheerpWriter::compileConstant(const Constant* c)
 		if(cast<StructType>(c->getType())->hasByteLayout())
 		{
 			// Populate a DataView with a byte buffer
-			stream << "new DataView(new Int8Array([";
-			compileConstantAsBytes(c, true);
-			stream << "]).buffer)";
+			stream << "new DataView(";
+			if(!compileConstantAsBlob(c))
+			{
+				stream << "new Int8Array([";
+				compileConstantAsBytes(c, true);
+				stream << "]).buffer";
+			}
+			stream << ')';
 			return;
 		}
+		structShapes[d->getType()] |= STRUCT_SHAPE_CONSTANT;
 		stream << '{';
 		assert(d->getType()->getNumElements() == d->getNumOperands());
 
@@ -1641,6 +2127,12 @@ void CheerpWriter::compileConstant(const Constant* c)
 		const ConstantInt* i=cast<ConstantInt>(c);
 		if(i->getBitWidth()==1)
 			stream << i->getZExtValue();
+		else if(i->getBitWidth()==64 && !i->isZero())
+		{
+			// See I64Lowering, 64-bit values are packed as [low,high]
+			uint64_t val = i->getZExtValue();
+			stream << '[' << (int32_t)(val & 0xffffffff) << ',' << (int32_t)(val >> 32) << ']';
+		}
 		else
 			stream << i->getSExtValue();
 	}
@@ -1659,7 +2151,7 @@ void CheerpWriter::compileConstant(const Constant* c)
 	else if(isa<GlobalValue>(c))
 	{
 		assert(c->hasName());
-		stream << namegen.getName(c);
+		stream << getName(c);
 	}
 	else if(isa<ConstantAggregateZero>(c) || isa<UndefValue>(c))
 	{
@@ -1707,7 +2199,7 @@ void CheerpWriter::compileOperand(const Value* v, PARENT_PRIORITY parentPrio, bo
 		{
 			if(it->getType()->isIntegerTy(1))
 				if(parentPrio >= SHIFT) stream << '(';
-			stream << namegen.getName(it);
+			stream << getName(it);
 			if(it->getType()->isIntegerTy(1))
 			{
 				stream << ">>0";
@@ -1717,7 +2209,7 @@ void CheerpWriter::compileOperand(const Value* v, PARENT_PRIORITY parentPrio, bo
 	}
 	else if(const Argument* arg=dyn_cast<Argument>(v))
 	{
-		stream << namegen.getName(arg);
+		stream << getName(arg);
 	}
 	else if(const InlineAsm* a=dyn_cast<InlineAsm>(v))
 	{
@@ -1800,17 +2292,17 @@ void CheerpWriter::compilePHIOfBlockFromOtherBlock(const BasicBlock* to, const B
 			assert(incoming);
 			if(incoming->getType()->isPointerTy() && writer.PA.getPointerKind(incoming)==SPLIT_REGULAR && !writer.PA.getConstantOffsetForPointer(incoming))
 			{
-				writer.namegen.setEdgeContext(fromBB, toBB);
-				writer.stream << writer.namegen.getSecondaryNameForEdge(incoming);
-				writer.namegen.clearEdgeContext();
+				writer.setEdgeContext(fromBB, toBB);
+				writer.stream << writer.getSecondaryName(incoming);
+				writer.clearEdgeContext();
 				writer.stream << '=';
 				writer.compilePointerOffset(incoming, LOWEST);
 				writer.stream << ';' << writer.NewLine;
 			}
-			writer.namegen.setEdgeContext(fromBB, toBB);
-			writer.stream << writer.namegen.getNameForEdge(incoming);
-			writer.namegen.clearEdgeContext();
-			writer.stream << '=' << writer.namegen.getName(incoming) << ';' << writer.NewLine;
+			writer.setEdgeContext(fromBB, toBB);
+			writer.stream << writer.getName(incoming);
+			writer.clearEdgeContext();
+			writer.stream << '=' << writer.getName(incoming) << ';' << writer.NewLine;
 		}
 		void handlePHI(const Instruction* phi, const Value* incoming) override
 		{
@@ -1823,25 +2315,25 @@ void CheerpWriter::compilePHIOfBlockFromOtherBlock(const BasicBlock* to, const B
 				POINTER_KIND k=writer.PA.getPointerKind(phi);
 				if((k==REGULAR || k==SPLIT_REGULAR) && writer.PA.getConstantOffsetForPointer(phi))
 				{
-					writer.stream << writer.namegen.getName(phi) << '=';
-					writer.namegen.setEdgeContext(fromBB, toBB);
+					writer.stream << writer.getName(phi) << '=';
+					writer.setEdgeContext(fromBB, toBB);
 					writer.compilePointerBase(incoming);
 				}
 				else if(k==SPLIT_REGULAR)
 				{
-					writer.stream << writer.namegen.getSecondaryName(phi) << '=';
-					writer.namegen.setEdgeContext(fromBB, toBB);
+					writer.stream << writer.getSecondaryName(phi) << '=';
+					writer.setEdgeContext(fromBB, toBB);
 					writer.compilePointerOffset(incoming, LOWEST);
 					writer.stream << ';' << writer.NewLine;
-					writer.namegen.clearEdgeContext();
-					writer.stream << writer.namegen.getName(phi) << '=';
-					writer.namegen.setEdgeContext(fromBB, toBB);
+					writer.clearEdgeContext();
+					writer.stream << writer.getName(phi) << '=';
+					writer.setEdgeContext(fromBB, toBB);
 					writer.compilePointerBase(incoming);
 				}
 				else
 				{
-					writer.stream << writer.namegen.getName(phi) << '=';
-					writer.namegen.setEdgeContext(fromBB, toBB);
+					writer.stream << writer.getName(phi) << '=';
+					writer.setEdgeContext(fromBB, toBB);
 					if(k==REGULAR)
 						writer.stream << "aSlot=";
 					writer.compilePointerAs(incoming, k);
@@ -1849,12 +2341,12 @@ void CheerpWriter::compilePHIOfBlockFromOtherBlock(const BasicBlock* to, const B
 			}
 			else
 			{
-				writer.stream << writer.namegen.getName(phi) << '=';
-				writer.namegen.setEdgeContext(fromBB, toBB);
+				writer.stream << writer.getName(phi) << '=';
+				writer.setEdgeContext(fromBB, toBB);
 				writer.compileOperand(incoming);
 			}
 			writer.stream << ';' << writer.NewLine;
-			writer.namegen.clearEdgeContext();
+			writer.clearEdgeContext();
 		}
 	};
 	WriterPHIHandler(*this, from, to).runOnEdge(registerize, from, to);
@@ -1942,7 +2434,7 @@ void CheerpWriter::compileMethodArgs(User::const_op_iterator it, User::const_op_
 		else
 		{
 			compileOperand(*cur);
-			if(tp->isIntegerTy())
+			if(tp->isIntegerTy() && !tp->isIntegerTy(64))
 				stream << ">>0";
 		}
 
@@ -1990,7 +2482,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 				{
 					stream << "return ";
 					compileOperand(retVal, LOWEST);
-					if(retVal->getType()->isIntegerTy())
+					if(retVal->getType()->isIntegerTy() && !retVal->getType()->isIntegerTy(64))
 						stream << ">>0";
 				}
 			}
@@ -2020,7 +2512,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 					return COMPILE_OK;
 				}
 				else
-					stream << namegen.getName(ci.getCalledFunction());
+					stream << getName(ci.getCalledFunction());
 			}
 			else
 			{
@@ -2065,10 +2557,11 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 			stream << "aSlot=";
 			POINTER_KIND k = PA.getPointerKind(ai);
 
-			StringRef varName = namegen.getName(&I);
+			StringRef varName = getName(&I);
 			if(k == REGULAR)
 			{
 				stream << "{d:[";
+				NumRegularObjects++;
 				compileType(ai->getAllocatedType(), LITERAL_OBJ, varName);
 				stream << "],o:0}";
 			}
@@ -2078,11 +2571,12 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 				compileType(ai->getAllocatedType(), LITERAL_OBJ, varName);
 				stream << ']';
 				stream << ';' << NewLine;
-				stream << namegen.getSecondaryName(ai) << "=0";
+				stream << getSecondaryName(ai) << "=0";
 			}
 			else if(k == BYTE_LAYOUT)
 			{
 				stream << "{d:";
+				NumRegularObjects++;
 				compileType(ai->getAllocatedType(), LITERAL_OBJ, varName);
 				stream << ",o:0}";
 			}
@@ -2118,14 +2612,14 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 				assert(ivi.getNumIndices()==1);
 				//Find the offset to the pointed element
 				assert(ivi.hasName());
-				stream << namegen.getName(&ivi);
+				stream << getName(&ivi);
 			}
 			else
 			{
 				//Optimize for the assembly of the aggregate values
 				assert(aggr->hasOneUse());
 				assert(aggr->hasName());
-				stream << namegen.getName(aggr);
+				stream << getName(aggr);
 			}
 			uint32_t offset=ivi.getIndices()[0];
 			stream << '.' << types.getPrefixCharForMember(PA, cast<StructType>(t), offset) << offset;
@@ -2143,9 +2637,34 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 
 			if (PA.getPointerKind(ptrOp) == BYTE_LAYOUT)
 			{
+				//Use a typed array view if the store is provably aligned
+				if(compileByteLayoutViewAccess(ptrOp))
+				{
+					stream << '=';
+					compileOperand(valOp);
+					return COMPILE_OK;
+				}
+				Type* pointedType=ptrOp->getType()->getPointerElementType();
+				if(pointedType->isIntegerTy(64))
+				{
+					// Packed 64-bit values are stored as two 32-bit integers
+					for(uint32_t i=0;i<2;i++)
+					{
+						if(i)
+							stream << ';' << NewLine;
+						compilePointerBase(ptrOp);
+						stream << ".setInt32(";
+						compilePointerOffset(ptrOp, i ? ADD_SUB : LOWEST);
+						if(i)
+							stream << "+4";
+						stream << ",(";
+						compileOperand(valOp, HIGHEST);
+						stream << '[' << i << "]|0),true)";
+					}
+					return COMPILE_OK;
+				}
 				//Optimize stores of single values from unions
 				compilePointerBase(ptrOp);
-				Type* pointedType=ptrOp->getType()->getPointerElementType();
 				if(pointedType->isIntegerTy(8))
 					stream << ".setInt8(";
 				else if(pointedType->isIntegerTy(16))
@@ -2174,6 +2693,8 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 			stream << '=';
 			if(valOp->getType()->isIntegerTy(32))
 				compileSignedInteger(valOp, /*forComparison*/ false, LOWEST);
+			else if(valOp->getType()->isIntegerTy(64))
+				compileOperand(valOp, LOWEST);
 			else if(valOp->getType()->isIntegerTy())
 				compileUnsignedInteger(valOp, LOWEST);
 			else if(valOp->getType()->isPointerTy())
@@ -2392,6 +2913,7 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 		}
 
 		stream << "{d:";
+		NumRegularObjects++;
 		compilePointerBase( gep_inst, true);
 		stream << ",o:";
 		compilePointerOffset( gep_inst, LOWEST, true);
@@ -2849,7 +3371,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 				stream << ':';
 				compilePointerBase(si.getOperand(2));
 				stream << ';' << NewLine;
-				stream << namegen.getSecondaryName(&si) << '=';
+				stream << getSecondaryName(&si) << '=';
 				compileOperand(si.getOperand(0), TERNARY, /*allowBooleanObjects*/ true);
 				stream << '?';
 				compilePointerOffset(si.getOperand(1), TERNARY);
@@ -2919,7 +3441,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 				COMPILE_INSTRUCTION_FEEDBACK cf=handleBuiltinCall(&ci, calledFunc);
 				if(cf!=COMPILE_UNSUPPORTED)
 					return cf;
-				stream << namegen.getName(calledFunc);
+				stream << getName(calledFunc);
 			}
 			else
 			{
@@ -2935,7 +3457,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 			{
 				assert(!isInlineable(ci, PA));
 				stream << ';' << NewLine;
-				stream << namegen.getSecondaryName(&ci) << "=oSlot";
+				stream << getSecondaryName(&ci) << "=oSlot";
 			}
 			return COMPILE_OK;
 		}
@@ -2952,36 +3474,54 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 
 			if (PA.getPointerKind(ptrOp) == BYTE_LAYOUT)
 			{
-				//Optimize loads of single values from unions
-				compilePointerBase(ptrOp);
+				//Use a typed array view if the load is provably aligned
 				Type* pointedType=ptrOp->getType()->getPointerElementType();
-				if(pointedType->isIntegerTy(8))
-					stream << ".getInt8(";
-				else if(pointedType->isIntegerTy(16))
-					stream << ".getInt16(";
-				else if(pointedType->isIntegerTy(32))
+				if(pointedType->isIntegerTy(64))
+				{
+					// Pack the two 32-bit halves, see I64Lowering
+					stream << '[';
+					compilePointerBase(ptrOp);
 					stream << ".getInt32(";
-				else if(pointedType->isFloatTy())
-					stream << ".getFloat32(";
-				else if(pointedType->isDoubleTy())
-					stream << ".getFloat64(";
-				compilePointerOffset(ptrOp, LOWEST);
-				if(!pointedType->isIntegerTy(8))
-					stream << ",true";
-				stream << ')';
+					compilePointerOffset(ptrOp, LOWEST);
+					stream << ",true),";
+					compilePointerBase(ptrOp);
+					stream << ".getInt32(";
+					compilePointerOffset(ptrOp, ADD_SUB);
+					stream << "+4,true)]";
+					return COMPILE_OK;
+				}
+				else if(!compileByteLayoutViewAccess(ptrOp))
+				{
+					//Optimize loads of single values from unions
+					compilePointerBase(ptrOp);
+					if(pointedType->isIntegerTy(8))
+						stream << ".getInt8(";
+					else if(pointedType->isIntegerTy(16))
+						stream << ".getInt16(";
+					else if(pointedType->isIntegerTy(32))
+						stream << ".getInt32(";
+					else if(pointedType->isFloatTy())
+						stream << ".getFloat32(";
+					else if(pointedType->isDoubleTy())
+						stream << ".getFloat64(";
+					compilePointerOffset(ptrOp, LOWEST);
+					if(!pointedType->isIntegerTy(8))
+						stream << ",true";
+					stream << ')';
+				}
 			}
 			else if(li.getType()->isPointerTy() && !li.use_empty() && PA.getPointerKind(&li) == SPLIT_REGULAR && !PA.getConstantOffsetForPointer(&li))
 			{
 				assert(!isInlineable(li, PA));
 				compileCompleteObject(ptrOp);
 				stream << ';' << NewLine;
-				stream << namegen.getSecondaryName(&li) << '=';
+				stream << getSecondaryName(&li) << '=';
 				compileCompleteObject(ptrOp);
 				stream <<'o';
 			}
 			else
 				compileCompleteObject(ptrOp);
-			if(li.getType()->isIntegerTy())
+			if(li.getType()->isIntegerTy() && !li.getType()->isIntegerTy(64))
 			{
 				uint32_t width = li.getType()->getIntegerBitWidth();
 				// 32-bit integers are all loaded as signed, other integers as unsigned
@@ -3025,10 +3565,13 @@ void CheerpWriter::compileBB(const BasicBlock& BB)
 		}
 		const DebugLoc& debugLoc = I->getDebugLoc();
 		if(sourceMapGenerator && !debugLoc.isUnknown())
+		{
+			stream.syncSourceMap();
 			sourceMapGenerator->setDebugLoc(I->getDebugLoc());
+		}
 		if(!I->getType()->isVoidTy() && !I->use_empty())
 		{
-			stream << namegen.getName(I) << '=';
+			stream << getName(I) << '=';
 		}
 		if(I->isTerminator())
 		{
@@ -3131,6 +3674,41 @@ void CheerpRenderInterface::renderElseBlockBegin()
 	writer->stream << "}else{" << NewLine;
 }
 
+void CheerpRenderInterface::renderSwitchBlockBegin(const void* privateBlock)
+{
+	const BasicBlock* bb=(const BasicBlock*)privateBlock;
+	const SwitchInst* si=cast<SwitchInst>(bb->getTerminator());
+	writer->stream << "switch(";
+	writer->compileOperandForIntegerPredicate(si->getCondition(), CmpInst::ICMP_EQ, CheerpWriter::LOWEST);
+	writer->stream << "){" << NewLine;
+}
+
+void CheerpRenderInterface::renderCaseBlockBegin(const void* privateBlock, int branchId)
+{
+	const BasicBlock* bb=(const BasicBlock*)privateBlock;
+	const SwitchInst* si=cast<SwitchInst>(bb->getTerminator());
+	assert(branchId > 0);
+	SwitchInst::ConstCaseIt it=si->case_begin();
+	for(int i=1;i<branchId;i++)
+		++it;
+	const BasicBlock* dest=it.getCaseSuccessor();
+	//Cases going to the same destination share the same body
+	for(;it!=si->case_end();++it)
+	{
+		if(it.getCaseSuccessor()!=dest)
+			continue;
+		writer->stream << "case ";
+		writer->compileOperandForIntegerPredicate(it.getCaseValue(), CmpInst::ICMP_EQ, CheerpWriter::LOWEST);
+		writer->stream << ':';
+	}
+	writer->stream << NewLine;
+}
+
+void CheerpRenderInterface::renderDefaultBlockBegin()
+{
+	writer->stream << "default:" << NewLine;
+}
+
 void CheerpRenderInterface::renderBlockEnd()
 {
 	writer->stream << '}' << NewLine;
@@ -3235,6 +3813,7 @@ void CheerpWriter::compileMethodLocals(const Function& F, bool needsLabel)
 	if(needsLabel)
 	{
 		stream << "var label=0";
+		NumLabelVariables++;
 		firstVar = false;
 	}
 	std::set<StringRef> compiledTmpPHIs;
@@ -3257,14 +3836,14 @@ void CheerpWriter::compileMethodLocals(const Function& F, bool needsLabel)
 					stream << "var ";
 				else
 					stream << ',';
-				compileMethodLocal(namegen.getName(&I),Registerize::getRegKindFromType(I.getType()));
+				compileMethodLocal(getName(&I),Registerize::getRegKindFromType(I.getType()));
 				firstVar = false;
 				localsFound[regId]=NAME_DONE;
 			}
 			if(localsFound[regId]<SECONDARY_NAME_DONE && needsSecondaryName)
 			{
 				stream << ',';
-				compileMethodLocal(namegen.getSecondaryName(&I),Registerize::INTEGER);
+				compileMethodLocal(getSecondaryName(&I),Registerize::INTEGER);
 				localsFound[regId]=SECONDARY_NAME_DONE;
 			}
 		}
@@ -3285,23 +3864,23 @@ void CheerpWriter::compileMethodLocals(const Function& F, bool needsLabel)
 			const BasicBlock* toBB;
 			void handleRecursivePHIDependency(const Instruction* incoming) override
 			{
-				writer.namegen.setEdgeContext(fromBB, toBB);
+				writer.setEdgeContext(fromBB, toBB);
 				if(incoming->getType()->isPointerTy() && writer.PA.getPointerKind(incoming)==SPLIT_REGULAR && !writer.PA.getConstantOffsetForPointer(incoming))
 				{
-					StringRef secondaryName = writer.namegen.getSecondaryNameForEdge(incoming);
+					StringRef secondaryName = writer.getSecondaryName(incoming);
 					if(compiledLocals.insert(secondaryName).second)
 					{
 						writer.stream << ',';
 						writer.compileMethodLocal(secondaryName, Registerize::INTEGER);
 					}
 				}
-				StringRef primaryName = writer.namegen.getNameForEdge(incoming);
+				StringRef primaryName = writer.getName(incoming);
 				if(compiledLocals.insert(primaryName).second)
 				{
 					writer.stream << ',';
 					writer.compileMethodLocal(primaryName, Registerize::getRegKindFromType(incoming->getType()));
 				}
-				writer.namegen.clearEdgeContext();
+				writer.clearEdgeContext();
 			}
 			void handlePHI(const Instruction* phi, const Value* incoming) override
 			{
@@ -3318,7 +3897,7 @@ void CheerpWriter::compileMethodLocals(const Function& F, bool needsLabel)
 		stream << ';' << NewLine;
 }
 
-void CheerpWriter::compileMethod(const Function& F)
+void CheerpWriter::compileMethodSourceMapInfo(const Function& F)
 {
 	if (sourceMapGenerator) {
 #ifdef CHEERP_DEBUG_SOURCE_MAP
@@ -3331,11 +3910,20 @@ void CheerpWriter::compileMethod(const Function& F)
 			llvm::errs() << "Found on " << search->second.getFilename()
 				<< ":"  << search->second.getLineNumber() << '\n';
 #endif
+			stream.syncSourceMap();
 			sourceMapGenerator->setFunctionName(search->second);
 		}
 	}
+}
+
+void CheerpWriter::compileMethod(const Function& F, bool anonymous)
+{
+	compileMethodSourceMapInfo(F);
 	currentFun = &F;
-	stream << "function " << namegen.getName(&F) << '(';
+	stream << "function";
+	if(!anonymous)
+		stream << ' ' << getName(&F);
+	stream << '(';
 	const Function::const_arg_iterator A=F.arg_begin();
 	const Function::const_arg_iterator AE=F.arg_end();
 	for(Function::const_arg_iterator curArg=A;curArg!=AE;++curArg)
@@ -3343,9 +3931,9 @@ void CheerpWriter::compileMethod(const Function& F)
 		if(curArg!=A)
 			stream << ',';
 		if(curArg->getType()->isPointerTy() && PA.getPointerKind(curArg) == SPLIT_REGULAR)
-			stream << namegen.getName(curArg) << ',' << namegen.getSecondaryName(curArg);
+			stream << getName(curArg) << ',' << getSecondaryName(curArg);
 		else
-			stream << namegen.getName(curArg);
+			stream << getName(curArg);
 	}
 	stream << "){" << NewLine;
 	if (measureTimeToMain && F.getName() == "main")
@@ -3432,6 +4020,12 @@ void CheerpWriter::compileMethod(const Function& F)
 					assert(isa<SwitchInst>(term));
 				}
 			}
+			//Use a native switch when there are enough cases, JS engines can compile it to a jump table
+			if(isa<SwitchInst>(term) && cast<SwitchInst>(term)->getNumCases() >= MinCasesForNativeSwitch &&
+				relooperMap[&(*B)]->BranchesOut.size() > 1)
+			{
+				relooperMap[&(*B)]->UseSwitch = true;
+			}
 		}
 
 		B=F.begin();
@@ -3455,6 +4049,139 @@ void CheerpWriter::compileMethod(const Function& F)
 	currentFun = NULL;
 }
 
+CheerpWriter::CheerpWriter(const CheerpWriter& parent, raw_ostream& s, SourceMapGenerator* sourceMapGenerator):
+	module(parent.module),targetData(&parent.module),currentFun(NULL),PA(parent.PA),registerize(parent.registerize),globalDeps(parent.globalDeps),
+	namegen(parent.namegen),types(parent.module),
+	sourceMapGenerator(sourceMapGenerator),NewLine(),useNativeJavaScriptMath(parent.useNativeJavaScriptMath),
+	useMathImul(parent.useMathImul),makeModule(parent.makeModule),addCredits(parent.addCredits),measureTimeToMain(parent.measureTimeToMain),
+	useStructConstructors(parent.useStructConstructors),reportStructShapes(parent.reportStructShapes),
+	blobThreshold(parent.blobThreshold),blobsUsed(false),i64BitcastsUsed(false),jobs(1),byteLayoutViewsUsed(0),
+	poolTypes(parent.poolTypes),secondaryStream(NULL),secondarySlotsCount(0),builtinTable(parent.builtinTable),
+	stream(s, sourceMapGenerator, parent.stream.isReadableOutput())
+{
+}
+
+void CheerpWriter::prepareMethodForParallelCompilation(const Function& F)
+{
+	SmallVector<const Constant*, 8> constantsQueue;
+	for(const BasicBlock& BB: F)
+	{
+		for(const Instruction& I: BB)
+		{
+			for(const Value* op: I.operands())
+			{
+				if(isa<Constant>(op) && !isa<GlobalValue>(op))
+					constantsQueue.push_back(cast<Constant>(op));
+			}
+			ImmutableCallSite callV(&I);
+			if(!callV || !callV.getCalledFunction())
+				continue;
+			// Variadic arguments use the kind of the least derived base, see compileMethodArgs
+			for(uint32_t i=callV.getCalledFunction()->arg_size();i<callV.arg_size();i++)
+			{
+				Type* argType = callV.getArgument(i)->getType();
+				if(!argType->isPointerTy())
+					continue;
+				if(StructType* st = dyn_cast<StructType>(argType->getPointerElementType()))
+				{
+					while(st->getDirectBase())
+						st = st->getDirectBase();
+					st->getPointerTo();
+				}
+			}
+		}
+	}
+	// Elements of ConstantDataSequential are uniqued in the context when accessed
+	SmallPtrSet<const Constant*, 8> visitedConstants;
+	while(!constantsQueue.empty())
+	{
+		const Constant* C = constantsQueue.pop_back_val();
+		if(!visitedConstants.insert(C).second)
+			continue;
+		if(const ConstantDataSequential* CD = dyn_cast<ConstantDataSequential>(C))
+		{
+			for(uint32_t i=0;i<CD->getNumElements();i++)
+				CD->getElementAsConstant(i);
+		}
+		for(const Use& op: C->operands())
+		{
+			if(!isa<GlobalValue>(op.get()))
+				constantsQueue.push_back(cast<Constant>(op.get()));
+		}
+	}
+}
+
+void CheerpWriter::compileMethodsInParallel(const std::vector<const Function*>& functions)
+{
+	for(const Function* F: functions)
+		prepareMethodForParallelCompilation(*F);
+	// Used by DynamicAllocInfo
+	Type::getInt8PtrTy(module.getContext());
+
+	struct CompiledMethod
+	{
+		std::string code;
+		ostream_proxy::IndentState indentState;
+		std::unique_ptr<SourceMapGenerator> sourceMapRecorder;
+	};
+	std::vector<CompiledMethod> compiledMethods(functions.size());
+	std::atomic<uint32_t> nextMethod(0);
+	// The merged state does not depend on the order of the methods
+	std::mutex mergeMutex;
+	auto compileMethods = [&]()
+	{
+		for(uint32_t i = nextMethod++; i < functions.size(); i = nextMethod++)
+		{
+			CompiledMethod& compiled = compiledMethods[i];
+			if(sourceMapGenerator)
+				compiled.sourceMapRecorder.reset(new SourceMapGenerator(module.getContext()));
+			raw_string_ostream code(compiled.code);
+			CheerpWriter writer(*this, code, compiled.sourceMapRecorder.get());
+			writer.compileMethod(*functions[i]);
+			writer.stream.flush();
+			compiled.indentState = writer.stream.getIndentState();
+			std::lock_guard<std::mutex> lock(mergeMutex);
+			mergeWriterState(writer);
+		}
+	};
+
+	PA.setConcurrentAccess(true);
+#if LLVM_ENABLE_THREADS
+	std::vector<std::thread> workers;
+	for(uint32_t i=1;i<jobs;i++)
+		workers.emplace_back(compileMethods);
+#endif
+	// This thread does its share of the work as well
+	compileMethods();
+#if LLVM_ENABLE_THREADS
+	for(std::thread& t: workers)
+		t.join();
+#endif
+	PA.setConcurrentAccess(false);
+
+	// Join the methods in the original order, the source map is fixed up by replaying the recorded events
+	for(uint32_t i=0;i<functions.size();i++)
+	{
+		compileMethodSourceMapInfo(*functions[i]);
+		if(sourceMapGenerator)
+		{
+			stream.syncSourceMap();
+			sourceMapGenerator->replay(*compiledMethods[i].sourceMapRecorder);
+		}
+		stream.appendCode(compiledMethods[i].code, compiledMethods[i].indentState);
+	}
+}
+
+void CheerpWriter::mergeWriterState(const CheerpWriter& writer)
+{
+	byteLayoutViewsUsed |= writer.byteLayoutViewsUsed;
+	blobsUsed |= writer.blobsUsed;
+	i64BitcastsUsed |= writer.i64BitcastsUsed;
+	poolsUsed.insert(writer.poolsUsed.begin(), writer.poolsUsed.end());
+	for(const auto& it: writer.structShapes)
+		structShapes[it.first] |= it.second;
+}
+
 CheerpWriter::GlobalSubExprInfo CheerpWriter::compileGlobalSubExpr(const GlobalDepsAnalyzer::SubExprVec& subExpr)
 {
 	for ( auto it = std::next(subExpr.begin()); it != subExpr.end(); ++it )
@@ -3500,7 +4227,7 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 		// Extern globals in the client namespace are only placeholders for JS globals
 		return;
 	}
-	stream  << "var " << namegen.getName(&G);
+	stream  << "var " << getName(&G);
 
 	if(G.hasInitializer())
 	{
@@ -3511,6 +4238,7 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 		if(k == REGULAR)
 		{
 			stream << "{d:[";
+			NumRegularObjects++;
 			if(C->getType()->isPointerTy())
 				compilePointerAs(C, PA.getPointerKindForStoredType(C->getType()));
 			else
@@ -3520,6 +4248,7 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 		else if(k == BYTE_LAYOUT)
 		{
 			stream << "{d:";
+			NumRegularObjects++;
 			if(C->getType()->isPointerTy())
 				compilePointerAs(C, PA.getPointerKindForStoredType(C->getType()));
 			else
@@ -3535,7 +4264,7 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 				compileOperand(C);
 			stream << ']';
 			stream << ';' << NewLine;
-			stream << "var " << namegen.getSecondaryName(&G);
+			stream << "var " << getSecondaryName(&G);
 			stream << "=0";
 		}
 		else
@@ -3633,6 +4362,184 @@ void CheerpWriter::compileHandleVAArg()
 	stream << "function handleVAArg(ptr){var ret=ptr.d[ptr.o];ptr.o++;return ret;}" << NewLine;
 }
 
+void CheerpWriter::compileBlobDecoder()
+{
+	// Decoded bytes past the end of the data, i.e. from the '=' padding, are dropped by the Uint8Array
+	stream << "function __cheerpBlob(s){" << NewLine;
+	stream << "function d(c){return c>96?c-71:c>64?c-65:c>47?c+4:c===43?62:63;}" << NewLine;
+	stream << "var l=s.length,b=new Uint8Array((l>>2)*3-(s.charCodeAt(l-1)===61)-(s.charCodeAt(l-2)===61));" << NewLine;
+	stream << "for(var i=0,j=0;i<l;i+=4){" << NewLine;
+	stream << "var v=d(s.charCodeAt(i))<<18|d(s.charCodeAt(i+1))<<12|d(s.charCodeAt(i+2))<<6|d(s.charCodeAt(i+3));" << NewLine;
+	stream << "b[j++]=v>>16;b[j++]=v>>8;b[j++]=v;}" << NewLine;
+	stream << "return b.buffer;}" << NewLine;
+}
+
+void CheerpWriter::compileByteLayoutViews()
+{
+	for(uint32_t i=0;i<array_lengthof(byteLayoutViews);i++)
+	{
+		if(!(byteLayoutViewsUsed & (1 << i)))
+			continue;
+		const ByteLayoutView& view = byteLayoutViews[i];
+		stream << "function " << view.helperName << "(dv){var v=dv." << view.cacheName << ";if(!v)v=dv." << view.cacheName;
+		stream << "=new " << view.typedArray << "(dv.buffer,0,dv.byteLength>>" << view.shift << ");return v;}" << NewLine;
+	}
+}
+
+const uint32_t CheerpWriter::NO_SECONDARY_SLOT;
+
+void CheerpWriter::computeSecondaryFunctions()
+{
+	// Split points are the requested entry points and the functions marked as cold
+	SmallPtrSet<const GlobalValue*, 16> splitPoints;
+	for(const std::string& name: splitEntryPoints)
+	{
+		const Function* F = module.getFunction(name);
+		if(!F || F->empty())
+		{
+			llvm::errs() << "warning: split entry point " << name << " not found\n";
+			continue;
+		}
+		splitPoints.insert(F);
+	}
+	for(const Function& F: module)
+	{
+		if(!F.empty() && F.hasFnAttribute(Attribute::Cold))
+			splitPoints.insert(&F);
+	}
+
+	// Everything reachable from the roots without going through a split point is needed at startup.
+	// Functions created after the dependency analysis are not in the graph, keep them and what they use in the primary file.
+	// Every global variable is compiled in the primary file, so the functions used by their initializers are needed too.
+	std::vector<const GlobalValue*> queue = globalDeps.getRoots();
+	for(const Function& F: module)
+	{
+		if(!F.empty() && !globalDeps.isReachable(&F))
+			queue.push_back(&F);
+	}
+	for(const GlobalVariable& GV: module.globals())
+		queue.push_back(&GV);
+	SmallPtrSet<const GlobalValue*, 64> primaryGlobals;
+	for(const GlobalValue* G: queue)
+		primaryGlobals.insert(G);
+	SmallPtrSet<const Function*, 16> usedSplitPoints;
+	while(!queue.empty())
+	{
+		const GlobalValue* G = queue.back();
+		queue.pop_back();
+		std::vector<const GlobalValue*> deps;
+		if(globalDeps.isReachable(G))
+			deps = globalDeps.getDependencies(G);
+		else
+		{
+			// Globals created after the dependency analysis, e.g. by StackArena
+			SmallVector<const Constant*, 8> constants;
+			if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(G))
+			{
+				if(GV->hasInitializer())
+					constants.push_back(GV->getInitializer());
+			}
+			else
+			{
+				for(const BasicBlock& BB: *cast<Function>(G))
+				{
+					for(const Instruction& I: BB)
+					{
+						for(const Value* op: I.operands())
+						{
+							if(isa<Constant>(op))
+								constants.push_back(cast<Constant>(op));
+						}
+					}
+				}
+			}
+			while(!constants.empty())
+			{
+				const Constant* C = constants.pop_back_val();
+				if(const GlobalValue* GV = dyn_cast<GlobalValue>(C))
+					deps.push_back(GV);
+				else
+				{
+					for(const Value* op: C->operands())
+					{
+						// Block addresses also have a basic block as operand
+						if(isa<Constant>(op))
+							constants.push_back(cast<Constant>(op));
+					}
+				}
+			}
+		}
+		for(const GlobalValue* D: deps)
+		{
+			if(primaryGlobals.count(D))
+				continue;
+			if(splitPoints.count(D))
+			{
+				usedSplitPoints.insert(cast<Function>(D));
+				continue;
+			}
+			primaryGlobals.insert(D);
+			queue.push_back(D);
+		}
+	}
+
+	for(const Function& F: module)
+	{
+		if(F.empty() || primaryGlobals.count(&F))
+			continue;
+		secondaryFunctions.push_back(&F);
+		uint32_t slot = usedSplitPoints.count(&F) ? secondarySlotsCount++ : NO_SECONDARY_SLOT;
+		secondarySlots.insert(std::make_pair(&F, slot));
+	}
+}
+
+void CheerpWriter::compileSecondaryFile()
+{
+	CheerpWriter writer(*this, *secondaryStream, NULL);
+	writer.stream << "\"use strict\";" << NewLine;
+	for(const Function* F: secondaryFunctions)
+	{
+		uint32_t slot = secondarySlots.find(F)->second;
+		if(slot == NO_SECONDARY_SLOT)
+		{
+			writer.compileMethod(*F);
+			continue;
+		}
+		// The name of the function is bound to the stub, use a function expression to not shadow it
+		writer.stream << "__cheerpSecondary[" << slot << "]=";
+		writer.compileMethod(*F, /*anonymous*/true);
+		writer.stream << ';' << NewLine;
+	}
+	writer.stream.flush();
+	mergeWriterState(writer);
+}
+
+void CheerpWriter::compileSecondaryStubs()
+{
+	stream << "var __cheerpSecondary=null;" << NewLine;
+	stream << "function __cheerpFetchSecondary(u){";
+	stream << "if(typeof XMLHttpRequest!==\"undefined\"){var x=new XMLHttpRequest();x.open(\"GET\",u,false);x.send(null);return x.responseText;}";
+	stream << "if(typeof require!==\"undefined\")return require(\"fs\").readFileSync(u,\"utf8\");";
+	stream << "return read(u);}" << NewLine;
+	// The loader has no locals, so that they can't shadow the names used by the evaluated code
+	stream << "function __cheerpLoadSecondary(){__cheerpSecondary=[];eval(__cheerpFetchSecondary(\"";
+	for(char c: secondaryURL)
+	{
+		if(c == '"' || c == '\\')
+			stream << '\\';
+		stream << c;
+	}
+	stream << "\"));}" << NewLine;
+	for(const Function* F: secondaryFunctions)
+	{
+		uint32_t slot = secondarySlots.find(F)->second;
+		if(slot == NO_SECONDARY_SLOT)
+			continue;
+		stream << "function " << getName(F) << "(){if(__cheerpSecondary===null)__cheerpLoadSecondary();";
+		stream << "return __cheerpSecondary[" << slot << "].apply(null,arguments);}" << NewLine;
+	}
+}
+
 void CheerpWriter::makeJS()
 {
 	if (sourceMapGenerator) {
@@ -3683,22 +4590,37 @@ void CheerpWriter::makeJS()
 
 	std::vector<StringRef> exportedClassNames = compileClassesExportedToJs();
 	compileNullPtrs();
+
+	if (secondaryStream)
+		computeSecondaryFunctions();
 	
+	std::vector<const Function*> functions;
 	for ( const Function & F : module.getFunctionList() )
-		if (!F.empty())
+		if (!F.empty() && !secondarySlots.count(&F))
 		{
 #ifdef CHEERP_DEBUG_POINTERS
 			dumpAllPointers(F, PA);
 #endif //CHEERP_DEBUG_POINTERS
-			compileMethod(F);
+			if (jobs > 1)
+				functions.push_back(&F);
+			else
+				compileMethod(F);
 		}
+	if (!functions.empty())
+		compileMethodsInParallel(functions);
+
+	if (secondaryStream)
+	{
+		compileSecondaryFile();
+		compileSecondaryStubs();
+	}
 	
 	for ( const GlobalVariable & GV : module.getGlobalList() )
 		compileGlobal(GV);
 
 	for ( StructType * st : globalDeps.classesUsed() )
 	{
-		if ( st->getNumElements() > V8MaxLiteralProperties )
+		if ( useStructConstructors || st->getNumElements() > V8MaxLiteralProperties )
 			compileClassConstructor(st);
 	}
 
@@ -3718,16 +4640,33 @@ void CheerpWriter::makeJS()
 	//Compile handleVAArg if needed
 	if( globalDeps.needHandleVAArg() )
 		compileHandleVAArg();
+
+	//Compile the typed array views used for aligned byte layout accesses
+	compileByteLayoutViews();
+
+	//Compile the decoder of the constant arrays compiled as blobs
+	if(blobsUsed)
+		compileBlobDecoder();
+
+	//Compile the scratch memory used for bitcasts between double and i64
+	if(i64BitcastsUsed)
+	{
+		stream << "var __cheerpF64Scratch=new Float64Array(1);" << NewLine;
+		stream << "var __cheerpI32Scratch=new Int32Array(__cheerpF64Scratch.buffer);" << NewLine;
+	}
+
+	//Compile the free lists of pooled types
+	compilePools();
 	
 	//Call constructors
 	for (const Function * F : globalDeps.constructors() )
 	{
-		stream << namegen.getName(F) << "();" << NewLine;
+		stream << getName(F) << "();" << NewLine;
 	}
 
 	//Invoke the entry point
 	if ( const Function * entryPoint = globalDeps.getEntryPoint() )
-		stream << namegen.getName(entryPoint) << "();" << NewLine;
+		stream << getName(entryPoint) << "();" << NewLine;
 
 	if (makeModule) {
 		if (!exportedClassNames.empty()) {
@@ -3762,4 +4701,8 @@ void CheerpWriter::makeJS()
 		sourceMapGenerator->endFile();
 		stream << "//# sourceMappingURL=" << sourceMapGenerator->getSourceMapName();
 	}
+	stream.flush();
+
+	if(reportStructShapes)
+		reportStructTypeShapes();
 }
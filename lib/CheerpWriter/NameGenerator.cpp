@@ -128,7 +128,7 @@ NameGenerator::NameGenerator(const Module& M, const GlobalDepsAnalyzer& gda, con
 	generateTypeNames(gda);
 }
 
-llvm::StringRef NameGenerator::getNameForEdge(const llvm::Value* v) const
+llvm::StringRef NameGenerator::getNameForEdge(const llvm::Value* v, const EdgeContext& edgeContext) const
 {
 	assert(!edgeContext.isNull());
 	if (const Instruction* I=dyn_cast<Instruction>(v))
@@ -140,7 +140,7 @@ llvm::StringRef NameGenerator::getNameForEdge(const llvm::Value* v) const
 	return namemap.at(v);
 }
 
-llvm::StringRef NameGenerator::getSecondaryNameForEdge(const llvm::Value* v) const
+llvm::StringRef NameGenerator::getSecondaryNameForEdge(const llvm::Value* v, const EdgeContext& edgeContext) const
 {
 	assert(!edgeContext.isNull());
 	if (const Instruction* I=dyn_cast<Instruction>(v))
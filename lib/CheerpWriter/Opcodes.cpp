@@ -9,12 +9,17 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/Cheerp/Writer.h"
 
 using namespace llvm;
 using namespace cheerp;
 
+#define DEBUG_TYPE "CheerpWriter"
+
+STATISTIC(NumRegularCasts, "Number of {d,o} pointer objects created for bitcasts");
+
 void CheerpWriter::compileIntegerComparison(const llvm::Value* lhs, const llvm::Value* rhs, CmpInst::Predicate p, PARENT_PRIORITY parentPrio)
 {
 	if(lhs->getType()->isPointerTy())
@@ -103,6 +108,7 @@ void CheerpWriter::compileBitCast(const llvm::User* bc_inst, POINTER_KIND kind)
 		else
 		{
 			stream << "{d:";
+			NumRegularCasts++;
 			compilePointerBase(bc_inst, true);
 			stream << ",o:";
 			compilePointerOffset(bc_inst, LOWEST, true);
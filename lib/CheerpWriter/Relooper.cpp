@@ -47,7 +47,7 @@ void Branch::Render(Block *Target, bool SetLabel, RenderInterface* renderInterfa
 // Block
 
 Block::Block(const void* b, bool s, int Id) : Parent(NULL), Id(Id), privateBlock(b), DefaultTarget(NULL),
-	IsCheckedMultipleEntry(false), IsSplittable(s) {
+	IsCheckedMultipleEntry(false), IsSplittable(s), UseSwitch(false) {
 }
 
 Block::~Block() {
@@ -127,6 +127,14 @@ void Block::Render(bool InLoop, RenderInterface* renderInterface) {
   }
   assert(DefaultTarget); // Must be a default
 
+  if (UseSwitch) {
+    RenderSwitch(InLoop, SetLabel, Fused, renderInterface);
+    if (Fused) {
+      Fused->RenderLoopPostfix(renderInterface);
+    }
+    return;
+  }
+
   std::vector<int> emptyBranchesIds;
   bool First = true;
   for (BlockBranchMap::iterator iter = ProcessedBranchesOut.begin();; iter++) {
@@ -178,6 +186,55 @@ void Block::Render(bool InLoop, RenderInterface* renderInterface) {
   }
 }
 
+void Block::RenderSwitch(bool InLoop, bool SetLabel, MultipleShape *Fused, RenderInterface* renderInterface) {
+  // Every case that has content ends with a break out of the switch, the default is always rendered last.
+  // Unlabeled breaks and continues inside the switch are avoided by FindLabeledLoops.
+  renderInterface->renderSwitchBlockBegin(privateBlock);
+  std::vector<int> emptyBranchesIds;
+  for (BlockBranchMap::iterator iter = ProcessedBranchesOut.begin();; iter++) {
+    Block *Target;
+    Branch *Details;
+    if (iter != ProcessedBranchesOut.end()) {
+      Target = iter->first;
+      if (Target == DefaultTarget) continue; // done at the end
+      Details = iter->second;
+    } else {
+      Target = DefaultTarget;
+      Details = ProcessedBranchesOut[DefaultTarget];
+    }
+    bool SetCurrLabel = SetLabel && Target->IsCheckedMultipleEntry;
+    bool HasFusedContent = Fused && Fused->InnerMap.find(Target) != Fused->InnerMap.end();
+    bool HasContent = SetCurrLabel || Details->Type != Branch::Direct ||
+                      HasFusedContent || renderInterface->hasBlockPrologue(Target->privateBlock, privateBlock);
+    if (!HasContent) {
+      // Cases without content only need to skip the default, if it has content
+      if (iter != ProcessedBranchesOut.end())
+        emptyBranchesIds.push_back(Details->branchId);
+      else
+        break;
+      continue;
+    }
+    if (iter != ProcessedBranchesOut.end()) {
+      renderInterface->renderCaseBlockBegin(privateBlock, Details->branchId);
+    } else {
+      if (!emptyBranchesIds.empty()) {
+        for (unsigned int i = 0; i < emptyBranchesIds.size(); i++)
+          renderInterface->renderCaseBlockBegin(privateBlock, emptyBranchesIds[i]);
+        renderInterface->renderBreak();
+      }
+      renderInterface->renderDefaultBlockBegin();
+    }
+    renderInterface->renderBlockPrologue(Target->privateBlock, privateBlock);
+    Details->Render(Target, SetCurrLabel, renderInterface);
+    if (HasFusedContent) {
+      Fused->InnerMap.find(Target)->second->Render(InLoop, renderInterface);
+    }
+    if (iter == ProcessedBranchesOut.end()) break;
+    renderInterface->renderBreak();
+  }
+  renderInterface->renderBlockEnd();
+}
+
 // MultipleShape
 
 void MultipleShape::RenderLoopPrefix(RenderInterface* renderInterface) {
@@ -841,9 +898,17 @@ void Relooper::Calculate(Block *Entry) {
 
         SHAPE_SWITCH(Root, {
           MultipleShape *Fused = Shape::IsMultiple(Root->Next);
-          // If we are fusing a Multiple with a loop into this Simple, then visit it now
+          bool UseSwitch = Simple->Inner->UseSwitch;
           if (Fused && Fused->NeedLoop) {
             LoopStack.push(Fused);
+          }
+          // A switch captures unlabeled breaks, push a dummy to force labels on every flow from inside it
+          if (UseSwitch) {
+            LoopStack.push(NULL);
+          }
+          // If we are fusing a Multiple with a loop, or inside a switch, into this Simple, then visit it now
+          bool VisitFused = Fused && (Fused->NeedLoop || UseSwitch);
+          if (VisitFused) {
             RECURSE_MULTIPLE_MANUAL(FindLabeledLoops, Fused);
           }
           for (BlockBranchMap::iterator iter = Simple->Inner->ProcessedBranchesOut.begin(); iter != Simple->Inner->ProcessedBranchesOut.end(); iter++) {
@@ -859,8 +924,13 @@ void Relooper::Calculate(Block *Entry) {
               }
             }
           }
+          if (UseSwitch) {
+            LoopStack.pop();
+          }
           if (Fused && Fused->NeedLoop) {
             LoopStack.pop();
+          }
+          if (VisitFused) {
             Next = Fused->Next;
           } else {
             Next = Root->Next;
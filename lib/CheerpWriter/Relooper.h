@@ -22,6 +22,7 @@ LLVM.
 
 struct Block;
 struct Shape;
+struct MultipleShape;
 
 class RenderInterface
 {
@@ -33,6 +34,9 @@ public:
 	virtual void renderIfBlockBegin(const void* privateBlock, int branchId, bool first) = 0;
 	virtual void renderIfBlockBegin(const void* privateBlock, const std::vector<int>& skipBranchIds, bool first) = 0;
 	virtual void renderElseBlockBegin() = 0;
+	virtual void renderSwitchBlockBegin(const void* privateBlock) = 0;
+	virtual void renderCaseBlockBegin(const void* privateBlock, int branchId) = 0;
+	virtual void renderDefaultBlockBegin() = 0;
 	virtual void renderBlockEnd() = 0;
 	virtual void renderBlockPrologue(const void* privateBlockTo, const void* privateBlockFrom) = 0;
 	virtual bool hasBlockPrologue(const void* privateBlockTo, const void* privateBlockFrom) const = 0;
@@ -93,6 +97,7 @@ struct Block {
                         // Since each block *must* branch somewhere, this must be set
   bool IsCheckedMultipleEntry; // If true, we are a multiple entry, so reaching us requires setting the label variable
   bool IsSplittable;
+  bool UseSwitch; // If true, the branches are rendered as a native switch instead of a chain of ifs
 
   Block(const void* privateBlock, bool splittable, int Id);
   ~Block();
@@ -104,6 +109,8 @@ struct Block {
 
   // Prints out the instructions code and branchings
   void Render(bool InLoop, RenderInterface* renderInterface);
+  // Prints out the branchings as a native switch, used when UseSwitch is set
+  void RenderSwitch(bool InLoop, bool SetLabel, MultipleShape *Fused, RenderInterface* renderInterface);
 };
 
 inline bool OrderBlocksById::operator()(Block* lhs, Block* rhs) const
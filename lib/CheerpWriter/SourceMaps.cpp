@@ -20,7 +20,15 @@ namespace cheerp
 {
 
 SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C, std::error_code& ErrorCode):
-	sourceMap(sourceMapName.c_str(), ErrorCode, sys::fs::F_None), sourceMapName(sourceMapName), sourceMapPrefix(sourceMapPrefix),
+	sourceMap(new tool_output_file(sourceMapName.c_str(), ErrorCode, sys::fs::F_None)), sourceMapName(sourceMapName), sourceMapPrefix(sourceMapPrefix),
+	Ctx(C), lastFile(0), lastLine(0), lastColumn(0), lastOffset(0), lineOffset(0), lastName(0), lineBegin(true)
+{
+}
+
+static const std::string noSourceMapName;
+
+SourceMapGenerator::SourceMapGenerator(llvm::LLVMContext& C):
+	sourceMapName(noSourceMapName), sourceMapPrefix(noSourceMapName),
 	Ctx(C), lastFile(0), lastLine(0), lastColumn(0), lastOffset(0), lineOffset(0), lastName(0), lineBegin(true)
 {
 }
@@ -41,12 +49,18 @@ void SourceMapGenerator::writeBase64VLQInt(int i)
 		i >>= 5;
 		if(i)
 			base64Char |= 0x20;
-		sourceMap.os() << base64Chars[base64Char];
+		sourceMap->os() << base64Chars[base64Char];
 	}
 	while(i);
 }
 
 void SourceMapGenerator::setFunctionName(const llvm::DISubprogram &method) {
+	if (isRecording()) {
+		recordedEvents.emplace_back(MappingEvent::FUNCTION_NAME, lineOffset);
+		recordedEvents.back().method = method;
+		return;
+	}
+
 	StringRef fileName = method.getFilename();
 	unsigned lineNumber = method.getLineNumber();
 	StringRef functionName = method.getLinkageName();
@@ -71,7 +85,7 @@ void SourceMapGenerator::setFunctionName(const llvm::DISubprogram &method) {
 	uint32_t currentColumn = 0;
 
 	if(!lineBegin)
-		sourceMap.os() << ',';
+		sourceMap->os() << ',';
 	lineBegin = false;
 
 	// Starting column in the generated code
@@ -95,6 +109,12 @@ void SourceMapGenerator::setFunctionName(const llvm::DISubprogram &method) {
 
 void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
 {
+	if(isRecording())
+	{
+		recordedEvents.emplace_back(MappingEvent::DEBUG_LOC, lineOffset);
+		recordedEvents.back().debugLoc = debugLoc;
+		return;
+	}
 	MDNode* file = debugLoc.getScope(Ctx);
 	assert(file->getNumOperands()>=2);
 	MDNode* fileNamePath = cast<MDNode>(file->getOperand(1));
@@ -108,7 +128,7 @@ void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
 	uint32_t currentLine = debugLoc.getLine() - 1;
 	uint32_t currentColumn = debugLoc.getCol() - 1;
 	if(!lineBegin)
-		sourceMap.os() << ',';
+		sourceMap->os() << ',';
 	lineBegin = false;
 	// Starting column in the generated code
 	writeBase64VLQInt(lineOffset - lastOffset);
@@ -129,14 +149,17 @@ void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
 void SourceMapGenerator::beginFile()
 {
 	// Output the prologue of the file
-	sourceMap.os() << "{\n";
-	sourceMap.os() << "\"version\": 3,\n";
-	sourceMap.os() << "\"mappings\": \"";
+	sourceMap->os() << "{\n";
+	sourceMap->os() << "\"version\": 3,\n";
+	sourceMap->os() << "\"mappings\": \"";
 }
 
 void SourceMapGenerator::finishLine()
 {
-	sourceMap.os() << ";";
+	if(isRecording())
+		recordedEvents.emplace_back(MappingEvent::FINISH_LINE, lineOffset);
+	else
+		sourceMap->os() << ";";
 	lastOffset = 0;
 	lineOffset = 0;
 	lineBegin = true;
@@ -145,16 +168,16 @@ void SourceMapGenerator::finishLine()
 void SourceMapGenerator::endFile()
 {
 	// Output the prologue of the file
-	sourceMap.os() << "\",\n";
+	sourceMap->os() << "\",\n";
 	// Output file names
 	SmallVector<StringRef, 10> files(fileMap.size());
 	for(auto mapItem: fileMap)
 		files[mapItem.second] = mapItem.first;
-	sourceMap.os() << "\"sources\": [";
+	sourceMap->os() << "\"sources\": [";
 	for(uint32_t i=0;i<files.size();i++)
 	{
 		if(i!=0)
-			sourceMap.os() << ',';
+			sourceMap->os() << ',';
 		// Fix slashes in the file path
 		std::string tmp;
 		StringRef string = files[i];
@@ -169,25 +192,51 @@ void SourceMapGenerator::endFile()
 				c='/';
 			tmp.push_back(c);
 		}
-		sourceMap.os() << '"' << tmp << '"';
+		sourceMap->os() << '"' << tmp << '"';
 	}
-	sourceMap.os() << "],\n";
+	sourceMap->os() << "],\n";
 	// Output the symbol names
 	SmallVector<StringRef, 10> functions(functionNameMap.size());
 	for(auto mapItem: functionNameMap)
 		functions[mapItem.second] = mapItem.first;
-	sourceMap.os() << "\"names\": [";
+	sourceMap->os() << "\"names\": [";
 	for(uint32_t i=0; i < functions.size(); i++)
 	{
 		if (i != 0)
-			sourceMap.os() << ',';
+			sourceMap->os() << ',';
 		// Add an underscore to the function name to match the generated symbol
 		// names in the JavaScript file.
-		sourceMap.os() << '"' << functions[i] << '"';
+		sourceMap->os() << '"' << functions[i] << '"';
+	}
+	sourceMap->os() << "]\n";
+	sourceMap->os() << "}\n";
+	sourceMap->keep();
+}
+
+void SourceMapGenerator::replay(const SourceMapGenerator& recorder)
+{
+	assert(!isRecording() && recorder.isRecording());
+	// Offsets are recorded from the beginning of the line, or of the recording
+	uint32_t recordedOffset = 0;
+	for(const MappingEvent& e: recorder.recordedEvents)
+	{
+		addLineOffset(e.lineOffset - recordedOffset);
+		recordedOffset = e.lineOffset;
+		switch(e.kind)
+		{
+			case MappingEvent::FUNCTION_NAME:
+				setFunctionName(e.method);
+				break;
+			case MappingEvent::DEBUG_LOC:
+				setDebugLoc(e.debugLoc);
+				break;
+			case MappingEvent::FINISH_LINE:
+				finishLine();
+				recordedOffset = 0;
+				break;
+		}
 	}
-	sourceMap.os() << "]\n";
-	sourceMap.os() << "}\n";
-	sourceMap.keep();
+	addLineOffset(recorder.lineOffset - recordedOffset);
 }
 
 std::string SourceMapGenerator::getSourceMapName() const
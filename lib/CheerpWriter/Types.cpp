@@ -111,12 +111,17 @@ uint32_t CheerpWriter::compileComplexType(Type* t, COMPILE_TYPE_STYLE style, Str
 	if(StructType* ST = dyn_cast<StructType>(t))
 	{
 		numElements = ST->getNumElements();
-		if(numElements > V8MaxLiteralProperties && style!=THIS_OBJ)
+		// Constructors are only compiled for the types found by GlobalDepsAnalyzer
+		bool hasConstructor = numElements > V8MaxLiteralProperties || (useStructConstructors && globalDeps.classesUsed().count(ST));
+		if(hasConstructor && style!=THIS_OBJ)
 		{
-			// This is a big object, call the constructor and be done with it
+			// This is a big object, or all objects of this type share their constructor, call it and be done with it
+			structShapes[ST] |= STRUCT_SHAPE_CONSTRUCTOR;
 			stream << "new construct" << namegen.getTypeName(t) << "()";
 			return 0;
 		}
+		if(style!=THIS_OBJ)
+			structShapes[ST] |= STRUCT_SHAPE_LITERAL;
 	}
 	else if(ArrayType* AT = dyn_cast<ArrayType>(t))
 	{
@@ -332,7 +337,7 @@ uint32_t CheerpWriter::compileClassTypeRecursive(const std::string& baseName, St
 
 void CheerpWriter::compileClassConstructor(StructType* T)
 {
-	assert(T->getNumElements() > V8MaxLiteralProperties);
+	assert(useStructConstructors || T->getNumElements() > V8MaxLiteralProperties);
 	stream << "function construct" << namegen.getTypeName(T) << "(){" << NewLine;
 	compileComplexType(T, THIS_OBJ, "aSlot", V8MaxLiteralDepth, 0);
 	stream << '}' << NewLine;
@@ -289,8 +289,10 @@ GenericValue Interpreter::callExternalFunction(Function *F,
   else
     report_fatal_error("Tried to execute an unknown external function: " +
                        F->getName());
-  if (ForPreExecute)
+  if (ForPreExecute) {
     CleanAbort = true;
+    FailureReason = "call to unsupported function " + F->getName().str();
+  }
 #ifndef USE_LIBFFI
   else
     errs() << "Recompiling LLVM with --enable-libffi might help.\n";
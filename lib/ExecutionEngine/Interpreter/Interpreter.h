@@ -113,6 +113,8 @@ class Interpreter : public ExecutionEngine, public InstVisitor<Interpreter> {
   bool ForPreExecute;
 
   bool CleanAbort;
+  // Why the interpreter aborted the execution, if it did so by itself
+  std::string FailureReason;
 public:
   explicit Interpreter(std::unique_ptr<Module> M, bool preExecute);
   ~Interpreter();
@@ -144,6 +146,13 @@ public:
   }
 
   bool hasFailed() const override { return CleanAbort; }
+  void markFailed() override { CleanAbort = true; }
+  void clearFailure() override {
+    ECStack.clear();
+    CleanAbort = false;
+    FailureReason.clear();
+  }
+  StringRef getFailureReason() const override { return FailureReason; }
 
   // Methods used to execute code:
   // Place a call on the stack
@@ -18,11 +18,17 @@
 #include "llvm/IR/Type.h"
 #include "llvm/Cheerp/Writer.h"
 #include "llvm/Cheerp/AllocaMerging.h"
+#include "llvm/Cheerp/Devirtualize.h"
+#include "llvm/Cheerp/I64Lowering.h"
 #include "llvm/Cheerp/PointerPasses.h"
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/ResolveAliases.h"
+#include "llvm/Cheerp/ScalarizeObjects.h"
 #include "llvm/Cheerp/SourceMaps.h"
+#include "llvm/Cheerp/StackArena.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 
 using namespace llvm;
 
@@ -38,6 +44,12 @@ static cl::opt<bool> MakeModule("cheerp-make-module", cl::desc("Create a closure
 
 static cl::opt<bool> NoRegisterize("cheerp-no-registerize", cl::desc("Disable registerize pass") );
 
+static cl::opt<bool> NoDevirtualize("cheerp-no-devirtualize", cl::desc("Disable the devirtualization of calls through constant tables of functions") );
+
+static cl::opt<bool> NoScalarizeObjects("cheerp-no-scalarize-objects", cl::desc("Disable the scalar replacement of non escaping objects") );
+
+static cl::opt<bool> NoStackArena("cheerp-no-stack-arena", cl::desc("Disable the stack arena for typed array allocas") );
+
 static cl::opt<bool> NoNativeJavaScriptMath("cheerp-no-native-math", cl::desc("Disable native JavaScript math functions") );
 
 static cl::opt<bool> NoJavaScriptMathImul("cheerp-no-math-imul", cl::desc("Disable JavaScript Math.imul") );
@@ -46,6 +58,27 @@ static cl::opt<bool> NoCredits("cheerp-no-credits", cl::desc("Disable Cheerp cre
 
 static cl::opt<bool> MeasureTimeToMain("cheerp-measure-time-to-main", cl::desc("Print time elapsed until the first line of main() is executed") );
 
+static cl::opt<bool> StructConstructors("cheerp-struct-constructors", cl::desc("Allocate every struct type with a shared constructor function instead of object literals") );
+
+static cl::opt<bool> ReportStructShapes("cheerp-report-struct-shapes", cl::desc("Report the struct types which are created with more than one object shape") );
+
+static cl::opt<unsigned> BlobThreshold("cheerp-blob-threshold", cl::init(1024), cl::desc("Minimum size in bytes of the constant arrays encoded as base64 strings, 0 disables the encoding"), cl::value_desc("bytes") );
+
+static cl::opt<unsigned> Jobs("cheerp-jobs", cl::init(1), cl::desc("Number of threads used to analyze and compile functions to JS"), cl::value_desc("N") );
+
+static cl::opt<std::string> DumpDeps("cheerp-dump-deps", cl::Optional,
+  cl::desc("If specified, the file name where the dependency graph of the globals is written in DOT format"), cl::value_desc("filename"));
+
+static cl::opt<std::string> SecondaryOutput("cheerp-secondary-output", cl::Optional,
+  cl::desc("If specified, the file name where the code which is not needed at startup is written"), cl::value_desc("filename"));
+
+static cl::opt<std::string> SecondaryURL("cheerp-secondary-url", cl::Optional,
+  cl::desc("The URL used to load the secondary file at runtime, by default its file name"), cl::value_desc("url"));
+
+static cl::list<std::string> SplitEntryPoints("cheerp-split-entry-points", cl::value_desc("list"), cl::desc("A list of functions which are compiled in the secondary file, along with the code only they use. Functions marked as cold are always split"), cl::CommaSeparated);
+
+static cl::list<std::string> PoolTypes("cheerp-pool-types", cl::value_desc("list"), cl::desc("A list of struct types whose freed objects are recycled by later allocations"), cl::CommaSeparated);
+
 static cl::list<std::string> ReservedNames("cheerp-reserved-names", cl::value_desc("list"), cl::desc("A list of JS identifiers that should not be used by Cheerp"), cl::CommaSeparated);
 
 extern "C" void LLVMInitializeCheerpBackendTarget() {
@@ -87,6 +120,19 @@ bool CheerpWritePass::runOnModule(Module& M)
        return false;
     }
   }
+  std::unique_ptr<raw_fd_ostream> secondaryFile;
+  if (!SecondaryOutput.empty())
+  {
+    std::error_code ErrorCode;
+    secondaryFile.reset(new raw_fd_ostream(SecondaryOutput, ErrorCode, sys::fs::F_Text));
+    if (ErrorCode)
+    {
+       delete sourceMapGenerator;
+       llvm::report_fatal_error(ErrorCode.message(), false);
+       return false;
+    }
+  }
+  std::string secondaryURL = SecondaryURL.empty() ? sys::path::filename(SecondaryOutput).str() : SecondaryURL;
   PA.fullResolve();
   PA.computeConstantOffsets(M);
   registerize.assignRegisters(M, PA);
@@ -95,7 +141,10 @@ bool CheerpWritePass::runOnModule(Module& M)
   std::sort(reservedNames.begin(), reservedNames.end());
   cheerp::CheerpWriter writer(M, Out, PA, registerize, GDA, sourceMapGenerator, reservedNames,
           PrettyCode, MakeModule, NoRegisterize, !NoNativeJavaScriptMath,
-          !NoJavaScriptMathImul, !NoCredits, MeasureTimeToMain);
+          !NoJavaScriptMathImul, !NoCredits, MeasureTimeToMain,
+          StructConstructors, ReportStructShapes, BlobThreshold, Jobs,
+          std::vector<std::string>(PoolTypes.begin(), PoolTypes.end()), secondaryFile.get(), secondaryURL,
+          std::vector<std::string>(SplitEntryPoints.begin(), SplitEntryPoints.end()));
   writer.makeJS();
   delete sourceMapGenerator;
   return false;
@@ -122,17 +171,28 @@ bool CheerpTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
                                            AnalysisID StopAfter) {
   if (FileType != TargetMachine::CGFT_AssemblyFile) return true;
   PM.add(createResolveAliasesPass());
-  PM.add(createFreeAndDeleteRemovalPass());
-  PM.add(cheerp::createGlobalDepsAnalyzerPass());
+  PM.add(createFreeAndDeleteRemovalPass(std::vector<std::string>(PoolTypes.begin(), PoolTypes.end())));
+  if (!NoScalarizeObjects)
+    PM.add(cheerp::createScalarizeObjectsPass());
+  PM.add(cheerp::createI64LoweringPass());
+  if (!NoDevirtualize)
+    PM.add(cheerp::createDevirtualizePass());
+  PM.add(cheerp::createGlobalDepsAnalyzerPass(DumpDeps));
   PM.add(createPointerArithmeticToArrayIndexingPass());
   PM.add(createPointerToImmutablePHIRemovalPass());
   PM.add(cheerp::createRegisterizePass(NoRegisterize));
-  PM.add(cheerp::createPointerAnalyzerPass());
+  PM.add(cheerp::createPointerAnalyzerPass(Jobs));
   PM.add(cheerp::createAllocaMergingPass());
   PM.add(createIndirectCallOptimizerPass());
   PM.add(createAllocaArraysPass());
   PM.add(cheerp::createAllocaArraysMergingPass());
+  if (!NoStackArena)
+    PM.add(cheerp::createStackArenaPass());
   PM.add(createDelayAllocasPass());
   PM.add(new CheerpWritePass(o));
   return false;
 }
+
+void CheerpTargetMachine::addAnalysisPasses(PassManagerBase &PM) {
+  PM.add(createCheerpTargetTransformInfoPass(this));
+}
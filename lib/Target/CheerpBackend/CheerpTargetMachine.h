@@ -19,6 +19,12 @@
 namespace llvm {
 
 class formatted_raw_ostream;
+class ImmutablePass;
+struct CheerpTargetMachine;
+
+/// createCheerpTargetTransformInfoPass - Return the TTI pass which models
+/// the costs of the generated JavaScript
+ImmutablePass *createCheerpTargetTransformInfoPass(const CheerpTargetMachine *TM);
 
 class CheerpSubtarget : public TargetSubtargetInfo {
 private:
@@ -53,6 +59,7 @@ public:
                                    bool DisableVerify,
                                    AnalysisID StartAfter,
                                    AnalysisID StopAfter) override;
+  void addAnalysisPasses(PassManagerBase &PM) override;
 };
 
 extern Target TheCheerpBackendTarget;
@@ -0,0 +1,247 @@
+//===-- CheerpTargetTransformInfo.cpp - Cheerp specific TTI pass ----------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2016 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+/// \file
+/// This file implements a TargetTransformInfo analysis pass for the Cheerp
+/// backend. The costs model the generated JavaScript instead of a machine:
+/// accesses to struct members and array elements fold into property
+/// accesses, 64-bit integers are lowered to pairs of 32-bit values and
+/// pointer PHIs may need both a base and an offset. There is no SIMD, and
+/// code size matters since the output must be downloaded and parsed.
+///
+//===----------------------------------------------------------------------===//
+
+#include "CheerpTargetMachine.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/MathExtras.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "cheerptti"
+
+// Declare the pass initialization routine locally as target-specific passes
+// don't have a target-wide initialization entry point, and so we rely on the
+// pass constructor initialization.
+namespace llvm {
+void initializeCheerpTTIPass(PassRegistry &);
+}
+
+namespace {
+
+class CheerpTTI final : public ImmutablePass, public TargetTransformInfo {
+  // Thresholds of the loop unroller, lower than the generic ones since every
+  // unrolled instruction ends up in the JS which is downloaded and parsed
+  static const unsigned UnrollThreshold = 100;
+  static const unsigned UnrollMaxCount = 4;
+
+  static bool isI64(Type *Ty) {
+    return Ty && Ty->isIntegerTy() && Ty->getIntegerBitWidth() > 32;
+  }
+
+public:
+  CheerpTTI() : ImmutablePass(ID) {
+    llvm_unreachable("This pass cannot be directly constructed");
+  }
+
+  CheerpTTI(const CheerpTargetMachine *TM) : ImmutablePass(ID) {
+    initializeCheerpTTIPass(*PassRegistry::getPassRegistry());
+  }
+
+  void initializePass() override {
+    pushTTIStack(this);
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    TargetTransformInfo::getAnalysisUsage(AU);
+  }
+
+  /// Pass identification.
+  static char ID;
+
+  /// Provide necessary pointer adjustments for the two base classes.
+  void *getAdjustedAnalysisPointer(const void *ID) override {
+    if (ID == &TargetTransformInfo::ID)
+      return (TargetTransformInfo*)this;
+    return this;
+  }
+
+  /// \name Scalar TTI Implementations
+  /// @{
+  unsigned getOperationCost(unsigned Opcode, Type *Ty,
+                            Type *OpTy) const override;
+  unsigned getGEPCost(const Value *Ptr,
+                      ArrayRef<const Value *> Operands) const override;
+  unsigned getUserCost(const User *U) const override;
+  bool isLoweredToCall(const Function *F) const override;
+  void getUnrollingPreferences(const Function *F, Loop *L,
+                               UnrollingPreferences &UP) const override;
+  bool isLegalAddImmediate(int64_t Imm) const override;
+  bool isLegalICmpImmediate(int64_t Imm) const override;
+  bool isTypeLegal(Type *Ty) const override;
+  PopcntSupportKind getPopcntSupport(unsigned IntTyWidthInBit) const override;
+  bool haveFastSqrt(Type *Ty) const override;
+  /// @}
+
+  /// \name Vector TTI Implementations
+  /// @{
+  unsigned getNumberOfRegisters(bool Vector) const override;
+  unsigned getRegisterBitWidth(bool Vector) const override;
+  /// @}
+};
+
+} // end anonymous namespace
+
+INITIALIZE_AG_PASS(CheerpTTI, TargetTransformInfo, "cheerptti",
+                   "Cheerp Target Transform Info", true, true, false)
+char CheerpTTI::ID = 0;
+const unsigned CheerpTTI::UnrollThreshold;
+const unsigned CheerpTTI::UnrollMaxCount;
+
+ImmutablePass *
+llvm::createCheerpTargetTransformInfoPass(const CheerpTargetMachine *TM) {
+  return new CheerpTTI(TM);
+}
+
+unsigned CheerpTTI::getOperationCost(unsigned Opcode, Type *Ty,
+                                     Type *OpTy) const {
+  switch (Opcode) {
+  case Instruction::GetElementPtr:
+    llvm_unreachable("Use getGEPCost for GEP operations!");
+
+  case Instruction::PtrToInt:
+  case Instruction::IntToPtr:
+    // Pointers are not numbers in JS, these need the pointer to be decomposed
+    return TCC_Expensive;
+
+  case Instruction::Mul:
+  case Instruction::UDiv:
+  case Instruction::SDiv:
+  case Instruction::URem:
+  case Instruction::SRem:
+    // 64-bit multiplications and divisions are calls to lowering helpers
+    if (isI64(Ty))
+      return 2 * TCC_Expensive;
+    // Math.imul and a coercion of the floating point result
+    return TCC_Basic;
+
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+    // Casts between 32-bit and 64-bit integers create or drop the high part
+    if (isI64(Ty) || isI64(OpTy))
+      return TCC_Basic;
+    break;
+
+  default:
+    // Any other operation on 64-bit integers is split in at least two
+    // operations on the halves, plus carries and comparisons
+    if (isI64(Ty) || isI64(OpTy))
+      return TCC_Expensive;
+    break;
+  }
+  return TargetTransformInfo::getOperationCost(Opcode, Ty, OpTy);
+}
+
+unsigned CheerpTTI::getGEPCost(const Value *Ptr,
+                               ArrayRef<const Value *> Operands) const {
+  // Struct members and constant array elements are property accesses which
+  // fold into the load or store using them
+  for (unsigned Idx = 0, Size = Operands.size(); Idx != Size; ++Idx)
+    if (!isa<Constant>(Operands[Idx]))
+      return TCC_Basic;
+  return TCC_Free;
+}
+
+unsigned CheerpTTI::getUserCost(const User *U) const {
+  if (const PHINode *PN = dyn_cast<PHINode>(U)) {
+    // Pointer PHIs may need both a base and an offset, or an allocated
+    // {d:,o:} object. 64-bit PHIs need a register for each half.
+    if (PN->getType()->isPointerTy() || isI64(PN->getType()))
+      return TCC_Basic;
+    return TCC_Free;
+  }
+
+  if (const GEPOperator *GEP = dyn_cast<GEPOperator>(U)) {
+    SmallVector<const Value *, 4> Indices(GEP->idx_begin(), GEP->idx_end());
+    return getGEPCost(GEP->getPointerOperand(), Indices);
+  }
+
+  if (ImmutableCallSite(U))
+    return TargetTransformInfo::getUserCost(U);
+
+  if (const CastInst *CI = dyn_cast<CastInst>(U)) {
+    // Booleans are already 0 or 1 in JS
+    if (isa<CmpInst>(CI->getOperand(0)))
+      return TCC_Free;
+  }
+
+  return getOperationCost(Operator::getOpcode(U), U->getType(),
+                          U->getNumOperands() == 1 ?
+                              U->getOperand(0)->getType() : nullptr);
+}
+
+bool CheerpTTI::isLoweredToCall(const Function *F) const {
+  // Intrinsics and the math functions available in JS are compiled inline
+  if (F->getIntrinsicID())
+    return false;
+  StringRef Name = F->getName();
+  if (Name == "sqrt" || Name == "sqrtf" || Name == "fabs" ||
+      Name == "fabsf" || Name == "floor" || Name == "floorf" ||
+      Name == "ceil" || Name == "ceilf")
+    return false;
+  return TargetTransformInfo::isLoweredToCall(F);
+}
+
+void CheerpTTI::getUnrollingPreferences(const Function *F, Loop *L,
+                                        UnrollingPreferences &UP) const {
+  UP.Threshold = std::min(UP.Threshold, UnrollThreshold);
+  UP.PartialThreshold = std::min(UP.PartialThreshold, UnrollThreshold);
+  UP.MaxCount = std::min(UP.MaxCount, UnrollMaxCount);
+  // Runtime unrolling adds a remainder loop, which is only code size in JS
+  UP.Runtime = false;
+}
+
+bool CheerpTTI::isLegalAddImmediate(int64_t Imm) const {
+  return isInt<32>(Imm);
+}
+
+bool CheerpTTI::isLegalICmpImmediate(int64_t Imm) const {
+  return isInt<32>(Imm);
+}
+
+bool CheerpTTI::isTypeLegal(Type *Ty) const {
+  if (Ty->isIntegerTy())
+    return Ty->getIntegerBitWidth() <= 32;
+  return Ty->isFloatTy() || Ty->isDoubleTy() || Ty->isPointerTy();
+}
+
+TargetTransformInfo::PopcntSupportKind
+CheerpTTI::getPopcntSupport(unsigned IntTyWidthInBit) const {
+  return PSK_Software;
+}
+
+bool CheerpTTI::haveFastSqrt(Type *Ty) const {
+  // Math.sqrt
+  return Ty->isFloatTy() || Ty->isDoubleTy();
+}
+
+unsigned CheerpTTI::getNumberOfRegisters(bool Vector) const {
+  // There are no vector registers, this disables the vectorizers. JS locals
+  // are unbounded, but a lower count keeps the unroller and LSR reasonable.
+  if (Vector)
+    return 0;
+  return 32;
+}
+
+unsigned CheerpTTI::getRegisterBitWidth(bool Vector) const {
+  return 32;
+}
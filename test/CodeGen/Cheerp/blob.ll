@@ -0,0 +1,62 @@
+; REQUIRES: node
+; RUN: llc -march=cheerp -cheerp-blob-threshold=4 < %s > %t.js
+; RUN: FileCheck < %t.js %s
+; RUN: node %t.js | FileCheck --check-prefix=EXEC %s
+
+; Constant arrays and byte layout structs above the threshold are encoded as base64 strings.
+; Both byte counts are not a multiple of 3, so the encoding ends with '=' padding
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+%packet = type bytelayout { i32, i16, i8 }
+
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+declare void @_ZN6client7Console3logEd(%"class._ZN6client7ConsoleE"*, double)
+
+; 20 bytes
+; CHECK: new Float32Array(__cheerpBlob("AADAPwAAEMAAAIBEAAAAAAAA5EA="))
+@floats = global [5 x float] [float 1.5, float -2.25, float 1.024e+03, float 0.0, float 7.125]
+; 7 bytes
+; CHECK: new DataView(__cheerpBlob("6zKk+P7/TQ=="))
+@packet = global %packet { i32 -123456789, i16 -2, i8 77 }
+
+define void @_Z7webMainv() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %p = getelementptr [5 x float]* @floats, i32 0, i32 %i
+  %f = load float* %p
+  %d = fpext float %f to double
+  call void @_ZN6client7Console3logEd(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, double %d)
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 5
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %a.p = getelementptr %packet* @packet, i32 0, i32 0
+  %a = load i32* %a.p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %a)
+  %b.p = getelementptr %packet* @packet, i32 0, i32 1
+  %b = load i16* %b.p
+  %b.ext = sext i16 %b to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %b.ext)
+  %c.p = getelementptr %packet* @packet, i32 0, i32 2
+  %c = load i8* %c.p
+  %c.ext = zext i8 %c to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %c.ext)
+  ret void
+}
+
+; EXEC: 1.5
+; EXEC-NEXT: -2.25
+; EXEC-NEXT: 1024
+; EXEC-NEXT: 0
+; EXEC-NEXT: 7.125
+; EXEC-NEXT: -123456789
+; EXEC-NEXT: -2
+; EXEC-NEXT: 77
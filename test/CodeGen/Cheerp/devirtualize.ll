@@ -0,0 +1,125 @@
+; RUN: opt -Devirtualize -S < %s | FileCheck %s
+
+; Calls through constant tables of functions become direct calls, or a chain
+; of guarded direct calls when there are a few possible targets
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%single = type { i32 (i32)* }
+%multi = type { i32 (i32)*, void ()* }
+
+@singleTable = constant %single { i32 (i32)* @onlyTarget }
+@multiA = constant %multi { i32 (i32)* @targetA, void ()* @done }
+@multiB = constant %multi { i32 (i32)* @targetB, void ()* @done }
+@multiC = constant %multi { i32 (i32)* @targetC, void ()* @done }
+
+define i32 @onlyTarget(i32 %a) {
+  ret i32 %a
+}
+
+define i32 @targetA(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @targetB(i32 %a) {
+  %r = add i32 %a, 2
+  ret i32 %r
+}
+
+define i32 @targetC(i32 %a) {
+  %r = add i32 %a, 3
+  ret i32 %r
+}
+
+define void @done() {
+  ret void
+}
+
+; CHECK-LABEL: define i32 @callSingle(
+; CHECK-NOT: load
+; CHECK: %r = call i32 @onlyTarget(i32 %a)
+; CHECK-NEXT: ret i32 %r
+define i32 @callSingle(%single* %t, i32 %a) {
+  %slot = getelementptr %single* %t, i32 0, i32 0
+  %f = load i32 (i32)** %slot
+  %r = call i32 %f(i32 %a)
+  ret i32 %r
+}
+
+; Every table with the same type holds the same function in the second slot
+; CHECK-LABEL: define void @callDone(
+; CHECK: call void @done()
+define void @callDone(%multi* %t) {
+  %slot = getelementptr %multi* %t, i32 0, i32 1
+  %f = load void ()** %slot
+  call void %f()
+  ret void
+}
+
+; CHECK-LABEL: define i32 @callMulti(
+; CHECK: %f = load i32 (i32)** %slot
+; CHECK: icmp eq i32 (i32)* %f, @target{{[ABC]}}
+; CHECK: devirt.call:
+; CHECK-NEXT: call i32 @target{{[ABC]}}(i32 %a)
+; CHECK: devirt.check:
+; CHECK-NEXT: icmp eq i32 (i32)* %f, @target{{[ABC]}}
+; CHECK: devirt.check{{[0-9]+}}:
+; CHECK-NEXT: icmp eq i32 (i32)* %f, @target{{[ABC]}}
+; CHECK: devirt.indirect:
+; CHECK-NEXT: %[[INDIRECT:[^ ]+]] = call i32 %f(i32 %a)
+; CHECK: devirt.merge:
+; CHECK-NEXT: %[[RESULT:[^ ]+]] = phi i32 {{.*}}[ %[[INDIRECT]], %devirt.indirect ]
+; CHECK-NEXT: ret i32 %[[RESULT]]
+define i32 @callMulti(%multi* %t, i32 %a) {
+  %slot = getelementptr %multi* %t, i32 0, i32 0
+  %f = load i32 (i32)** %slot
+  %r = call i32 %f(i32 %a)
+  ret i32 %r
+}
+
+; Tables which are written to are not trusted
+%mutable = type { i32 (i32)* }
+@mutableTable = global %mutable { i32 (i32)* @onlyTarget }
+
+; CHECK-LABEL: define i32 @callMutable(
+; CHECK: call i32 %f(i32 %a)
+define i32 @callMutable(%mutable* %t, i32 %a) {
+  %slot = getelementptr %mutable* %t, i32 0, i32 0
+  %f = load i32 (i32)** %slot
+  %r = call i32 %f(i32 %a)
+  ret i32 %r
+}
+
+; Tables of a type which may be reached by a cast are not trusted, also when
+; the cast is in the initializer of a global or nested in another expression
+%casted = type { i32 (i32)* }
+%other = type { i32 (i32)* }
+@castedTable = constant %casted { i32 (i32)* @onlyTarget }
+@otherTable = constant %other { i32 (i32)* @targetA }
+@castedPtr = global %casted* bitcast (%other* @otherTable to %casted*)
+
+; CHECK-LABEL: define i32 @callCasted(
+; CHECK: call i32 %f(i32 %a)
+define i32 @callCasted(i32 %a) {
+  %t = load %casted** @castedPtr
+  %slot = getelementptr %casted* %t, i32 0, i32 0
+  %f = load i32 (i32)** %slot
+  %r = call i32 %f(i32 %a)
+  ret i32 %r
+}
+
+%nested = type { i32 (i32)* }
+@nestedTable = constant %nested { i32 (i32)* @onlyTarget }
+@otherTables = constant [2 x %other] [%other { i32 (i32)* @targetB }, %other { i32 (i32)* @targetC }]
+@nestedPtr = global i32 (i32)** getelementptr (%nested* bitcast (%other* getelementptr ([2 x %other]* @otherTables, i32 0, i32 1) to %nested*), i32 0, i32 0)
+
+; CHECK-LABEL: define i32 @callNested(
+; CHECK: call i32 %f(i32 %a)
+define i32 @callNested(%nested* %t, i32 %a) {
+  %slot = getelementptr %nested* %t, i32 0, i32 0
+  %f = load i32 (i32)** %slot
+  %r = call i32 %f(i32 %a)
+  ret i32 %r
+}
@@ -0,0 +1,27 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code < %s | FileCheck %s
+
+; A module with a single static constructor
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@x = global i32 0
+@llvm.global_ctors = appending global [1 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @initX }]
+
+declare void @print(i32)
+
+define internal void @initX() {
+  store i32 42, i32* @x
+  ret void
+}
+
+define void @_Z7webMainv() {
+  %v = load i32* @x
+  call void @print(i32 %v)
+  ret void
+}
+
+; CHECK: function _initX(
+; CHECK: var _x=0;
+; CHECK: _initX();
+; CHECK-NEXT: __Z7webMainv();
@@ -0,0 +1,36 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code < %s | FileCheck %s
+
+; Several static constructors are called in priority order, the list of constructors is visited once
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@x = global i32 0
+@y = global i32 0
+@llvm.global_ctors = appending global [2 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @initY }, { i32, void ()* } { i32 100, void ()* @initX }]
+
+declare void @print(i32)
+
+define internal void @initX() {
+  store i32 1, i32* @x
+  ret void
+}
+
+define internal void @initY() {
+  %v = load i32* @x
+  %w = add i32 %v, 1
+  store i32 %w, i32* @y
+  ret void
+}
+
+define void @_Z7webMainv() {
+  %v = load i32* @y
+  call void @print(i32 %v)
+  ret void
+}
+
+; CHECK: function _initX(
+; CHECK: function _initY(
+; CHECK: _initX();
+; CHECK-NEXT: _initY();
+; CHECK-NEXT: __Z7webMainv();
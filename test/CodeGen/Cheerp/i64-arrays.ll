@@ -0,0 +1,40 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code < %s | FileCheck %s
+; REQUIRES: node
+; RUN: llc -march=cheerp < %s > %t.js
+; RUN: node %t.js | FileCheck --check-prefix=EXEC %s
+
+; There are no typed arrays for i64, arrays of them hold [low,high] pairs in regular arrays
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+
+@g = global [4 x i64] [i64 1, i64 4294967296, i64 -1, i64 5]
+@s = global i64 7
+
+; CHECK-NOT: Int64Array
+; CHECK: var _g=[
+
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+
+define void @_Z7webMainv() {
+  %a = alloca [4 x i64]
+  %p = getelementptr [4 x i64]* %a, i32 0, i32 1
+  %gp = getelementptr [4 x i64]* @g, i32 0, i32 1
+  %v = load i64* %gp
+  %sv = load i64* @s
+  %w = add i64 %v, %sv
+  store i64 %w, i64* %p
+  %x = load i64* %p
+  %h = lshr i64 %x, 32
+  %l = trunc i64 %x to i32
+  %ht = trunc i64 %h to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %l)
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %ht)
+  ret void
+}
+
+; EXEC: 7
+; EXEC-NEXT: 1
@@ -0,0 +1,44 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code < %s | FileCheck %s
+; REQUIRES: node
+; RUN: llc -march=cheerp < %s > %t.js
+; RUN: node %t.js | FileCheck --check-prefix=EXEC %s
+
+; Bitcasts between double and i64 read and write the halves through shared scratch views
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+
+@d = global double 1.5
+@bits = global i64 -4611686018427387904
+
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+declare void @_ZN6client7Console3logEd(%"class._ZN6client7ConsoleE"*, double)
+
+; CHECK: var __cheerpF64Scratch=new Float64Array(1);
+; CHECK-NEXT: var __cheerpI32Scratch=new Int32Array(__cheerpF64Scratch.buffer);
+
+define void @_Z7webMainv() {
+  %v = load double* @d
+  %b = bitcast double %v to i64
+  %l = trunc i64 %b to i32
+  %h64 = lshr i64 %b, 32
+  %h = trunc i64 %h64 to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %l)
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %h)
+  ; Flip the sign bit
+  %n = xor i64 %b, -9223372036854775808
+  %nd = bitcast i64 %n to double
+  call void @_ZN6client7Console3logEd(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, double %nd)
+  %m = load i64* @bits
+  %md = bitcast i64 %m to double
+  call void @_ZN6client7Console3logEd(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, double %md)
+  ret void
+}
+
+; EXEC: 0
+; EXEC-NEXT: 1073217536
+; EXEC-NEXT: -1.5
+; EXEC-NEXT: -2
@@ -0,0 +1,65 @@
+; REQUIRES: node
+; RUN: llc -march=cheerp < %s > %t.js
+; RUN: node %t.js | FileCheck %s
+
+; Memsets which are not removed before code generation are compiled with fill on the typed arrays
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@ints = internal global [16 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8, i32 9, i32 10, i32 11, i32 12, i32 13, i32 14, i32 15, i32 16]
+@bytes = internal global [16 x i8] c"abcdefghijklmnop"
+
+declare void @llvm.memset.p0i32.i32(i32* nocapture, i8, i32, i32, i1)
+declare void @llvm.memset.p0i8.i32(i8* nocapture, i8, i32, i32, i1)
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+
+define void @clear(i8* %p, i32 %n) {
+  call void @llvm.memset.p0i8.i32(i8* %p, i8 0, i32 %n, i32 1, i1 false)
+  ret void
+}
+
+define void @_Z7webMainv() {
+  %i = getelementptr [16 x i32]* @ints, i32 0, i32 4
+  call void @llvm.memset.p0i32.i32(i32* %i, i8 0, i32 32, i32 4, i1 false)
+  %b = getelementptr [16 x i8]* @bytes, i32 0, i32 2
+  call void @clear(i8* %b, i32 3)
+  %b1 = getelementptr [16 x i8]* @bytes, i32 0, i32 6
+  call void @llvm.memset.p0i8.i32(i8* %b1, i8 120, i32 4, i32 1, i1 false)
+  %i3p = getelementptr [16 x i32]* @ints, i32 0, i32 3
+  %i3 = load i32* %i3p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %i3)
+  %i4p = getelementptr [16 x i32]* @ints, i32 0, i32 4
+  %i4 = load i32* %i4p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %i4)
+  %i11p = getelementptr [16 x i32]* @ints, i32 0, i32 11
+  %i11 = load i32* %i11p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %i11)
+  %i12p = getelementptr [16 x i32]* @ints, i32 0, i32 12
+  %i12 = load i32* %i12p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %i12)
+  %b2p = getelementptr [16 x i8]* @bytes, i32 0, i32 2
+  %b2 = load i8* %b2p
+  %b2i = zext i8 %b2 to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %b2i)
+  %b7p = getelementptr [16 x i8]* @bytes, i32 0, i32 7
+  %b7 = load i8* %b7p
+  %b7i = zext i8 %b7 to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %b7i)
+  %b10p = getelementptr [16 x i8]* @bytes, i32 0, i32 10
+  %b10 = load i8* %b10p
+  %b10i = zext i8 %b10 to i32
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %b10i)
+  ret void
+}
+
+; CHECK: 4
+; CHECK-NEXT: 0
+; CHECK-NEXT: 0
+; CHECK-NEXT: 13
+; CHECK-NEXT: 0
+; CHECK-NEXT: 120
+; CHECK-NEXT: 107
@@ -0,0 +1,44 @@
+; REQUIRES: preexecute
+; RUN: opt -PreExecute -cheerp-preexecute-report -S < %s 2> %t.report | FileCheck %s
+; RUN: FileCheck --check-prefix=REPORT < %t.report %s
+
+; Constructors are folded one at a time. A constructor which fails is rolled back and kept,
+; and so are the later ones which share state with it, since they may observe its side effects
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@llvm.global_ctors = appending global [3 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @initFolded, i8* null }, { i32, void ()*, i8* } { i32 65535, void ()* @initFailing, i8* null }, { i32, void ()*, i8* } { i32 65535, void ()* @initShared, i8* null }]
+
+; CHECK: @folded = global i32 42
+; CHECK: @shared = global i32 0
+; CHECK: @dependent = global i32 0
+; CHECK: @llvm.global_ctors = appending global [2 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @initFailing, i8* null }, { i32, void ()*, i8* } { i32 65535, void ()* @initShared, i8* null }]
+@folded = global i32 0
+@shared = global i32 0
+@dependent = global i32 0
+
+declare i32 @unknownExternal()
+
+define internal void @initFolded() {
+  store i32 42, i32* @folded
+  ret void
+}
+
+define internal void @initFailing() {
+  store i32 1, i32* @shared
+  %v = call i32 @unknownExternal()
+  store i32 %v, i32* @shared
+  ret void
+}
+
+define internal void @initShared() {
+  %v = load i32* @shared
+  %w = add i32 %v, 1
+  store i32 %w, i32* @dependent
+  ret void
+}
+
+; REPORT: PreExecute: folded initFolded
+; REPORT: PreExecute: kept initFailing: call to unsupported function unknownExternal
+; REPORT: PreExecute: kept initShared: depends on initFailing through shared
@@ -0,0 +1,134 @@
+; REQUIRES: preexecute, node
+; RUN: opt -PreExecute -cheerp-preexecute-report -S < %s 2> %t.report | FileCheck %s
+; RUN: FileCheck --check-prefix=REPORT < %t.report %s
+; RUN: opt -PreExecute < %s | llc -march=cheerp > %t.js
+; RUN: node %t.js | FileCheck --check-prefix=EXEC %s
+
+; Typed allocations reachable from the globals written by the constructors are serialized into new globals.
+; A constructor storing a pointer which can not be serialized is rolled back and kept
+
+; CHECK: @vec = global %vector { i32* getelementptr inbounds ([4 x i32]* @promotedMalloc, i32 0, i32 0), i32* getelementptr inbounds ([4 x i32]* @promotedMalloc, i32 0, i32 3), i32* getelementptr ([4 x i32]* @promotedMalloc, i32 0, i32 4) }
+; CHECK: @head = global %node* @promotedMalloc1
+; CHECK: @escaped = global i32* null
+; CHECK: @promotedMalloc = internal global [4 x i32] [i32 10, i32 20, i32 30, i32 0]
+; CHECK: @promotedMalloc1 = internal global %node { i32 3, %node* @promotedMalloc2 }
+; CHECK: @promotedMalloc2 = internal global %node { i32 2, %node* @promotedMalloc3 }
+; CHECK: @promotedMalloc3 = internal global %node { i32 1, %node* null }
+; CHECK: @llvm.global_ctors = appending global [1 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @initEscaped, i8* null }]
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+%vector = type { i32*, i32*, i32* }
+%node = type { i32, %node* }
+
+@llvm.global_ctors = appending global [3 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @initVector, i8* null }, { i32, void ()*, i8* } { i32 65535, void ()* @initList, i8* null }, { i32, void ()*, i8* } { i32 65535, void ()* @initEscaped, i8* null }]
+
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+@vec = global %vector zeroinitializer
+@head = global %node* null
+@escaped = global i32* null
+
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+declare i32* @llvm.cheerp.allocate.p0i32(i32)
+declare i32* @llvm.cheerp.reallocate.p0i32.p0i32(i32*, i32)
+declare %node* @llvm.cheerp.allocate.p0node(i32)
+
+; Grow the buffer once, like push_back does when the capacity is exhausted
+define internal void @initVector() {
+  %small = call i32* @llvm.cheerp.allocate.p0i32(i32 8)
+  store i32 10, i32* %small
+  %s1 = getelementptr i32* %small, i32 1
+  store i32 20, i32* %s1
+  %big = call i32* @llvm.cheerp.reallocate.p0i32.p0i32(i32* %small, i32 16)
+  %b2 = getelementptr i32* %big, i32 2
+  store i32 30, i32* %b2
+  %end = getelementptr i32* %big, i32 3
+  %cap = getelementptr i32* %big, i32 4
+  %begin.p = getelementptr %vector* @vec, i32 0, i32 0
+  store i32* %big, i32** %begin.p
+  %end.p = getelementptr %vector* @vec, i32 0, i32 1
+  store i32* %end, i32** %end.p
+  %cap.p = getelementptr %vector* @vec, i32 0, i32 2
+  store i32* %cap, i32** %cap.p
+  ret void
+}
+
+define internal void @initList() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 1, %entry ], [ %i.next, %loop ]
+  %n = call %node* @llvm.cheerp.allocate.p0node(i32 8)
+  %val.p = getelementptr %node* %n, i32 0, i32 0
+  store i32 %i, i32* %val.p
+  %next.p = getelementptr %node* %n, i32 0, i32 1
+  %old = load %node** @head
+  store %node* %old, %node** %next.p
+  store %node* %n, %node** @head
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 4
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; A pointer to the stack can not be serialized
+define internal void @initEscaped() {
+  %local = alloca i32
+  store i32 5, i32* %local
+  store i32* %local, i32** @escaped
+  ret void
+}
+
+define void @_Z7webMainv() {
+entry:
+  %begin.p = getelementptr %vector* @vec, i32 0, i32 0
+  %begin = load i32** %begin.p
+  %end.p = getelementptr %vector* @vec, i32 0, i32 1
+  %end = load i32** %end.p
+  br label %vecloop
+
+vecloop:
+  %p = phi i32* [ %begin, %entry ], [ %p.next, %vecloop ]
+  %v = load i32* %p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %v)
+  %p.next = getelementptr i32* %p, i32 1
+  %vecdone = icmp eq i32* %p.next, %end
+  br i1 %vecdone, label %list, label %vecloop
+
+list:
+  %first = load %node** @head
+  br label %listloop
+
+listloop:
+  %n = phi %node* [ %first, %list ], [ %next, %listloop ]
+  %val.p = getelementptr %node* %n, i32 0, i32 0
+  %val = load i32* %val.p
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %val)
+  %next.p = getelementptr %node* %n, i32 0, i32 1
+  %next = load %node** %next.p
+  %listdone = icmp eq %node* %next, null
+  br i1 %listdone, label %exit, label %listloop
+
+exit:
+  %e = load i32** @escaped
+  %ev = load i32* %e
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %ev)
+  ret void
+}
+
+; REPORT: PreExecute: folded initVector
+; REPORT: PreExecute: folded initList
+; REPORT: PreExecute: kept initEscaped: stores a pointer to memory which can not be serialized
+
+; EXEC: 10
+; EXEC-NEXT: 20
+; EXEC-NEXT: 30
+; EXEC-NEXT: 3
+; EXEC-NEXT: 2
+; EXEC-NEXT: 1
+; EXEC-NEXT: 5
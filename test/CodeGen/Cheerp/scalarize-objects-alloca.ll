@@ -0,0 +1,33 @@
+; RUN: opt -ScalarizeObjects -S < %s | FileCheck %s
+
+; The lifetime markers of a scalarized alloca are erased together with it,
+; while they are still in the list of candidates of the pass
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%struct.Point = type { i32, i32 }
+
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture)
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture)
+
+; CHECK-LABEL: define i32 @sum(
+; CHECK-NOT: alloca
+; CHECK-NOT: llvm.lifetime
+; CHECK: add i32 %a, %b
+; CHECK-NEXT: ret i32
+define i32 @sum(i32 %a, i32 %b) {
+entry:
+  %p = alloca %struct.Point
+  %c = bitcast %struct.Point* %p to i8*
+  call void @llvm.lifetime.start.p0i8(i64 8, i8* %c)
+  %x = getelementptr %struct.Point* %p, i32 0, i32 0
+  store i32 %a, i32* %x
+  %y = getelementptr %struct.Point* %p, i32 0, i32 1
+  store i32 %b, i32* %y
+  %lx = load i32* %x
+  %ly = load i32* %y
+  call void @llvm.lifetime.end.p0i8(i64 8, i8* %c)
+  %r = add i32 %lx, %ly
+  ret i32 %r
+}
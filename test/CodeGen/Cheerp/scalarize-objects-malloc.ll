@@ -0,0 +1,47 @@
+; RUN: opt -ScalarizeObjects -S < %s | FileCheck %s
+
+; The free of a scalarized heap allocation is erased together with it,
+; while it is still in the list of candidates of the pass
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%struct.Point = type { i32, i32 }
+
+declare noalias i8* @malloc(i32)
+declare void @free(i8*)
+
+; CHECK-LABEL: define i32 @sum(
+; CHECK-NOT: call
+; CHECK: add i32 %a, %b
+; CHECK-NEXT: ret i32
+define i32 @sum(i32 %a, i32 %b) {
+entry:
+  %m = call i8* @malloc(i32 8)
+  %p = bitcast i8* %m to %struct.Point*
+  %x = getelementptr %struct.Point* %p, i32 0, i32 0
+  store i32 %a, i32* %x
+  %y = getelementptr %struct.Point* %p, i32 0, i32 1
+  store i32 %b, i32* %y
+  %lx = load i32* %x
+  %ly = load i32* %y
+  call void @free(i8* %m)
+  %r = add i32 %lx, %ly
+  ret i32 %r
+}
+
+; Members of scalarized heap objects start as zero
+; CHECK-LABEL: define i32 @partial(
+; CHECK-NOT: call
+; CHECK: ret i32 0
+define i32 @partial(i32 %a) {
+entry:
+  %m = call i8* @malloc(i32 8)
+  %p = bitcast i8* %m to %struct.Point*
+  %x = getelementptr %struct.Point* %p, i32 0, i32 0
+  store i32 %a, i32* %x
+  %y = getelementptr %struct.Point* %p, i32 0, i32 1
+  %ly = load i32* %y
+  call void @free(i8* %m)
+  ret i32 %ly
+}
@@ -0,0 +1,56 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-secondary-output=%t.secondary.js < %s | FileCheck %s
+; RUN: FileCheck %s --check-prefix=SECONDARY < %t.secondary.js
+; REQUIRES: node
+; RUN: llc -march=cheerp -cheerp-secondary-output=%t.secondary.js -cheerp-secondary-url=%t.secondary.js < %s > %t.js
+; RUN: node %t.js | FileCheck %s --check-prefix=EXEC
+
+; Global variables are compiled in the primary file, the functions used by their initializers
+; must be available there even if the globals are only used by code in the secondary file.
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+
+@vt = global [2 x i32 (i32)*] [i32 (i32)* @helper, i32 (i32)* @coldHelper]
+
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+
+define i32 @helper(i32 %x) {
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @coldHelper(i32 %x) cold {
+  %y = mul i32 %x, 3
+  ret i32 %y
+}
+
+define void @coldPath(i32 %x) cold {
+  %p = getelementptr [2 x i32 (i32)*]* @vt, i32 0, i32 0
+  %f = load i32 (i32)** %p
+  %r = call i32 %f(i32 %x)
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %r)
+  %p1 = getelementptr [2 x i32 (i32)*]* @vt, i32 0, i32 1
+  %f1 = load i32 (i32)** %p1
+  %r1 = call i32 %f1(i32 %x)
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %r1)
+  ret void
+}
+
+define void @_Z7webMainv() {
+  call void @coldPath(i32 41)
+  ret void
+}
+
+; CHECK-DAG: function _helper(
+; CHECK-DAG: function _coldHelper(){if(__cheerpSecondary===null)
+; CHECK-DAG: function _coldPath(){if(__cheerpSecondary===null)
+; CHECK-DAG: var _vt=[_helper,_coldHelper];
+
+; SECONDARY-NOT: function _helper(
+; SECONDARY: __cheerpSecondary[{{[0-9]+}}]=function(
+
+; EXEC: 42
+; EXEC-NEXT: 123
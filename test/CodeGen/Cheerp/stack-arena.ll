@@ -0,0 +1,94 @@
+; REQUIRES: node
+; RUN: llc -march=cheerp < %s > %t.js
+; RUN: node %t.js | FileCheck --check-prefix=EXEC %s
+; RUN: llc -march=cheerp -cheerp-pretty-code < %s | FileCheck %s
+
+; Fixed size arrays on the stack are allocated from a typed array arena which grows on demand,
+; unless a pointer to them escapes the function
+
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%"class._ZN6client7ConsoleE" = type { i8 }
+
+@_ZN6client7consoleE = external global %"class._ZN6client7ConsoleE"
+declare void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"*, i32)
+
+; Ten frames of 300 elements overflow the initial arena of 1024 elements
+; CHECK-LABEL: function _recurse(
+; CHECK: ___cheerpStackAlloc_i32(300
+; CHECK: ___cheerpStackTop_i32=
+define i32 @recurse(i32 %depth) {
+entry:
+  %buf = alloca [300 x i32]
+  br label %fill
+
+fill:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %fill ]
+  %p = getelementptr [300 x i32]* %buf, i32 0, i32 %i
+  %v = add i32 %i, %depth
+  store i32 %v, i32* %p
+  %i.next = add i32 %i, 1
+  %filled = icmp eq i32 %i.next, 300
+  br i1 %filled, label %call, label %fill
+
+call:
+  %last = icmp eq i32 %depth, 0
+  br i1 %last, label %sum, label %inner
+
+inner:
+  %d = sub i32 %depth, 1
+  %r = call i32 @recurse(i32 %d)
+  br label %sum
+
+sum:
+  %inner.sum = phi i32 [ 0, %call ], [ %r, %inner ]
+  br label %sumloop
+
+sumloop:
+  %j = phi i32 [ 0, %sum ], [ %j.next, %sumloop ]
+  %acc = phi i32 [ %inner.sum, %sum ], [ %acc.next, %sumloop ]
+  %q = getelementptr [300 x i32]* %buf, i32 0, i32 %j
+  %x = load i32* %q
+  %acc.next = add i32 %acc, %x
+  %j.next = add i32 %j, 1
+  %done = icmp eq i32 %j.next, 300
+  br i1 %done, label %exit, label %sumloop
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @sum4(i32* %p) {
+  %a = load i32* %p
+  %p1 = getelementptr i32* %p, i32 3
+  %b = load i32* %p1
+  %r = add i32 %a, %b
+  ret i32 %r
+}
+
+; The pointer to the array is passed to another function
+; CHECK-LABEL: function _escaping(
+; CHECK-NOT: ___cheerpStack
+; CHECK: new Int32Array(4)
+; CHECK-LABEL: function __Z7webMainv(
+define i32 @escaping(i32 %x) {
+  %buf = alloca [4 x i32]
+  %p0 = getelementptr [4 x i32]* %buf, i32 0, i32 0
+  store i32 %x, i32* %p0
+  %p3 = getelementptr [4 x i32]* %buf, i32 0, i32 3
+  store i32 7, i32* %p3
+  %r = call i32 @sum4(i32* %p0)
+  ret i32 %r
+}
+
+define void @_Z7webMainv() {
+  %r = call i32 @recurse(i32 9)
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %r)
+  %e = call i32 @escaping(i32 5)
+  call void @_ZN6client7Console3logEi(%"class._ZN6client7ConsoleE"* @_ZN6client7consoleE, i32 %e)
+  ret void
+}
+
+; EXEC: 462000
+; EXEC-NEXT: 12
@@ -0,0 +1,276 @@
+#!/usr/bin/env python
+#===-- cheerp-bench.py - Cheerp compile time and output benchmark --------===#
+#
+#                     Cheerp: The C++ compiler for the Web
+#
+# This file is distributed under the University of Illinois Open Source
+# License. See LICENSE.TXT for details.
+#
+# Copyright 2016 Leaning Technologies
+#
+#===----------------------------------------------------------------------===#
+
+"""
+Compile a corpus of .ll modules with llc -march=cheerp and record, for each
+module:
+
+  * total compile time and peak resident memory of llc
+  * wall time and memory of every pass, from -time-passes -track-memory
+  * the size of the generated JS
+  * the statistics collected by the backend (-stats), which include the
+    number of registers allocated by Registerize, the number of label
+    variables and of {d:,o:} pointer objects emitted by the writer
+  * optionally, the time needed to run the generated JS in a JS shell
+
+The results are written as JSON. When a baseline produced by a previous run
+is given the results are compared against it and the script fails if any
+metric got worse by more than the allowed tolerance. Only the statistics in
+STATS_DIRECTION are checked, the changes of the other ones are reported.
+
+Statistics are only collected by builds with assertions or LLVM_ENABLE_STATS,
+the other metrics are always available.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+# Matches a row of the -time-passes report, the last time group is the wall
+# time and the optional integer after it is the -track-memory column
+TIMER_ROW = re.compile(r'^\s*((?:[\d.]+ \(\s*[\d.]+%\)\s+)+)(?:(-?\d+)\s+)?(\S.*?)\s*$')
+TIMER_GROUP = re.compile(r'([\d.]+) \(\s*[\d.]+%\)')
+# Matches a row of the -stats report
+STATS_ROW = re.compile(r'^\s*(\d+) (\S+)\s+- (.*?)\s*$')
+
+JS_SHELLS = ['node', 'd8', 'js']
+
+# Metrics compared against the baseline, all of them are better when lower.
+# Timings are noisy, so they use their own tolerance.
+SIZE_METRICS = ['js_bytes', 'peak_rss_kb']
+TIME_METRICS = ['compile_time', 'run_time']
+# Statistics which are compared against the baseline, by their -stats key,
+# and whether they are better when lower or when higher
+LOWER, HIGHER = 'lower', 'higher'
+STATS_DIRECTION = {
+	'CheerpRegisterize.Total number of registers allocated to functions': LOWER,
+	'CheerpWriter.Number of functions that need a label variable for control flow': LOWER,
+	'CheerpWriter.Number of {d,o} pointer objects created in the output': LOWER,
+	'CheerpWriter.Number of {d,o} pointer objects created for bitcasts': LOWER,
+	'CheerpDevirtualize.Number of indirect calls replaced by direct calls': HIGHER,
+	'CheerpDevirtualize.Number of indirect calls replaced by guarded direct calls': HIGHER,
+	'ScalarizeObjects.Number of struct allocas replaced by their members': HIGHER,
+	'ScalarizeObjects.Number of heap allocations replaced by their members': HIGHER,
+	'StackArena.Number of typed array allocas moved to the stack arena': HIGHER,
+	'pre-execute.Number of constructors folded by pre-execution': HIGHER,
+	'pre-execute.Number of heap allocations serialized into globals': HIGHER,
+	'pre-execute.Number of failed pre-executions which have been rolled back': LOWER,
+	'GlobalDepsAnalyzer.Number of unused globals which have been removed': HIGHER,
+}
+
+def find_executable(name):
+	for d in os.environ.get('PATH', '').split(os.pathsep):
+		candidate = os.path.join(d, name)
+		if os.path.isfile(candidate) and os.access(candidate, os.X_OK):
+			return candidate
+	return None
+
+def run_measured(cmd, stdout, stderr):
+	"""
+	Run cmd and return (exit code, wall time, peak RSS in KB or None)
+	"""
+	start = time.time()
+	proc = subprocess.Popen(cmd, stdout=stdout, stderr=stderr)
+	if hasattr(os, 'wait4'):
+		_, status, usage = os.wait4(proc.pid, 0)
+		elapsed = time.time() - start
+		# Tell Popen that the child has already been reaped
+		proc.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -os.WTERMSIG(status)
+		peak = usage.ru_maxrss
+		if sys.platform == 'darwin':
+			peak //= 1024
+		return proc.returncode, elapsed, peak
+	proc.wait()
+	return proc.returncode, time.time() - start, None
+
+def parse_timers(text):
+	"""
+	Return a dictionary from pass name to its wall time and memory, passes
+	which run more than once are accumulated
+	"""
+	passes = {}
+	inReport = False
+	for line in text.splitlines():
+		if '--- Name ---' in line:
+			inReport = True
+			continue
+		if not inReport:
+			continue
+		m = TIMER_ROW.match(line)
+		if not m:
+			inReport = False
+			continue
+		name = m.group(3)
+		if name == 'Total':
+			inReport = False
+			continue
+		wall = float(TIMER_GROUP.findall(m.group(1))[-1])
+		entry = passes.setdefault(name, {'wall': 0.0})
+		entry['wall'] += wall
+		if m.group(2) is not None:
+			entry['mem'] = entry.get('mem', 0) + int(m.group(2))
+	return passes
+
+def parse_stats(text):
+	stats = {}
+	for line in text.splitlines():
+		m = STATS_ROW.match(line)
+		if m:
+			stats[m.group(2) + '.' + m.group(3)] = int(m.group(1))
+	return stats
+
+def run_js(shell, jsFile, runs):
+	best = None
+	with open(os.devnull, 'w') as devnull:
+		for _ in range(runs):
+			code, elapsed, _ = run_measured([shell, jsFile], devnull, devnull)
+			if code != 0:
+				return None
+			best = elapsed if best is None else min(best, elapsed)
+	return best
+
+def bench_module(args, llFile, jsShell):
+	name = os.path.splitext(os.path.basename(llFile))[0]
+	jsFile = os.path.join(args.work_dir, name + '.js')
+	logFile = os.path.join(args.work_dir, name + '.log')
+	cmd = [args.llc, '-march=cheerp', '-time-passes', '-track-memory', '-stats', '-o', jsFile, llFile]
+	cmd += args.llc_arg
+	with open(logFile, 'w') as log, open(os.devnull, 'w') as devnull:
+		code, elapsed, peak = run_measured(cmd, devnull, log)
+	with open(logFile) as log:
+		report = log.read()
+	if code != 0:
+		print('error: llc failed on %s, see %s' % (llFile, logFile), file=sys.stderr)
+		return None
+	result = {
+		'compile_time': elapsed,
+		'js_bytes': os.path.getsize(jsFile),
+		'passes': parse_timers(report),
+		'stats': parse_stats(report),
+	}
+	if peak is not None:
+		result['peak_rss_kb'] = peak
+	if jsShell:
+		runTime = run_js(jsShell, jsFile, args.runs)
+		if runTime is None:
+			print('warning: %s failed to run %s' % (jsShell, jsFile), file=sys.stderr)
+		else:
+			result['run_time'] = runTime
+	return result
+
+def compare_metric(module, metric, old, new, tolerance, regressions, direction=LOWER):
+	if old is None or new is None:
+		return
+	if direction == HIGHER:
+		worse = new < old * (1.0 - tolerance) and new < old
+	else:
+		worse = new > old * (1.0 + tolerance) and new > old
+	if worse:
+		regressions.append('%s: %s went from %s to %s' % (module, metric, old, new))
+
+def compare(baseline, results, args):
+	"""
+	Return the list of regressions, the changes of the statistics which are
+	not known to be better in one direction are only printed
+	"""
+	regressions = []
+	for module, new in sorted(results.items()):
+		old = baseline.get(module)
+		if old is None:
+			continue
+		for metric in SIZE_METRICS:
+			compare_metric(module, metric, old.get(metric), new.get(metric), args.tolerance, regressions)
+		for metric in TIME_METRICS:
+			compare_metric(module, metric, old.get(metric), new.get(metric), args.time_tolerance, regressions)
+		oldStats = old.get('stats', {})
+		for stat, value in sorted(new.get('stats', {}).items()):
+			oldValue = oldStats.get(stat)
+			if stat in STATS_DIRECTION:
+				compare_metric(module, stat, oldValue, value, args.tolerance, regressions, STATS_DIRECTION[stat])
+			elif oldValue is not None and oldValue != value:
+				print('note: %s: %s went from %s to %s' % (module, stat, oldValue, value))
+	return regressions
+
+def main():
+	parser = argparse.ArgumentParser(description='Benchmark the Cheerp backend on a corpus of LLVM modules')
+	parser.add_argument('--llc', required=True, help='path to llc')
+	parser.add_argument('--output', required=True, help='JSON file to write the results to')
+	parser.add_argument('--work-dir', required=True, help='directory for the generated JS and the llc logs')
+	parser.add_argument('--baseline', help='JSON results of a previous run to compare against')
+	parser.add_argument('--tolerance', type=float, default=0.02,
+			help='allowed relative change of sizes and statistics (default: %(default)s)')
+	parser.add_argument('--time-tolerance', type=float, default=0.25,
+			help='allowed relative growth of timings (default: %(default)s)')
+	parser.add_argument('--js-shell', help='JS shell used to run the output, by default the first of '
+			+ ', '.join(JS_SHELLS) + ' found in PATH')
+	parser.add_argument('--no-run', action='store_true', help='do not run the generated JS')
+	parser.add_argument('--runs', type=int, default=3, help='runs of each JS output, the fastest is kept')
+	parser.add_argument('--llc-arg', action='append', default=[], help='extra argument for llc')
+	parser.add_argument('corpus', nargs='+', help='.ll files or directories containing them')
+	args = parser.parse_args()
+
+	modules = []
+	for c in args.corpus:
+		if os.path.isdir(c):
+			modules += [os.path.join(c, f) for f in sorted(os.listdir(c)) if f.endswith('.ll')]
+		else:
+			modules.append(c)
+
+	jsShell = None
+	if not args.no_run:
+		if args.js_shell:
+			jsShell = args.js_shell
+		else:
+			for s in JS_SHELLS:
+				jsShell = find_executable(s)
+				if jsShell:
+					break
+	if not os.path.isdir(args.work_dir):
+		os.makedirs(args.work_dir)
+
+	results = {}
+	failed = False
+	for m in modules:
+		r = bench_module(args, m, jsShell)
+		if r is None:
+			failed = True
+			continue
+		name = os.path.splitext(os.path.basename(m))[0]
+		results[name] = r
+		line = '%-20s %8.3fs %10d bytes' % (name, r['compile_time'], r['js_bytes'])
+		if 'peak_rss_kb' in r:
+			line += ' %8d KB' % r['peak_rss_kb']
+		if 'run_time' in r:
+			line += ' run %8.3fs' % r['run_time']
+		print(line)
+
+	with open(args.output, 'w') as out:
+		json.dump(results, out, indent=1, sort_keys=True)
+
+	if args.baseline:
+		with open(args.baseline) as b:
+			baseline = json.load(b)
+		regressions = compare(baseline, results, args)
+		for r in regressions:
+			print('regression: ' + r, file=sys.stderr)
+		if regressions:
+			failed = True
+	return 1 if failed else 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,49 @@
+; 64-bit FNV-1a hashing and division, exercises I64Lowering.
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@data = internal global [32 x i8] c"The quick brown fox jumps over\00\00", align 1
+
+define internal i64 @fnv1a(i8* %p, i32 %len) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %h = phi i64 [ -3750763034362895579, %entry ], [ %h.next, %loop ]
+  %cp = getelementptr inbounds i8* %p, i32 %i
+  %c = load i8* %cp, align 1
+  %c64 = zext i8 %c to i64
+  %x = xor i64 %h, %c64
+  %h.next = mul i64 %x, 1099511628211
+  %i.next = add nuw nsw i32 %i, 1
+  %done = icmp eq i32 %i.next, %len
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i64 %h.next
+}
+
+define i32 @main() {
+entry:
+  %p = getelementptr inbounds [32 x i8]* @data, i32 0, i32 0
+  br label %loop
+
+loop:
+  %round = phi i32 [ 0, %entry ], [ %round.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %h = call i64 @fnv1a(i8* %p, i32 30)
+  %q = udiv i64 %h, 1000003
+  %s = lshr i64 %q, 7
+  %acc.next = add i64 %acc, %s
+  %round.next = add nuw nsw i32 %round, 1
+  %done = icmp eq i32 %round.next, 100000
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %hi = lshr i64 %acc.next, 32
+  %lo = trunc i64 %acc.next to i32
+  %hi32 = trunc i64 %hi to i32
+  %r = xor i32 %lo, %hi32
+  ret i32 %r
+}
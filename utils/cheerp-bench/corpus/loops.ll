@@ -0,0 +1,100 @@
+; Nested integer and floating point loops with early exits, exercises the
+; Relooper, Registerize and label variable generation.
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@table = internal global [256 x i32] zeroinitializer, align 4
+
+define internal void @fill(i32 %seed) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %x = phi i32 [ %seed, %entry ], [ %x.next, %loop ]
+  %m = mul i32 %x, 1103515245
+  %x.next = add i32 %m, 12345
+  %p = getelementptr inbounds [256 x i32]* @table, i32 0, i32 %i
+  store i32 %x.next, i32* %p, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %done = icmp eq i32 %i.next, 256
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+define internal i32 @search(i32 %key) {
+entry:
+  br label %outer
+
+outer:
+  %round = phi i32 [ 0, %entry ], [ %round.next, %outer.latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.inner, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner.latch ]
+  %acc.inner.phi = phi i32 [ %acc, %outer ], [ %acc.next, %inner.latch ]
+  %p = getelementptr inbounds [256 x i32]* @table, i32 0, i32 %j
+  %v = load i32* %p, align 4
+  %masked = and i32 %v, 1023
+  %found = icmp eq i32 %masked, %key
+  br i1 %found, label %hit, label %inner.latch
+
+inner.latch:
+  %odd = and i32 %v, 1
+  %isodd = icmp eq i32 %odd, 0
+  %delta = select i1 %isodd, i32 %v, i32 %round
+  %acc.next = xor i32 %acc.inner.phi, %delta
+  %j.next = add nuw nsw i32 %j, 1
+  %inner.done = icmp eq i32 %j.next, 256
+  br i1 %inner.done, label %outer.latch, label %inner
+
+outer.latch:
+  %acc.inner = phi i32 [ %acc.next, %inner.latch ]
+  %round.next = add nuw nsw i32 %round, 1
+  %outer.done = icmp eq i32 %round.next, 2000
+  br i1 %outer.done, label %miss, label %outer
+
+hit:
+  %r.hit = add i32 %acc.inner.phi, %j
+  ret i32 %r.hit
+
+miss:
+  ret i32 %acc.inner
+}
+
+define internal double @integrate(i32 %steps) {
+entry:
+  %n = sitofp i32 %steps to double
+  %h = fdiv double 1.000000e+00, %n
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %sum = phi double [ 0.000000e+00, %entry ], [ %sum.next, %loop ]
+  %fi = sitofp i32 %i to double
+  %x = fmul double %fi, %h
+  %x2 = fmul double %x, %x
+  %den = fadd double %x2, 1.000000e+00
+  %f = fdiv double 4.000000e+00, %den
+  %sum.next = fadd double %sum, %f
+  %i.next = add nuw nsw i32 %i, 1
+  %done = icmp eq i32 %i.next, %steps
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %r = fmul double %sum.next, %h
+  ret double %r
+}
+
+define i32 @main() {
+entry:
+  call void @fill(i32 42)
+  %s = call i32 @search(i32 7)
+  %pi = call double @integrate(i32 1000000)
+  %pi.i = fptosi double %pi to i32
+  %r = add i32 %s, %pi.i
+  ret i32 %r
+}
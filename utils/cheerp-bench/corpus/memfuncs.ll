@@ -0,0 +1,34 @@
+; Buffer copies and clears through memcpy, memmove and memset.
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@src = internal global [1024 x i32] zeroinitializer, align 4
+@dst = internal global [1024 x i32] zeroinitializer, align 4
+
+declare void @llvm.memcpy.p0i32.p0i32.i32(i32* nocapture, i32* nocapture readonly, i32, i32, i1)
+declare void @llvm.memmove.p0i32.p0i32.i32(i32* nocapture, i32* nocapture readonly, i32, i32, i1)
+declare void @llvm.memset.p0i32.i32(i32* nocapture, i8, i32, i32, i1)
+
+define i32 @main() {
+entry:
+  %s = getelementptr inbounds [1024 x i32]* @src, i32 0, i32 0
+  %d = getelementptr inbounds [1024 x i32]* @dst, i32 0, i32 0
+  %s16 = getelementptr inbounds [1024 x i32]* @src, i32 0, i32 16
+  br label %loop
+
+loop:
+  %round = phi i32 [ 0, %entry ], [ %round.next, %loop ]
+  %p = getelementptr inbounds [1024 x i32]* @src, i32 0, i32 %round
+  store i32 %round, i32* %p, align 4
+  call void @llvm.memcpy.p0i32.p0i32.i32(i32* %d, i32* %s, i32 4096, i32 4, i1 false)
+  call void @llvm.memmove.p0i32.p0i32.i32(i32* %s16, i32* %s, i32 1024, i32 4, i1 false)
+  call void @llvm.memset.p0i32.i32(i32* %s, i8 0, i32 64, i32 4, i1 false)
+  %round.next = add nuw nsw i32 %round, 1
+  %done = icmp eq i32 %round.next, 1024
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %last = getelementptr inbounds [1024 x i32]* @dst, i32 0, i32 1023
+  %r = load i32* %last, align 4
+  ret i32 %r
+}
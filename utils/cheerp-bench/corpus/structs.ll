@@ -0,0 +1,101 @@
+; Heap allocated linked list and a pointer walked through an array of
+; structs, exercises the PointerAnalyzer and {d:,o:} pointer objects.
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%struct._Z4Node = type { i32, %struct._Z4Node* }
+%struct._Z5Point = type { i32, i32 }
+
+@points = internal global [64 x %struct._Z5Point] zeroinitializer, align 4
+
+declare i8* @malloc(i32)
+declare void @free(i8*)
+
+define internal %struct._Z4Node* @build(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %head = phi %struct._Z4Node* [ null, %entry ], [ %node, %loop ]
+  %mem = call i8* @malloc(i32 8)
+  %node = bitcast i8* %mem to %struct._Z4Node*
+  %val = getelementptr inbounds %struct._Z4Node* %node, i32 0, i32 0
+  store i32 %i, i32* %val, align 4
+  %next = getelementptr inbounds %struct._Z4Node* %node, i32 0, i32 1
+  store %struct._Z4Node* %head, %struct._Z4Node** %next, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret %struct._Z4Node* %node
+}
+
+define internal i32 @consume(%struct._Z4Node* %list) {
+entry:
+  %empty = icmp eq %struct._Z4Node* %list, null
+  br i1 %empty, label %exit, label %loop
+
+loop:
+  %cur = phi %struct._Z4Node* [ %list, %entry ], [ %nextnode, %loop ]
+  %sum = phi i32 [ 0, %entry ], [ %sum.next, %loop ]
+  %val = getelementptr inbounds %struct._Z4Node* %cur, i32 0, i32 0
+  %v = load i32* %val, align 4
+  %sum.next = add i32 %sum, %v
+  %next = getelementptr inbounds %struct._Z4Node* %cur, i32 0, i32 1
+  %nextnode = load %struct._Z4Node** %next, align 4
+  %mem = bitcast %struct._Z4Node* %cur to i8*
+  call void @free(i8* %mem)
+  %end = icmp eq %struct._Z4Node* %nextnode, null
+  br i1 %end, label %exit, label %loop
+
+exit:
+  %r = phi i32 [ 0, %entry ], [ %sum.next, %loop ]
+  ret i32 %r
+}
+
+define internal i32 @walk(%struct._Z5Point* %begin, %struct._Z5Point* %end) {
+entry:
+  br label %loop
+
+loop:
+  %p = phi %struct._Z5Point* [ %begin, %entry ], [ %p.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %xp = getelementptr inbounds %struct._Z5Point* %p, i32 0, i32 0
+  %yp = getelementptr inbounds %struct._Z5Point* %p, i32 0, i32 1
+  %x = load i32* %xp, align 4
+  %y = load i32* %yp, align 4
+  %xy = mul i32 %x, %y
+  %acc.next = add i32 %acc, %xy
+  %x.next = add i32 %x, 1
+  store i32 %x.next, i32* %yp, align 4
+  %p.next = getelementptr inbounds %struct._Z5Point* %p, i32 1
+  %done = icmp eq %struct._Z5Point* %p.next, %end
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %round = phi i32 [ 0, %entry ], [ %round.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %list = call %struct._Z4Node* @build(i32 1000)
+  %s = call i32 @consume(%struct._Z4Node* %list)
+  %begin = getelementptr inbounds [64 x %struct._Z5Point]* @points, i32 0, i32 0
+  %end = getelementptr inbounds [64 x %struct._Z5Point]* @points, i32 0, i32 64
+  %w = call i32 @walk(%struct._Z5Point* %begin, %struct._Z5Point* %end)
+  %sw = add i32 %s, %w
+  %acc.next = xor i32 %acc, %sw
+  %round.next = add nuw nsw i32 %round, 1
+  %done = icmp eq i32 %round.next, 1000
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %acc.next
+}